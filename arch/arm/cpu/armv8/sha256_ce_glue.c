@@ -18,3 +18,21 @@ void sha256_process(sha256_context *ctx, const unsigned char *data,
 
 	sha256_armv8_ce_process(ctx->state, data, blocks);
 }
+
+/*
+ * The Crypto Extensions already keep the SHA-256 pipeline busy with one
+ * stream, so run the lanes of sha256_csum_multi() one after the other
+ */
+void sha256_mb_process(uint32_t state[][8], const uint8_t *data[],
+		       unsigned int lanes, unsigned int blocks)
+{
+	unsigned int i;
+
+	if (!blocks)
+		return;
+
+	for (i = 0; i < lanes; i++) {
+		sha256_armv8_ce_process(state[i], data[i], blocks);
+		data[i] += blocks * 64;
+	}
+}
@@ -81,7 +81,9 @@ typedef int sandbox_eth_tx_hand_f(struct udevice *dev, void *pkt,
  * iss - tcp initial send sequence
  * recv_packet_buffer - buffers of the packet returned as received
  * recv_packet_length - lengths of the packet returned as received
- * recv_packets - number of packets returned
+ * recv_packets - number of packets returned, including the held ones
+ * recv_held - number of packets at the start of recv_packet_buffer which
+ *	       have been passed to the network stack and not freed yet
  * tx_handler - function to generate responses to sent packets
  * priv - a pointer to some structure a test may want to keep track of
  */
@@ -94,6 +96,7 @@ struct eth_sandbox_priv {
 	uchar * recv_packet_buffer[PKTBUFSRX];
 	int recv_packet_length[PKTBUFSRX];
 	int recv_packets;
+	int recv_held;
 	sandbox_eth_tx_hand_f *tx_handler;
 	void *priv;
 };
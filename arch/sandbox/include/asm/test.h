@@ -361,4 +361,27 @@ bool sandbox_sf_bootdev_enabled(void);
  */
 void sandbox_sf_set_enable_bootdevs(bool enable);
 
+/**
+ * sandbox_host_blk_set_fail() - Make requests to a host block device fail
+ *
+ * This also clears the counts returned by sandbox_host_blk_get_busy().
+ *
+ * @dev: Block device of a host device
+ * @submit_fail: Block whose request fails to be submitted, or -1 for none
+ * @poll_fail: Block at which a request stops, or -1 for none. The request
+ *	returns the number of blocks before this one, or -EIO if there are none
+ */
+void sandbox_host_blk_set_fail(struct udevice *dev, long submit_fail,
+			       long poll_fail);
+
+/**
+ * sandbox_host_blk_get_busy() - Check how full the request queue got
+ *
+ * @dev: Block device of a host device
+ * @max_countp: Returns the largest number of requests queued at once
+ * Return: number of requests refused with -EBUSY since the last call to
+ *	sandbox_host_blk_set_fail()
+ */
+int sandbox_host_blk_get_busy(struct udevice *dev, int *max_countp);
+
 #endif
@@ -0,0 +1,734 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Loading FIT sub-images piece by piece from storage
+ *
+ * Rather than reading the whole FIT into memory, hashing each sub-image and
+ * then decompressing it, the sub-image data is read in chunks. Each chunk is
+ * passed to the progressive hash of every hash node and to a streaming
+ * decompressor writing to the load address, so the data is only touched
+ * once.
+ */
+
+#define LOG_CATEGORY LOGC_BOOT
+
+#include <errno.h>
+#include <gzip.h>
+#include <hash.h>
+#include <image.h>
+#include <fs.h>
+#include <lmb.h>
+#include <log.h>
+#include <malloc.h>
+#include <mapmem.h>
+#include <memalign.h>
+#include <watchdog.h>
+#include <asm/global_data.h>
+#include <u-boot/zlib.h>
+#include <linux/libfdt.h>
+#include <linux/sizes.h>
+#include <linux/zstd.h>
+
+DECLARE_GLOBAL_DATA_PTR;
+
+/* Amount of sub-image data read from the stream at once */
+#define FIT_STREAM_CHUNK	SZ_1M
+
+/* Hash nodes checked per sub-image while streaming */
+#define FIT_STREAM_MAX_HASHES	4
+
+/**
+ * struct fit_stream_hash - progressive hash for one hash node
+ *
+ * @noffset: hash node offset
+ * @algo: hash algorithm
+ * @ctx: progressive hash context
+ */
+struct fit_stream_hash {
+	int noffset;
+	struct hash_algo *algo;
+	void *ctx;
+};
+
+/**
+ * struct fit_stream_load - state for loading one sub-image
+ *
+ * @comp: compression type (IH_COMP_...)
+ * @out: output buffer
+ * @out_size: size of @out
+ * @out_len: number of bytes written to @out so far
+ * @hash: progressive hashes, one per hash node
+ * @hash_count: number of entries in @hash
+ * @zs: gzip state
+ * @gz_started: true once the gzip header has been skipped
+ * @gz_done: true once the deflate stream has ended
+ * @zds: zstd state, NULL until the frame header has been seen
+ * @zwksp: zstd workspace
+ * @zstd_done: true once the zstd frame has ended
+ */
+struct fit_stream_load {
+	int comp;
+	void *out;
+	ulong out_size;
+	ulong out_len;
+	struct fit_stream_hash hash[FIT_STREAM_MAX_HASHES];
+	int hash_count;
+	z_stream zs;
+	bool gz_started;
+	bool gz_done;
+	zstd_dstream *zds;
+	void *zwksp;
+	bool zstd_done;
+};
+
+/*
+ * Check whether the control FDT has keys which images must be signed with.
+ * Required signatures are checked by fit_image_verify_with_data(), which
+ * needs all the data at once.
+ */
+static bool fit_stream_sigs_required(void)
+{
+	const void *blob = gd_fdt_blob();
+	int key_node, noffset;
+
+	if (!FIT_IMAGE_ENABLE_VERIFY || !blob)
+		return false;
+
+	key_node = fdt_subnode_offset(blob, 0, FIT_SIG_NODENAME);
+	if (key_node < 0)
+		return false;
+	fdt_for_each_subnode(noffset, blob, key_node) {
+		if (fdt_getprop(blob, noffset, FIT_KEY_REQUIRED, NULL))
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * fit_stream_can_stream() - check whether a sub-image can be streamed
+ *
+ * Signatures on the image node itself need all the data at once, as do hash
+ * algorithms without progressive support and keys required by the control
+ * FDT, which apply even to images without a signature node. Images using
+ * those are read in one go and verified afterwards instead.
+ *
+ * @fit: FIT header
+ * @noffset: image node offset
+ * @verify: true if the hashes are checked
+ * @ld: load state, whose @hash entries are set up
+ * Return: 1 if the image can be streamed, 0 if it must be read in one go,
+ * -EPROTONOSUPPORT if it cannot be loaded this way at all
+ */
+static int fit_stream_can_stream(const void *fit, int noffset, bool verify,
+				 struct fit_stream_load *ld)
+{
+	int sub;
+
+	if (IS_ENABLED(CONFIG_FIT_IMAGE_POST_PROCESS))
+		return -EPROTONOSUPPORT;
+
+	fdt_for_each_subnode(sub, fit, noffset) {
+		const char *name = fit_get_name(fit, sub, NULL);
+		struct fit_stream_hash *hash;
+		const char *algo;
+		int ignore;
+
+		if (!strncmp(name, FIT_CIPHER_NODENAME,
+			     strlen(FIT_CIPHER_NODENAME)))
+			return -EPROTONOSUPPORT;
+		if (!verify)
+			continue;
+		if (!strncmp(name, FIT_SIG_NODENAME, strlen(FIT_SIG_NODENAME)))
+			return 0;
+		if (strncmp(name, FIT_HASH_NODENAME, strlen(FIT_HASH_NODENAME)))
+			continue;
+
+		fit_image_hash_get_ignore(fit, sub, &ignore);
+		if (ignore)
+			continue;
+		if (ld->hash_count == FIT_STREAM_MAX_HASHES ||
+		    fit_image_hash_get_algo(fit, sub, &algo))
+			return 0;
+
+		hash = &ld->hash[ld->hash_count];
+		if (hash_progressive_lookup_algo(algo, &hash->algo))
+			return 0;
+		hash->noffset = sub;
+		ld->hash_count++;
+	}
+
+	if (verify && fit_stream_sigs_required())
+		return 0;
+
+	return 1;
+}
+
+static int fit_stream_gzip(struct fit_stream_load *ld, void *buf, ulong size)
+{
+	z_stream *zs = &ld->zs;
+	int ret;
+
+	if (ld->gz_done)
+		return 0;
+
+	if (!ld->gz_started) {
+		int ofs = gzip_parse_header(buf, size);
+
+		if (ofs < 0)
+			return -EINVAL;
+		zs->zalloc = gzalloc;
+		zs->zfree = gzfree;
+		if (inflateInit2(zs, -MAX_WBITS) != Z_OK)
+			return -ENOMEM;
+		ld->gz_started = true;
+		zs->next_out = ld->out;
+		zs->avail_out = 0;
+		buf += ofs;
+		size -= ofs;
+	}
+
+	zs->next_in = buf;
+	zs->avail_in = size;
+	for (;;) {
+		/* avail_out is a uInt, so hand the output over in pieces */
+		if (!zs->avail_out)
+			zs->avail_out = min_t(ulong, ld->out_size -
+					      ((void *)zs->next_out - ld->out),
+					      UINT_MAX);
+		ret = inflate(zs, Z_SYNC_FLUSH);
+		if (ret == Z_STREAM_END) {
+			/* the gzip trailer is not checked, as with gunzip() */
+			ld->gz_done = true;
+			break;
+		}
+		/* no progress: the output is full or more input is needed */
+		if (ret == Z_BUF_ERROR) {
+			if (zs->avail_in)
+				return -ENOSPC;
+			break;
+		}
+		if (ret != Z_OK)
+			return -EINVAL;
+		if (!zs->avail_in && zs->avail_out)
+			break;
+	}
+	ld->out_len = (void *)zs->next_out - ld->out;
+
+	return 0;
+}
+
+static int fit_stream_zstd(struct fit_stream_load *ld, void *buf, ulong size)
+{
+	zstd_in_buffer in = { .src = buf, .size = size };
+	zstd_out_buffer out;
+	size_t ret;
+
+	if (ld->zstd_done)
+		return 0;
+
+	if (!ld->zds) {
+		zstd_frame_header hdr;
+		size_t wsize;
+
+		if (zstd_get_frame_header(&hdr, buf, size))
+			return -EINVAL;
+		wsize = zstd_dstream_workspace_bound(hdr.windowSize);
+		ld->zwksp = malloc(wsize);
+		if (!ld->zwksp)
+			return -ENOMEM;
+		ld->zds = zstd_init_dstream(hdr.windowSize, ld->zwksp, wsize);
+		if (!ld->zds)
+			return -EINVAL;
+	}
+
+	out.dst = ld->out;
+	out.size = ld->out_size;
+	out.pos = ld->out_len;
+	while (in.pos < in.size) {
+		ret = zstd_decompress_stream(ld->zds, &out, &in);
+		if (zstd_is_error(ret)) {
+			log_err("zstd: %s\n", zstd_get_error_name(ret));
+			return -EINVAL;
+		}
+		if (!ret) {
+			ld->zstd_done = true;
+			break;
+		}
+		if (out.pos == out.size)
+			return -ENOSPC;
+	}
+	ld->out_len = out.pos;
+
+	return 0;
+}
+
+/* Pass one chunk of sub-image data to the hashes and the decompressor */
+static int fit_stream_feed(struct fit_stream_load *ld, void *buf, ulong size,
+			   bool last)
+{
+	int i;
+
+	for (i = 0; i < ld->hash_count; i++) {
+		struct fit_stream_hash *hash = &ld->hash[i];
+
+		if (hash->algo->hash_update(hash->algo, hash->ctx, buf, size,
+					    last))
+			return -EIO;
+	}
+
+	switch (ld->comp) {
+	case IH_COMP_GZIP:
+		return fit_stream_gzip(ld, buf, size);
+	case IH_COMP_ZSTD:
+		return fit_stream_zstd(ld, buf, size);
+	default:
+		/* uncompressed data is read straight into the output buffer */
+		ld->out_len += size;
+		return 0;
+	}
+}
+
+static int fit_stream_check_hashes(const void *fit, struct fit_stream_load *ld)
+{
+	ALLOC_CACHE_ALIGN_BUFFER(uint8_t, value, FIT_MAX_HASH_LEN);
+	int i, fit_value_len;
+	uint8_t *fit_value;
+
+	for (i = 0; i < ld->hash_count; i++) {
+		struct fit_stream_hash *hash = &ld->hash[i];
+		int ret;
+
+		ret = hash->algo->hash_finish(hash->algo, hash->ctx, value,
+					      FIT_MAX_HASH_LEN);
+		hash->ctx = NULL;
+		if (ret)
+			return -EIO;
+		printf("%s", hash->algo->name);
+		if (fit_image_hash_get_value(fit, hash->noffset, &fit_value,
+					     &fit_value_len) ||
+		    fit_value_len != hash->algo->digest_size ||
+		    memcmp(value, fit_value, fit_value_len)) {
+			printf(" error!\nBad hash value for '%s' hash node\n",
+			       fit_get_name(fit, hash->noffset, NULL));
+			return -EACCES;
+		}
+		puts("+ ");
+	}
+
+	return 0;
+}
+
+/*
+ * Fallback for images which cannot be streamed: read all the data, then
+ * verify and decompress it as fit_image_load() does
+ */
+static int fit_stream_load_whole(struct fit_stream *stream, const void *fit,
+				 int noffset, ulong data_pos, ulong size,
+				 bool verify, struct fit_stream_load *ld)
+{
+	ulong load_end;
+	uint8_t type;
+	void *buf;
+	int ret;
+
+	if (ld->comp == IH_COMP_NONE) {
+		if (size > ld->out_size)
+			return -ENOSPC;
+		buf = ld->out;
+	} else {
+		buf = malloc(size);
+		if (!buf)
+			return -ENOMEM;
+	}
+
+	ret = stream->read(stream, data_pos, size, buf);
+	if (ret)
+		goto out;
+
+	if (verify && !fit_image_verify_with_data(fit, noffset, gd_fdt_blob(),
+						  buf, size)) {
+		ret = -EACCES;
+		goto out;
+	}
+
+	ld->out_len = size;
+	if (ld->comp != IH_COMP_NONE) {
+		if (fit_image_get_type(fit, noffset, &type))
+			type = IH_TYPE_INVALID;
+		ret = image_decomp(ld->comp, map_to_sysmem(ld->out),
+				   map_to_sysmem(buf), type, ld->out, buf,
+				   size, ld->out_size, &load_end);
+		ld->out_len = load_end - map_to_sysmem(ld->out);
+	}
+
+out:
+	if (ld->comp != IH_COMP_NONE)
+		free(buf);
+
+	return ret;
+}
+
+int fit_stream_read_header(struct fit_stream *stream, void **fitp)
+{
+	struct fdt_header hdr;
+	void *fit;
+	ulong size;
+	int ret;
+
+	ret = stream->read(stream, 0, sizeof(hdr), &hdr);
+	if (ret)
+		return ret;
+	if (fdt_check_header(&hdr))
+		return -ENOEXEC;
+
+	size = fdt_totalsize(&hdr);
+	fit = malloc(size);
+	if (!fit)
+		return -ENOMEM;
+
+	ret = stream->read(stream, 0, size, fit);
+	if (!ret)
+		ret = fit_check_format(fit, size);
+	if (ret) {
+		free(fit);
+		return ret;
+	}
+	*fitp = fit;
+
+	return 0;
+}
+
+/*
+ * Find where the data of a sub-image is in the FIT. Returns true in
+ * @externalp if it follows the header rather than being part of it.
+ */
+static int fit_stream_data_range(const void *fit, int noffset, ulong *posp,
+				 ulong *sizep, bool *externalp)
+{
+	const void *emb_data;
+	size_t size;
+	int val;
+
+	*externalp = true;
+	if (!fit_image_get_data_position(fit, noffset, &val)) {
+		*posp = val;
+	} else if (!fit_image_get_data_offset(fit, noffset, &val)) {
+		*posp = val + ((fdt_totalsize(fit) + 3) & ~3);
+	} else {
+		/* embedded data is part of the header, already in memory */
+		*externalp = false;
+		if (fit_image_get_emb_data(fit, noffset, &emb_data, &size))
+			return -ENOENT;
+		*posp = emb_data - fit;
+		*sizep = size;
+		return 0;
+	}
+	if (fit_image_get_data_size(fit, noffset, &val))
+		return -ENOENT;
+	*sizep = val;
+
+	return 0;
+}
+
+int fit_stream_load_image(struct fit_stream *stream, const void *fit,
+			  int noffset, bool verify, void *out, ulong out_size,
+			  ulong *lenp)
+{
+	struct fit_stream_load ld = {
+		.out = out,
+		.out_size = out_size,
+	};
+	ALLOC_CACHE_ALIGN_BUFFER(uint8_t, scratch, FIT_MAX_HASH_LEN);
+	ulong data_pos, pos, size;
+	bool external;
+	uint8_t comp;
+	int i, ret;
+	void *buf;
+
+	ret = fit_stream_data_range(fit, noffset, &data_pos, &size, &external);
+	if (ret)
+		return ret;
+
+	if (fit_image_get_comp(fit, noffset, &comp))
+		comp = IH_COMP_NONE;
+	ld.comp = comp;
+
+	ret = fit_stream_can_stream(fit, noffset, verify, &ld);
+	if (ret < 0) {
+		printf("Image '%s' cannot be loaded from a stream\n",
+		       fit_get_name(fit, noffset, NULL));
+		return ret;
+	}
+
+	if (verify)
+		puts("   Verifying Hash Integrity ... ");
+
+	if (!ret || (comp != IH_COMP_NONE && comp != IH_COMP_GZIP &&
+	     comp != IH_COMP_ZSTD) ||
+	    (comp == IH_COMP_GZIP && !CONFIG_IS_ENABLED(GZIP)) ||
+	    (comp == IH_COMP_ZSTD && !CONFIG_IS_ENABLED(ZSTD))) {
+		log_debug("loading '%s' in one go\n",
+			  fit_get_name(fit, noffset, NULL));
+		ret = fit_stream_load_whole(stream, fit, noffset, data_pos,
+					    size, verify, &ld);
+		goto done;
+	}
+
+	if (comp == IH_COMP_NONE) {
+		if (size > out_size)
+			return -ENOSPC;
+		buf = NULL;
+	} else {
+		buf = malloc_cache_aligned(min_t(ulong, size,
+						 FIT_STREAM_CHUNK));
+		if (!buf)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < ld.hash_count; i++) {
+		struct fit_stream_hash *hash = &ld.hash[i];
+
+		if (hash->algo->hash_init(hash->algo, &hash->ctx)) {
+			ret = -ENOMEM;
+			goto err;
+		}
+	}
+
+	/* uncompressed data goes straight to @out, so read it at once */
+	ret = 0;
+	if (external && !buf)
+		ret = stream->read(stream, data_pos, size, out);
+	for (pos = 0; pos < size && !ret;) {
+		ulong chunk = min_t(ulong, size - pos, FIT_STREAM_CHUNK);
+		void *dst = buf ? buf : out + pos;
+
+		if (external && buf)
+			ret = stream->read(stream, data_pos + pos, chunk, dst);
+		else if (!external)
+			memcpy(dst, fit + data_pos + pos, chunk);
+		if (!ret)
+			ret = fit_stream_feed(&ld, dst, chunk,
+					      pos + chunk == size);
+		pos += chunk;
+		schedule();
+	}
+	/* the input ran out before the end of the compressed stream */
+	if (!ret && ((comp == IH_COMP_GZIP && !ld.gz_done) ||
+		     (comp == IH_COMP_ZSTD && !ld.zstd_done)))
+		ret = ld.out_len == out_size ? -ENOSPC : -EINVAL;
+	if (!ret && verify)
+		ret = fit_stream_check_hashes(fit, &ld);
+
+err:
+	for (i = 0; i < ld.hash_count; i++) {
+		/* finish any hash left over after an error to free it */
+		if (ld.hash[i].ctx)
+			ld.hash[i].algo->hash_finish(ld.hash[i].algo,
+						     ld.hash[i].ctx, scratch,
+						     FIT_MAX_HASH_LEN);
+	}
+	if (ld.gz_started)
+		inflateEnd(&ld.zs);
+	free(ld.zwksp);
+	free(buf);
+
+done:
+	if (verify)
+		puts(ret ? "Bad Data Hash\n" : "OK\n");
+	if (ret)
+		return ret;
+	*lenp = ld.out_len;
+
+	return 0;
+}
+
+/**
+ * struct fit_stream_fs - a FIT stored in a file
+ *
+ * @ifname: interface name, e.g. "mmc"
+ * @dev_part: device and partition, e.g. "0:1"
+ * @fstype: filesystem type (FS_TYPE_...)
+ * @filename: path of the FIT
+ * @win: sub-image data already read from the file, or NULL
+ * @win_pos: offset of @win in the FIT
+ * @win_size: size of @win
+ */
+struct fit_stream_fs {
+	const char *ifname;
+	const char *dev_part;
+	int fstype;
+	const char *filename;
+	void *win;
+	ulong win_pos;
+	ulong win_size;
+};
+
+static int fit_stream_fs_read(struct fit_stream *stream, ulong offset,
+			      ulong size, void *buf)
+{
+	struct fit_stream_fs *priv = stream->priv;
+	loff_t actread;
+	int ret;
+
+	if (priv->win && offset >= priv->win_pos &&
+	    offset + size <= priv->win_pos + priv->win_size) {
+		memcpy(buf, priv->win + offset - priv->win_pos, size);
+		return 0;
+	}
+
+	/* fs_read() closes the filesystem, so select it each time */
+	ret = fs_set_blk_dev(priv->ifname, priv->dev_part, priv->fstype);
+	if (ret)
+		return -ENODEV;
+
+	ret = fs_read(priv->filename, map_to_sysmem(buf), offset, size,
+		      &actread);
+	if (ret)
+		return ret;
+	if (actread != size)
+		return -EIO;
+
+	return 0;
+}
+
+static void fit_stream_fs_free_win(struct fit_stream_fs *priv)
+{
+	if (!priv->win)
+		return;
+	if (CONFIG_IS_ENABLED(LMB))
+		lmb_free(map_to_sysmem(priv->win), priv->win_size, LMB_NONE);
+	else
+		free(priv->win);
+	priv->win = NULL;
+}
+
+/*
+ * Each fs_read() mounts the filesystem and looks the file up again, so read
+ * the compressed data of a sub-image with a single one. It is then hashed
+ * and decompressed from memory in one pass.
+ */
+static int fit_stream_fs_read_win(struct fit_stream *stream, ulong pos,
+				  ulong size)
+{
+	struct fit_stream_fs *priv = stream->priv;
+	phys_addr_t addr;
+	void *win;
+	int ret;
+
+	if (CONFIG_IS_ENABLED(LMB)) {
+		if (lmb_alloc_mem(LMB_MEM_ALLOC_ANY, ARCH_DMA_MINALIGN, &addr,
+				  size, LMB_NONE))
+			return -ENOMEM;
+		win = map_sysmem(addr, size);
+	} else {
+		win = malloc_cache_aligned(size);
+		if (!win)
+			return -ENOMEM;
+	}
+
+	ret = fit_stream_fs_read(stream, pos, size, win);
+	priv->win = win;
+	priv->win_pos = pos;
+	priv->win_size = size;
+	if (ret)
+		fit_stream_fs_free_win(priv);
+
+	return ret;
+}
+
+int fit_stream_load_file(const char *ifname, const char *dev_part,
+			 int fstype, const char *filename,
+			 const char *image_uname, bool verify, ulong addr,
+			 ulong *lenp)
+{
+	struct fit_stream_fs priv = {
+		.ifname = ifname,
+		.dev_part = dev_part,
+		.fstype = fstype,
+		.filename = filename,
+	};
+	struct fit_stream stream = {
+		.read = fit_stream_fs_read,
+		.priv = &priv,
+	};
+	ulong out_size, data_pos, data_size;
+	phys_addr_t out_addr;
+	loff_t file_size;
+	void *fit, *out;
+	bool external;
+	uint8_t comp;
+	int noffset;
+	int ret;
+
+	ret = fit_stream_read_header(&stream, &fit);
+	if (ret)
+		return ret;
+
+	noffset = fit_image_get_node(fit, image_uname);
+	if (noffset < 0) {
+		printf("Can't find image '%s'\n", image_uname);
+		ret = -ENOENT;
+		goto out;
+	}
+
+	if (addr == -1UL && fit_image_get_load(fit, noffset, &addr)) {
+		printf("No load address for image '%s'\n", image_uname);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = fs_set_blk_dev(ifname, dev_part, fstype);
+	if (!ret)
+		ret = fs_size(filename, &file_size);
+	if (ret) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	ret = fit_stream_data_range(fit, noffset, &data_pos, &data_size,
+				    &external);
+	if (ret)
+		goto out;
+	if (fit_image_get_comp(fit, noffset, &comp))
+		comp = IH_COMP_NONE;
+	if (external && comp != IH_COMP_NONE) {
+		ret = fit_stream_fs_read_win(&stream, data_pos, data_size);
+		if (ret)
+			goto out;
+	}
+
+	out_addr = addr;
+	if (CONFIG_IS_ENABLED(LMB)) {
+		/* Load no further than the free memory at the load address */
+		out_size = lmb_get_free_size(addr);
+		if (!out_size || lmb_alloc_mem(LMB_MEM_ALLOC_ADDR, 0, &out_addr,
+					       out_size, LMB_NONE)) {
+			log_err("** Loading image would overwrite reserved memory **\n");
+			ret = -ENOSPC;
+			goto out;
+		}
+	} else {
+		/* Leave room for compressed data, as fit_image_load() does */
+		out_size = max_t(ulong, file_size, SZ_1M) * 20;
+	}
+
+	printf("   Loading '%s' to 0x%08lx\n", image_uname, addr);
+	out = map_sysmem(addr, out_size);
+	ret = fit_stream_load_image(&stream, fit, noffset, verify, out,
+				    out_size, lenp);
+	unmap_sysmem(out);
+
+	if (CONFIG_IS_ENABLED(LMB)) {
+		/* keep only the loaded image reserved, as fs_read() does */
+		lmb_free(out_addr, out_size, LMB_NONE);
+		if (!ret)
+			lmb_alloc_mem(LMB_MEM_ALLOC_ADDR, 0, &out_addr, *lenp,
+				      LMB_NONE);
+	}
+
+out:
+	fit_stream_fs_free_win(&priv);
+	free(fit);
+
+	return ret;
+}
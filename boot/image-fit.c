@@ -1151,7 +1151,7 @@ int fit_image_hash_get_value(const void *fit, int noffset, uint8_t **value,
  *     0, on ignore not found
  *     value, on ignore found
  */
-static int fit_image_hash_get_ignore(const void *fit, int noffset, int *ignore)
+int fit_image_hash_get_ignore(const void *fit, int noffset, int *ignore)
 {
 	int len;
 	int *value;
@@ -1446,6 +1446,179 @@ err:
 	return 0;
 }
 
+#if CONFIG_IS_ENABLED(FIT_VERIFY_BATCH)
+/* Most hash nodes of an image which fit_config_verify_images() handles */
+#define FIT_VERIFY_MAX_HASHES	4
+
+/**
+ * struct fit_verify_hash - a hash node checked by fit_config_verify_images()
+ *
+ * @image: index of the image in the list being checked
+ * @value: expected hash value, from the hash node
+ * @value_len: length of @value
+ * @digest: calculated hash value
+ */
+struct fit_verify_hash {
+	int image;
+	uint8_t *value;
+	int value_len;
+	uint8_t digest[FIT_MAX_HASH_LEN];
+};
+
+/* Check whether any key in @key_blob is required for all images */
+static bool fit_required_image_keys(const void *key_blob)
+{
+	const char *required;
+	int sig_node, noffset;
+
+	sig_node = fdt_subnode_offset(key_blob, 0, FIT_SIG_NODENAME);
+	if (sig_node < 0)
+		return false;
+	fdt_for_each_subnode(noffset, key_blob, sig_node) {
+		required = fdt_getprop(key_blob, noffset, FIT_KEY_REQUIRED,
+				       NULL);
+		if (required && !strcmp(required, "image"))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Add the hash nodes of an image to @reqs and @hashes, returning the number
+ * added, or 0 if the image must be checked with fit_image_verify() instead
+ */
+static int fit_config_add_hashes(const void *fit, int image_noffset,
+				 int image, struct hash_req *reqs,
+				 struct fit_verify_hash *hashes)
+{
+	const char *name = fit_get_name(fit, image_noffset, NULL);
+	struct hash_algo *algo;
+	const void *data;
+	size_t size;
+	int noffset;
+	int count = 0;
+
+	if (IS_ENABLED(CONFIG_FIT_SIGNATURE) && strchr(name, '@'))
+		return 0;
+	if (fit_image_get_data(fit, image_noffset, &data, &size))
+		return 0;
+
+	fdt_for_each_subnode(noffset, fit, image_noffset) {
+		const char *algo_name;
+		int ignore;
+
+		name = fit_get_name(fit, noffset, NULL);
+		if (FIT_IMAGE_ENABLE_VERIFY &&
+		    !strncmp(name, FIT_SIG_NODENAME, strlen(FIT_SIG_NODENAME)))
+			return 0;
+		if (strncmp(name, FIT_HASH_NODENAME, strlen(FIT_HASH_NODENAME)))
+			continue;
+		fit_image_hash_get_ignore(fit, noffset, &ignore);
+		if (ignore)
+			continue;
+		if (count == FIT_VERIFY_MAX_HASHES ||
+		    fit_image_hash_get_algo(fit, noffset, &algo_name) ||
+		    hash_lookup_algo(algo_name, &algo) ||
+		    fit_image_hash_get_value(fit, noffset,
+					     &hashes[count].value,
+					     &hashes[count].value_len) ||
+		    hashes[count].value_len != algo->digest_size)
+			return 0;
+
+		reqs[count].algo_name = algo_name;
+		reqs[count].data = data;
+		reqs[count].len = size;
+		reqs[count].output = hashes[count].digest;
+		hashes[count].image = image;
+		count++;
+	}
+	if (noffset == -FDT_ERR_TRUNCATED || noffset == -FDT_ERR_BADSTRUCTURE)
+		return 0;
+
+	return count;
+}
+
+int fit_config_verify_images(const void *fit, int conf_noffset, int *noffsets,
+			     int max)
+{
+	static const char *const props[] = {
+		FIT_KERNEL_PROP, FIT_FDT_PROP, FIT_RAMDISK_PROP,
+		FIT_SETUP_PROP, FIT_LOADABLE_PROP, FIT_FPGA_PROP,
+	};
+	struct fit_verify_hash *hashes;
+	struct hash_req *reqs;
+	int count = 0, nreqs = 0;
+	int i, j, k, n, ret;
+	bool *bad;
+
+	/* Images checked here skip fit_image_verify_required_sigs() */
+	if (FIT_IMAGE_ENABLE_VERIFY && fit_required_image_keys(gd_fdt_blob()))
+		return 0;
+
+	reqs = calloc(max * FIT_VERIFY_MAX_HASHES, sizeof(*reqs));
+	hashes = calloc(max * FIT_VERIFY_MAX_HASHES, sizeof(*hashes));
+	bad = calloc(max, sizeof(*bad));
+	if (!reqs || !hashes || !bad) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(props) && count < max; i++) {
+		n = fdt_stringlist_count(fit, conf_noffset, props[i]);
+		for (j = 0; j < n && count < max; j++) {
+			const char *uname;
+			int noffset;
+
+			uname = fdt_stringlist_get(fit, conf_noffset, props[i],
+						   j, NULL);
+			noffset = uname ? fit_image_get_node(fit, uname) : -1;
+			if (noffset < 0)
+				continue;
+			for (k = 0; k < count; k++) {
+				if (noffsets[k] == noffset)
+					break;
+			}
+			if (k < count)
+				continue;
+
+			k = fit_config_add_hashes(fit, noffset, count,
+						  &reqs[nreqs], &hashes[nreqs]);
+			if (!k)
+				continue;
+			noffsets[count++] = noffset;
+			nreqs += k;
+		}
+	}
+
+	ret = hash_block_multi(reqs, nreqs);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < nreqs; i++) {
+		if (memcmp(hashes[i].digest, hashes[i].value,
+			   hashes[i].value_len))
+			bad[hashes[i].image] = true;
+	}
+	for (i = 0, j = 0; i < count; i++) {
+		if (bad[i])
+			log_debug("Image '%s' left to be checked on its own\n",
+				  fit_get_name(fit, noffsets[i], NULL));
+		else
+			noffsets[j++] = noffsets[i];
+	}
+	ret = j;
+	log_debug("%d images checked with %d hashes\n", ret, nreqs);
+
+out:
+	free(bad);
+	free(hashes);
+	free(reqs);
+
+	return ret;
+}
+#endif /* FIT_VERIFY_BATCH */
+
 /**
  * fit_all_image_verify - verify data integrity for all images
  * @fit: pointer to the FIT format image header
@@ -1973,12 +2146,72 @@ int fit_get_data_conf_prop(const void *fit, const char *prop_name,
 	return fit_get_data_tail(fit, noffset, data, size);
 }
 
-static int fit_image_select(const void *fit, int rd_noffset, int verify)
+/* Check whether fit_config_verify_images() already checked an image */
+static bool fit_image_verified(struct bootm_headers *images, const void *fit,
+			       int noffset)
+{
+	int i;
+
+	if (!CONFIG_IS_ENABLED(FIT_VERIFY_BATCH) ||
+	    images->fit_hdr_verified != fit)
+		return false;
+	for (i = 0; i < images->fit_num_verified; i++) {
+		if (images->fit_noffset_verified[i] == noffset)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Forget the checked images whose data lies in @start..@start+@len, since
+ * an image has just been written there. Writing over the FIT header
+ * invalidates the node offsets, so everything is forgotten then.
+ */
+static void fit_image_forget_verified(struct bootm_headers *images,
+				      const void *fit, ulong start, ulong len)
+{
+	ulong fit_start = map_to_sysmem(fit);
+	const void *data;
+	ulong data_start;
+	size_t size;
+	int i, j;
+
+	if (!CONFIG_IS_ENABLED(FIT_VERIFY_BATCH) ||
+	    images->fit_hdr_verified != fit)
+		return;
+	if (start < fit_start + fdt_totalsize(fit) && start + len > fit_start) {
+		images->fit_num_verified = 0;
+		return;
+	}
+	for (i = 0, j = 0; i < images->fit_num_verified; i++) {
+		int noffset = images->fit_noffset_verified[i];
+
+		if (!fit_image_get_data(fit, noffset, &data, &size)) {
+			data_start = map_to_sysmem(data);
+			if (start < data_start + size &&
+			    start + len > data_start) {
+				log_debug("Image '%s' overwritten, will be checked again\n",
+					  fit_get_name(fit, noffset, NULL));
+				continue;
+			}
+		}
+		images->fit_noffset_verified[j++] = noffset;
+	}
+	images->fit_num_verified = j;
+}
+
+static int fit_image_select(const void *fit, int rd_noffset, int verify,
+			    bool verified)
 {
 	fit_image_print(fit, rd_noffset, "   ");
 
 	if (verify) {
 		puts("   Verifying Hash Integrity ... ");
+		if (verified) {
+			puts("OK (checked with configuration)\n");
+			return 0;
+		}
 		if (!fit_image_verify(fit, rd_noffset)) {
 			puts("Bad Data Hash\n");
 			return -EACCES;
@@ -2133,6 +2366,15 @@ int fit_image_load(struct bootm_headers *images, ulong addr,
 			puts("OK\n");
 		}
 
+		if (CONFIG_IS_ENABLED(FIT_VERIFY_BATCH) && images->verify &&
+		    images->fit_hdr_verified != fit) {
+			ret = fit_config_verify_images(fit, cfg_noffset,
+						images->fit_noffset_verified,
+						BOOTM_MAX_VERIFIED);
+			images->fit_hdr_verified = fit;
+			images->fit_num_verified = ret > 0 ? ret : 0;
+		}
+
 		bootstage_mark(BOOTSTAGE_ID_FIT_CONFIG);
 
 		noffset = fit_conf_get_prop_node(fit, cfg_noffset, prop_name,
@@ -2147,7 +2389,8 @@ int fit_image_load(struct bootm_headers *images, ulong addr,
 
 	printf("   Trying '%s' %s subimage\n", fit_uname, prop_name);
 
-	ret = fit_image_select(fit, noffset, images->verify);
+	ret = fit_image_select(fit, noffset, images->verify,
+			       fit_image_verified(images, fit, noffset));
 	if (ret) {
 		bootstage_error(bootstage_id + BOOTSTAGE_SUB_HASH);
 		return ret;
@@ -2297,6 +2540,10 @@ int fit_image_load(struct bootm_headers *images, ulong addr,
 		memcpy(loadbuf, buf, len);
 	}
 
+	/* Writing to the load address may change data checked earlier */
+	if (load != data)
+		fit_image_forget_verified(images, fit, load, len);
+
 	if (image_type == IH_TYPE_RAMDISK && comp != IH_COMP_NONE)
 		puts("WARNING: 'compression' nodes for ramdisks are deprecated,"
 		     " please fix your .its file!\n");
@@ -4,6 +4,7 @@
  * Author: Eric Nelson<eric@nelint.com>
  *
  */
+#include <blk.h>
 #include <command.h>
 #include <config.h>
 #include <malloc.h>
@@ -13,16 +14,28 @@
 static int blkc_show(struct cmd_tbl *cmdtp, int flag,
 		     int argc, char *const argv[])
 {
+	struct block_cache_dev_stats dev_stats;
 	struct block_cache_stats stats;
+	int i;
+
 	blkcache_stats(&stats);
 
 	printf("hits: %u\n"
 	       "misses: %u\n"
 	       "entries: %u\n"
 	       "max blocks/entry: %u\n"
-	       "max cache entries: %u\n",
+	       "max cache entries: %u\n"
+	       "readahead blocks: %u\n"
+	       "sets: %u x %u ways\n",
 	       stats.hits, stats.misses, stats.entries,
-	       stats.max_blocks_per_entry, stats.max_entries);
+	       stats.max_blocks_per_entry, stats.max_entries,
+	       stats.readahead, stats.sets, stats.ways);
+
+	for (i = 0; !blkcache_dev_stats(i, &dev_stats); i++)
+		printf("%s %d: hits %u, misses %u, readahead %lu blocks\n",
+		       blk_get_uclass_name(dev_stats.iftype), dev_stats.devnum,
+		       dev_stats.hits, dev_stats.misses, dev_stats.readahead);
+
 	return 0;
 }
 
@@ -30,20 +43,26 @@ static int blkc_configure(struct cmd_tbl *cmdtp, int flag,
 			  int argc, char *const argv[])
 {
 	unsigned blocks_per_entry, max_entries;
-	if (argc != 3)
+	struct block_cache_stats stats;
+
+	if (argc != 3 && argc != 4)
 		return CMD_RET_USAGE;
 
 	blocks_per_entry = simple_strtoul(argv[1], 0, 0);
 	max_entries = simple_strtoul(argv[2], 0, 0);
 	blkcache_configure(blocks_per_entry, max_entries);
+	if (argc == 4)
+		blkcache_set_readahead(simple_strtoul(argv[3], 0, 0));
+
+	blkcache_stats(&stats);
 	printf("changed to max of %u entries of %u blocks each\n",
-	       max_entries, blocks_per_entry);
+	       stats.max_entries, stats.max_blocks_per_entry);
 	return 0;
 }
 
 static struct cmd_tbl cmd_blkc_sub[] = {
 	U_BOOT_CMD_MKENT(show, 0, 0, blkc_show, "", ""),
-	U_BOOT_CMD_MKENT(configure, 3, 0, blkc_configure, "", ""),
+	U_BOOT_CMD_MKENT(configure, 4, 0, blkc_configure, "", ""),
 };
 
 static int do_blkcache(struct cmd_tbl *cmdtp, int flag,
@@ -67,9 +86,9 @@ static int do_blkcache(struct cmd_tbl *cmdtp, int flag,
 }
 
 U_BOOT_CMD(
-	blkcache, 4, 0, do_blkcache,
+	blkcache, 5, 0, do_blkcache,
 	"block cache diagnostics and control",
 	"show - show and reset statistics\n"
-	"blkcache configure <blocks> <entries> "
-	"- set max blocks per entry and max cache entries\n"
+	"blkcache configure <blocks> <entries> [<readahead>] "
+	"- set blocks per entry, max cache entries and readahead blocks\n"
 );
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Decompress an image from memory to a block device
+ */
+
+#include <blk.h>
+#include <command.h>
+#include <decompwrite.h>
+#include <mapmem.h>
+#include <part.h>
+#include <vsprintf.h>
+
+static int do_decompwrite(struct cmd_tbl *cmdtp, int flag, int argc,
+			  char *const argv[])
+{
+	struct blk_desc *bdev;
+	ulong addr, length;
+	void *src;
+	ulong writebuf = 1 << 20;
+	u64 startoffs = 0;
+	u64 szexpected = 0;
+	int ret;
+
+	if (argc < 5)
+		return CMD_RET_USAGE;
+	ret = blk_get_device_by_str(argv[1], argv[2], &bdev);
+	if (ret < 0)
+		return CMD_RET_FAILURE;
+
+	addr = hextoul(argv[3], NULL);
+	length = hextoul(argv[4], NULL);
+	if (argc > 5)
+		writebuf = hextoul(argv[5], NULL);
+	if (argc > 6)
+		startoffs = simple_strtoull(argv[6], NULL, 16);
+	if (argc > 7)
+		szexpected = simple_strtoull(argv[7], NULL, 16);
+
+	src = map_sysmem(addr, length);
+	ret = decompwrite(src, length, bdev, writebuf, startoffs, szexpected);
+	unmap_sysmem(src);
+
+	return ret ? CMD_RET_FAILURE : CMD_RET_SUCCESS;
+}
+
+U_BOOT_CMD(
+	decompwrite, 8, 0, do_decompwrite,
+	"decompress gzip, zstd or lz4 image and write to block device",
+	"<interface> <dev> <addr> length [wbuf=1M [offs=0 [outsize=0]]]\n"
+	"\twbuf is the size in bytes (hex) of write buffer\n"
+	"\t\tand should be padded to erase size for SSDs\n"
+	"\toffs is the output start offset in bytes (hex)\n"
+	"\toutsize is the expected uncompressed size (hex bytes)\n"
+	"\t\tand is checked if given\n"
+);
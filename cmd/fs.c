@@ -6,7 +6,10 @@
  */
 
 #include <command.h>
+#include <env.h>
 #include <fs.h>
+#include <image.h>
+#include <time.h>
 
 static int do_size_wrapper(struct cmd_tbl *cmdtp, int flag, int argc,
 			   char *const argv[])
@@ -152,3 +155,44 @@ U_BOOT_CMD(
 	"    - renames/moves a file/directory in 'dev' on 'interface' from\n"
 	"      'old_path' to 'new_path'"
 );
+
+#if CONFIG_IS_ENABLED(FIT_STREAM)
+static int do_fitload(struct cmd_tbl *cmdtp, int flag, int argc,
+		      char *const argv[])
+{
+	ulong addr = -1UL, len;
+	ulong start;
+	int ret;
+
+	if (argc < 5)
+		return CMD_RET_USAGE;
+	if (argc > 5)
+		addr = hextoul(argv[5], NULL);
+
+	start = get_timer(0);
+	ret = fit_stream_load_file(argv[1], argv[2], FS_TYPE_ANY, argv[3],
+				   argv[4], env_get_yesno("verify") != 0, addr,
+				   &len);
+	if (ret) {
+		printf("Failed to load '%s' from %s (err=%d)\n", argv[4],
+		       argv[3], ret);
+		return CMD_RET_FAILURE;
+	}
+	printf("%lu bytes loaded in %lu ms\n", len, get_timer(start));
+
+	env_set_hex("filesize", len);
+
+	return 0;
+}
+
+U_BOOT_CMD(
+	fitload,	6,	0,	do_fitload,
+	"load an image from a FIT in a filesystem",
+	"<interface> <dev[:part]> <filename> <image> [<addr>]\n"
+	"    - Load image node 'image' of FIT 'filename' from partition 'part'\n"
+	"      on device type 'interface' instance 'dev' to address 'addr',\n"
+	"      or to the image's load address if 'addr' is omitted. The image\n"
+	"      is read, hashed and decompressed in a single pass; its hashes\n"
+	"      are checked unless 'verify' is set to 'n'."
+);
+#endif
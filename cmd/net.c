@@ -18,6 +18,8 @@
 #include <log.h>
 #include <net.h>
 #include <net6.h>
+#include <part.h>
+#include <net/sink.h>
 #include <net/udp.h>
 #include <net/sntp.h>
 #include <net/ncsi.h>
@@ -164,15 +166,78 @@ U_BOOT_CMD(
 #if defined(CONFIG_CMD_WGET)
 static int do_wget(struct cmd_tbl *cmdtp, int flag, int argc, char * const argv[])
 {
+	char *args[3];
+	int ret;
+
 	wget_info = &default_wget_info;
+	if (argc > 2 && !strcmp(argv[1], "-j")) {
+		wget_info->jobs = dectoul(argv[2], NULL);
+		args[0] = argv[0];
+		memcpy(args + 1, argv + 3, (argc - 3) * sizeof(char *));
+		argc -= 2;
+		argv = args;
+	}
 
-	return netboot_common(WGET, cmdtp, argc, argv);
+	ret = netboot_common(WGET, cmdtp, argc, argv);
+	wget_info->jobs = 0;
+
+	return ret;
 }
 
 U_BOOT_CMD(
-	wget,   3,      1,      do_wget,
+	wget,   5,      1,      do_wget,
 	"boot image via network using HTTP protocol",
-	"[loadAddress] [[hostIPaddr:]path and image name]"
+	"[-j jobs] [loadAddress] [[hostIPaddr:]path and image name]\n"
+	"    - with -j, fetch up to 'jobs' byte ranges of the file in parallel"
+);
+#endif
+
+#if defined(CONFIG_CMD_NETSINK)
+static int do_netsink(struct cmd_tbl *cmdtp, int flag, int argc,
+		      char *const argv[])
+{
+	enum net_sink_format fmt = NET_SINK_RAW;
+	struct disk_partition info;
+	struct blk_desc *desc;
+	int ret;
+
+	if (argc == 2 && !strcmp(argv[1], "off")) {
+		net_sink_off();
+		return CMD_RET_SUCCESS;
+	}
+	if (argc < 3)
+		return CMD_RET_USAGE;
+
+	if (argc > 3) {
+		if (!strcmp(argv[3], "gzip"))
+			fmt = NET_SINK_GZIP;
+		else if (!strcmp(argv[3], "sparse"))
+			fmt = NET_SINK_SPARSE;
+		else if (strcmp(argv[3], "raw"))
+			return CMD_RET_USAGE;
+	}
+
+	if (blk_get_device_part_str(argv[1], argv[2], &desc, &info, 1) < 0)
+		return CMD_RET_FAILURE;
+
+	ret = net_sink_setup(desc, info.start, info.size, fmt);
+	if (ret) {
+		printf("netsink: %s is not supported (%d)\n", argv[3], ret);
+		return CMD_RET_FAILURE;
+	}
+
+	return CMD_RET_SUCCESS;
+}
+
+U_BOOT_CMD(
+	netsink,	4,	0,	do_netsink,
+	"write the next network download to a block device",
+	"<interface> <dev[:part]> [raw|gzip|sparse]\n"
+	"    - write the file loaded by the next tftpboot or wget to the\n"
+	"      device or partition while it is received, decompressing a\n"
+	"      gzip file or expanding an Android sparse image if asked\n"
+	"netsink off\n"
+	"    - keep the next download in memory"
 );
 #endif
 
@@ -350,6 +415,25 @@ static int parse_args(enum proto_t proto, int argc, char *const argv[])
 	return 0;
 }
 
+/*
+ * Finish a download which was written to a block device by netsink. The size
+ * is taken from net_boot_file_size, since net_loop() cannot return the size
+ * of a file of 2GiB or more.
+ */
+static int netboot_sink_end(int ret)
+{
+	if (ret > 0)
+		ret = 0;
+	if (net_sink_end(ret, net_boot_file_size) || ret) {
+		bootstage_error(BOOTSTAGE_ID_NET_NETLOOP_OK);
+		return CMD_RET_FAILURE;
+	}
+	bootstage_mark(BOOTSTAGE_ID_NET_NETLOOP_OK);
+	netboot_update_env();
+
+	return CMD_RET_SUCCESS;
+}
+
 static int netboot_common(enum proto_t proto, struct cmd_tbl *cmdtp, int argc,
 			  char *const argv[])
 {
@@ -397,6 +481,9 @@ static int netboot_common(enum proto_t proto, struct cmd_tbl *cmdtp, int argc,
 	}
 
 	size = net_loop(proto);
+	if (IS_ENABLED(CONFIG_CMD_NETSINK) && net_sink_enabled() &&
+	    proto != TFTPPUT)
+		return netboot_sink_end(size);
 	if (size < 0) {
 		bootstage_error(BOOTSTAGE_ID_NET_NETLOOP_OK);
 		return CMD_RET_FAILURE;
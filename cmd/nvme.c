@@ -34,6 +34,19 @@ static int do_nvme(struct cmd_tbl *cmdtp, int flag, int argc,
 
 			nvme_print_info(udev);
 
+			return ret;
+		}
+		if (strncmp(argv[1], "inf", 3) == 0) {
+			struct udevice *udev;
+			struct uclass *uc;
+
+			ret = blk_common_cmd(argc, argv, UCLASS_NVME,
+					     &nvme_curr_dev);
+			uclass_id_foreach_dev(UCLASS_NVME, udev, uc) {
+				if (device_active(udev))
+					nvme_print_stats(udev);
+			}
+
 			return ret;
 		}
 	}
@@ -46,7 +59,7 @@ U_BOOT_CMD(
 	"NVM Express sub-system",
 	"scan - scan NVMe devices\n"
 	"nvme detail - show details of current NVMe device\n"
-	"nvme info - show all available NVMe devices\n"
+	"nvme info - show all available NVMe devices and their I/O timing\n"
 	"nvme device [dev] - show or set current NVMe device\n"
 	"nvme part [dev] - print partition table of one or all NVMe devices\n"
 	"nvme read addr blk# cnt - read `cnt' blocks starting at block\n"
@@ -40,3 +40,24 @@ U_BOOT_CMD(sqfsload, 7, 0, do_sqfs_load,
 	   "      ARCH_DMA_MINALIGN then a misaligned buffer warning will\n"
 	   "      be printed and performance will suffer for the load."
 );
+
+static int do_sqfs_cache(struct cmd_tbl *cmdtp, int flag, int argc,
+			 char *const argv[])
+{
+	struct squashfs_cache_stats stats;
+
+	sqfs_cache_stats(&stats);
+	printf("table hits: %u\n"
+	       "table misses: %u\n"
+	       "block hits: %u\n"
+	       "block misses: %u\n",
+	       stats.table_hits, stats.table_misses,
+	       stats.block_hits, stats.block_misses);
+
+	return 0;
+}
+
+U_BOOT_CMD(sqfscache, 1, 1, do_sqfs_cache,
+	   "show and reset SquashFS cache statistics",
+	   ""
+);
@@ -261,6 +261,8 @@ static int initr_dm(void)
 
 	/* Drop the pre-reloc driver model and start a new one */
 	gd->dm_root = NULL;
+	/* Its index of compatible strings is in the early malloc() area */
+	gd_set_dm_compat_index(NULL);
 #ifdef CONFIG_TIMER
 	gd->timer = NULL;
 #endif
@@ -192,10 +192,14 @@ static int __maybe_unused hash_update_crc32(struct hash_algo *algo, void *ctx,
 static int __maybe_unused hash_finish_crc32(struct hash_algo *algo, void *ctx,
 					    void *dest_buf, int size)
 {
+	uint32_t crc;
+
 	if (size < algo->digest_size)
 		return -1;
 
-	*((uint32_t *)dest_buf) = *((uint32_t *)ctx);
+	/* big-endian, as crc32_wd_buf() and FIT hash nodes expect */
+	crc = cpu_to_be32(*((uint32_t *)ctx));
+	memcpy(dest_buf, &crc, sizeof(crc));
 	free(ctx);
 	return 0;
 }
@@ -245,6 +249,9 @@ static struct hash_algo hash_algo[] = {
 #else
 		.hash_func_ws	= sha256_csum_wd,
 #endif
+#if CONFIG_IS_ENABLED(SHA256_MB) && !CONFIG_IS_ENABLED(SHA_HW_ACCEL)
+		.hash_func_multi = sha256_csum_multi,
+#endif
 #if CONFIG_IS_ENABLED(SHA_PROG_HW_ACCEL)
 		.hash_init	= hw_sha_init,
 		.hash_update	= hw_sha_update,
@@ -416,6 +423,50 @@ int hash_block(const char *algo_name, const void *data, unsigned int len,
 	return 0;
 }
 
+/* Largest number of requests passed to hash_func_multi() in one call */
+#define HASH_MULTI_MAX	8
+
+int hash_block_multi(struct hash_req *reqs, int count)
+{
+	const unsigned char *input[HASH_MULTI_MAX];
+	unsigned char *output[HASH_MULTI_MAX];
+	unsigned int ilen[HASH_MULTI_MAX];
+	struct hash_algo *algo;
+	int i, j, n;
+	int ret;
+
+	for (i = 0; i < count; i++) {
+		ret = hash_lookup_algo(reqs[i].algo_name, &reqs[i].algo);
+		if (ret)
+			return ret;
+	}
+
+	/* Each request is done when its algo is cleared */
+	for (i = 0; i < count; i++) {
+		algo = reqs[i].algo;
+		if (!algo)
+			continue;
+		if (!algo->hash_func_multi) {
+			algo->hash_func_ws(reqs[i].data, reqs[i].len,
+					   reqs[i].output, algo->chunk_size);
+			reqs[i].algo = NULL;
+			continue;
+		}
+		for (j = i, n = 0; j < count && n < HASH_MULTI_MAX; j++) {
+			if (reqs[j].algo != algo)
+				continue;
+			input[n] = reqs[j].data;
+			ilen[n] = reqs[j].len;
+			output[n] = reqs[j].output;
+			reqs[j].algo = NULL;
+			n++;
+		}
+		algo->hash_func_multi(input, ilen, output, n, algo->chunk_size);
+	}
+
+	return 0;
+}
+
 #if !defined(CONFIG_XPL_BUILD) && (defined(CONFIG_CMD_HASH) || \
 	defined(CONFIG_CMD_SHA1SUM) || defined(CONFIG_CMD_CRC32)) || \
 	defined(CONFIG_CMD_MD5SUM)
@@ -37,14 +37,19 @@
 #include <dm.h>
 #include <errno.h>
 #include <log.h>
+#include <malloc.h>
 #include <mapmem.h>
 #include <memalign.h>
+#include <time.h>
 #include <asm/byteorder.h>
 #include <asm/cache.h>
 #include <asm/processor.h>
+#include <asm/unaligned.h>
 #include <dm/device-internal.h>
 #include <dm/lists.h>
 #include <linux/delay.h>
+#include <linux/math64.h>
+#include <u-boot/schedule.h>
 
 #include <part.h>
 #include <usb.h>
@@ -77,6 +82,12 @@ struct us_data;
 typedef int (*trans_cmnd)(struct scsi_cmd *cb, struct us_data *data);
 typedef int (*trans_reset)(struct us_data *data);
 
+/* IUs of a UAS command, each in cache lines of its own for DMA */
+struct uas_iu {
+	struct uas_cmd_iu cmd __aligned(ARCH_DMA_MINALIGN);
+	struct uas_sense_iu sense __aligned(ARCH_DMA_MINALIGN);
+};
+
 struct us_data {
 	struct usb_device *pusb_dev;	 /* this usb_device */
 
@@ -100,7 +111,18 @@ struct us_data {
 	trans_reset	transport_reset;	/* reset routine */
 	trans_cmnd	transport;		/* transport routine */
 	unsigned short	max_xfer_blk;		/* maximum transfer blocks */
+	unsigned short	max_xfer_top;		/* max_xfer_blk to probe up to */
+	u64		rd_bytes;		/* bytes read */
+	u64		wr_bytes;		/* bytes written */
+	u64		rd_us;			/* time spent reading */
+	u64		wr_us;			/* time spent writing */
 	bool		cmd12;			/* use 12-byte commands (RBC/UFI) */
+	unsigned char	ep_cmd;			/* UAS command pipe */
+	unsigned char	ep_status;		/* UAS status pipe */
+	unsigned char	ep_din;			/* UAS data in pipe */
+	unsigned char	ep_dout;		/* UAS data out pipe */
+	unsigned short	uas_tags;		/* UAS commands in flight */
+	struct uas_iu	*uas_iu;		/* IUs for each UAS tag */
 };
 
 #if !CONFIG_IS_ENABLED(BLK)
@@ -111,6 +133,14 @@ static struct us_data usb_stor[USB_MAX_STOR_DEV];
 #define USB_STOR_TRANSPORT_FAILED -1
 #define USB_STOR_TRANSPORT_ERROR  -2
 
+/* Transfer size in blocks which all devices are known to handle */
+#define USB_STOR_XFER_BLK	240
+
+/* Streams to ask for with UAS, including the reserved stream 0 */
+#define USB_STOR_UAS_STREAMS	16
+/* Time for a UAS command to finish in ms */
+#define USB_STOR_UAS_TIMEOUT	5000
+
 int usb_stor_get_info(struct usb_device *dev, struct us_data *us,
 		      struct blk_desc *dev_desc);
 int usb_storage_probe(struct usb_device *dev, unsigned int ifnum,
@@ -133,6 +163,28 @@ static void usb_show_progress(void)
 	debug(".");
 }
 
+static void usb_stor_show_rate(const char *what, u64 bytes, u64 us)
+{
+	uint rate;
+
+	if (!bytes)
+		return;
+	/* Bytes per microsecond are MB/s, keep one decimal */
+	rate = div64_u64(bytes * 10, max_t(u64, us, 1));
+	printf("            %s: %llu MiB at %u.%u MB/s\n", what, bytes >> 20,
+	       rate / 10, rate % 10);
+}
+
+static void usb_stor_show_stats(struct us_data *ss)
+{
+	printf("            Transfer size: %u blocks", ss->max_xfer_blk);
+	if (ss->max_xfer_top > ss->max_xfer_blk)
+		printf(", probing up to %u", ss->max_xfer_top);
+	printf("\n");
+	usb_stor_show_rate("Read", ss->rd_bytes, ss->rd_us);
+	usb_stor_show_rate("Written", ss->wr_bytes, ss->wr_us);
+}
+
 /*******************************************************************************
  * show info on storage devices; 'usb start/init' must be invoked earlier
  * as we only retrieve structures populated during devices initialization
@@ -147,9 +199,13 @@ int usb_stor_info(void)
 	     dev;
 	     blk_next_device(&dev)) {
 		struct blk_desc *desc = dev_get_uclass_plat(dev);
+		struct usb_device *udev;
 
 		printf("  Device %d: ", desc->devnum);
 		dev_print(desc);
+		udev = dev_get_parent_priv(dev_get_parent(dev));
+		if (udev->privptr)
+			usb_stor_show_stats(udev->privptr);
 		count++;
 	}
 #else
@@ -157,8 +213,12 @@ int usb_stor_info(void)
 
 	if (usb_max_devs > 0) {
 		for (i = 0; i < usb_max_devs; i++) {
+			struct usb_device *udev = usb_dev_desc[i].priv;
+
 			printf("  Device %d: ", i);
 			dev_print(&usb_dev_desc[i]);
+			if (udev && udev->privptr)
+				usb_stor_show_stats(udev->privptr);
 		}
 		return 0;
 	}
@@ -952,6 +1012,353 @@ do_retry:
 	return USB_STOR_TRANSPORT_FAILED;
 }
 
+#if CONFIG_IS_ENABLED(USB_STORAGE_UAS)
+/* Bulk pipes which use streams with UAS: status, data in and data out */
+static void usb_stor_UAS_pipes(struct us_data *us, unsigned long *pipes)
+{
+	struct usb_device *udev = us->pusb_dev;
+
+	pipes[0] = usb_rcvbulkpipe(udev, us->ep_status);
+	pipes[1] = usb_rcvbulkpipe(udev, us->ep_din);
+	pipes[2] = usb_sndbulkpipe(udev, us->ep_dout);
+}
+
+/*
+ * Go back to Bulk-Only Transport in alternate setting 0, e.g. after a UAS
+ * command timed out. Commands still in flight are thrown away.
+ */
+static void usb_stor_UAS_fallback(struct us_data *us)
+{
+	struct usb_device *udev = us->pusb_dev;
+	unsigned long pipes[3];
+
+	printf("UAS failed, falling back to Bulk-Only Transport\n");
+	usb_stor_UAS_pipes(us, pipes);
+	usb_free_streams(udev, pipes, ARRAY_SIZE(pipes));
+	usb_set_interface(udev,
+			  udev->config.if_desc[us->ifnum].desc.bInterfaceNumber,
+			  0);
+	free(us->uas_iu);
+	us->uas_iu = NULL;
+	us->uas_tags = 0;
+	us->protocol = US_PR_BULK;
+	us->transport = usb_stor_BBB_transport;
+	us->transport_reset = usb_stor_BBB_reset;
+	usb_stor_BBB_reset(us);
+}
+
+static int usb_stor_UAS_reset(struct us_data *us)
+{
+	usb_stor_UAS_fallback(us);
+
+	return 0;
+}
+
+/*
+ * Start a UAS command: queue the Sense IU and the data on the streams of
+ * the tag, then send the Command IU. The device serves the streams in
+ * whatever order it likes once it has the command.
+ */
+static int usb_stor_UAS_submit(struct us_data *us, unsigned int tag,
+			       const u8 *cdb, int cdblen, int lun, void *data,
+			       int datalen, bool dir_in)
+{
+	struct usb_device *udev = us->pusb_dev;
+	struct uas_iu *iu = &us->uas_iu[tag - 1];
+	int actlen, ret;
+
+	memset(&iu->cmd, '\0', sizeof(iu->cmd));
+	iu->cmd.bIUID = UAS_IU_ID_COMMAND;
+	iu->cmd.wTag = cpu_to_be16(tag);
+	iu->cmd.LUN[1] = lun;
+	memcpy(iu->cmd.CDB, cdb, cdblen);
+	/* The LUN goes in the IU, not in the old place in the CDB */
+	iu->cmd.CDB[1] &= 0x1f;
+
+	ret = usb_submit_stream_msg(udev, usb_rcvbulkpipe(udev, us->ep_status),
+				    tag, &iu->sense, UAS_SENSE_IU_SIZE);
+	if (!ret && datalen)
+		ret = usb_submit_stream_msg(udev, dir_in ?
+					    usb_rcvbulkpipe(udev, us->ep_din) :
+					    usb_sndbulkpipe(udev, us->ep_dout),
+					    tag, data, datalen);
+	if (!ret)
+		ret = usb_bulk_msg(udev, usb_sndbulkpipe(udev, us->ep_cmd),
+				   &iu->cmd, UAS_CMD_IU_SIZE, &actlen,
+				   USB_CNTL_TIMEOUT * 5);
+
+	return ret;
+}
+
+static int usb_stor_UAS_poll(struct us_data *us, unsigned long pipe,
+			     unsigned int tag, ulong start, int *actlen)
+{
+	int ret;
+
+	while (1) {
+		ret = usb_poll_stream_msg(us->pusb_dev, pipe, tag, actlen);
+		if (ret != -EINPROGRESS)
+			return ret;
+		if (get_timer(start) > USB_STOR_UAS_TIMEOUT)
+			return -ETIMEDOUT;
+		schedule();
+	}
+}
+
+/*
+ * Wait for a UAS command to finish. Returns the SCSI status from the Sense
+ * IU, or -ve on a transport error.
+ */
+static int usb_stor_UAS_wait(struct us_data *us, unsigned int tag,
+			     bool dir_in, int datalen, int *data_actlen)
+{
+	struct usb_device *udev = us->pusb_dev;
+	struct uas_iu *iu = &us->uas_iu[tag - 1];
+	ulong start = get_timer(0);
+	int actlen, ret;
+
+	/* The device sends the Sense IU once it is done with the data */
+	ret = usb_stor_UAS_poll(us, usb_rcvbulkpipe(udev, us->ep_status), tag,
+				start, &actlen);
+	if (ret)
+		return ret;
+	if (iu->sense.bIUID != UAS_IU_ID_STATUS ||
+	    be16_to_cpu(iu->sense.wTag) != tag) {
+		debug("UAS: IU %#x for tag %d\n", iu->sense.bIUID, tag);
+		return -EIO;
+	}
+
+	*data_actlen = 0;
+	if (datalen) {
+		ret = usb_stor_UAS_poll(us, dir_in ?
+					usb_rcvbulkpipe(udev, us->ep_din) :
+					usb_sndbulkpipe(udev, us->ep_dout),
+					tag, start, data_actlen);
+		/* A stall ends the data phase, the status tells the rest */
+		if (ret && ret != -EPIPE)
+			return ret;
+	}
+
+	return iu->sense.bStatus;
+}
+
+static int usb_stor_UAS_transport(struct scsi_cmd *srb, struct us_data *us)
+{
+	struct uas_iu *iu = &us->uas_iu[0];
+	bool dir_in = US_DIRECTION(srb->cmd[0]);
+	int data_actlen;
+	int ret;
+
+	ret = usb_stor_UAS_submit(us, 1, srb->cmd, srb->cmdlen, srb->lun,
+				  srb->pdata, srb->datalen, dir_in);
+	if (!ret)
+		ret = usb_stor_UAS_wait(us, 1, dir_in, srb->datalen,
+					&data_actlen);
+	if (ret < 0) {
+		debug("UAS transport error %d\n", ret);
+		usb_stor_UAS_fallback(us);
+		return USB_STOR_TRANSPORT_FAILED;
+	}
+	if (ret) {
+		debug("UAS status %#x\n", ret);
+		memcpy(srb->sense_buf, iu->sense.SenseData,
+		       min_t(size_t, be16_to_cpu(iu->sense.wLength),
+			     sizeof(srb->sense_buf)));
+		return USB_STOR_TRANSPORT_FAILED;
+	}
+
+	return USB_STOR_TRANSPORT_GOOD;
+}
+
+/* Fill in a READ(10) or WRITE(10) command */
+static void usb_stor_UAS_rw_cdb(u8 *cdb, bool write, lbaint_t start,
+				unsigned short blocks)
+{
+	memset(cdb, '\0', 10);
+	cdb[0] = write ? SCSI_WRITE10 : SCSI_READ10;
+	put_unaligned_be32(start, &cdb[2]);
+	put_unaligned_be16(blocks, &cdb[7]);
+}
+
+/*
+ * Read or write with several UAS commands in flight, each moving up to
+ * max_xfer_blk blocks on a stream of its own. Commands complete in order
+ * of their tags. Returns the number of blocks done before the first
+ * failure; the caller goes on from there one command at a time.
+ */
+static lbaint_t usb_stor_UAS_rw(struct us_data *ss, struct blk_desc *desc,
+				lbaint_t start, lbaint_t blkcnt, void *buffer,
+				bool write)
+{
+	unsigned short blks[USB_STOR_UAS_STREAMS];
+	lbaint_t issued = 0, done = 0;
+	uint head = 0, tail = 0;
+	bool failed = false;
+	unsigned int tag;
+	int actlen, ret;
+	u8 cdb[10];
+
+	while (1) {
+		/* Keep all the tags busy */
+		while (!failed && issued < blkcnt &&
+		       tail - head < ss->uas_tags) {
+			tag = tail % ss->uas_tags + 1;
+			blks[tag] = min_t(lbaint_t, blkcnt - issued,
+					  ss->max_xfer_blk);
+			usb_stor_UAS_rw_cdb(cdb, write, start + issued,
+					    blks[tag]);
+			ret = usb_stor_UAS_submit(ss, tag, cdb, sizeof(cdb),
+						  desc->lun, buffer +
+						  issued * desc->blksz,
+						  blks[tag] * desc->blksz,
+						  !write);
+			if (ret) {
+				usb_stor_UAS_fallback(ss);
+				return done;
+			}
+			issued += blks[tag];
+			tail++;
+		}
+		if (head == tail)
+			break;
+
+		/* Wait for the oldest command */
+		tag = head % ss->uas_tags + 1;
+		ret = usb_stor_UAS_wait(ss, tag, !write,
+					blks[tag] * desc->blksz, &actlen);
+		if (ret < 0) {
+			usb_stor_UAS_fallback(ss);
+			return done;
+		}
+		if (ret || actlen != blks[tag] * desc->blksz)
+			failed = true;
+		else if (!failed)
+			done += blks[tag];
+		head++;
+		if (blks[tag] == ss->max_xfer_blk)
+			usb_show_progress();
+	}
+
+	return done;
+}
+
+/*
+ * Look for a UAS alternate setting of the interface, which also has a
+ * Pipe Usage descriptor after each endpoint, and switch to it if the host
+ * controller can set up streams on its endpoints.
+ */
+static void usb_stor_UAS_probe(struct usb_device *dev, struct us_data *ss)
+{
+	struct usb_interface_descriptor *ifd = NULL;
+	struct usb_endpoint_descriptor *epd = NULL;
+	struct usb_descriptor_header *head;
+	unsigned int ifnum, ep_streams = 1, max_streams = USB_STOR_UAS_STREAMS;
+	struct usb_ss_ep_comp_descriptor *comp;
+	unsigned long pipes[3];
+	unsigned char *buf;
+	int index, len, ret;
+	u8 pipe_id;
+
+	ifnum = dev->config.if_desc[ss->ifnum].desc.bInterfaceNumber;
+	if (dev->config.if_desc[ss->ifnum].num_altsetting < 2)
+		return;
+	len = usb_get_configuration_len(dev, 0);
+	if (len < 0)
+		return;
+	buf = malloc_cache_aligned(len);
+	if (!buf)
+		return;
+	if (usb_get_configuration_no(dev, 0, buf, len) < 0)
+		goto out;
+
+	for (index = 0; index + 2 <= len; index += head->bLength) {
+		head = (struct usb_descriptor_header *)&buf[index];
+		if (head->bLength < 2 || index + head->bLength > len)
+			break;
+
+		switch (head->bDescriptorType) {
+		case USB_DT_INTERFACE:
+			/* Stop at the end of the UAS alternate setting */
+			if (ss->ep_cmd)
+				goto found;
+			ifd = (struct usb_interface_descriptor *)head;
+			if (ifd->bInterfaceNumber != ifnum ||
+			    ifd->bInterfaceClass != USB_CLASS_MASS_STORAGE ||
+			    ifd->bInterfaceSubClass != US_SC_SCSI ||
+			    ifd->bInterfaceProtocol != US_PR_UAS)
+				ifd = NULL;
+			epd = NULL;
+			break;
+		case USB_DT_ENDPOINT:
+			if (ifd)
+				epd = (struct usb_endpoint_descriptor *)head;
+			ep_streams = 1;
+			break;
+		case USB_DT_SS_ENDPOINT_COMP:
+			comp = (struct usb_ss_ep_comp_descriptor *)head;
+			ep_streams = 1U << (comp->bmAttributes & 0x1f);
+			break;
+		case USB_DT_PIPE_USAGE:
+			if (!ifd || !epd)
+				break;
+			pipe_id = ((struct uas_pipe_usage_desc *)head)->bPipeID;
+			/* Each pipe but the command pipe needs streams */
+			if (pipe_id != UAS_CMD_PIPE_ID)
+				max_streams = min(max_streams, ep_streams);
+			switch (pipe_id) {
+			case UAS_CMD_PIPE_ID:
+				ss->ep_cmd = usb_endpoint_num(epd);
+				break;
+			case UAS_STATUS_PIPE_ID:
+				ss->ep_status = usb_endpoint_num(epd);
+				break;
+			case UAS_DATA_IN_PIPE_ID:
+				ss->ep_din = usb_endpoint_num(epd);
+				break;
+			case UAS_DATA_OUT_PIPE_ID:
+				ss->ep_dout = usb_endpoint_num(epd);
+				break;
+			}
+			break;
+		}
+	}
+found:
+	if (!ifd || !ss->ep_cmd || !ss->ep_status || !ss->ep_din ||
+	    !ss->ep_dout || max_streams < 2)
+		goto out;
+
+	debug("UAS alternate setting %d: cmd %d status %d in %d out %d\n",
+	      ifd->bAlternateSetting, ss->ep_cmd, ss->ep_status, ss->ep_din,
+	      ss->ep_dout);
+	if (usb_set_interface(dev, ifnum, ifd->bAlternateSetting))
+		goto out;
+	usb_stor_UAS_pipes(ss, pipes);
+	ret = usb_alloc_streams(dev, pipes, ARRAY_SIZE(pipes), max_streams);
+	if (ret < 2) {
+		debug("UAS: cannot allocate streams (err=%d)\n", ret);
+		usb_set_interface(dev, ifnum, 0);
+		goto out;
+	}
+
+	ss->uas_iu = memalign(ARCH_DMA_MINALIGN,
+			      (ret - 1) * sizeof(struct uas_iu));
+	if (!ss->uas_iu) {
+		usb_free_streams(dev, pipes, ARRAY_SIZE(pipes));
+		usb_set_interface(dev, ifnum, 0);
+		goto out;
+	}
+	ss->uas_tags = ret - 1;
+	ss->protocol = US_PR_UAS;
+	ss->transport = usb_stor_UAS_transport;
+	ss->transport_reset = usb_stor_UAS_reset;
+	debug("USB Attached SCSI, %d tags\n", ss->uas_tags);
+out:
+	if (ss->protocol != US_PR_UAS)
+		ss->ep_cmd = 0;
+	free(buf);
+}
+#endif
+
 static void usb_stor_set_max_xfer_blk(struct usb_device *udev,
 				      struct us_data *us)
 {
@@ -972,8 +1379,9 @@ static void usb_stor_set_max_xfer_blk(struct usb_device *udev,
 	 * and Apple Mac OS X 10.11 limiting transfers to 256 sectors for USB2
 	 * and 2048 for USB3 devices.
 	 */
-	unsigned short blk = 240;
+	unsigned short blk = USB_STOR_XFER_BLK;
 
+	us->max_xfer_top = blk;
 #if CONFIG_IS_ENABLED(DM_USB)
 	size_t size;
 	int ret;
@@ -981,11 +1389,64 @@ static void usb_stor_set_max_xfer_blk(struct usb_device *udev,
 	ret = usb_get_max_xfer_size(udev, (size_t *)&size);
 	if ((ret >= 0) && (size < blk * 512))
 		blk = size / 512;
+#if CONFIG_IS_ENABLED(USB_STORAGE_MAX_XFER_PROBE)
+	/*
+	 * Many devices do cope with larger transfers though, so try them
+	 * at runtime, see usb_stor_xfer_ok(). UAS streams are not probed
+	 * since their rings are smaller.
+	 */
+	else if (ret >= 0 && us->protocol != US_PR_UAS)
+		us->max_xfer_top = min_t(size_t, size / 512, U16_MAX);
+#endif
 #endif
 
 	us->max_xfer_blk = blk;
+	us->max_xfer_top = max(us->max_xfer_top, blk);
 }
 
+#if CONFIG_IS_ENABLED(USB_STORAGE_MAX_XFER_PROBE)
+/*
+ * A transfer of max_xfer_blk blocks went through, so try twice as many with
+ * the next one
+ */
+static void usb_stor_xfer_ok(struct us_data *ss, unsigned short blks)
+{
+	if (blks == ss->max_xfer_blk && blks < ss->max_xfer_top)
+		ss->max_xfer_blk = min_t(uint, blks * 2, ss->max_xfer_top);
+}
+
+/*
+ * A transfer failed with transport result @result. If the transport itself
+ * broke down on a transfer larger than the size all devices handle, the
+ * device may not cope with it, so keep to half of it from now on. A command
+ * which the device completed with an error (USB_STOR_TRANSPORT_FAILED) says
+ * nothing about the size, e.g. a bad sector. Returns true if the transfer
+ * should be retried with the lower limit.
+ */
+static bool usb_stor_xfer_failed(struct us_data *ss, unsigned short blks,
+				 int result)
+{
+	if (result != USB_STOR_TRANSPORT_ERROR || blks <= USB_STOR_XFER_BLK)
+		return false;
+
+	ss->max_xfer_top = max(blks / 2, USB_STOR_XFER_BLK);
+	ss->max_xfer_blk = ss->max_xfer_top;
+	debug("Transfers limited to %u blocks\n", ss->max_xfer_top);
+
+	return true;
+}
+#else
+static void usb_stor_xfer_ok(struct us_data *ss, unsigned short blks)
+{
+}
+
+static bool usb_stor_xfer_failed(struct us_data *ss, unsigned short blks,
+				 int result)
+{
+	return false;
+}
+#endif
+
 static int usb_inquiry(struct scsi_cmd *srb, struct us_data *ss)
 {
 	int retry, i;
@@ -1014,6 +1475,10 @@ static int usb_request_sense(struct scsi_cmd *srb, struct us_data *ss)
 {
 	char *ptr;
 
+	/* UAS returns the sense data along with the status of the command */
+	if (ss->protocol == US_PR_UAS)
+		return 0;
+
 	ptr = (char *)srb->pdata;
 	memset(&srb->cmd[0], 0, 12);
 	srb->cmd[0] = SCSI_REQ_SENSE;
@@ -1146,10 +1611,11 @@ static unsigned long usb_stor_read(struct blk_desc *block_dev, lbaint_t blknr,
 {
 	lbaint_t start, blks;
 	uintptr_t buf_addr;
-	unsigned short smallblks;
+	unsigned short smallblks = 0;
 	struct usb_device *udev;
 	struct us_data *ss;
-	int retry;
+	ulong ts;
+	int retry, result;
 	struct scsi_cmd *srb = &usb_ccb;
 #if CONFIG_IS_ENABLED(BLK)
 	struct blk_desc *block_dev;
@@ -1181,8 +1647,21 @@ static unsigned long usb_stor_read(struct blk_desc *block_dev, lbaint_t blknr,
 
 	debug("\nusb_read: dev %d startblk " LBAF ", blccnt " LBAF " buffer %lx\n",
 	      block_dev->devnum, start, blks, buf_addr);
+	ts = timer_get_us();
 
-	do {
+#if CONFIG_IS_ENABLED(USB_STORAGE_UAS)
+	if (ss->protocol == US_PR_UAS) {
+		lbaint_t done;
+
+		done = usb_stor_UAS_rw(ss, block_dev, start, blks, buffer,
+				       false);
+		start += done;
+		blks -= done;
+		buf_addr += done * block_dev->blksz;
+	}
+#endif
+
+	while (blks != 0) {
 		/* XXX need some comment here */
 		retry = 2;
 		srb->pdata = (unsigned char *)buf_addr;
@@ -1195,22 +1674,28 @@ retry_it:
 			usb_show_progress();
 		srb->datalen = block_dev->blksz * smallblks;
 		srb->pdata = (unsigned char *)buf_addr;
-		if (usb_read_10(srb, ss, start, smallblks)) {
+		result = usb_read_10(srb, ss, start, smallblks);
+		if (result) {
 			debug("Read ERROR\n");
 			ss->flags &= ~USB_READY;
 			usb_request_sense(srb, ss);
+			if (usb_stor_xfer_failed(ss, smallblks, result))
+				continue;
 			if (retry--)
 				goto retry_it;
 			blkcnt -= blks;
 			break;
 		}
+		usb_stor_xfer_ok(ss, smallblks);
 		start += smallblks;
 		blks -= smallblks;
 		buf_addr += srb->datalen;
-	} while (blks != 0);
+	}
 
 	debug("usb_read: end startblk " LBAF ", blccnt %x buffer %lx\n",
 	      start, smallblks, buf_addr);
+	ss->rd_us += timer_get_us() - ts;
+	ss->rd_bytes += (u64)blkcnt * block_dev->blksz;
 
 	usb_lock_async(udev, 0);
 	usb_disable_asynch(0); /* asynch transfer allowed */
@@ -1229,10 +1714,11 @@ static unsigned long usb_stor_write(struct blk_desc *block_dev, lbaint_t blknr,
 {
 	lbaint_t start, blks;
 	uintptr_t buf_addr;
-	unsigned short smallblks;
+	unsigned short smallblks = 0;
 	struct usb_device *udev;
 	struct us_data *ss;
-	int retry;
+	ulong ts;
+	int retry, result;
 	struct scsi_cmd *srb = &usb_ccb;
 #if CONFIG_IS_ENABLED(BLK)
 	struct blk_desc *block_dev;
@@ -1266,8 +1752,21 @@ static unsigned long usb_stor_write(struct blk_desc *block_dev, lbaint_t blknr,
 
 	debug("\nusb_write: dev %d startblk " LBAF ", blccnt " LBAF " buffer %lx\n",
 	      block_dev->devnum, start, blks, buf_addr);
+	ts = timer_get_us();
 
-	do {
+#if CONFIG_IS_ENABLED(USB_STORAGE_UAS)
+	if (ss->protocol == US_PR_UAS) {
+		lbaint_t done;
+
+		done = usb_stor_UAS_rw(ss, block_dev, start, blks,
+				       (void *)buffer, true);
+		start += done;
+		blks -= done;
+		buf_addr += done * block_dev->blksz;
+	}
+#endif
+
+	while (blks != 0) {
 		/* If write fails retry for max retry count else
 		 * return with number of blocks written successfully.
 		 */
@@ -1282,22 +1781,28 @@ retry_it:
 			usb_show_progress();
 		srb->datalen = block_dev->blksz * smallblks;
 		srb->pdata = (unsigned char *)buf_addr;
-		if (usb_write_10(srb, ss, start, smallblks)) {
+		result = usb_write_10(srb, ss, start, smallblks);
+		if (result) {
 			debug("Write ERROR\n");
 			ss->flags &= ~USB_READY;
 			usb_request_sense(srb, ss);
+			if (usb_stor_xfer_failed(ss, smallblks, result))
+				continue;
 			if (retry--)
 				goto retry_it;
 			blkcnt -= blks;
 			break;
 		}
+		usb_stor_xfer_ok(ss, smallblks);
 		start += smallblks;
 		blks -= smallblks;
 		buf_addr += srb->datalen;
-	} while (blks != 0);
+	}
 
 	debug("usb_write: end startblk " LBAF ", blccnt %x buffer %lx\n",
 	      start, smallblks, buf_addr);
+	ss->wr_us += timer_get_us() - ts;
+	ss->wr_bytes += (u64)blkcnt * block_dev->blksz;
 
 	usb_lock_async(udev, 0);
 	usb_disable_asynch(0); /* asynch transfer allowed */
@@ -1428,6 +1933,12 @@ int usb_storage_probe(struct usb_device *dev, unsigned int ifnum,
 		dev->irq_handle = usb_stor_irq;
 	}
 
+#if CONFIG_IS_ENABLED(USB_STORAGE_UAS)
+	/* UAS comes as an alternate setting of a Bulk-Only interface */
+	if (ss->protocol == US_PR_BULK && ss->subclass == US_SC_SCSI)
+		usb_stor_UAS_probe(dev, ss);
+#endif
+
 	/* Set the maximum transfer size per host controller setting */
 	usb_stor_set_max_xfer_blk(dev, ss);
 
@@ -1535,6 +2046,18 @@ static int usb_mass_storage_probe(struct udevice *dev)
 	return ret;
 }
 
+#if CONFIG_IS_ENABLED(USB_STORAGE_UAS)
+static int usb_mass_storage_remove(struct udevice *dev)
+{
+	struct us_data *data = dev_get_plat(dev);
+
+	free(data->uas_iu);
+	data->uas_iu = NULL;
+
+	return 0;
+}
+#endif
+
 static const struct udevice_id usb_mass_storage_ids[] = {
 	{ .compatible = "usb-mass-storage" },
 	{ }
@@ -1545,6 +2068,9 @@ U_BOOT_DRIVER(usb_mass_storage) = {
 	.id	= UCLASS_MASS_STORAGE,
 	.of_match = usb_mass_storage_ids,
 	.probe = usb_mass_storage_probe,
+#if CONFIG_IS_ENABLED(USB_STORAGE_UAS)
+	.remove = usb_mass_storage_remove,
+#endif
 #if CONFIG_IS_ENABLED(BLK)
 	.plat_auto	= sizeof(struct us_data),
 #endif
@@ -429,18 +429,103 @@ static int blk_buffer_aligned(struct bounce_buffer *state)
 	return 1;	/* Default, any buffer is OK */
 }
 
-long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+/**
+ * blk_rw_async() - Read or write through requests kept in flight
+ *
+ * The transfer is split into requests of CONFIG_BLK_ASYNC_REQ_SIZE bytes,
+ * of which up to CONFIG_BLK_ASYNC_DEPTH are submitted at once. No more
+ * requests are submitted after one fails, but those in flight are waited
+ * for, since they use @buf.
+ *
+ * @dev: Device to access
+ * @start: Start block
+ * @blkcnt: Number of blocks
+ * @buf: Data to write, or place to put the data read
+ * @write: true to write, false to read
+ * Return: number of blocks transferred from @start onwards, -ENOSYS if the
+ *	driver cannot queue requests or the transfer fits in one request,
+ *	other -ve on error
+ */
+static long blk_rw_async(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
+			 void *buf, bool write)
 {
 	struct blk_desc *desc = dev_get_uclass_plat(dev);
 	const struct blk_ops *ops = blk_get_ops(dev);
-	ulong blks_read;
-
-	if (!ops->read)
+	struct blk_req reqs[CONFIG_BLK_ASYNC_DEPTH];
+	struct blk_req *free_reqs[CONFIG_BLK_ASYNC_DEPTH];
+	struct blk_req *req;
+	lbaint_t per_req, next, done;
+	int nfree, inflight, i;
+	int err = 0;
+
+	per_req = max_t(lbaint_t, CONFIG_BLK_ASYNC_REQ_SIZE / desc->blksz, 1);
+	if (!ops->submit || !ops->poll || blkcnt <= per_req)
 		return -ENOSYS;
 
-	if (blkcache_read(desc->uclass_id, desc->devnum,
-			  start, blkcnt, desc->blksz, buf))
-		return blkcnt;
+	for (i = 0; i < CONFIG_BLK_ASYNC_DEPTH; i++)
+		free_reqs[i] = &reqs[i];
+	nfree = CONFIG_BLK_ASYNC_DEPTH;
+	inflight = 0;
+	next = 0;	/* blocks submitted so far */
+	done = blkcnt;	/* blocks before the first failure */
+	while (next < done || inflight) {
+		if (next < done && nfree) {
+			req = free_reqs[--nfree];
+			req->start = start + next;
+			req->blkcnt = min(per_req, blkcnt - next);
+			req->buffer = buf + next * desc->blksz;
+			req->write = write;
+			req->result = 0;
+			err = ops->submit(dev, req);
+			if (!err) {
+				next += req->blkcnt;
+				inflight++;
+				continue;
+			}
+			free_reqs[nfree++] = req;
+			if (err == -ENOSYS && !next)
+				return -ENOSYS;
+			if (err != -EBUSY || !inflight) {
+				log_debug("submit at " LBAF " failed (err=%dE)\n",
+					  req->start, err);
+				done = next;
+				continue;
+			}
+			err = 0;
+		}
+
+		req = ops->poll(dev);
+		if (!req)
+			continue;
+		inflight--;
+		free_reqs[nfree++] = req;
+		if (req->result != req->blkcnt) {
+			log_debug("request at " LBAF " failed (%ld)\n",
+				  req->start, req->result);
+			done = min(done, req->start - start +
+				   max_t(long, req->result, 0));
+			if (req->result < 0)
+				err = req->result;
+		}
+	}
+
+	return done || !err ? done : err;
+}
+#else
+static long blk_rw_async(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
+			 void *buf, bool write)
+{
+	return -ENOSYS;
+}
+#endif
+
+static long blk_read_dev(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
+			 void *buf)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	const struct blk_ops *ops = blk_get_ops(dev);
+	ulong blks_read;
 
 	if (IS_ENABLED(CONFIG_BOUNCE_BUFFER) && desc->bb) {
 		struct blk_bounce_buffer bbstate = { .dev = dev };
@@ -457,9 +542,45 @@ long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
 
 		bounce_buffer_stop(&bbstate.state);
 	} else {
-		blks_read = ops->read(dev, start, blkcnt, buf);
+		blks_read = blk_rw_async(dev, start, blkcnt, buf, false);
+		if (blks_read == -ENOSYS)
+			blks_read = ops->read(dev, start, blkcnt, buf);
 	}
 
+	return blks_read;
+}
+
+long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	const struct blk_ops *ops = blk_get_ops(dev);
+	lbaint_t ra_start, ra_cnt;
+	ulong blks_read;
+	char *ra_buf;
+
+	if (!ops->read)
+		return -ENOSYS;
+
+	if (blkcache_read(desc->uclass_id, desc->devnum,
+			  start, blkcnt, desc->blksz, buf))
+		return blkcnt;
+
+	/*
+	 * Small reads are widened to whole cache lines, plus readahead when
+	 * sequential, so that the following reads hit the cache
+	 */
+	ra_buf = blkcache_readahead(desc->uclass_id, desc->devnum, start,
+				    blkcnt, desc->blksz, desc->lba, &ra_start,
+				    &ra_cnt);
+	if (ra_buf && blk_read_dev(dev, ra_start, ra_cnt, ra_buf) == ra_cnt) {
+		blkcache_fill(desc->uclass_id, desc->devnum, ra_start, ra_cnt,
+			      desc->blksz, ra_buf);
+		memcpy(buf, ra_buf + (start - ra_start) * desc->blksz,
+		       blkcnt * desc->blksz);
+		return blkcnt;
+	}
+
+	blks_read = blk_read_dev(dev, start, blkcnt, buf);
 	if (blks_read == blkcnt)
 		blkcache_fill(desc->uclass_id, desc->devnum, start, blkcnt,
 			      desc->blksz, buf);
@@ -495,7 +616,10 @@ long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
 
 		bounce_buffer_stop(&bbstate.state);
 	} else {
-		blks_written = ops->write(dev, start, blkcnt, buf);
+		blks_written = blk_rw_async(dev, start, blkcnt, (void *)buf,
+					    true);
+		if (blks_written == -ENOSYS)
+			blks_written = ops->write(dev, start, blkcnt, buf);
 	}
 
 	return blks_written;
@@ -841,9 +965,20 @@ static int blk_post_probe(struct udevice *dev)
 	return 0;
 }
 
+static int blk_pre_remove(struct udevice *dev)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+
+	/* the device number may be reused by another device */
+	blkcache_remove(desc->uclass_id, desc->devnum);
+
+	return 0;
+}
+
 UCLASS_DRIVER(blk) = {
 	.id		= UCLASS_BLK,
 	.name		= "blk",
 	.post_probe	= blk_post_probe,
+	.pre_remove	= blk_pre_remove,
 	.per_device_plat_auto	= sizeof(struct blk_desc),
 };
@@ -3,168 +3,451 @@
  * Copyright (C) Nelson Integration, LLC 2016
  * Author: Eric Nelson<eric@nelint.com>
  *
+ * The cache is set-associative: each device is split into fixed-size lines
+ * of max_blocks_per_entry blocks, and a line can only live in one of the
+ * CONFIG_BLOCK_CACHE_WAYS slots of the set selected by hashing its
+ * (iftype, devnum, line) key. The line data lives in a single slab which is
+ * allocated on first use, so lookups never walk more than one set and fills
+ * never call malloc().
  */
 #include <blk.h>
 #include <log.h>
 #include <malloc.h>
+#include <memalign.h>
 #include <part.h>
 #include <asm/global_data.h>
 #include <linux/ctype.h>
 #include <linux/list.h>
+#include <linux/log2.h>
 
-struct block_cache_node {
-	struct list_head lh;
+/**
+ * struct block_cache_line - a cached, line-aligned run of blocks
+ *
+ * @iftype: uclass ID of the device
+ * @devnum: device number
+ * @start: first block of the line, a multiple of the line size
+ * @age: LRU stamp, 0 if the line is empty
+ */
+struct block_cache_line {
 	int iftype;
 	int devnum;
 	lbaint_t start;
-	lbaint_t blkcnt;
-	unsigned long blksz;
-	char *cache;
+	ulong age;
+};
+
+/**
+ * struct block_cache_dev - per-device readahead state and statistics
+ *
+ * @lh: entry in the block_cache_devs list
+ * @iftype: uclass ID of the device
+ * @devnum: device number
+ * @next: block following the last block requested, for sequential detection
+ * @ra_start: first block of the pending readahead window
+ * @ra_cnt: number of blocks in the pending readahead window
+ * @ra_extra: blocks of the pending window which were not requested
+ * @stats: statistics for this device
+ */
+struct block_cache_dev {
+	struct list_head lh;
+	int iftype;
+	int devnum;
+	lbaint_t next;
+	lbaint_t ra_start;
+	lbaint_t ra_cnt;
+	lbaint_t ra_extra;
+	struct block_cache_dev_stats stats;
 };
 
-static LIST_HEAD(block_cache);
+static LIST_HEAD(block_cache_devs);
 
 static struct block_cache_stats _stats = {
 	.max_blocks_per_entry = 8,
-	.max_entries = 32
+	.max_entries = 32,
+	.readahead = CONFIG_BLOCK_CACHE_READAHEAD,
 };
 
-static struct block_cache_node *cache_find(int iftype, int devnum,
-					   lbaint_t start, lbaint_t blkcnt,
-					   unsigned long blksz)
-{
-	struct block_cache_node *node;
-
-	list_for_each_entry(node, &block_cache, lh)
-		if ((node->iftype == iftype) &&
-		    (node->devnum == devnum) &&
-		    (node->blksz == blksz) &&
-		    (node->start <= start) &&
-		    (node->start + node->blkcnt >= start + blkcnt)) {
-			if (block_cache.next != &node->lh) {
-				/* maintain MRU ordering */
-				list_del(&node->lh);
-				list_add(&node->lh, &block_cache);
-			}
-			return node;
+static struct block_cache_line *lines;	/* sets * ways line headers */
+static char *slab;			/* line data, one line per header */
+static unsigned long slab_blksz;	/* block size the slab was sized for */
+static uint sets, ways, line_shift;
+static ulong tick;			/* LRU clock */
+
+static char *ra_buf;			/* bounce buffer for readahead */
+static size_t ra_size;
+
+static struct block_cache_dev *cache_dev_find(int iftype, int devnum)
+{
+	struct block_cache_dev *bdev;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh)
+		if (bdev->iftype == iftype && bdev->devnum == devnum)
+			return bdev;
+
+	return NULL;
+}
+
+/* Find the state of a device, adding it if the cache is in use */
+static struct block_cache_dev *cache_dev(int iftype, int devnum)
+{
+	struct block_cache_dev *bdev;
+
+	bdev = cache_dev_find(iftype, devnum);
+	if (bdev || !_stats.max_entries)
+		return bdev;
+
+	bdev = calloc(1, sizeof(*bdev));
+	if (!bdev)
+		return NULL;
+	bdev->iftype = iftype;
+	bdev->devnum = devnum;
+	bdev->stats.iftype = iftype;
+	bdev->stats.devnum = devnum;
+	list_add_tail(&bdev->lh, &block_cache_devs);
+
+	return bdev;
+}
+
+static uint cache_set(int iftype, int devnum, lbaint_t start)
+{
+	u64 key = (u64)(start >> line_shift);
+
+	key ^= (u64)iftype << 56 ^ (u64)devnum << 48;
+	key *= 0x9e3779b97f4a7c15ULL;	/* golden ratio, see hash_64() */
+
+	return (uint)(key >> 32) % sets;
+}
+
+static char *line_data(struct block_cache_line *line)
+{
+	return slab + (line - lines) * (_stats.max_blocks_per_entry *
+					slab_blksz);
+}
+
+static struct block_cache_line *cache_find(int iftype, int devnum,
+					   lbaint_t start)
+{
+	struct block_cache_line *line;
+	uint i;
+
+	line = &lines[cache_set(iftype, devnum, start) * ways];
+	for (i = 0; i < ways; i++, line++) {
+		if (line->age && line->start == start &&
+		    line->iftype == iftype && line->devnum == devnum) {
+			line->age = ++tick;
+			return line;
 		}
-	return 0;
+	}
+
+	return NULL;
+}
+
+/* Return a line to (re)use for @start, evicting the LRU way of its set */
+static struct block_cache_line *cache_victim(int iftype, int devnum,
+					     lbaint_t start)
+{
+	struct block_cache_line *line, *victim;
+	uint i;
+
+	victim = &lines[cache_set(iftype, devnum, start) * ways];
+	for (i = 0, line = victim; i < ways; i++, line++) {
+		if (line->age && line->start == start &&
+		    line->iftype == iftype && line->devnum == devnum)
+			return line;
+		if (line->age < victim->age)
+			victim = line;
+	}
+	if (victim->age) {
+		debug("drop: start " LBAF "\n", victim->start);
+		_stats.entries--;
+	}
+
+	return victim;
+}
+
+/* Set up the slab for blocks of @blksz, returning false if not possible */
+static bool cache_alloc(unsigned long blksz)
+{
+	uint entries;
+
+	if (slab && blksz <= slab_blksz)
+		return true;
+
+	blkcache_invalidate(-1, 0);
+	free(slab);
+	free(lines);
+	slab = NULL;
+	lines = NULL;
+
+	ways = min_t(uint, CONFIG_BLOCK_CACHE_WAYS, _stats.max_entries);
+	sets = _stats.max_entries / ways;
+	entries = sets * ways;
+	line_shift = ilog2(_stats.max_blocks_per_entry);
+
+	lines = calloc(entries, sizeof(*lines));
+	slab = malloc(entries * _stats.max_blocks_per_entry * blksz);
+	if (!lines || !slab) {
+		free(lines);
+		lines = NULL;
+		slab = NULL;
+		return false;
+	}
+	slab_blksz = blksz;
+	debug("slab: %u sets of %u ways, %lu bytes per line\n", sets, ways,
+	      _stats.max_blocks_per_entry * blksz);
+
+	return true;
+}
+
+/* Largest request the cache will try to serve or fill: a readahead window */
+static lbaint_t cache_max_blocks(void)
+{
+	lbaint_t mask = _stats.max_blocks_per_entry - 1;
+
+	return 2 * (mask + 1) + ((_stats.readahead + mask) & ~mask);
 }
 
 int blkcache_read(int iftype, int devnum,
 		  lbaint_t start, lbaint_t blkcnt,
 		  unsigned long blksz, void *buffer)
 {
-	struct block_cache_node *node = cache_find(iftype, devnum, start,
-						   blkcnt, blksz);
-	if (node) {
-		const char *src = node->cache + (start - node->start) * blksz;
-		memcpy(buffer, src, blksz * blkcnt);
-		debug("hit: start " LBAF ", count " LBAFU "\n",
-		      start, blkcnt);
-		++_stats.hits;
-		return 1;
+	lbaint_t mask = _stats.max_blocks_per_entry - 1;
+	struct block_cache_dev *bdev = cache_dev_find(iftype, devnum);
+	lbaint_t blk, end = start + blkcnt;
+	char *dst = buffer;
+
+	if (!slab || blksz > slab_blksz || blkcnt > cache_max_blocks())
+		goto miss;
+
+	for (blk = start; blk < end;) {
+		struct block_cache_line *line = cache_find(iftype, devnum,
+							   blk & ~mask);
+		lbaint_t ofs = blk & mask;
+		lbaint_t cnt = min(end - blk, mask + 1 - ofs);
+
+		if (!line)
+			goto miss;
+		memcpy(dst, line_data(line) + ofs * blksz, cnt * blksz);
+		dst += cnt * blksz;
+		blk += cnt;
+	}
+
+	debug("hit: start " LBAF ", count " LBAFU "\n",
+	      start, blkcnt);
+	++_stats.hits;
+	if (bdev) {
+		++bdev->stats.hits;
+		bdev->next = end;
 	}
+	return 1;
 
+miss:
 	debug("miss: start " LBAF ", count " LBAFU "\n",
 	      start, blkcnt);
 	++_stats.misses;
+	if (!bdev)
+		bdev = cache_dev(iftype, devnum);
+	if (bdev)
+		++bdev->stats.misses;
 	return 0;
 }
 
+void *blkcache_readahead(int iftype, int devnum,
+			 lbaint_t start, lbaint_t blkcnt,
+			 unsigned long blksz, lbaint_t lba,
+			 lbaint_t *ra_startp, lbaint_t *ra_cntp)
+{
+	lbaint_t mask = _stats.max_blocks_per_entry - 1;
+	struct block_cache_dev *bdev;
+	lbaint_t ra_start, ra_end;
+	bool seq = false;
+	size_t size;
+
+	bdev = cache_dev(iftype, devnum);
+	if (bdev) {
+		seq = bdev->next == start;
+		bdev->next = start + blkcnt;
+		bdev->ra_extra = 0;
+	}
+
+	if (!_stats.max_entries || blkcnt > _stats.max_blocks_per_entry)
+		return NULL;
+
+	ra_start = start & ~mask;
+	ra_end = (start + blkcnt + mask) & ~mask;
+	if (seq)
+		ra_end += (_stats.readahead + mask) & ~mask;
+
+	if (lba && ra_end > lba)
+		ra_end = lba;
+	if (ra_end - ra_start <= blkcnt)
+		return NULL;
+
+	size = (ra_end - ra_start) * blksz;
+	if (size > ra_size) {
+		free(ra_buf);
+		ra_buf = malloc_cache_aligned(size);
+		ra_size = ra_buf ? size : 0;
+		if (!ra_buf)
+			return NULL;
+	}
+
+	/* counted by blkcache_fill() once the window has been read */
+	if (bdev) {
+		bdev->ra_start = ra_start;
+		bdev->ra_cnt = ra_end - ra_start;
+		bdev->ra_extra = ra_end - ra_start - blkcnt;
+	}
+	*ra_startp = ra_start;
+	*ra_cntp = ra_end - ra_start;
+
+	return ra_buf;
+}
+
 void blkcache_fill(int iftype, int devnum,
 		   lbaint_t start, lbaint_t blkcnt,
 		   unsigned long blksz, void const *buffer)
 {
-	lbaint_t bytes;
-	struct block_cache_node *node;
+	lbaint_t mask = _stats.max_blocks_per_entry - 1;
+	lbaint_t blk, end = start + blkcnt;
+	struct block_cache_dev *bdev;
+
+	bdev = cache_dev_find(iftype, devnum);
+	if (bdev && bdev->ra_extra && bdev->ra_start == start &&
+	    bdev->ra_cnt == blkcnt) {
+		bdev->stats.readahead += bdev->ra_extra;
+		bdev->ra_extra = 0;
+	}
 
 	/* don't cache big stuff */
-	if (blkcnt > _stats.max_blocks_per_entry)
+	if (blkcnt > cache_max_blocks())
 		return;
 
 	if (_stats.max_entries == 0)
 		return;
 
-	bytes = blksz * blkcnt;
-	if (_stats.max_entries <= _stats.entries) {
-		/* pop LRU */
-		node = (struct block_cache_node *)block_cache.prev;
-		list_del(&node->lh);
-		_stats.entries--;
-		debug("drop: start " LBAF ", count " LBAFU "\n",
-		      node->start, node->blkcnt);
-		if (node->blkcnt * node->blksz < bytes) {
-			free(node->cache);
-			node->cache = 0;
-		}
-	} else {
-		node = malloc(sizeof(*node));
-		if (!node)
-			return;
-		node->cache = 0;
-	}
-
-	if (!node->cache) {
-		node->cache = malloc(bytes);
-		if (!node->cache) {
-			free(node);
-			return;
-		}
-	}
+	if (!cache_alloc(blksz))
+		return;
 
-	debug("fill: start " LBAF ", count " LBAFU "\n",
-	      start, blkcnt);
+	/* only whole lines are cached, so skip any partial head and tail */
+	for (blk = (start + mask) & ~mask; blk + mask < end; blk += mask + 1) {
+		struct block_cache_line *line;
 
-	node->iftype = iftype;
-	node->devnum = devnum;
-	node->start = start;
-	node->blkcnt = blkcnt;
-	node->blksz = blksz;
-	memcpy(node->cache, buffer, bytes);
-	list_add(&node->lh, &block_cache);
-	_stats.entries++;
+		line = cache_victim(iftype, devnum, blk);
+		debug("fill: start " LBAF "\n", blk);
+		if (!line->age)
+			_stats.entries++;
+		line->iftype = iftype;
+		line->devnum = devnum;
+		line->start = blk;
+		line->age = ++tick;
+		memcpy(line_data(line), (const char *)buffer +
+		       (blk - start) * blksz, (mask + 1) * blksz);
+	}
 }
 
 void blkcache_invalidate(int iftype, int devnum)
 {
-	struct list_head *entry, *n;
-	struct block_cache_node *node;
+	struct block_cache_dev *bdev;
+	uint i;
 
-	list_for_each_safe(entry, n, &block_cache) {
-		node = (struct block_cache_node *)entry;
-		if (iftype == -1 ||
-		    (node->iftype == iftype && node->devnum == devnum)) {
-			list_del(entry);
-			free(node->cache);
-			free(node);
+	for (i = 0; lines && i < sets * ways; i++) {
+		struct block_cache_line *line = &lines[i];
+
+		if (line->age && (iftype == -1 ||
+				  (line->iftype == iftype &&
+				   line->devnum == devnum))) {
+			line->age = 0;
 			--_stats.entries;
 		}
 	}
+
+	list_for_each_entry(bdev, &block_cache_devs, lh)
+		if (iftype == -1 ||
+		    (bdev->iftype == iftype && bdev->devnum == devnum))
+			bdev->next = 0;
+}
+
+void blkcache_remove(int iftype, int devnum)
+{
+	struct block_cache_dev *bdev;
+
+	blkcache_invalidate(iftype, devnum);
+	bdev = cache_dev_find(iftype, devnum);
+	if (bdev) {
+		list_del(&bdev->lh);
+		free(bdev);
+	}
 }
 
 void blkcache_configure(unsigned blocks, unsigned entries)
 {
+	/* lines are addressed with shifts, so keep them a power of two */
+	if (blocks)
+		blocks = roundup_pow_of_two(blocks);
+
 	/* invalidate cache if there is a change */
 	if ((blocks != _stats.max_blocks_per_entry) ||
-	    (entries != _stats.max_entries))
+	    (entries != _stats.max_entries)) {
 		blkcache_invalidate(-1, 0);
+		free(slab);
+		free(lines);
+		slab = NULL;
+		lines = NULL;
+	}
 
 	_stats.max_blocks_per_entry = blocks;
-	_stats.max_entries = entries;
+	_stats.max_entries = blocks ? entries : 0;
 
 	_stats.hits = 0;
 	_stats.misses = 0;
 }
 
+void blkcache_set_readahead(unsigned blocks)
+{
+	_stats.readahead = blocks;
+}
+
 void blkcache_stats(struct block_cache_stats *stats)
 {
 	memcpy(stats, &_stats, sizeof(*stats));
+	stats->sets = lines ? sets : 0;
+	stats->ways = lines ? ways : 0;
 	_stats.hits = 0;
 	_stats.misses = 0;
 }
 
+int blkcache_dev_stats(int seq, struct block_cache_dev_stats *stats)
+{
+	struct block_cache_dev *bdev;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		if (!seq--) {
+			memcpy(stats, &bdev->stats, sizeof(*stats));
+			bdev->stats.hits = 0;
+			bdev->stats.misses = 0;
+			bdev->stats.readahead = 0;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
 void blkcache_free(void)
 {
+	struct block_cache_dev *bdev, *n;
+
 	blkcache_invalidate(-1, 0);
+	free(slab);
+	free(lines);
+	free(ra_buf);
+	slab = NULL;
+	lines = NULL;
+	ra_buf = NULL;
+	ra_size = 0;
+
+	list_for_each_entry_safe(bdev, n, &block_cache_devs, lh) {
+		list_del(&bdev->lh);
+		free(bdev);
+	}
 }
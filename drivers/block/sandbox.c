@@ -11,12 +11,35 @@
 #include <malloc.h>
 #include <sandbox_host.h>
 #include <asm/global_data.h>
+#include <asm/test.h>
 #include <dm/device_compat.h>
 #include <dm/device-internal.h>
 #include <linux/errno.h>
 
 DECLARE_GLOBAL_DATA_PTR;
 
+/* Number of requests which can be submitted to a host device at once */
+#define HOST_BLK_QUEUE_DEPTH	4
+
+/**
+ * struct host_blk_priv - private data for a host block device
+ *
+ * @queue: Requests submitted and not yet polled
+ * @count: Number of requests in @queue
+ * @submit_fail: Block whose request fails to be submitted, or -1
+ * @poll_fail: Block at which a request stops when polled, or -1
+ * @max_count: Largest value of @count so far
+ * @busy: Number of times submit() found @queue full
+ */
+struct host_blk_priv {
+	struct blk_req *queue[HOST_BLK_QUEUE_DEPTH];
+	int count;
+	long submit_fail;
+	long poll_fail;
+	int max_count;
+	int busy;
+};
+
 static unsigned long host_block_read(struct udevice *dev,
 				     lbaint_t start, lbaint_t blkcnt,
 				     void *buffer)
@@ -55,13 +78,102 @@ static unsigned long host_block_write(struct udevice *dev,
 	return -EIO;
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+void sandbox_host_blk_set_fail(struct udevice *dev, long submit_fail,
+			       long poll_fail)
+{
+	struct host_blk_priv *priv = dev_get_priv(dev);
+
+	priv->submit_fail = submit_fail;
+	priv->poll_fail = poll_fail;
+	priv->max_count = 0;
+	priv->busy = 0;
+}
+
+int sandbox_host_blk_get_busy(struct udevice *dev, int *max_countp)
+{
+	struct host_blk_priv *priv = dev_get_priv(dev);
+
+	*max_countp = priv->max_count;
+
+	return priv->busy;
+}
+
+/* Check whether @blk falls within @req */
+static bool host_block_in_req(struct blk_req *req, long blk)
+{
+	return blk >= 0 && blk >= req->start && blk < req->start + req->blkcnt;
+}
+
+static int host_block_submit(struct udevice *dev, struct blk_req *req)
+{
+	struct host_blk_priv *priv = dev_get_priv(dev);
+
+	if (host_block_in_req(req, priv->submit_fail))
+		return -EIO;
+	if (priv->count == HOST_BLK_QUEUE_DEPTH) {
+		priv->busy++;
+		return -EBUSY;
+	}
+	priv->queue[priv->count++] = req;
+	priv->max_count = max(priv->max_count, priv->count);
+
+	return 0;
+}
+
+/*
+ * Requests are carried out when polled, newest first, so that callers see
+ * them finish out of order as they would on real hardware
+ */
+static struct blk_req *host_block_poll(struct udevice *dev)
+{
+	struct host_blk_priv *priv = dev_get_priv(dev);
+	lbaint_t blkcnt;
+	struct blk_req *req;
+
+	if (!priv->count)
+		return NULL;
+	req = priv->queue[--priv->count];
+
+	/* A failing request does the blocks before the failure, if any */
+	blkcnt = req->blkcnt;
+	if (host_block_in_req(req, priv->poll_fail))
+		blkcnt = priv->poll_fail - req->start;
+	if (req->write)
+		req->result = host_block_write(dev, req->start, blkcnt,
+					       req->buffer);
+	else
+		req->result = host_block_read(dev, req->start, blkcnt,
+					      req->buffer);
+	if (blkcnt != req->blkcnt && !req->result)
+		req->result = -EIO;
+
+	return req;
+}
+
+static int host_block_probe(struct udevice *dev)
+{
+	sandbox_host_blk_set_fail(dev, -1, -1);
+
+	return 0;
+}
+#endif
+
 static const struct blk_ops sandbox_host_blk_ops = {
 	.read	= host_block_read,
 	.write	= host_block_write,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.submit	= host_block_submit,
+	.poll	= host_block_poll,
+#endif
 };
 
 U_BOOT_DRIVER(sandbox_host_blk) = {
 	.name		= "sandbox_host_blk",
 	.id		= UCLASS_BLK,
 	.ops		= &sandbox_host_blk_ops,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.probe		= host_block_probe,
+#endif
+	.priv_auto	= sizeof(struct host_blk_priv),
 };
@@ -1143,12 +1143,26 @@ int device_set_name(struct udevice *dev, const char *name)
 	name = strdup(name);
 	if (!name)
 		return -ENOMEM;
+	uclass_index_del(dev);
 	dev->name = name;
+	uclass_index_add(dev);
 	device_set_name_alloced(dev);
 
 	return 0;
 }
 
+#if CONFIG_IS_ENABLED(DM_UCLASS_INDEX) && CONFIG_IS_ENABLED(OF_REAL)
+void dev_set_ofnode(struct udevice *dev, ofnode node)
+{
+	/* A device is not in a uclass's index until it is bound */
+	if (dev->uclass)
+		uclass_index_del(dev);
+	dev->node_ = node;
+	if (dev->uclass)
+		uclass_index_add(dev);
+}
+#endif
+
 void dev_set_priv(struct udevice *dev, void *priv)
 {
 	dev->priv_ = priv;
@@ -11,6 +11,9 @@
 #include <debug_uart.h>
 #include <errno.h>
 #include <log.h>
+#include <malloc.h>
+#include <sort.h>
+#include <asm/global_data.h>
 #include <dm/device.h>
 #include <dm/device-internal.h>
 #include <dm/lists.h>
@@ -19,6 +22,9 @@
 #include <dm/util.h>
 #include <fdtdec.h>
 #include <linux/compiler.h>
+#include <linux/kernel.h>
+
+DECLARE_GLOBAL_DATA_PTR;
 
 struct driver *lists_driver_lookup_name(const char *name)
 {
@@ -196,6 +202,177 @@ static int driver_check_compatible(const struct udevice_id *of_match,
 	return -ENOENT;
 }
 
+#if CONFIG_IS_ENABLED(DM_COMPAT_INDEX)
+/**
+ * struct dm_compat_entry - compatible string offered by a driver
+ *
+ * @hash:	hash of the compatible string
+ * @drv:	index of the driver in the driver linker list
+ * @id:		index of the string in the of_match table of the driver
+ */
+struct dm_compat_entry {
+	u32 hash;
+	u16 drv;
+	u16 id;
+};
+
+/**
+ * struct dm_compat_index - compatible strings of all drivers
+ *
+ * @count:	number of entries, or -1 if the index could not be built
+ * @entries:	one for each compatible string of each driver, sorted by
+ *		hash, then by driver, then by position in of_match
+ */
+struct dm_compat_index {
+	int count;
+	struct dm_compat_entry entries[];
+};
+
+/* Marks that there is no room for the index, so drivers are checked in turn */
+static const struct dm_compat_index lists_compat_none = { .count = -1 };
+
+/* FNV-1a hash of a compatible string */
+static u32 lists_compat_hash(const char *compat)
+{
+	u32 hash = 0x811c9dc5;
+
+	while (*compat)
+		hash = (hash ^ (u8)*compat++) * 0x01000193;
+
+	return hash;
+}
+
+static int lists_compat_cmp(const void *s1, const void *s2)
+{
+	const struct dm_compat_entry *e1 = s1, *e2 = s2;
+
+	if (e1->hash != e2->hash)
+		return e1->hash < e2->hash ? -1 : 1;
+	if (e1->drv != e2->drv)
+		return e1->drv - e2->drv;
+
+	return e1->id - e2->id;
+}
+
+/* Get the index, building it if needed. Returns NULL if there is none */
+static const struct dm_compat_index *lists_compat_index(void)
+{
+	struct driver *driver = ll_entry_start(struct driver, driver);
+	const int n_ents = ll_entry_count(struct driver, driver);
+	const struct dm_compat_index *index = gd_dm_compat_index();
+	const struct udevice_id *of_match;
+	struct dm_compat_index *new;
+	struct dm_compat_entry *entry;
+	ulong size, room = 0;
+	int count = 0;
+	int i;
+
+	if (index)
+		return index->count < 0 ? NULL : index;
+
+	/*
+	 * The early malloc() area is left to devices, unless the board asks
+	 * for the index before relocation and most of the area is free
+	 */
+	if (!(gd->flags & GD_FLG_FULL_MALLOC_INIT) &&
+	    !CONFIG_IS_ENABLED(DM_COMPAT_INDEX_PRE_RELOC))
+		return NULL;
+
+	for (i = 0; i < n_ents; i++) {
+		for (of_match = driver[i].of_match;
+		     of_match && of_match->compatible; of_match++)
+			count++;
+	}
+	size = sizeof(*new) + count * sizeof(*entry);
+
+#if CONFIG_IS_ENABLED(DM_COMPAT_INDEX_PRE_RELOC)
+	room = (gd->malloc_limit - gd->malloc_ptr) / 2;
+#endif
+	new = NULL;
+	if (n_ents <= U16_MAX &&
+	    (gd->flags & GD_FLG_FULL_MALLOC_INIT || size <= room))
+		new = malloc(size);
+	if (!new) {
+		log_debug("No room for compatible index of %lu bytes\n", size);
+		gd_set_dm_compat_index((void *)&lists_compat_none);
+		return NULL;
+	}
+
+	entry = new->entries;
+	for (i = 0; i < n_ents; i++) {
+		for (of_match = driver[i].of_match;
+		     of_match && of_match->compatible; of_match++) {
+			entry->hash = lists_compat_hash(of_match->compatible);
+			entry->drv = i;
+			entry->id = of_match - driver[i].of_match;
+			entry++;
+		}
+	}
+	new->count = count;
+	qsort(new->entries, count, sizeof(*entry), lists_compat_cmp);
+	gd_set_dm_compat_index(new);
+	log_debug("Indexed %d compatible strings of %d drivers\n", count,
+		  n_ents);
+
+	return new;
+}
+
+/* Find the first entry for @compat, in order of driver */
+static struct driver *lists_compat_find(const struct dm_compat_index *index,
+					const char *compat,
+					const struct udevice_id **idp)
+{
+	struct driver *driver = ll_entry_start(struct driver, driver);
+	const struct dm_compat_entry *entry;
+	u32 hash = lists_compat_hash(compat);
+	int lo = 0, hi = index->count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (index->entries[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (entry = index->entries + lo;
+	     entry != index->entries + index->count && entry->hash == hash;
+	     entry++) {
+		const struct udevice_id *id =
+			&driver[entry->drv].of_match[entry->id];
+
+		if (!strcmp(id->compatible, compat)) {
+			*idp = id;
+			return &driver[entry->drv];
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+struct driver *lists_driver_lookup_compat(const char *compat,
+					  const struct udevice_id **idp)
+{
+	struct driver *driver = ll_entry_start(struct driver, driver);
+	const int n_ents = ll_entry_count(struct driver, driver);
+	struct driver *entry;
+
+#if CONFIG_IS_ENABLED(DM_COMPAT_INDEX)
+	const struct dm_compat_index *index = lists_compat_index();
+
+	if (index)
+		return lists_compat_find(index, compat, idp);
+#endif
+
+	for (entry = driver; entry != driver + n_ents; entry++) {
+		if (!driver_check_compatible(entry->of_match, idp, compat))
+			return entry;
+	}
+
+	return NULL;
+}
+
 int lists_bind_fdt(struct udevice *parent, ofnode node, struct udevice **devp,
 		   struct driver *drv, bool pre_reloc_only)
 {
@@ -238,20 +415,27 @@ int lists_bind_fdt(struct udevice *parent, ofnode node, struct udevice **devp,
 			  compat);
 
 		id = NULL;
-		for (entry = driver; entry != driver + n_ents; entry++) {
-			if (drv) {
+		if (!drv) {
+			entry = lists_driver_lookup_compat(compat, &id);
+			if (!entry) {
+				ret = -ENOENT;
+				continue;
+			}
+		} else {
+			for (entry = driver; entry != driver + n_ents;
+			     entry++) {
 				if (drv != entry)
 					continue;
 				if (!entry->of_match)
 					break;
+				ret = driver_check_compatible(entry->of_match,
+							      &id, compat);
+				if (!ret)
+					break;
 			}
-			ret = driver_check_compatible(entry->of_match, &id,
-						      compat);
-			if (!ret)
-				break;
+			if (entry == driver + n_ents)
+				continue;
 		}
-		if (entry == driver + n_ents)
-			continue;
 
 		if (pre_reloc_only) {
 			if (!ofnode_pre_reloc(node) &&
@@ -137,6 +137,9 @@ int uclass_destroy(struct uclass *uc)
 	list_del(&uc->sibling_node);
 	if (uc_drv->priv_auto)
 		free(uclass_get_priv(uc));
+#if CONFIG_IS_ENABLED(DM_UCLASS_INDEX)
+	free(uc->index_);
+#endif
 	free(uc);
 
 	return 0;
@@ -221,6 +224,287 @@ int dev_get_uclass_index(struct udevice *dev, struct uclass **ucp)
 	return -ENODEV;
 }
 
+#if CONFIG_IS_ENABLED(DM_UCLASS_INDEX)
+/*
+ * Each uclass may keep an index with one hash table per key. The tables use
+ * open addressing with linear probing, and each slot points to a device
+ * whose key hashes there. A device lacking a key (e.g. no sequence number
+ * or no device tree node) is not in that table.
+ */
+enum uclass_index_key {
+	UCLASS_INDEX_SEQ,
+	UCLASS_INDEX_NAME,
+	UCLASS_INDEX_NODE,
+	UCLASS_INDEX_PHANDLE,
+
+	UCLASS_INDEX_KEYS,
+};
+
+/* Slot of a device which was removed, which must not end a probe sequence */
+#define UCLASS_INDEX_DELETED	((struct udevice *)1)
+
+/**
+ * struct uclass_index - hash tables of the devices in a uclass
+ *
+ * @mask: Number of slots in each table, less one
+ * @used: Number of slots used in each table, including deleted ones
+ * @slots: UCLASS_INDEX_KEYS tables of @mask + 1 slots each
+ */
+struct uclass_index {
+	uint mask;
+	uint used;
+	struct udevice *slots[];
+};
+
+static uint uclass_index_hash_int(ulong val)
+{
+	u32 hash = lower_32_bits(val) ^ upper_32_bits(val);
+
+	/* Mix all bits down, since node pointers have low bits clear */
+	hash = (hash ^ (hash >> 16)) * 0x85ebca6b;
+	hash = (hash ^ (hash >> 13)) * 0xc2b2ae35;
+
+	return hash ^ (hash >> 16);
+}
+
+static uint uclass_index_hash_str(const char *str, int len)
+{
+	uint hash = 0x811c9dc5;
+
+	while (len--)
+		hash = (hash ^ (u8)*str++) * 0x01000193;
+
+	return hash;
+}
+
+/**
+ * uclass_index_dev_hash() - Get the hash of a device's key
+ *
+ * @dev: Device to check
+ * @key: Key to hash
+ * @hashp: Returns the hash
+ * Return: true if the device has this key, false if not
+ */
+static bool uclass_index_dev_hash(struct udevice *dev,
+				  enum uclass_index_key key, uint *hashp)
+{
+	ofnode node = dev_ofnode(dev);
+
+	switch (key) {
+	case UCLASS_INDEX_SEQ:
+		if (dev->seq_ < 0)
+			return false;
+		*hashp = uclass_index_hash_int(dev->seq_);
+		return true;
+	case UCLASS_INDEX_NAME:
+		*hashp = uclass_index_hash_str(dev->name, strlen(dev->name));
+		return true;
+	case UCLASS_INDEX_NODE:
+		if (!ofnode_valid(node))
+			return false;
+		*hashp = uclass_index_hash_int(node.of_offset);
+		return true;
+	case UCLASS_INDEX_PHANDLE:
+		if (!CONFIG_IS_ENABLED(OF_REAL) || !ofnode_valid(node) ||
+		    !dev_read_phandle(dev))
+			return false;
+		*hashp = uclass_index_hash_int(dev_read_phandle(dev));
+		return true;
+	default:
+		return false;
+	}
+}
+
+static struct udevice **uclass_index_table(struct uclass_index *idx,
+					   enum uclass_index_key key)
+{
+	return idx->slots + key * (idx->mask + 1);
+}
+
+static void uclass_index_insert(struct uclass_index *idx, struct udevice *dev)
+{
+	enum uclass_index_key key;
+	struct udevice **tab;
+	uint hash, i;
+
+	for (key = 0; key < UCLASS_INDEX_KEYS; key++) {
+		if (!uclass_index_dev_hash(dev, key, &hash))
+			continue;
+		tab = uclass_index_table(idx, key);
+		for (i = hash & idx->mask; tab[i]; i = (i + 1) & idx->mask)
+			;
+		tab[i] = dev;
+	}
+	idx->used++;
+}
+
+/**
+ * uclass_index_build() - Build the index of a uclass from its devices
+ *
+ * Any existing index is replaced by one where at most half of the slots are
+ * used.
+ *
+ * @uc: uclass to index
+ * Return: 0 if OK, -ENOMEM if out of memory
+ */
+static int uclass_index_build(struct uclass *uc)
+{
+	struct uclass_index *idx;
+	struct udevice *dev;
+	uint size = 8;
+	uint count = 0;
+
+	list_for_each_entry(dev, &uc->dev_head, uclass_node)
+		count++;
+	while (size < count * 2)
+		size <<= 1;
+
+	idx = calloc(1, sizeof(*idx) +
+		     UCLASS_INDEX_KEYS * size * sizeof(struct udevice *));
+	if (!idx)
+		return log_msg_ret("idx", -ENOMEM);
+	idx->mask = size - 1;
+	list_for_each_entry(dev, &uc->dev_head, uclass_node)
+		uclass_index_insert(idx, dev);
+	free(uc->index_);
+	uc->index_ = idx;
+
+	return 0;
+}
+
+static struct uclass_index *uclass_index_get(struct uclass *uc)
+{
+	if (!uc->index_ && (gd->flags & GD_FLG_FULL_MALLOC_INIT))
+		uclass_index_build(uc);
+
+	return uc->index_;
+}
+
+void uclass_index_add(struct udevice *dev)
+{
+	struct uclass *uc = dev->uclass;
+	struct uclass_index *idx = uc->index_;
+
+	if (!idx || list_empty(&dev->uclass_node))
+		return;
+
+	/* Keep at least a quarter of the slots free, else start afresh */
+	if ((idx->used + 1) * 4 > (idx->mask + 1) * 3) {
+		if (uclass_index_build(uc)) {
+			free(uc->index_);
+			uc->index_ = NULL;
+		}
+		return;
+	}
+	uclass_index_insert(idx, dev);
+}
+
+void uclass_index_del(struct udevice *dev)
+{
+	struct uclass_index *idx = dev->uclass->index_;
+	enum uclass_index_key key;
+	struct udevice **tab;
+	uint hash, i;
+
+	if (!idx || list_empty(&dev->uclass_node))
+		return;
+
+	/*
+	 * A key may have changed since the device was added, so look through
+	 * the whole table if the device is not found under its current key
+	 */
+	for (key = 0; key < UCLASS_INDEX_KEYS; key++) {
+		tab = uclass_index_table(idx, key);
+		if (uclass_index_dev_hash(dev, key, &hash)) {
+			for (i = hash & idx->mask; tab[i] && tab[i] != dev;
+			     i = (i + 1) & idx->mask)
+				;
+			if (tab[i] == dev) {
+				tab[i] = UCLASS_INDEX_DELETED;
+				continue;
+			}
+		}
+		for (i = 0; i <= idx->mask; i++) {
+			if (tab[i] == dev)
+				tab[i] = UCLASS_INDEX_DELETED;
+		}
+	}
+}
+
+/**
+ * uclass_index_find() - Find a device through the index of its uclass
+ *
+ * The device must be the only one in the table whose key matches, so that
+ * it is the same device as the first one in the uclass's list with that
+ * key. A device given a sequence number after binding is not in the table,
+ * so there may be such a device even if the table has none. Names and nodes
+ * are kept up to date by device_set_name() and dev_set_ofnode().
+ *
+ * @uc: uclass to search
+ * @key: Table to use
+ * @hash: Hash of the key to look for
+ * @match: Function to check whether a device has the key
+ * @arg: First argument for @match
+ * @len: Second argument for @match
+ * @devp: Returns the device found
+ * Return: 0 if found, -ENODEV if no device has the key, -EAGAIN if the
+ *	uclass's list of devices must be searched instead
+ */
+static int uclass_index_find(struct uclass *uc, enum uclass_index_key key,
+			     uint hash,
+			     bool (*match)(struct udevice *dev, const void *arg,
+					   ulong len),
+			     const void *arg, ulong len, struct udevice **devp)
+{
+	struct uclass_index *idx = uclass_index_get(uc);
+	struct udevice *found = NULL;
+	struct udevice **tab;
+	uint i;
+
+	if (!idx)
+		return -EAGAIN;
+	tab = uclass_index_table(idx, key);
+	for (i = hash & idx->mask; tab[i]; i = (i + 1) & idx->mask) {
+		if (tab[i] == UCLASS_INDEX_DELETED || !match(tab[i], arg, len))
+			continue;
+		if (found)
+			return -EAGAIN;
+		found = tab[i];
+	}
+	if (!found)
+		return key == UCLASS_INDEX_SEQ ? -EAGAIN : -ENODEV;
+	*devp = found;
+
+	return 0;
+}
+
+static bool uclass_index_match_seq(struct udevice *dev, const void *arg,
+				   ulong seq)
+{
+	return dev->seq_ == (int)seq;
+}
+
+static bool uclass_index_match_name(struct udevice *dev, const void *name,
+				    ulong len)
+{
+	return !strncmp(dev->name, name, len) && strlen(dev->name) == len;
+}
+
+static bool uclass_index_match_node(struct udevice *dev, const void *arg,
+				    ulong node)
+{
+	return dev_ofnode(dev).of_offset == node;
+}
+
+#if CONFIG_IS_ENABLED(OF_REAL)
+static bool uclass_index_match_phandle(struct udevice *dev, const void *arg,
+				       ulong phandle)
+{
+	return dev_read_phandle(dev) == phandle;
+}
+#endif
+#endif
+
 int uclass_find_device(enum uclass_id id, int index, struct udevice **devp)
 {
 	struct uclass *uc;
@@ -285,6 +569,13 @@ int uclass_find_device_by_namelen(enum uclass_id id, const char *name, int len,
 	if (ret)
 		return ret;
 
+#if CONFIG_IS_ENABLED(DM_UCLASS_INDEX)
+	ret = uclass_index_find(uc, UCLASS_INDEX_NAME,
+				uclass_index_hash_str(name, len),
+				uclass_index_match_name, name, len, devp);
+	if (ret != -EAGAIN)
+		return ret;
+#endif
 	uclass_foreach_dev(dev, uc) {
 		if (!strncmp(dev->name, name, len) &&
 		    strlen(dev->name) == len) {
@@ -350,6 +641,16 @@ int uclass_find_device_by_seq(enum uclass_id id, int seq, struct udevice **devp)
 	if (ret)
 		return ret;
 
+#if CONFIG_IS_ENABLED(DM_UCLASS_INDEX)
+	if (seq >= 0) {
+		ret = uclass_index_find(uc, UCLASS_INDEX_SEQ,
+					uclass_index_hash_int(seq),
+					uclass_index_match_seq, NULL, seq,
+					devp);
+		if (ret != -EAGAIN)
+			return ret;
+	}
+#endif
 	uclass_foreach_dev(dev, uc) {
 		log_debug("   - %d '%s'\n", dev->seq_, dev->name);
 		if (dev->seq_ == seq) {
@@ -402,6 +703,14 @@ int uclass_find_device_by_ofnode(enum uclass_id id, ofnode node,
 	if (ret)
 		return ret;
 
+#if CONFIG_IS_ENABLED(DM_UCLASS_INDEX)
+	ret = uclass_index_find(uc, UCLASS_INDEX_NODE,
+				uclass_index_hash_int(node.of_offset),
+				uclass_index_match_node, NULL, node.of_offset,
+				devp);
+	if (ret != -EAGAIN)
+		goto done;
+#endif
 	uclass_foreach_dev(dev, uc) {
 		log(LOGC_DM, LOGL_DEBUG_CONTENT, "      - checking %s\n",
 		    dev->name);
@@ -431,6 +740,14 @@ static int uclass_find_device_by_phandle_id(enum uclass_id id,
 	if (ret)
 		return ret;
 
+#if CONFIG_IS_ENABLED(DM_UCLASS_INDEX)
+	ret = uclass_index_find(uc, UCLASS_INDEX_PHANDLE,
+				uclass_index_hash_int(find_phandle),
+				uclass_index_match_phandle, NULL, find_phandle,
+				devp);
+	if (ret != -EAGAIN)
+		return ret;
+#endif
 	uclass_foreach_dev(dev, uc) {
 		uint phandle;
 
@@ -717,6 +1034,7 @@ int uclass_bind_device(struct udevice *dev)
 
 	uc = dev->uclass;
 	list_add_tail(&dev->uclass_node, &uc->dev_head);
+	uclass_index_add(dev);
 
 	if (dev->parent) {
 		struct uclass_driver *uc_drv = dev->parent->uclass->uc_drv;
@@ -731,6 +1049,7 @@ int uclass_bind_device(struct udevice *dev)
 	return 0;
 err:
 	/* There is no need to undo the parent's post_bind call */
+	uclass_index_del(dev);
 	list_del(&dev->uclass_node);
 
 	return ret;
@@ -754,6 +1073,7 @@ int uclass_pre_unbind_device(struct udevice *dev)
 
 int uclass_unbind_device(struct udevice *dev)
 {
+	uclass_index_del(dev);
 	list_del(&dev->uclass_node);
 
 	return 0;
@@ -14,6 +14,7 @@
 #include <fat.h>
 #include <dfu.h>
 #include <hash.h>
+#include <uthread.h>
 #include <linux/list.h>
 #include <linux/compiler.h>
 #include <linux/printk.h>
@@ -199,8 +200,136 @@ static unsigned char *dfu_buf;
 static unsigned long dfu_buf_size;
 static enum dfu_device_type dfu_buf_device_type;
 
+#if CONFIG_IS_ENABLED(DFU_ASYNC_WRITE)
+#define DFU_WRITE_BUFS	CONFIG_DFU_ASYNC_WRITE_BUFS
+#else
+#define DFU_WRITE_BUFS	1
+#endif
+
+/**
+ * struct dfu_ring - buffers waiting to be written to the medium
+ *
+ * @buf: buffers of dfu_buf_size bytes, the first one being dfu_buf
+ * @len: number of bytes to write from each buffer
+ * @fill: buffer being filled by dfu_write()
+ * @next: next buffer for the writer thread to write
+ * @queued: number of buffers waiting to be written
+ * @ret: result of the first failed write, 0 if none
+ * @grp_id: uthread group of the writer thread
+ * @stop: tells the writer thread to stop early
+ */
+struct dfu_ring {
+	unsigned char *buf[DFU_WRITE_BUFS];
+	long len[DFU_WRITE_BUFS];
+	int fill;
+	int next;
+	int queued;
+	int ret;
+	unsigned int grp_id;
+	bool stop;
+};
+
+static struct dfu_ring dfu_ring;
+
+/*
+ * Runs in a uthread and writes the queued buffers in order. Back ends which
+ * wait for the hardware with udelay() or schedule() let the USB gadget fill
+ * the next buffer in the meantime.
+ */
+static void dfu_write_thread(void *arg)
+{
+	struct dfu_entity *dfu = arg;
+	long w_size;
+	int ret;
+
+	while (dfu_ring.queued && !dfu_ring.stop) {
+		w_size = dfu_ring.len[dfu_ring.next];
+		ret = dfu->write_medium(dfu, dfu->offset,
+					dfu_ring.buf[dfu_ring.next], &w_size);
+		if (ret) {
+			debug("%s: Write error!\n", __func__);
+			dfu_ring.ret = ret;
+			break;
+		}
+		dfu->offset += w_size;
+		dfu_ring.next = (dfu_ring.next + 1) % DFU_WRITE_BUFS;
+		dfu_ring.queued--;
+
+		puts("#");
+	}
+}
+
+/* Waits until at most @max buffers are queued */
+static int dfu_ring_wait(int max)
+{
+	while (dfu_ring.queued > max && !dfu_ring.ret) {
+		/* The writer thread was stopped */
+		if (uthread_grp_done(dfu_ring.grp_id))
+			return -EIO;
+		uthread_schedule();
+	}
+
+	return dfu_ring.ret;
+}
+
+/* Stops the writer thread, dropping any buffers still queued */
+static void dfu_ring_stop(void)
+{
+	if (dfu_ring.grp_id) {
+		dfu_ring.stop = true;
+		while (!uthread_grp_done(dfu_ring.grp_id))
+			uthread_schedule();
+	}
+
+	dfu_ring.stop = false;
+	dfu_ring.fill = 0;
+	dfu_ring.next = 0;
+	dfu_ring.queued = 0;
+	dfu_ring.ret = 0;
+}
+
+static int dfu_ring_alloc(void)
+{
+	int i;
+
+	if (dfu_ring.buf[0] == dfu_buf)
+		return 0;
+
+	for (i = 1; i < DFU_WRITE_BUFS; i++) {
+		dfu_ring.buf[i] = memalign(CONFIG_SYS_CACHELINE_SIZE,
+					   dfu_buf_size);
+		if (!dfu_ring.buf[i]) {
+			printf("%s: Could not memalign 0x%lx bytes\n",
+			       __func__, dfu_buf_size);
+			while (--i)
+				free(dfu_ring.buf[i]);
+			return -ENOMEM;
+		}
+	}
+	dfu_ring.buf[0] = dfu_buf;
+	if (!dfu_ring.grp_id)
+		dfu_ring.grp_id = uthread_grp_new_id();
+
+	return 0;
+}
+
+static void dfu_ring_free(void)
+{
+	int i;
+
+	dfu_ring_stop();
+	if (!dfu_ring.buf[0])
+		return;
+
+	for (i = 1; i < DFU_WRITE_BUFS; i++)
+		free(dfu_ring.buf[i]);
+	memset(dfu_ring.buf, '\0', sizeof(dfu_ring.buf));
+}
+
 unsigned char *dfu_free_buf(void)
 {
+	if (CONFIG_IS_ENABLED(DFU_ASYNC_WRITE))
+		dfu_ring_free();
 	free(dfu_buf);
 	dfu_buf = NULL;
 	return dfu_buf;
@@ -258,7 +387,49 @@ static char *dfu_get_hash_algo(void)
 	return NULL;
 }
 
-static int dfu_write_buffer_drain(struct dfu_entity *dfu)
+/*
+ * Tells whether the buffer can be written by the writer thread while
+ * dfu_write() goes on with the next one
+ */
+static bool dfu_write_async(void *buf)
+{
+	if (!CONFIG_IS_ENABLED(DFU_ASYNC_WRITE))
+		return false;
+
+	/* f_thor receives straight into dfu_buf, which must stay its own */
+	if (buf >= (void *)dfu_buf && buf < (void *)dfu_buf + dfu_buf_size)
+		return false;
+
+	return !dfu_ring_alloc();
+}
+
+/*
+ * Hands the full buffer to the writer thread and moves on to the next one,
+ * waiting for it to be written out first if all buffers are in use
+ */
+static int dfu_write_buffer_queue(struct dfu_entity *dfu, long w_size)
+{
+	int ret;
+
+	dfu_ring.len[dfu_ring.fill] = w_size;
+	dfu_ring.queued++;
+	if (uthread_grp_done(dfu_ring.grp_id) &&
+	    uthread_create(NULL, dfu_write_thread, dfu, 0, dfu_ring.grp_id))
+		dfu_write_thread(dfu);
+
+	ret = dfu_ring_wait(DFU_WRITE_BUFS - 1);
+	if (ret)
+		return ret;
+
+	dfu_ring.fill = (dfu_ring.fill + 1) % DFU_WRITE_BUFS;
+	dfu->i_buf_start = dfu_ring.buf[dfu_ring.fill];
+	dfu->i_buf_end = dfu->i_buf_start + dfu_get_buf_size();
+	dfu->i_buf = dfu->i_buf_start;
+
+	return 0;
+}
+
+static int dfu_write_buffer_drain(struct dfu_entity *dfu, bool async)
 {
 	long w_size;
 	int ret;
@@ -268,9 +439,15 @@ static int dfu_write_buffer_drain(struct dfu_entity *dfu)
 	if (w_size == 0)
 		return 0;
 
-	if (dfu_hash_algo)
-		dfu_hash_algo->hash_update(dfu_hash_algo, &dfu->crc,
-					   dfu->i_buf_start, w_size, 0);
+	if (async)
+		return dfu_write_buffer_queue(dfu, w_size);
+
+	/* Buffers handed to the writer thread go first */
+	if (CONFIG_IS_ENABLED(DFU_ASYNC_WRITE)) {
+		ret = dfu_ring_wait(0);
+		if (ret)
+			return ret;
+	}
 
 	ret = dfu->write_medium(dfu, dfu->offset, dfu->i_buf_start, &w_size);
 	if (ret)
@@ -289,6 +466,9 @@ static int dfu_write_buffer_drain(struct dfu_entity *dfu)
 
 void dfu_transaction_cleanup(struct dfu_entity *dfu)
 {
+	if (CONFIG_IS_ENABLED(DFU_ASYNC_WRITE))
+		dfu_ring_stop();
+
 	/* clear everything */
 	dfu->crc = 0;
 	dfu->offset = 0;
@@ -334,7 +514,7 @@ int dfu_flush(struct dfu_entity *dfu, void *buf, int size, int blk_seq_num)
 {
 	int ret = 0;
 
-	ret = dfu_write_buffer_drain(dfu);
+	ret = dfu_write_buffer_drain(dfu, false);
 	if (ret)
 		return ret;
 
@@ -354,6 +534,7 @@ int dfu_flush(struct dfu_entity *dfu, void *buf, int size, int blk_seq_num)
 
 int dfu_write(struct dfu_entity *dfu, void *buf, int size, int blk_seq_num)
 {
+	bool async;
 	int ret;
 
 	debug("%s: name: %s buf: 0x%p size: 0x%x p_num: 0x%x offset: 0x%llx bufoffset: 0x%lx\n",
@@ -388,9 +569,18 @@ int dfu_write(struct dfu_entity *dfu, void *buf, int size, int blk_seq_num)
 	/* handle rollover */
 	dfu->i_blk_seq_num = (dfu->i_blk_seq_num + 1) & 0xffff;
 
+	/* report a failed write of an earlier buffer */
+	ret = CONFIG_IS_ENABLED(DFU_ASYNC_WRITE) ? dfu_ring.ret : 0;
+	if (ret) {
+		dfu_transaction_cleanup(dfu);
+		dfu_error_callback(dfu, "DFU write error");
+		return ret;
+	}
+	async = dfu_write_async(buf);
+
 	/* flush buffer if overflow */
 	if ((dfu->i_buf + size) > dfu->i_buf_end) {
-		ret = dfu_write_buffer_drain(dfu);
+		ret = dfu_write_buffer_drain(dfu, async);
 		if (ret) {
 			dfu_transaction_cleanup(dfu);
 			dfu_error_callback(dfu, "DFU write error");
@@ -410,9 +600,14 @@ int dfu_write(struct dfu_entity *dfu, void *buf, int size, int blk_seq_num)
 	memcpy(dfu->i_buf, buf, size);
 	dfu->i_buf += size;
 
+	/* update the hash while the data is in the cache */
+	if (dfu_hash_algo && size)
+		dfu_hash_algo->hash_update(dfu_hash_algo, &dfu->crc, buf,
+					   size, 0);
+
 	/* if end or if buffer full flush */
 	if (size == 0 || (dfu->i_buf + size) > dfu->i_buf_end) {
-		ret = dfu_write_buffer_drain(dfu);
+		ret = dfu_write_buffer_drain(dfu, async && size);
 		if (ret) {
 			dfu_transaction_cleanup(dfu);
 			dfu_error_callback(dfu, "DFU write error");
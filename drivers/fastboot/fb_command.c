@@ -31,6 +31,11 @@ static u32 fastboot_bytes_received;
  */
 static u32 fastboot_bytes_expected;
 
+/**
+ * fastboot_streamed - the current download is flashed while it arrives
+ */
+static bool fastboot_streamed;
+
 static void okay(char *, char *);
 static void getvar(char *, char *);
 static void download(char *, char *);
@@ -44,6 +49,7 @@ static void oem_partconf(char *, char *);
 static void oem_bootbus(char *, char *);
 static void oem_console(char *, char *);
 static void oem_board(char *, char *);
+static void oem_stream(char *, char *);
 static void run_ucmd(char *, char *);
 static void run_acmd(char *, char *);
 
@@ -119,6 +125,10 @@ static const struct {
 		.command = "oem board",
 		.dispatch = CONFIG_IS_ENABLED(FASTBOOT_OEM_BOARD, (oem_board), (NULL))
 	},
+	[FASTBOOT_COMMAND_OEM_STREAM] = {
+		.command = "oem stream",
+		.dispatch = CONFIG_IS_ENABLED(FASTBOOT_MMC_STREAM, (oem_stream), (NULL))
+	},
 	[FASTBOOT_COMMAND_UCMD] = {
 		.command = "UCmd",
 		.dispatch = CONFIG_IS_ENABLED(FASTBOOT_UUU_SUPPORT, (run_ucmd), (NULL))
@@ -228,6 +238,7 @@ static void getvar(char *cmd_parameter, char *response)
  */
 static void download(char *cmd_parameter, char *response)
 {
+	u32 limit = fastboot_buf_size;
 	char *tmp;
 
 	if (!cmd_parameter) {
@@ -240,14 +251,20 @@ static void download(char *cmd_parameter, char *response)
 		fastboot_fail("Expected nonzero image size", response);
 		return;
 	}
+	fastboot_streamed = IS_ENABLED(CONFIG_FASTBOOT_MMC_STREAM) &&
+			    fastboot_mmc_stream_limit();
+	if (fastboot_streamed)
+		limit = fastboot_mmc_stream_limit();
 	/*
 	 * Nothing to download yet. Response is of the form:
 	 * [DATA|FAIL]$cmd_parameter
 	 *
 	 * where cmd_parameter is an 8 digit hexadecimal number
 	 */
-	if (fastboot_bytes_expected > fastboot_buf_size) {
+	if (fastboot_bytes_expected > limit) {
 		fastboot_fail(cmd_parameter, response);
+	} else if (fastboot_streamed && fastboot_mmc_stream_start(response)) {
+		fastboot_streamed = false;
 	} else {
 		printf("Starting download of %d bytes\n",
 		       fastboot_bytes_expected);
@@ -293,9 +310,18 @@ void fastboot_data_download(const void *fastboot_data,
 			      response);
 		return;
 	}
-	/* Download data to fastboot_buf_addr */
-	memcpy(fastboot_buf_addr + fastboot_bytes_received,
-	       fastboot_data, fastboot_data_len);
+	if (IS_ENABLED(CONFIG_FASTBOOT_MMC_STREAM) && fastboot_streamed) {
+		/* Flash data, collecting it at fastboot_buf_addr */
+		if (fastboot_mmc_stream_write(fastboot_data,
+					      fastboot_data_len)) {
+			fastboot_fail("Flashing failed", response);
+			return;
+		}
+	} else {
+		/* Download data to fastboot_buf_addr */
+		memcpy(fastboot_buf_addr + fastboot_bytes_received,
+		       fastboot_data, fastboot_data_len);
+	}
 
 	pre_dot_num = fastboot_bytes_received / BYTES_PER_DOT;
 	fastboot_bytes_received += fastboot_data_len;
@@ -321,7 +347,8 @@ void fastboot_data_complete(char *response)
 	/* Download complete. Respond with "OKAY" */
 	fastboot_okay(NULL, response);
 	printf("\ndownloading of %d bytes finished\n", fastboot_bytes_received);
-	image_size = fastboot_bytes_received;
+	/* A download which was flashed is not kept in memory */
+	image_size = fastboot_streamed ? 0 : fastboot_bytes_received;
 	env_set_hex("filesize", image_size);
 	fastboot_bytes_expected = 0;
 	fastboot_bytes_received = 0;
@@ -338,6 +365,12 @@ void fastboot_data_complete(char *response)
  */
 static void __maybe_unused flash(char *cmd_parameter, char *response)
 {
+	if (IS_ENABLED(CONFIG_FASTBOOT_MMC_STREAM) && fastboot_streamed) {
+		fastboot_streamed = false;
+		fastboot_mmc_stream_finish(cmd_parameter, response);
+		return;
+	}
+
 	if (IS_ENABLED(CONFIG_FASTBOOT_FLASH_MMC))
 		fastboot_mmc_flash_write(cmd_parameter, fastboot_buf_addr,
 					 image_size, response);
@@ -581,3 +614,15 @@ static void __maybe_unused oem_board(char *cmd_parameter, char *response)
 {
 	fastboot_oem_board(cmd_parameter, (void *)fastboot_buf_addr, image_size, response);
 }
+
+/**
+ * oem_stream() - Execute the OEM stream command
+ *
+ * @cmd_parameter: Pointer to partition name, or NULL to stop streaming
+ * @response: Pointer to fastboot response buffer
+ */
+static void __maybe_unused oem_stream(char *cmd_parameter, char *response)
+{
+	fastboot_streamed = false;
+	fastboot_mmc_stream_arm(cmd_parameter, response);
+}
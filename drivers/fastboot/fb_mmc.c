@@ -14,6 +14,7 @@
 #include <log.h>
 #include <part.h>
 #include <mmc.h>
+#include <time.h>
 #include <div64.h>
 #include <linux/compat.h>
 #include <android_image.h>
@@ -636,6 +637,240 @@ void fastboot_mmc_flash_write(const char *cmd, void *download_buffer,
 	}
 }
 
+#ifdef CONFIG_FASTBOOT_MMC_STREAM
+/* Largest download size which fits the 8 hex digits of "download" */
+#define FB_MMC_STREAM_MAX_DOWNLOAD	0xfffff000
+
+/**
+ * struct fb_mmc_stream - image flashed while it is downloaded
+ *
+ * @part: partition given to "oem stream", empty if streaming is off
+ * @dev_desc: device holding the partition
+ * @info: the partition
+ * @sparse_priv: private data of @sparse
+ * @sparse: storage for a sparse image
+ * @ss: sparse image being written, or NULL for a raw image
+ * @begun: true once the image format is known
+ * @err: first error, 0 if none
+ * @len: number of bytes waiting in the download buffer
+ * @blk: next block to write of a raw image
+ * @start: time the download started, in ms
+ * @end: time the last data arrived, in ms
+ * @write: time spent writing during the download, in ms
+ */
+struct fb_mmc_stream {
+	char part[FASTBOOT_COMMAND_LEN];
+	struct blk_desc *dev_desc;
+	struct disk_partition info;
+	struct fb_mmc_sparse sparse_priv;
+	struct sparse_storage sparse;
+	struct sparse_stream *ss;
+	bool begun;
+	int err;
+	ulong len;
+	lbaint_t blk;
+	ulong start;
+	ulong end;
+	ulong write;
+};
+
+static struct fb_mmc_stream fb_stream;
+
+static ulong fb_mmc_stream_buf_size(void)
+{
+	ulong size = min_t(ulong, fastboot_buf_size,
+			   CONFIG_FASTBOOT_MMC_STREAM_BUF_SIZE);
+
+	return rounddown(size, fb_stream.info.blksz);
+}
+
+static void fb_mmc_stream_abort(void)
+{
+	if (fb_stream.ss)
+		sparse_stream_finish(fb_stream.ss);
+	fb_stream.ss = NULL;
+}
+
+/* Write out what is in the download buffer, padding the end if @last */
+static int fb_mmc_stream_flush(bool last)
+{
+	struct fb_mmc_stream *st = &fb_stream;
+	void *buf = fastboot_buf_addr;
+	ulong blksz = st->info.blksz;
+	ulong start = get_timer(0);
+	lbaint_t blkcnt;
+	int ret = 0;
+
+	if (!st->len)
+		return 0;
+
+	if (!st->begun) {
+		st->begun = true;
+		if (st->len >= sizeof(sparse_header_t) &&
+		    is_sparse_image(buf)) {
+			printf("Flashing sparse image at offset " LBAFU "\n",
+			       st->info.start);
+			st->ss = sparse_stream_init(&st->sparse);
+			if (!st->ss)
+				return -ENOMEM;
+		} else {
+			puts("Flashing Raw Image\n");
+		}
+	}
+
+	if (st->ss) {
+		ret = sparse_stream_write(st->ss, buf, st->len);
+	} else {
+		blkcnt = last ? DIV_ROUND_UP(st->len, blksz) : st->len / blksz;
+		if (st->blk + blkcnt > st->info.start + st->info.size) {
+			pr_err("too large for partition: '%s'\n", st->part);
+			ret = -ENOSPC;
+		} else {
+			memset(buf + st->len, '\0', blkcnt * blksz - st->len);
+			if (fb_mmc_blk_write(st->dev_desc, st->blk, blkcnt,
+					     buf) != blkcnt)
+				ret = -EIO;
+			st->blk += blkcnt;
+		}
+	}
+	st->len = 0;
+	st->write += get_timer(start);
+
+	return ret;
+}
+
+void fastboot_mmc_stream_arm(const char *cmd, char *response)
+{
+	struct blk_desc *dev_desc;
+	struct disk_partition info;
+
+	fb_mmc_stream_abort();
+	fb_stream.part[0] = '\0';
+
+	if (!cmd || !*cmd) {
+		puts("Downloads are kept in memory\n");
+		fastboot_okay(NULL, response);
+		return;
+	}
+
+	if (fastboot_mmc_get_part_info(cmd, &dev_desc, &info, response) < 0)
+		return;
+
+	strlcpy(fb_stream.part, cmd, sizeof(fb_stream.part));
+	printf("Downloads are flashed to '%s' while they arrive\n", cmd);
+	fastboot_okay(NULL, response);
+}
+
+u32 fastboot_mmc_stream_limit(void)
+{
+	return fb_stream.part[0] ? FB_MMC_STREAM_MAX_DOWNLOAD : 0;
+}
+
+int fastboot_mmc_stream_start(char *response)
+{
+	struct fb_mmc_stream *st = &fb_stream;
+	int ret;
+
+	fb_mmc_stream_abort();
+
+	ret = fastboot_mmc_get_part_info(st->part, &st->dev_desc, &st->info,
+					 response);
+	if (ret < 0)
+		return ret;
+	if (!fb_mmc_stream_buf_size()) {
+		fastboot_fail("download buffer too small", response);
+		return -ENOSPC;
+	}
+
+	st->sparse_priv.dev_desc = st->dev_desc;
+	st->sparse.blksz = st->info.blksz;
+	st->sparse.start = st->info.start;
+	st->sparse.size = st->info.size;
+	st->sparse.write = fb_mmc_sparse_write;
+	st->sparse.reserve = fb_mmc_sparse_reserve;
+	st->sparse.mssg = fastboot_fail;
+	st->sparse.priv = &st->sparse_priv;
+
+	st->begun = false;
+	st->err = 0;
+	st->len = 0;
+	st->blk = st->info.start;
+	st->start = get_timer(0);
+	st->end = st->start;
+	st->write = 0;
+
+	return 0;
+}
+
+int fastboot_mmc_stream_write(const void *data, u32 len)
+{
+	struct fb_mmc_stream *st = &fb_stream;
+	ulong size = fb_mmc_stream_buf_size();
+	ulong n;
+
+	while (len && !st->err) {
+		n = min_t(ulong, size - st->len, len);
+		memcpy(fastboot_buf_addr + st->len, data, n);
+		st->len += n;
+		data += n;
+		len -= n;
+		if (st->len == size)
+			st->err = fb_mmc_stream_flush(false);
+	}
+	st->end = get_timer(0);
+
+	return st->err;
+}
+
+void fastboot_mmc_stream_finish(const char *cmd, char *response)
+{
+	struct fb_mmc_stream *st = &fb_stream;
+	ulong rx, drain;
+	int ret;
+
+	/*
+	 * The partition is only named now, after most of the image was
+	 * written, so all that can be done is to report the mismatch
+	 */
+	if (strcmp(cmd, st->part)) {
+		pr_err("image was flashed to '%s'\n", st->part);
+		fastboot_fail("image was flashed to another partition",
+			      response);
+		return;
+	}
+
+	drain = get_timer(0);
+	ret = st->err;
+	if (!ret)
+		ret = fb_mmc_stream_flush(true);
+	if (st->ss && sparse_stream_finish(st->ss) && !ret)
+		ret = -EIO;
+	st->ss = NULL;
+	drain = get_timer(drain);
+	rx = st->end - st->start - st->write;
+
+	switch (ret) {
+	case 0:
+		break;
+	case -ENOSPC:
+		fastboot_fail("too large for partition", response);
+		return;
+	case -EINVAL:
+		fastboot_fail("invalid sparse image", response);
+		return;
+	default:
+		pr_err("failed writing to device %d\n", st->dev_desc->devnum);
+		fastboot_fail("failed writing to device", response);
+		return;
+	}
+
+	printf("........ flashed '%s': receive %lu ms, write %lu ms, drain %lu ms\n",
+	       st->part, rx, st->write, drain);
+	fastboot_response("OKAY", response, "rx %lums wr %lums drain %lums",
+			  rx, st->write, drain);
+}
+#endif
+
 /**
  * fastboot_mmc_flash_erase() - Erase eMMC for fastboot
  *
@@ -403,10 +403,16 @@ static int sb_eth_start(struct udevice *dev)
 
 	debug("eth_sandbox: Start\n");
 
-	priv->recv_packets = 0;
+	/*
+	 * Drop the packets which are waiting, but keep those which the network
+	 * stack still holds, since they come back through free_pkt() later
+	 */
+	priv->recv_packets = priv->recv_held;
 	for (int i = 0; i < PKTBUFSRX; i++) {
-		priv->recv_packet_buffer[i] = net_rx_packets[i];
-		priv->recv_packet_length[i] = 0;
+		if (!priv->recv_held)
+			priv->recv_packet_buffer[i] = net_rx_packets[i];
+		if (i >= priv->recv_held)
+			priv->recv_packet_length[i] = 0;
 	}
 
 	return 0;
@@ -433,12 +439,14 @@ static int sb_eth_recv(struct udevice *dev, int flags, uchar **packetp)
 		skip_timeout = false;
 	}
 
-	if (priv->recv_packets) {
-		int lcl_recv_packet_length = priv->recv_packet_length[0];
+	if (priv->recv_held < priv->recv_packets) {
+		int lcl_recv_packet_length =
+			priv->recv_packet_length[priv->recv_held];
 
 		debug("eth_sandbox: received packet[%d], %d waiting\n",
-		      lcl_recv_packet_length, priv->recv_packets - 1);
-		*packetp = priv->recv_packet_buffer[0];
+		      lcl_recv_packet_length,
+		      priv->recv_packets - priv->recv_held - 1);
+		*packetp = priv->recv_packet_buffer[priv->recv_held++];
 		return lcl_recv_packet_length;
 	}
 	return 0;
@@ -447,23 +455,36 @@ static int sb_eth_recv(struct udevice *dev, int flags, uchar **packetp)
 static int sb_eth_free_pkt(struct udevice *dev, uchar *packet, int length)
 {
 	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	uchar *buf;
 	int i;
 
-	if (!priv->recv_packets)
+	/* Packets may come back in any order, or after a restart */
+	for (i = 0; i < priv->recv_held; i++)
+		if (priv->recv_packet_buffer[i] == packet)
+			break;
+	if (i == priv->recv_held)
 		return 0;
 
+	/* Move the buffer behind the waiting packets, where it is free */
+	buf = priv->recv_packet_buffer[i];
+	--priv->recv_held;
 	--priv->recv_packets;
-	for (i = 0; i < priv->recv_packets; i++) {
+	for (; i < priv->recv_packets; i++) {
+		priv->recv_packet_buffer[i] = priv->recv_packet_buffer[i + 1];
 		priv->recv_packet_length[i] = priv->recv_packet_length[i + 1];
-		memcpy(priv->recv_packet_buffer[i],
-		       priv->recv_packet_buffer[i + 1],
-		       priv->recv_packet_length[i + 1]);
 	}
+	priv->recv_packet_buffer[priv->recv_packets] = buf;
 	priv->recv_packet_length[priv->recv_packets] = 0;
 
 	return 0;
 }
 
+static int sb_eth_max_held_pkts(struct udevice *dev)
+{
+	/* Leave room for the replies queued by the tx handler */
+	return PKTBUFSRX / 2;
+}
+
 static void sb_eth_stop(struct udevice *dev)
 {
 	debug("eth_sandbox: Stop\n");
@@ -485,6 +506,7 @@ static const struct eth_ops sb_eth_ops = {
 	.send			= sb_eth_send,
 	.recv			= sb_eth_recv,
 	.free_pkt		= sb_eth_free_pkt,
+	.max_held_pkts		= sb_eth_max_held_pkts,
 	.stop			= sb_eth_stop,
 	.write_hwaddr		= sb_eth_write_hwaddr,
 };
@@ -15,9 +15,10 @@
 #include <time.h>
 #include <dm/device-internal.h>
 #include <linux/compat.h>
+#include <linux/log2.h>
 #include "nvme.h"
 
-#define NVME_Q_DEPTH		2
+#define NVME_Q_DEPTH		64
 #define NVME_AQ_DEPTH		2
 #define NVME_SQ_SIZE(depth)	(depth * sizeof(struct nvme_command))
 #define NVME_CQ_SIZE(depth)	(depth * sizeof(struct nvme_completion))
@@ -25,7 +26,6 @@
 				      ARCH_DMA_MINALIGN)
 #define ADMIN_TIMEOUT		60
 #define IO_TIMEOUT		30
-#define MAX_PRP_POOL		512
 
 static int nvme_wait_csts(struct nvme_dev *dev, u32 mask, u32 val)
 {
@@ -44,68 +44,92 @@ static int nvme_wait_csts(struct nvme_dev *dev, u32 mask, u32 val)
 	return -ETIME;
 }
 
-static int nvme_setup_prps(struct nvme_dev *dev, u64 *prp2,
-			   int total_len, u64 dma_addr)
+/**
+ * nvme_prp_list() - get the PRP list of a command
+ *
+ * Each I/O command ID has a page of its own, so that commands in flight do
+ * not share a list. Synchronous commands use the page after the last ID.
+ *
+ * @dev:	NVMe device
+ * @id:		command ID, or dev->q_depth for synchronous commands
+ * Return: PRP list, one page long
+ */
+static u64 *nvme_prp_list(struct nvme_dev *dev, int id)
+{
+	return dev->prp_pool + (ulong)id * (dev->page_size >> 3);
+}
+
+/**
+ * nvme_setup_prps() - set up the PRP entries for a transfer
+ *
+ * @dev:	NVMe device
+ * @prp_list:	PRP list to fill in, see nvme_prp_list()
+ * @prp2:	returns the second PRP entry of the command
+ * @total_len:	length of the transfer in bytes, at most the MDTS
+ * @dma_addr:	address of the transfer
+ */
+static void nvme_setup_prps(struct nvme_dev *dev, u64 *prp_list, u64 *prp2,
+			    int total_len, u64 dma_addr)
 {
 	u32 page_size = dev->page_size;
 	int offset = dma_addr & (page_size - 1);
-	u64 *prp_pool;
-	int length = total_len;
+	int length = total_len - (page_size - offset);
 	int i, nprps;
-	u32 prps_per_page = page_size >> 3;
-	u32 num_pages;
-
-	length -= (page_size - offset);
 
 	if (length <= 0) {
 		*prp2 = 0;
-		return 0;
+		return;
 	}
 
-	if (length)
-		dma_addr += (page_size - offset);
-
+	dma_addr += page_size - offset;
 	if (length <= page_size) {
 		*prp2 = dma_addr;
-		return 0;
+		return;
 	}
 
+	/* The MDTS is limited so that the list never needs chaining */
 	nprps = DIV_ROUND_UP(length, page_size);
-	num_pages = DIV_ROUND_UP(nprps - 1, prps_per_page - 1);
-
-	if (nprps > dev->prp_entry_num) {
-		free(dev->prp_pool);
-		/*
-		 * Always increase in increments of pages.  It doesn't waste
-		 * much memory and reduces the number of allocations.
-		 */
-		dev->prp_pool = memalign(page_size, num_pages * page_size);
-		if (!dev->prp_pool) {
-			printf("Error: malloc prp_pool fail\n");
-			return -ENOMEM;
-		}
-		dev->prp_entry_num = num_pages * (prps_per_page - 1) + 1;
-	}
-
-	prp_pool = dev->prp_pool;
-	i = 0;
-	while (nprps) {
-		if ((i == (prps_per_page - 1)) && nprps > 1) {
-			*(prp_pool + i) = cpu_to_le64((ulong)prp_pool +
-					page_size);
-			i = 0;
-			prp_pool += page_size;
-		}
-		*(prp_pool + i++) = cpu_to_le64(dma_addr);
+	for (i = 0; i < nprps; i++) {
+		prp_list[i] = cpu_to_le64(dma_addr);
 		dma_addr += page_size;
-		nprps--;
 	}
-	*prp2 = (ulong)dev->prp_pool;
+	*prp2 = (ulong)prp_list;
 
-	flush_dcache_range((ulong)dev->prp_pool, (ulong)dev->prp_pool +
-			   num_pages * page_size);
+	flush_dcache_range((ulong)prp_list,
+			   ALIGN((ulong)(prp_list + nprps), ARCH_DMA_MINALIGN));
+}
 
-	return 0;
+/**
+ * nvme_setup_data() - describe the data buffer of a read or write command
+ *
+ * With SGLs a single descriptor in the command covers the buffer, whatever
+ * its length. Otherwise a PRP list is needed when it spans over two pages.
+ *
+ * @dev:	NVMe device
+ * @c:		command to fill in
+ * @id:		command ID, see nvme_prp_list()
+ * @buf:	data buffer
+ * @len:	length of @buf in bytes
+ */
+static void nvme_setup_data(struct nvme_dev *dev, struct nvme_command *c,
+			    int id, void *buf, u32 len)
+{
+	u64 prp2;
+
+	if (dev->sgl) {
+		c->rw.flags = NVME_CMD_PSDT_SGL_METABUF;
+		c->rw.sgl.addr = cpu_to_le64((ulong)buf);
+		c->rw.sgl.length = cpu_to_le32(len);
+		memset(c->rw.sgl.rsvd, '\0', sizeof(c->rw.sgl.rsvd));
+		c->rw.sgl.type = NVME_SGL_FMT_DATA_DESC;
+		dev->stats.sgl_cmds++;
+		return;
+	}
+
+	c->rw.flags = NVME_CMD_PSDT_PRP;
+	nvme_setup_prps(dev, nvme_prp_list(dev, id), &prp2, len, (ulong)buf);
+	c->rw.prp1 = cpu_to_le64((ulong)buf);
+	c->rw.prp2 = cpu_to_le64(prp2);
 }
 
 static __le16 nvme_get_cmd_id(void)
@@ -141,6 +165,7 @@ static void nvme_submit_cmd(struct nvme_queue *nvmeq, struct nvme_command *cmd)
 {
 	struct nvme_ops *ops;
 	u16 tail = nvmeq->sq_tail;
+	u64 start = get_ticks();
 
 	memcpy(&nvmeq->sq_cmds[tail], cmd, sizeof(*cmd));
 	flush_dcache_range((ulong)&nvmeq->sq_cmds[tail],
@@ -149,13 +174,15 @@ static void nvme_submit_cmd(struct nvme_queue *nvmeq, struct nvme_command *cmd)
 	ops = (struct nvme_ops *)nvmeq->dev->udev->driver->ops;
 	if (ops && ops->submit_cmd) {
 		ops->submit_cmd(nvmeq, cmd);
-		return;
+	} else {
+		if (++tail == nvmeq->q_depth)
+			tail = 0;
+		writel(tail, nvmeq->q_db);
+		nvmeq->sq_tail = tail;
 	}
 
-	if (++tail == nvmeq->q_depth)
-		tail = 0;
-	writel(tail, nvmeq->q_db);
-	nvmeq->sq_tail = tail;
+	if (nvmeq->qid != NVME_ADMIN_Q)
+		nvmeq->dev->stats.submit += get_ticks() - start;
 }
 
 static int nvme_submit_sync_cmd(struct nvme_queue *nvmeq,
@@ -168,11 +195,13 @@ static int nvme_submit_sync_cmd(struct nvme_queue *nvmeq,
 	u16 status;
 	ulong start_time;
 	ulong timeout_us = timeout * 100000;
+	u64 start;
 
 	cmd->common.command_id = nvme_get_cmd_id();
 	nvme_submit_cmd(nvmeq, cmd);
 
 	start_time = timer_get_us();
+	start = get_ticks();
 
 	for (;;) {
 		status = nvme_read_completion_status(nvmeq, head);
@@ -182,6 +211,8 @@ static int nvme_submit_sync_cmd(struct nvme_queue *nvmeq,
 		    >= timeout_us)
 			return -ETIMEDOUT;
 	}
+	if (nvmeq->qid != NVME_ADMIN_Q)
+		nvmeq->dev->stats.wait += get_ticks() - start;
 
 	ops = (struct nvme_ops *)nvmeq->dev->udev->driver->ops;
 	if (ops && ops->complete_cmd)
@@ -317,6 +348,7 @@ static int nvme_shutdown_ctrl(struct nvme_dev *dev)
 
 static void nvme_free_queue(struct nvme_queue *nvmeq)
 {
+	free(nvmeq->async);
 	free((void *)nvmeq->cqes);
 	free(nvmeq->sq_cmds);
 	free(nvmeq);
@@ -620,6 +652,7 @@ static int nvme_setup_io_queues(struct nvme_dev *dev)
 
 static int nvme_get_info_from_identify(struct nvme_dev *dev)
 {
+	struct nvme_ops *ops = (struct nvme_ops *)dev->udev->driver->ops;
 	struct nvme_id_ctrl *ctrl;
 	int ret;
 	int shift = NVME_CAP_MPSMIN(dev->cap) + 12;
@@ -662,6 +695,14 @@ static int nvme_get_info_from_identify(struct nvme_dev *dev)
 		 */
 		dev->max_transfer_shift = 20;
 	}
+	/* Keep the PRP list of a command within one page */
+	dev->max_transfer_shift = min_t(u32, dev->max_transfer_shift,
+					ilog2(dev->page_size >> 3) +
+					ilog2(dev->page_size));
+
+	/* The submit_cmd hook of Apple controllers only passes on PRPs */
+	dev->sgl = (le32_to_cpu(ctrl->sgls) & NVME_CTRL_SGLS_MASK) &&
+		   !(ops && ops->submit_cmd);
 
 	free(ctrl);
 	return 0;
@@ -746,10 +787,10 @@ static ulong nvme_blk_rw(struct udevice *udev, lbaint_t blknr,
 {
 	struct nvme_ns *ns = dev_get_priv(udev);
 	struct nvme_dev *dev = ns->dev;
+	struct nvme_stats *stats = &dev->stats;
 	struct nvme_command c;
 	struct blk_desc *desc = dev_get_uclass_plat(udev);
 	int status;
-	u64 prp2;
 	u64 total_len = blkcnt << desc->log2blksz;
 	u64 temp_len = total_len;
 	uintptr_t temp_buffer = (uintptr_t)buffer;
@@ -757,19 +798,12 @@ static ulong nvme_blk_rw(struct udevice *udev, lbaint_t blknr,
 	u64 slba = blknr;
 	u16 lbas = 1 << (dev->max_transfer_shift - ns->lba_shift);
 	u64 total_lbas = blkcnt;
+	u64 start;
+	u32 len;
 
-	flush_dcache_range((unsigned long)buffer,
-			   (unsigned long)buffer + total_len);
-
+	memset(&c, 0, sizeof(c));
 	c.rw.opcode = read ? nvme_cmd_read : nvme_cmd_write;
-	c.rw.flags = 0;
 	c.rw.nsid = cpu_to_le32(ns->ns_id);
-	c.rw.control = 0;
-	c.rw.dsmgmt = 0;
-	c.rw.reftag = 0;
-	c.rw.apptag = 0;
-	c.rw.appmask = 0;
-	c.rw.metadata = 0;
 
 	while (total_lbas) {
 		if (total_lbas < lbas) {
@@ -778,27 +812,36 @@ static ulong nvme_blk_rw(struct udevice *udev, lbaint_t blknr,
 		} else {
 			total_lbas -= lbas;
 		}
+		len = (u32)lbas << ns->lba_shift;
 
-		if (nvme_setup_prps(dev, &prp2,
-				    lbas << ns->lba_shift, temp_buffer))
-			return -EIO;
+		start = get_ticks();
+		nvme_setup_data(dev, &c, dev->q_depth, (void *)temp_buffer,
+				len);
 		c.rw.slba = cpu_to_le64(slba);
 		slba += lbas;
 		c.rw.length = cpu_to_le16(lbas - 1);
-		c.rw.prp1 = cpu_to_le64(temp_buffer);
-		c.rw.prp2 = cpu_to_le64(prp2);
+		stats->setup += get_ticks() - start;
+
+		/* Clean each chunk just before the device needs it */
+		start = get_ticks();
+		flush_dcache_range(temp_buffer, temp_buffer + len);
+		stats->cache += get_ticks() - start;
+
+		stats->cmds++;
 		status = nvme_submit_sync_cmd(dev->queues[NVME_IO_Q],
 				&c, NULL, IO_TIMEOUT);
 		if (status)
 			break;
-		temp_len -= (u32)lbas << ns->lba_shift;
-		temp_buffer += lbas << ns->lba_shift;
+		if (read) {
+			start = get_ticks();
+			invalidate_dcache_range(temp_buffer,
+						temp_buffer + len);
+			stats->cache += get_ticks() - start;
+		}
+		temp_len -= len;
+		temp_buffer += len;
 	}
 
-	if (read)
-		invalidate_dcache_range((unsigned long)buffer,
-					(unsigned long)buffer + total_len);
-
 	return (total_len - temp_len) >> desc->log2blksz;
 }
 
@@ -814,9 +857,209 @@ static ulong nvme_blk_write(struct udevice *udev, lbaint_t blknr,
 	return nvme_blk_rw(udev, blknr, blkcnt, (void *)buffer, false);
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+/**
+ * nvme_blk_issue() - submit commands for the rest of a block request
+ *
+ * Commands are submitted for as much of the request as the I/O queue has
+ * room for. req->priv[0] counts the blocks submitted so far and
+ * req->priv[1] the commands not yet completed.
+ *
+ * @udev:	Block device
+ * @req:	Request to continue
+ */
+static void nvme_blk_issue(struct udevice *udev, struct blk_req *req)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct nvme_dev *dev = ns->dev;
+	struct nvme_stats *stats = &dev->stats;
+	struct nvme_queue *nvmeq = dev->queues[NVME_IO_Q];
+	u32 max_lbas = 1U << (dev->max_transfer_shift - ns->lba_shift);
+	struct nvme_async_cmd *cmd;
+	struct nvme_command c;
+	u64 start;
+	void *buf;
+	u32 lbas;
+	int id;
+
+	while (req->priv[0] < req->blkcnt &&
+	       nvmeq->async_count < nvmeq->q_depth - 1) {
+		for (id = 0; nvmeq->async[id].busy; id++)
+			;
+		cmd = &nvmeq->async[id];
+		lbas = min_t(lbaint_t, max_lbas, req->blkcnt - req->priv[0]);
+		buf = req->buffer + (req->priv[0] << ns->lba_shift);
+		cmd->buf = buf;
+		cmd->len = lbas << ns->lba_shift;
+
+		start = get_ticks();
+		memset(&c, 0, sizeof(c));
+		c.rw.opcode = req->write ? nvme_cmd_write : nvme_cmd_read;
+		c.rw.command_id = cpu_to_le16(id);
+		c.rw.nsid = cpu_to_le32(ns->ns_id);
+		c.rw.slba = cpu_to_le64(req->start + req->priv[0]);
+		c.rw.length = cpu_to_le16(lbas - 1);
+		nvme_setup_data(dev, &c, id, buf, cmd->len);
+		stats->setup += get_ticks() - start;
+
+		start = get_ticks();
+		flush_dcache_range((ulong)buf, (ulong)buf + cmd->len);
+		stats->cache += get_ticks() - start;
+
+		cmd->req = req;
+		cmd->start = get_timer(0);
+		cmd->busy = true;
+		stats->cmds++;
+		nvme_submit_cmd(nvmeq, &c);
+		nvmeq->async_count++;
+		req->priv[0] += lbas;
+		req->priv[1]++;
+	}
+}
+
+/* Stop submitting commands for a failed request */
+static void nvme_blk_fail(struct nvme_ns *ns, struct blk_req *req, int err)
+{
+	if (req->result >= 0)
+		req->result = err;
+	req->priv[0] = req->blkcnt;
+	if (ns->partial == req)
+		ns->partial = NULL;
+}
+
+static int nvme_blk_submit(struct udevice *udev, struct blk_req *req)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct nvme_dev *dev = ns->dev;
+	struct nvme_queue *nvmeq = dev->queues[NVME_IO_Q];
+	struct nvme_ops *ops;
+
+	/* These hooks expect a single command in flight */
+	ops = (struct nvme_ops *)dev->udev->driver->ops;
+	if (ops && (ops->submit_cmd || ops->complete_cmd))
+		return -ENOSYS;
+
+	if (!nvmeq->async) {
+		nvmeq->async = calloc(nvmeq->q_depth, sizeof(*nvmeq->async));
+		if (!nvmeq->async)
+			return -ENOMEM;
+	}
+	if (ns->partial || nvmeq->async_count == nvmeq->q_depth - 1)
+		return -EBUSY;
+
+	req->result = req->blkcnt;
+	req->priv[0] = 0;
+	req->priv[1] = 0;
+	nvme_blk_issue(udev, req);
+	if (req->priv[0] < req->blkcnt)
+		ns->partial = req;
+
+	return 0;
+}
+
+/**
+ * nvme_blk_timeout() - give up on commands which took too long
+ *
+ * The commands stay busy in case their completions arrive later, but their
+ * request fails.
+ *
+ * @ns:		Namespace whose request is checked
+ * Return: request which has no more commands in flight, or NULL if none
+ */
+static struct blk_req *nvme_blk_timeout(struct nvme_ns *ns)
+{
+	struct nvme_queue *nvmeq = ns->dev->queues[NVME_IO_Q];
+	struct nvme_async_cmd *cmd;
+	struct blk_req *req;
+	int id;
+
+	for (id = 0; id < nvmeq->q_depth; id++) {
+		cmd = &nvmeq->async[id];
+		req = cmd->req;
+		if (!req || get_timer(cmd->start) < IO_TIMEOUT * 1000)
+			continue;
+		printf("ERROR: command %d timed out\n", id);
+		cmd->req = NULL;
+		nvme_blk_fail(ns, req, -ETIMEDOUT);
+		if (!--req->priv[1])
+			return req;
+	}
+
+	return NULL;
+}
+
+static struct blk_req *nvme_blk_poll(struct udevice *udev)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct nvme_stats *stats = &ns->dev->stats;
+	struct nvme_queue *nvmeq = ns->dev->queues[NVME_IO_Q];
+	u16 head = nvmeq->cq_head;
+	struct nvme_async_cmd *cmd;
+	struct blk_req *req;
+	u64 start;
+	u16 status, id;
+
+	if (!nvmeq->async_count)
+		return NULL;
+	start = get_ticks();
+	status = nvme_read_completion_status(nvmeq, head);
+	if ((status & 0x01) != nvmeq->cq_phase) {
+		stats->wait += get_ticks() - start;
+		return nvme_blk_timeout(ns);
+	}
+
+	id = readw(&nvmeq->cqes[head].command_id);
+	if (++head == nvmeq->q_depth) {
+		head = 0;
+		nvmeq->cq_phase = !nvmeq->cq_phase;
+	}
+	writel(head, nvmeq->q_db + nvmeq->dev->db_stride);
+	nvmeq->cq_head = head;
+
+	if (id >= nvmeq->q_depth || !nvmeq->async[id].busy) {
+		printf("ERROR: unexpected completion for command %d\n", id);
+		return NULL;
+	}
+	cmd = &nvmeq->async[id];
+	cmd->busy = false;
+	nvmeq->async_count--;
+	req = cmd->req;
+	if (!req)
+		return NULL;
+	cmd->req = NULL;
+
+	status >>= 1;
+	if (status) {
+		printf("ERROR: status = %x, command %d\n", status, id);
+		nvme_blk_fail(ns, req, -EIO);
+	} else if (!req->write) {
+		start = get_ticks();
+		invalidate_dcache_range((ulong)cmd->buf,
+					(ulong)cmd->buf + cmd->len);
+		stats->cache += get_ticks() - start;
+	}
+
+	/* The queue has room again for a request which did not fit */
+	if (ns->partial) {
+		nvme_blk_issue(udev, ns->partial);
+		if (ns->partial->priv[0] == ns->partial->blkcnt)
+			ns->partial = NULL;
+	}
+
+	if (--req->priv[1] || req->priv[0] < req->blkcnt)
+		return NULL;
+
+	return req;
+}
+#endif
+
 static const struct blk_ops nvme_blk_ops = {
 	.read	= nvme_blk_read,
 	.write	= nvme_blk_write,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.submit	= nvme_blk_submit,
+	.poll	= nvme_blk_poll,
+#endif
 };
 
 U_BOOT_DRIVER(nvme_blk) = {
@@ -860,15 +1103,6 @@ int nvme_init(struct udevice *udev)
 		goto free_queue;
 	}
 
-	/* Allocate after the page size is known */
-	ndev->prp_pool = memalign(ndev->page_size, MAX_PRP_POOL);
-	if (!ndev->prp_pool) {
-		ret = -ENOMEM;
-		printf("Error: %s: Out of memory!\n", udev->name);
-		goto free_nvme;
-	}
-	ndev->prp_entry_num = MAX_PRP_POOL >> 3;
-
 	ret = nvme_setup_io_queues(ndev);
 	if (ret) {
 		log_debug("Unable to setup I/O queues(err=%dE)\n", ret);
@@ -877,6 +1111,20 @@ int nvme_init(struct udevice *udev)
 
 	nvme_get_info_from_identify(ndev);
 
+	/*
+	 * Allocate once the MDTS and SGL support are known: a page of PRP
+	 * list for each I/O command ID, plus one for synchronous commands
+	 */
+	if (!ndev->sgl && !ndev->prp_pool) {
+		ndev->prp_pool = memalign(ndev->page_size,
+					  (ndev->q_depth + 1) * ndev->page_size);
+		if (!ndev->prp_pool) {
+			ret = -ENOMEM;
+			printf("Error: %s: Out of memory!\n", udev->name);
+			goto free_queue;
+		}
+	}
+
 	/* Create a blk device for each namespace */
 
 	id = memalign(ndev->page_size, sizeof(struct nvme_id_ns));
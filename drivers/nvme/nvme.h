@@ -82,6 +82,9 @@ enum {
 	NVME_CTRL_ONCS_WRITE_UNCORRECTABLE	= 1 << 1,
 	NVME_CTRL_ONCS_DSM			= 1 << 2,
 	NVME_CTRL_VWC_PRESENT			= 1 << 0,
+	NVME_CTRL_SGLS_MASK			= 3 << 0,
+	NVME_CTRL_SGLS_BYTE_ALIGNED		= 1 << 0,
+	NVME_CTRL_SGLS_DWORD_ALIGNED		= 2 << 0,
 };
 
 struct nvme_lbaf {
@@ -235,6 +238,18 @@ struct nvme_common_command {
 	__le32			cdw10[6];
 };
 
+/* SGL Data Block descriptor, which describes a contiguous buffer */
+struct nvme_sgl_desc {
+	__le64			addr;
+	__le32			length;
+	__u8			rsvd[3];
+	__u8			type;
+};
+
+enum {
+	NVME_SGL_FMT_DATA_DESC		= 0x00,
+};
+
 struct nvme_rw_command {
 	__u8			opcode;
 	__u8			flags;
@@ -242,8 +257,13 @@ struct nvme_rw_command {
 	__le32			nsid;
 	__u64			rsvd2;
 	__le64			metadata;
-	__le64			prp1;
-	__le64			prp2;
+	union {
+		struct {
+			__le64	prp1;
+			__le64	prp2;
+		};
+		struct nvme_sgl_desc sgl;
+	};
 	__le64			slba;
 	__le16			length;
 	__le16			control;
@@ -253,6 +273,12 @@ struct nvme_rw_command {
 	__le16			appmask;
 };
 
+/* Data pointer of a command (PSDT field of the flags) */
+enum {
+	NVME_CMD_PSDT_PRP		= 0 << 6,
+	NVME_CMD_PSDT_SGL_METABUF	= 1 << 6,
+};
+
 enum {
 	NVME_RW_LR			= 1 << 15,
 	NVME_RW_FUA			= 1 << 14,
@@ -594,6 +620,19 @@ enum {
 	NVME_CSTS_SHST_MASK	= 3 << 2,
 };
 
+/*
+ * Time spent on the I/O command path, in get_ticks() units. Waiting covers
+ * polling for completions, i.e. mostly the time the device takes.
+ */
+struct nvme_stats {
+	u64 cmds;		/* I/O commands submitted */
+	u64 sgl_cmds;		/* of which with an SGL */
+	u64 setup;		/* building commands and PRP lists */
+	u64 cache;		/* cache maintenance of data buffers */
+	u64 submit;		/* copying commands and ringing doorbells */
+	u64 wait;		/* polling for completions */
+};
+
 /* Represents an NVM Express device. Each nvme_dev is a PCI function. */
 struct nvme_dev {
 	struct udevice *udev;
@@ -618,9 +657,10 @@ struct nvme_dev {
 	u32 stripe_size;
 	u32 page_size;
 	u8 vwc;
-	u64 *prp_pool;
-	u32 prp_entry_num;
+	bool sgl;		/* describe data by SGL rather than PRP list */
+	u64 *prp_pool;		/* a page of PRP list for each command ID */
 	u32 nn;
+	struct nvme_stats stats;
 };
 
 /* Admin queue and a single I/O queue. */
@@ -630,6 +670,18 @@ enum nvme_queue_id {
 	NVME_Q_NUM,
 };
 
+/*
+ * A command submitted for a block request by nvme_blk_submit(), which
+ * stays busy until its completion arrives or it times out
+ */
+struct nvme_async_cmd {
+	struct blk_req *req;	/* request, or NULL once it timed out */
+	ulong start;		/* get_timer() value when submitted */
+	void *buf;		/* data buffer of this command */
+	u32 len;		/* length of @buf in bytes */
+	bool busy;
+};
+
 /*
  * An NVM Express queue. Each device has at least two (one for admin
  * commands and one for I/O commands).
@@ -647,6 +699,8 @@ struct nvme_queue {
 	u16 qid;
 	u8 cq_phase;
 	u8 cqe_seen;
+	struct nvme_async_cmd *async;	/* q_depth commands, by command ID */
+	u16 async_count;		/* number of busy commands in @async */
 	unsigned long cmdid_data[];
 };
 
@@ -662,6 +716,7 @@ struct nvme_ns {
 	int devnum;
 	int lba_shift;
 	u8 flbas;
+	struct blk_req *partial;	/* request not fully submitted yet */
 };
 
 struct nvme_ops {
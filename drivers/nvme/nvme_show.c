@@ -8,6 +8,8 @@
 #include <errno.h>
 #include <memalign.h>
 #include <nvme.h>
+#include <time.h>
+#include <linux/math64.h>
 #include "nvme.h"
 
 static void print_optional_admin_cmd(u16 oacs, int devnum)
@@ -143,3 +145,26 @@ free_ctrl:
 	free(ctrl);
 	return ret;
 }
+
+static void print_ticks(const char *name, u64 ticks, u64 cmds)
+{
+	printf("\t%-22s %12llu", name, ticks);
+	if (cmds)
+		printf(" (%llu per command)", div64_u64(ticks, cmds));
+	printf("\n");
+}
+
+void nvme_print_stats(struct udevice *udev)
+{
+	struct nvme_dev *dev = dev_get_priv(udev);
+	struct nvme_stats *stats = &dev->stats;
+
+	printf("%s: %llu I/O commands, %llu with SGL, up to %u bytes\n",
+	       udev->name, stats->cmds, stats->sgl_cmds,
+	       1U << dev->max_transfer_shift);
+	printf("\tTicks at %lu Hz:\n", get_tbclk());
+	print_ticks("Command setup:", stats->setup, stats->cmds);
+	print_ticks("Cache maintenance:", stats->cache, stats->cmds);
+	print_ticks("Submission:", stats->submit, stats->cmds);
+	print_ticks("Waiting:", stats->wait, stats->cmds);
+}
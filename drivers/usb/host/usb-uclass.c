@@ -174,6 +174,54 @@ int usb_get_max_xfer_size(struct usb_device *udev, size_t *size)
 	return ops->get_max_xfer_size(bus, size);
 }
 
+int usb_alloc_streams(struct usb_device *udev, unsigned long *pipes,
+		      int num_pipes, int num_streams)
+{
+	struct udevice *bus = udev->controller_dev;
+	struct dm_usb_ops *ops = usb_get_ops(bus);
+
+	if (!ops->alloc_streams)
+		return -ENOSYS;
+
+	return ops->alloc_streams(bus, udev, pipes, num_pipes, num_streams);
+}
+
+int usb_free_streams(struct usb_device *udev, unsigned long *pipes,
+		     int num_pipes)
+{
+	struct udevice *bus = udev->controller_dev;
+	struct dm_usb_ops *ops = usb_get_ops(bus);
+
+	if (!ops->free_streams)
+		return -ENOSYS;
+
+	return ops->free_streams(bus, udev, pipes, num_pipes);
+}
+
+int usb_submit_stream_msg(struct usb_device *udev, unsigned long pipe,
+			  unsigned int stream_id, void *buffer, int length)
+{
+	struct udevice *bus = udev->controller_dev;
+	struct dm_usb_ops *ops = usb_get_ops(bus);
+
+	if (!ops->submit_stream)
+		return -ENOSYS;
+
+	return ops->submit_stream(bus, udev, pipe, stream_id, buffer, length);
+}
+
+int usb_poll_stream_msg(struct usb_device *udev, unsigned long pipe,
+			unsigned int stream_id, int *actual_length)
+{
+	struct udevice *bus = udev->controller_dev;
+	struct dm_usb_ops *ops = usb_get_ops(bus);
+
+	if (!ops->poll_stream)
+		return -ENOSYS;
+
+	return ops->poll_stream(bus, udev, pipe, stream_id, actual_length);
+}
+
 #if CONFIG_IS_ENABLED(UTHREAD)
 static struct uthread_mutex mutex = UTHREAD_MUTEX_INITIALIZER;
 #endif
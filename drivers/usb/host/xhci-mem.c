@@ -160,9 +160,13 @@ static void xhci_free_virt_devices(struct xhci_ctrl *ctrl)
 
 		ctrl->dcbaa->dev_context_ptrs[slot_id] = 0;
 
-		for (i = 0; i < 31; ++i)
+		for (i = 0; i < 31; ++i) {
 			if (virt_dev->eps[i].ring)
 				xhci_ring_free(ctrl, virt_dev->eps[i].ring);
+			if (virt_dev->eps[i].stream_info)
+				xhci_free_stream_info(ctrl,
+						virt_dev->eps[i].stream_info);
+		}
 
 		if (virt_dev->in_ctx)
 			xhci_free_container_ctx(ctrl, virt_dev->in_ctx);
@@ -326,6 +330,7 @@ struct xhci_ring *xhci_ring_alloc(struct xhci_ctrl *ctrl, unsigned int num_segs,
 	if (num_segs == 0)
 		return ring;
 
+	ring->num_segs = num_segs;
 	ring->first_seg = xhci_segment_alloc(ctrl);
 	BUG_ON(!ring->first_seg);
 
@@ -354,6 +359,71 @@ struct xhci_ring *xhci_ring_alloc(struct xhci_ctrl *ctrl, unsigned int num_segs,
 	return ring;
 }
 
+/**
+ * Allocate a linear primary stream context array and a transfer ring for
+ * each stream but stream 0, which is reserved. See section 4.12.2.
+ *
+ * @ctrl	host controller data structure
+ * @num_streams	number of streams, a power of two
+ * Return:	pointer to the stream info
+ */
+struct xhci_stream_info *xhci_alloc_stream_info(struct xhci_ctrl *ctrl,
+						unsigned int num_streams)
+{
+	struct xhci_stream_info *stream_info;
+	struct xhci_ring *ring;
+	unsigned int i;
+	u64 addr;
+
+	stream_info = malloc(sizeof(struct xhci_stream_info));
+	BUG_ON(!stream_info);
+	stream_info->num_streams = num_streams;
+	stream_info->streams = calloc(num_streams, sizeof(struct xhci_stream));
+	BUG_ON(!stream_info->streams);
+
+	stream_info->ctx_array = xhci_malloc(num_streams *
+					     sizeof(struct xhci_stream_ctx));
+	stream_info->ctx_array_dma = xhci_dma_map(ctrl, stream_info->ctx_array,
+				num_streams * sizeof(struct xhci_stream_ctx));
+
+	for (i = 1; i < num_streams; i++) {
+		ring = xhci_ring_alloc(ctrl, 1, true);
+		stream_info->streams[i].ring = ring;
+
+		addr = xhci_trb_virt_to_dma(ring->first_seg, ring->enqueue);
+		stream_info->ctx_array[i].stream_ring =
+			cpu_to_le64(addr | SCT_FOR_CTX(SCT_PRI_TR) |
+				    ring->cycle_state);
+	}
+	xhci_flush_cache((uintptr_t)stream_info->ctx_array,
+			 num_streams * sizeof(struct xhci_stream_ctx));
+
+	return stream_info;
+}
+
+/**
+ * Free the stream context array and stream rings of an endpoint
+ *
+ * @ctrl	host controller data structure
+ * @stream_info	stream info to be freed
+ * Return:	none
+ */
+void xhci_free_stream_info(struct xhci_ctrl *ctrl,
+			   struct xhci_stream_info *stream_info)
+{
+	unsigned int i;
+
+	for (i = 1; i < stream_info->num_streams; i++)
+		xhci_ring_free(ctrl, stream_info->streams[i].ring);
+
+	xhci_dma_unmap(ctrl, stream_info->ctx_array_dma,
+		       stream_info->num_streams *
+		       sizeof(struct xhci_stream_ctx));
+	free(stream_info->ctx_array);
+	free(stream_info->streams);
+	free(stream_info);
+}
+
 /**
  * Set up the scratchpad buffer array and scratchpad buffers
  *
@@ -375,12 +375,13 @@ static u32 xhci_td_remainder(struct xhci_ctrl *ctrl, int transferred,
  *
  * @param udev		pointer to the USB device structure
  * @param ep_index	index of the endpoint
+ * @param stream_id	stream of the TRBs, 0 if the endpoint has no streams
  * @param start_cycle	cycle flag of the first TRB
  * @param start_trb	pionter to the first TRB
  * Return: none
  */
 static void giveback_first_trb(struct usb_device *udev, int ep_index,
-				int start_cycle,
+				unsigned int stream_id, int start_cycle,
 				struct xhci_generic_trb *start_trb)
 {
 	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
@@ -398,7 +399,7 @@ static void giveback_first_trb(struct usb_device *udev, int ep_index,
 
 	/* Ringing EP doorbell here */
 	xhci_writel(&ctrl->dba->doorbell[udev->slot_id],
-				DB_VALUE(ep_index, 0));
+				DB_VALUE(ep_index, stream_id));
 
 	return;
 }
@@ -450,15 +451,124 @@ static int event_ready(struct xhci_ctrl *ctrl)
 }
 
 /**
- * Waits for a specific type of event and returns it. Discards unexpected
- * events. Caller *must* call xhci_acknowledge_event() after it is finished
- * processing the event, and must not access the returned pointer afterwards.
+ * Converts the completion code of a transfer event to a USB_ST_... status
+ *
+ * @param comp	completion code
+ * Return: status of the transfer
+ */
+static unsigned long xhci_comp_to_status(xhci_comp_code comp)
+{
+	switch (comp) {
+	case COMP_SUCCESS:
+	case COMP_SHORT_TX:
+		return 0;
+	case COMP_STALL:
+		return USB_ST_STALLED;
+	case COMP_DB_ERR:
+	case COMP_TRB_ERR:
+		return USB_ST_BUF_ERR;
+	case COMP_BABBLE:
+		return USB_ST_BABBLE_DET;
+	default:
+		return 0x80;  /* USB_ST_TOO_LAZY_TO_MAKE_A_NEW_MACRO */
+	}
+}
+
+/**
+ * Records a transfer event which belongs to a transfer queued on a stream.
+ * Transfers on several streams can be in flight at once, so their events
+ * may turn up while waiting for anything else.
+ *
+ * @param ctrl	Host controller data structure
+ * @param event	transfer event TRB
+ * Return: true if the event was for a stream transfer, else false
+ */
+static bool xhci_stream_event(struct xhci_ctrl *ctrl, union xhci_trb *event)
+{
+	u32 field = le32_to_cpu(event->trans_event.flags);
+	u64 trb = le64_to_cpu(event->trans_event.buffer);
+	struct xhci_virt_device *virt_dev;
+	struct xhci_stream_info *stream_info;
+	struct xhci_stream *stream;
+	xhci_comp_code comp;
+	unsigned int i;
+	int ep_index;
+	int len;
+
+	virt_dev = ctrl->devs[TRB_TO_SLOT_ID(field)];
+	ep_index = TRB_TO_EP_INDEX(field);
+	if (!virt_dev || ep_index < 0 || ep_index >= MAX_EP_CTX_NUM)
+		return false;
+	stream_info = virt_dev->eps[ep_index].stream_info;
+	if (!stream_info)
+		return false;
+
+	comp = GET_COMP_CODE(le32_to_cpu(event->trans_event.transfer_len));
+	len = EVENT_TRB_LEN(le32_to_cpu(event->trans_event.transfer_len));
+	for (i = 1; i < stream_info->num_streams; i++) {
+		struct xhci_segment *seg;
+
+		stream = &stream_info->streams[i];
+		seg = stream->ring->first_seg;
+		if (!stream->buffer || stream->done || trb < seg->dma ||
+		    trb >= seg->dma + SEGMENT_SIZE)
+			continue;
+
+		/* A short packet part way through, the TD goes on */
+		if (trb != stream->last_trb && comp == COMP_SHORT_TX) {
+			stream->act_len -= len;
+			return true;
+		}
+
+		stream->act_len = min(stream->act_len, stream->act_len - len);
+		stream->status = xhci_comp_to_status(comp);
+		stream->done = true;
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Discards an event that nobody waits for
+ *
+ * @param event	event TRB
+ * Return: none
+ */
+static void xhci_skip_event(union xhci_trb *event)
+{
+	trb_type type;
+
+	type = TRB_FIELD_TO_TYPE(le32_to_cpu(event->event_cmd.flags));
+	if (type == TRB_PORT_STATUS)
+	/* TODO: remove this once enumeration has been reworked */
+		/*
+		 * Port status change events always have a
+		 * successful completion code
+		 */
+		BUG_ON(GET_COMP_CODE(
+			le32_to_cpu(event->generic.field[2])) !=
+							COMP_SUCCESS);
+	else
+		printf("Unexpected XHCI event TRB, skipping... "
+			"(%08x %08x %08x %08x)\n",
+			le32_to_cpu(event->generic.field[0]),
+			le32_to_cpu(event->generic.field[1]),
+			le32_to_cpu(event->generic.field[2]),
+			le32_to_cpu(event->generic.field[3]));
+}
+
+/**
+ * Waits for a specific type of event for up to timeout_ms milliseconds
  *
  * @param ctrl		Host controller data structure
  * @param expected	TRB type expected from Event TRB
- * Return: pointer to event trb
+ * @param timeout_ms	time to wait for the event
+ * Return: pointer to event trb, NULL on timeout
  */
-union xhci_trb *xhci_wait_for_event(struct xhci_ctrl *ctrl, trb_type expected)
+static union xhci_trb *xhci_wait_for_event_ms(struct xhci_ctrl *ctrl,
+					      trb_type expected,
+					      unsigned long timeout_ms)
 {
 	trb_type type;
 	unsigned long ts = get_timer(0);
@@ -470,29 +580,18 @@ union xhci_trb *xhci_wait_for_event(struct xhci_ctrl *ctrl, trb_type expected)
 			continue;
 
 		type = TRB_FIELD_TO_TYPE(le32_to_cpu(event->event_cmd.flags));
+		if (type == TRB_TRANSFER && xhci_stream_event(ctrl, event)) {
+			xhci_acknowledge_event(ctrl);
+			continue;
+		}
+
 		if (type == expected ||
 		    (expected == TRB_NONE && type != TRB_PORT_STATUS))
 			return event;
 
-		if (type == TRB_PORT_STATUS)
-		/* TODO: remove this once enumeration has been reworked */
-			/*
-			 * Port status change events always have a
-			 * successful completion code
-			 */
-			BUG_ON(GET_COMP_CODE(
-				le32_to_cpu(event->generic.field[2])) !=
-								COMP_SUCCESS);
-		else
-			printf("Unexpected XHCI event TRB, skipping... "
-				"(%08x %08x %08x %08x)\n",
-				le32_to_cpu(event->generic.field[0]),
-				le32_to_cpu(event->generic.field[1]),
-				le32_to_cpu(event->generic.field[2]),
-				le32_to_cpu(event->generic.field[3]));
-
+		xhci_skip_event(event);
 		xhci_acknowledge_event(ctrl);
-	} while (get_timer(ts) < XHCI_TIMEOUT);
+	} while (get_timer(ts) < timeout_ms);
 
 	if (expected == TRB_TRANSFER)
 		return NULL;
@@ -502,6 +601,21 @@ union xhci_trb *xhci_wait_for_event(struct xhci_ctrl *ctrl, trb_type expected)
 	return NULL;
 }
 
+/**
+ * Waits for a specific type of event and returns it. Discards unexpected
+ * events. Events of transfers on streams are recorded for xhci_stream_poll().
+ * Caller *must* call xhci_acknowledge_event() after it is finished processing
+ * the event, and must not access the returned pointer afterwards.
+ *
+ * @param ctrl		Host controller data structure
+ * @param expected	TRB type expected from Event TRB
+ * Return: pointer to event trb
+ */
+union xhci_trb *xhci_wait_for_event(struct xhci_ctrl *ctrl, trb_type expected)
+{
+	return xhci_wait_for_event_ms(ctrl, expected, XHCI_TIMEOUT);
+}
+
 /*
  * Send reset endpoint command for given endpoint. This recovers from a
  * halted endpoint (e.g. due to a stall error).
@@ -598,43 +712,33 @@ static void abort_td(struct usb_device *udev, int ep_index)
 static void record_transfer_result(struct usb_device *udev,
 				   union xhci_trb *event, int length)
 {
+	xhci_comp_code comp;
+
 	udev->act_len = min(length, length -
 		(int)EVENT_TRB_LEN(le32_to_cpu(event->trans_event.transfer_len)));
 
-	switch (GET_COMP_CODE(le32_to_cpu(event->trans_event.transfer_len))) {
-	case COMP_SUCCESS:
-		BUG_ON(udev->act_len != length);
-		/* fallthrough */
-	case COMP_SHORT_TX:
-		udev->status = 0;
-		break;
-	case COMP_STALL:
-		udev->status = USB_ST_STALLED;
-		break;
-	case COMP_DB_ERR:
-	case COMP_TRB_ERR:
-		udev->status = USB_ST_BUF_ERR;
-		break;
-	case COMP_BABBLE:
-		udev->status = USB_ST_BABBLE_DET;
-		break;
-	default:
-		udev->status = 0x80;  /* USB_ST_TOO_LAZY_TO_MAKE_A_NEW_MACRO */
-	}
+	comp = GET_COMP_CODE(le32_to_cpu(event->trans_event.transfer_len));
+	BUG_ON(comp == COMP_SUCCESS && udev->act_len != length);
+	udev->status = xhci_comp_to_status(comp);
 }
 
 /**** Bulk and Control transfer methods ****/
 /**
- * Queues up the BULK Request
+ * Queues up the TRBs of a BULK Request and rings the doorbell
  *
  * @param udev		pointer to the USB device structure
  * @param pipe		contains the DIR_IN or OUT , devnum
+ * @param stream_id	stream to queue on, 0 if the endpoint has no streams
  * @param length	length of the buffer
  * @param buffer	buffer to be read/written based on the request
- * Return: returns 0 if successful else -1 on failure
+ * @param buf_64	bus address of the buffer
+ * @param last_trbp	returns the bus address of the last TRB, whose
+ *			completion event finishes the request
+ * Return: returns 0 if successful else error code on failure
  */
-int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
-			int length, void *buffer)
+static int xhci_queue_bulk_tx(struct usb_device *udev, unsigned long pipe,
+			      unsigned int stream_id, int length, void *buffer,
+			      u64 buf_64, dma_addr_t *last_trbp)
 {
 	int num_trbs = 0;
 	struct xhci_generic_trb *start_trb;
@@ -648,7 +752,7 @@ int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
 	struct xhci_virt_device *virt_dev;
 	struct xhci_ep_ctx *ep_ctx;
 	struct xhci_ring *ring;		/* EP transfer ring */
-	union xhci_trb *event;
+	struct xhci_stream_info *stream_info;
 
 	int running_total, trb_buff_len;
 	bool more_trbs_coming = true;
@@ -656,14 +760,11 @@ int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
 	u64 addr;
 	int ret;
 	u32 trb_fields[4];
-	u64 buf_64 = xhci_dma_map(ctrl, buffer, length);
 	dma_addr_t last_transfer_trb_addr;
-	int available_length;
 
-	debug("dev=%p, pipe=%lx, buffer=%p, length=%d\n",
-		udev, pipe, buffer, length);
+	debug("dev=%p, pipe=%lx, stream=%u, buffer=%p, length=%d\n",
+		udev, pipe, stream_id, buffer, length);
 
-	available_length = length;
 	ep_index = usb_pipe_ep_index(pipe);
 	virt_dev = ctrl->devs[slot_id];
 
@@ -677,10 +778,23 @@ int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
 	 * the next transfer. It is the responsibility of the upper layer to
 	 * have dealt with whatever caused the error.
 	 */
-	if ((le32_to_cpu(ep_ctx->ep_info) & EP_STATE_MASK) == EP_STATE_HALTED)
+	stream_info = virt_dev->eps[ep_index].stream_info;
+	if ((le32_to_cpu(ep_ctx->ep_info) & EP_STATE_MASK) == EP_STATE_HALTED) {
+		/* Resuming needs the dequeue pointer of every stream */
+		if (stream_info)
+			return -EPIPE;
 		reset_ep(udev, ep_index);
+	}
 
-	ring = virt_dev->eps[ep_index].ring;
+	if (stream_info) {
+		if (!stream_id || stream_id >= stream_info->num_streams)
+			return -EINVAL;
+		ring = stream_info->streams[stream_id].ring;
+	} else {
+		if (stream_id)
+			return -EINVAL;
+		ring = virt_dev->eps[ep_index].ring;
+	}
 	if (!ring)
 		return -EINVAL;
 
@@ -708,6 +822,10 @@ int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
 		running_total += TRB_MAX_BUFF_SIZE;
 	}
 
+	/* The TD must fit on the ring, see xhci_get_max_xfer_size() */
+	if (num_trbs > ring->num_segs * (TRBS_PER_SEGMENT - 1))
+		return -EINVAL;
+
 	/*
 	 * XXX: Calling routine prepare_ring() called in place of
 	 * prepare_trasfer() as there in 'Linux' since we are not
@@ -801,10 +919,44 @@ int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
 		schedule();
 	} while (running_total < length);
 
-	giveback_first_trb(udev, ep_index, start_cycle, start_trb);
+	giveback_first_trb(udev, ep_index, stream_id, start_cycle, start_trb);
+	*last_trbp = last_transfer_trb_addr;
+
+	return 0;
+}
+
+/**
+ * Queues up the BULK Request and waits for it to finish
+ *
+ * @param udev		pointer to the USB device structure
+ * @param pipe		contains the DIR_IN or OUT , devnum
+ * @param length	length of the buffer
+ * @param buffer	buffer to be read/written based on the request
+ * Return: returns 0 if successful else -1 on failure
+ */
+int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
+			int length, void *buffer)
+{
+	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
+	int ep_index = usb_pipe_ep_index(pipe);
+	u64 buf_64 = xhci_dma_map(ctrl, buffer, length);
+	dma_addr_t last_transfer_trb_addr;
+	int available_length = length;
+	union xhci_trb *event;
+	u32 field;
+	int ret;
+
+	ret = xhci_queue_bulk_tx(udev, pipe, 0, length, buffer, buf_64,
+				 &last_transfer_trb_addr);
+	if (ret) {
+		xhci_dma_unmap(ctrl, buf_64, length);
+		return ret;
+	}
 
 again:
-	event = xhci_wait_for_event(ctrl, TRB_TRANSFER);
+	/* Large TDs may take a while, allow for a device doing 1MB/s */
+	event = xhci_wait_for_event_ms(ctrl, TRB_TRANSFER,
+				       XHCI_TIMEOUT + length / 1000);
 	if (!event) {
 		debug("XHCI bulk transfer timed out, aborting...\n");
 		abort_td(udev, ep_index);
@@ -822,7 +974,7 @@ again:
 	}
 
 	field = le32_to_cpu(event->trans_event.flags);
-	BUG_ON(TRB_TO_SLOT_ID(field) != slot_id);
+	BUG_ON(TRB_TO_SLOT_ID(field) != udev->slot_id);
 	BUG_ON(TRB_TO_EP_INDEX(field) != ep_index);
 
 	record_transfer_result(udev, event, available_length);
@@ -833,6 +985,119 @@ again:
 	return (udev->status != USB_ST_NOT_PROC) ? 0 : -1;
 }
 
+/**
+ * Finds the state of a stream on the endpoint of a pipe
+ *
+ * @param udev		pointer to the USB device structure
+ * @param pipe		bulk pipe of the endpoint
+ * @param stream_id	stream ID, from 1
+ * Return: pointer to the stream, NULL if the endpoint has no such stream
+ */
+static struct xhci_stream *xhci_get_stream(struct usb_device *udev,
+					   unsigned long pipe,
+					   unsigned int stream_id)
+{
+	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
+	struct xhci_virt_device *virt_dev = ctrl->devs[udev->slot_id];
+	struct xhci_stream_info *stream_info;
+
+	stream_info = virt_dev->eps[usb_pipe_ep_index(pipe)].stream_info;
+	if (!stream_info || !stream_id ||
+	    stream_id >= stream_info->num_streams)
+		return NULL;
+
+	return &stream_info->streams[stream_id];
+}
+
+/**
+ * Queues up a BULK Request on a stream, without waiting for it to finish.
+ * Only one request may be in flight on each stream.
+ *
+ * @param udev		pointer to the USB device structure
+ * @param pipe		contains the DIR_IN or OUT , devnum
+ * @param stream_id	stream to queue on, from 1
+ * @param length	length of the buffer
+ * @param buffer	buffer to be read/written based on the request
+ * Return: returns 0 if successful else error code on failure
+ */
+int xhci_stream_tx(struct usb_device *udev, unsigned long pipe,
+		   unsigned int stream_id, int length, void *buffer)
+{
+	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
+	struct xhci_stream *stream;
+	dma_addr_t last_trb;
+	u64 buf_64;
+	int ret;
+
+	stream = xhci_get_stream(udev, pipe, stream_id);
+	if (!stream)
+		return -EINVAL;
+	if (stream->buffer)
+		return -EBUSY;
+
+	buf_64 = xhci_dma_map(ctrl, buffer, length);
+	ret = xhci_queue_bulk_tx(udev, pipe, stream_id, length, buffer, buf_64,
+				 &last_trb);
+	if (ret) {
+		xhci_dma_unmap(ctrl, buf_64, length);
+		return ret;
+	}
+
+	stream->buffer = buffer;
+	stream->buf_64 = buf_64;
+	stream->length = length;
+	stream->last_trb = last_trb;
+	stream->act_len = length;
+	stream->status = 0;
+	stream->done = false;
+
+	return 0;
+}
+
+/**
+ * Checks whether a BULK Request queued by xhci_stream_tx() has finished,
+ * handling all events which are ready without waiting for more.
+ *
+ * @param udev		pointer to the USB device structure
+ * @param pipe		contains the DIR_IN or OUT , devnum
+ * @param stream_id	stream the request was queued on
+ * @param actual_length	returns the number of bytes transferred
+ * Return: 0 if the request finished, -EINPROGRESS if it is still in
+ *	   flight, -EPIPE if the endpoint stalled, other error code on failure
+ */
+int xhci_stream_poll(struct usb_device *udev, unsigned long pipe,
+		     unsigned int stream_id, int *actual_length)
+{
+	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
+	struct xhci_stream *stream;
+	union xhci_trb *event;
+	trb_type type;
+
+	stream = xhci_get_stream(udev, pipe, stream_id);
+	if (!stream || !stream->buffer)
+		return -EINVAL;
+
+	while (!stream->done && event_ready(ctrl)) {
+		event = ctrl->event_ring->dequeue;
+		type = TRB_FIELD_TO_TYPE(le32_to_cpu(event->event_cmd.flags));
+		if (type != TRB_TRANSFER || !xhci_stream_event(ctrl, event))
+			xhci_skip_event(event);
+		xhci_acknowledge_event(ctrl);
+	}
+	if (!stream->done)
+		return -EINPROGRESS;
+
+	xhci_inval_cache((uintptr_t)stream->buffer, stream->length);
+	xhci_dma_unmap(ctrl, stream->buf_64, stream->length);
+	stream->buffer = NULL;
+	*actual_length = stream->act_len;
+
+	if (stream->status & USB_ST_STALLED)
+		return -EPIPE;
+
+	return stream->status ? -EIO : 0;
+}
+
 /**
  * Queues up the Control Transfer Request
  *
@@ -1006,7 +1271,7 @@ int xhci_ctrl_tx(struct usb_device *udev, unsigned long pipe,
 
 	queue_trb(ctrl, ep_ring, false, trb_fields);
 
-	giveback_first_trb(udev, ep_index, start_cycle, start_trb);
+	giveback_first_trb(udev, ep_index, 0, start_cycle, start_trb);
 
 	event = xhci_wait_for_event(ctrl, TRB_TRANSFER);
 	if (!event)
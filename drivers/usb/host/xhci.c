@@ -35,6 +35,7 @@
 #include <linux/delay.h>
 #include <linux/errno.h>
 #include <linux/iopoll.h>
+#include <linux/log2.h>
 
 static struct descriptor {
 	struct usb_hub_descriptor hub;
@@ -530,8 +531,13 @@ static int xhci_init_ep_contexts_if(struct usb_device *udev,
 		ep_ctx[ep_index] = xhci_get_ep_ctx(ctrl, virt_dev->in_ctx,
 						   ep_index);
 
-		/* Allocate the ep rings */
-		virt_dev->eps[ep_index].ring = xhci_ring_alloc(ctrl, 1, true);
+		/*
+		 * Allocate the ep rings. Bulk rings get several segments, so
+		 * that large transfers fit in a single TD.
+		 */
+		virt_dev->eps[ep_index].ring =
+			xhci_ring_alloc(ctrl, usb_endpoint_xfer_bulk(endpt_desc) ?
+					CONFIG_USB_XHCI_BULK_RING_SEGS : 1, true);
 		if (!virt_dev->eps[ep_index].ring)
 			return -ENOMEM;
 
@@ -1417,17 +1423,179 @@ static int xhci_update_hub_device(struct udevice *dev, struct usb_device *udev)
 static int xhci_get_max_xfer_size(struct udevice *dev, size_t *size)
 {
 	/*
-	 * xHCD allocates one segment which includes 64 TRBs for each endpoint
-	 * and the last TRB in this segment is configured as a link TRB to form
-	 * a TRB ring. Each TRB can transfer up to 64K bytes, however data
-	 * buffers referenced by transfer TRBs shall not span 64KB boundaries.
-	 * Hence the maximum number of TRBs we can use in one transfer is 62.
+	 * xHCD allocates CONFIG_USB_XHCI_BULK_RING_SEGS segments of 64 TRBs
+	 * for each bulk endpoint and the last TRB in each segment is
+	 * configured as a link TRB to chain the segments into a TRB ring.
+	 * Each TRB can transfer up to 64K bytes, however data buffers
+	 * referenced by transfer TRBs shall not span 64KB boundaries. Hence
+	 * the maximum number of TRBs we can use in one transfer is one less
+	 * than the 63 transfer TRBs of each segment.
 	 */
-	*size = (TRBS_PER_SEGMENT - 2) * TRB_MAX_BUFF_SIZE;
+	*size = (CONFIG_USB_XHCI_BULK_RING_SEGS * (TRBS_PER_SEGMENT - 1) - 1) *
+		TRB_MAX_BUFF_SIZE;
 
 	return 0;
 }
 
+/**
+ * Set up the endpoint contexts of some endpoints in the input context and
+ * tell the xHC to drop its copy and add the new one.
+ *
+ * @param udev		pointer to the USB device structure
+ * @param pipes		pipes of the endpoints
+ * @param num_pipes	number of pipes
+ * @param num_streams	number of streams to set up, 0 to go back to a
+ *			single transfer ring
+ * Return: returns the status of the xhci_configure_endpoints
+ */
+static int xhci_config_streams(struct usb_device *udev, unsigned long *pipes,
+			       int num_pipes, unsigned int num_streams)
+{
+	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
+	struct xhci_virt_device *virt_dev = ctrl->devs[udev->slot_id];
+	struct xhci_container_ctx *out_ctx = virt_dev->out_ctx;
+	struct xhci_container_ctx *in_ctx = virt_dev->in_ctx;
+	struct xhci_input_control_ctx *ctrl_ctx;
+	struct xhci_ep_ctx *ep_ctx;
+	struct xhci_ring *ring;
+	u32 changed = 0;
+	int ep_index;
+	u64 deq;
+	int i;
+
+	ctrl_ctx = xhci_get_input_control_ctx(in_ctx);
+	xhci_inval_cache((uintptr_t)out_ctx->bytes, out_ctx->size);
+	xhci_slot_copy(ctrl, in_ctx, out_ctx);
+
+	for (i = 0; i < num_pipes; i++) {
+		ep_index = usb_pipe_ep_index(pipes[i]);
+		xhci_endpoint_copy(ctrl, in_ctx, out_ctx, ep_index);
+		ep_ctx = xhci_get_ep_ctx(ctrl, in_ctx, ep_index);
+
+		ep_ctx->ep_info &= cpu_to_le32(~(EP_MAXPSTREAMS_MASK |
+						 EP_HAS_LSA));
+		if (num_streams) {
+			/* The primary stream array has 2^(MaxPStreams+1) */
+			ep_ctx->ep_info |=
+				cpu_to_le32(EP_MAXPSTREAMS(ilog2(num_streams) - 1) |
+					    EP_HAS_LSA);
+			deq = virt_dev->eps[ep_index].stream_info->ctx_array_dma;
+		} else {
+			ring = virt_dev->eps[ep_index].ring;
+			deq = xhci_trb_virt_to_dma(ring->enq_seg,
+						   ring->enqueue) |
+				ring->cycle_state;
+		}
+		ep_ctx->deq = cpu_to_le64(deq);
+		changed |= 1 << (ep_index + 1);
+	}
+
+	ctrl_ctx->add_flags = cpu_to_le32(SLOT_FLAG | changed);
+	ctrl_ctx->drop_flags = cpu_to_le32(changed);
+
+	return xhci_configure_endpoints(udev, false);
+}
+
+static int xhci_alloc_streams(struct udevice *dev, struct usb_device *udev,
+			      unsigned long *pipes, int num_pipes,
+			      int num_streams)
+{
+	struct xhci_ctrl *ctrl = dev_get_priv(dev);
+	struct xhci_virt_device *virt_dev = ctrl->devs[udev->slot_id];
+	struct xhci_virt_ep *virt_ep;
+	u32 hcc_params;
+	int ret;
+	int i;
+
+	debug("%s: dev='%s', udev=%p, streams=%d\n", __func__, dev->name, udev,
+	      num_streams);
+
+	/* A MaxPSASize of 0 means that streams are not supported */
+	hcc_params = xhci_readl(&ctrl->hccr->cr_hccparams);
+	if (!((hcc_params >> 12) & 0xf) || udev->speed < USB_SPEED_SUPER)
+		return -ENOSYS;
+
+	num_streams = min(num_streams, (int)HCC_MAX_PSA(hcc_params));
+	if (num_streams < 2)
+		return -EINVAL;
+	num_streams = rounddown_pow_of_two(num_streams);
+
+	for (i = 0; i < num_pipes; i++) {
+		virt_ep = &virt_dev->eps[usb_pipe_ep_index(pipes[i])];
+		if (usb_pipetype(pipes[i]) != PIPE_BULK || !virt_ep->ring ||
+		    virt_ep->stream_info)
+			return -EINVAL;
+	}
+
+	for (i = 0; i < num_pipes; i++) {
+		virt_ep = &virt_dev->eps[usb_pipe_ep_index(pipes[i])];
+		virt_ep->stream_info = xhci_alloc_stream_info(ctrl,
+							      num_streams);
+	}
+
+	ret = xhci_config_streams(udev, pipes, num_pipes, num_streams);
+	if (ret) {
+		for (i = 0; i < num_pipes; i++) {
+			virt_ep = &virt_dev->eps[usb_pipe_ep_index(pipes[i])];
+			xhci_free_stream_info(ctrl, virt_ep->stream_info);
+			virt_ep->stream_info = NULL;
+		}
+		return ret;
+	}
+
+	return num_streams;
+}
+
+static int xhci_free_streams(struct udevice *dev, struct usb_device *udev,
+			     unsigned long *pipes, int num_pipes)
+{
+	struct xhci_ctrl *ctrl = dev_get_priv(dev);
+	struct xhci_virt_device *virt_dev = ctrl->devs[udev->slot_id];
+	struct xhci_virt_ep *virt_ep;
+	int ret;
+	int i;
+
+	debug("%s: dev='%s', udev=%p\n", __func__, dev->name, udev);
+	for (i = 0; i < num_pipes; i++) {
+		virt_ep = &virt_dev->eps[usb_pipe_ep_index(pipes[i])];
+		if (!virt_ep->stream_info)
+			return -EINVAL;
+	}
+
+	/* Transfers still queued on the streams are thrown away */
+	ret = xhci_config_streams(udev, pipes, num_pipes, 0);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < num_pipes; i++) {
+		virt_ep = &virt_dev->eps[usb_pipe_ep_index(pipes[i])];
+		xhci_free_stream_info(ctrl, virt_ep->stream_info);
+		virt_ep->stream_info = NULL;
+	}
+
+	return 0;
+}
+
+static int xhci_submit_stream_msg(struct udevice *dev, struct usb_device *udev,
+				  unsigned long pipe, unsigned int stream_id,
+				  void *buffer, int length)
+{
+	debug("%s: dev='%s', udev=%p\n", __func__, dev->name, udev);
+	if (usb_pipetype(pipe) != PIPE_BULK) {
+		printf("non-bulk pipe (type=%lu)", usb_pipetype(pipe));
+		return -EINVAL;
+	}
+
+	return xhci_stream_tx(udev, pipe, stream_id, length, buffer);
+}
+
+static int xhci_poll_stream_msg(struct udevice *dev, struct usb_device *udev,
+				unsigned long pipe, unsigned int stream_id,
+				int *actual_length)
+{
+	return xhci_stream_poll(udev, pipe, stream_id, actual_length);
+}
+
 int xhci_register(struct udevice *dev, struct xhci_hccr *hccr,
 		  struct xhci_hcor *hcor)
 {
@@ -1481,4 +1649,8 @@ struct dm_usb_ops xhci_usb_ops = {
 	.alloc_device = xhci_alloc_device,
 	.update_hub_device = xhci_update_hub_device,
 	.get_max_xfer_size  = xhci_get_max_xfer_size,
+	.alloc_streams = xhci_alloc_streams,
+	.free_streams = xhci_free_streams,
+	.submit_stream = xhci_submit_stream_msg,
+	.poll_stream = xhci_poll_stream_msg,
 };
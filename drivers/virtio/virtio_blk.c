@@ -12,21 +12,65 @@
 #include <virtio_types.h>
 #include <virtio.h>
 #include <virtio_ring.h>
+#include <linux/err.h>
 #include <linux/log2.h>
 #include "virtio_blk.h"
 
+/* Number of requests which can be submitted at once, over all queues */
+#define VIRTIO_BLK_QUEUE_DEPTH	32
+/* Maximum number of queues used with VIRTIO_BLK_F_MQ */
+#define VIRTIO_BLK_MAX_QUEUES	4
+/* Maximum number of data segments in a request */
+#define VIRTIO_BLK_MAX_SEGS	128
+
+/**
+ * struct virtio_blk_slot - a submitted request
+ */
+struct virtio_blk_slot {
+	/**
+	 * @out_hdr - request header, whose address virtqueue_get_buf()
+	 * returns when the request is done
+	 */
+	struct virtio_blk_outhdr out_hdr;
+	/** @status - status written by the device */
+	u8 status;
+	/** @req - block request, or NULL if the slot is free */
+	struct blk_req *req;
+};
+
 /**
  * struct virtio_blk_priv - private data for virtio block device
  */
 struct virtio_blk_priv {
-	/** @virtqueue - virtqueue to process */
-	struct virtqueue *vq;
+	/** @vqs - virtqueues to process */
+	struct virtqueue *vqs[VIRTIO_BLK_MAX_QUEUES];
+	/** @num_vqs - number of virtqueues in @vqs */
+	u32 num_vqs;
 	/** @blksz_shift - log2 of block size divided by 512 */
 	u32 blksz_shift;
+	/** @seg_max - maximum number of data segments in a request */
+	u32 seg_max;
+	/** @size_max - maximum size of a data segment in bytes */
+	u32 size_max;
+	/** @max_blks - maximum number of blocks in a request */
+	lbaint_t max_blks;
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	/** @slots - requests submitted through virtio_blk_submit() */
+	struct virtio_blk_slot slots[VIRTIO_BLK_QUEUE_DEPTH];
+	/** @partial - block request not fully submitted yet */
+	struct blk_req *partial;
+	/** @next_vq - virtqueue for the next request */
+	u32 next_vq;
+	/** @kick - mask of virtqueues with requests not notified yet */
+	u32 kick;
+#endif
 };
 
 static const u32 feature[] = {
+	VIRTIO_BLK_F_SIZE_MAX,
+	VIRTIO_BLK_F_SEG_MAX,
 	VIRTIO_BLK_F_BLK_SIZE,
+	VIRTIO_BLK_F_MQ,
 	VIRTIO_BLK_F_WRITE_ZEROES
 };
 
@@ -61,80 +105,130 @@ static void virtio_blk_init_status_sg(u8 *status, struct virtio_sg *sg)
 	sg->length = sizeof(*status);
 }
 
-static void virtio_blk_init_data_sg(void *buffer, lbaint_t blkcnt, struct virtio_sg *sg)
+/**
+ * virtio_blk_add() - add a read or write request to a virtqueue
+ *
+ * The data is split into segments of at most size_max bytes. The caller
+ * makes sure that there are no more than seg_max of them.
+ *
+ * @dev:	virtio block device
+ * @vq:		virtqueue to use
+ * @out_hdr:	request header to fill in
+ * @status:	place for the device to write the status
+ * @sector:	first sector (of 512 bytes) to transfer
+ * @type:	VIRTIO_BLK_T_IN or VIRTIO_BLK_T_OUT
+ * @buffer:	data
+ * @len:	number of bytes to transfer
+ * Return: 0 if OK, -ENOSPC if the virtqueue is full, other -ve on error
+ */
+static int virtio_blk_add(struct udevice *dev, struct virtqueue *vq,
+			  struct virtio_blk_outhdr *out_hdr, u8 *status,
+			  u64 sector, u32 type, void *buffer, ulong len)
 {
-	sg->addr = buffer;
-	sg->length = blkcnt * 512;
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_sg sg[VIRTIO_BLK_MAX_SEGS + 2];
+	struct virtio_sg *sgs[VIRTIO_BLK_MAX_SEGS + 2];
+	unsigned int n = 0, i;
+
+	virtio_blk_init_header_sg(dev, sector, type, out_hdr, &sg[n++]);
+	while (len) {
+		sg[n].addr = buffer;
+		sg[n].length = min_t(ulong, len, priv->size_max);
+		buffer += sg[n].length;
+		len -= sg[n++].length;
+	}
+	virtio_blk_init_status_sg(status, &sg[n++]);
+	for (i = 0; i < n; i++)
+		sgs[i] = &sg[i];
+
+	if (type == VIRTIO_BLK_T_OUT)
+		return virtqueue_add(vq, sgs, n - 1, 1);
+
+	return virtqueue_add(vq, sgs, 1, n - 1);
 }
 
 static ulong virtio_blk_do_req(struct udevice *dev, u64 sector,
 			       lbaint_t blkcnt, void *buffer, u32 type)
 {
 	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtqueue *vq = priv->vqs[0];
 	struct virtio_blk_outhdr out_hdr;
 	struct virtio_blk_discard_write_zeroes wz_hdr;
-	unsigned int num_out = 0, num_in = 0;
-	struct virtio_sg hdr_sg, wz_sg, data_sg, status_sg;
+	struct virtio_sg hdr_sg, wz_sg, status_sg;
 	struct virtio_sg *sgs[3];
 	u8 status;
 	int ret;
 
 	sector <<= priv->blksz_shift;
 	blkcnt <<= priv->blksz_shift;
-	virtio_blk_init_header_sg(dev, sector, type, &out_hdr, &hdr_sg);
-	sgs[num_out++] = &hdr_sg;
 
 	switch (type) {
 	case VIRTIO_BLK_T_IN:
 	case VIRTIO_BLK_T_OUT:
-		virtio_blk_init_data_sg(buffer, blkcnt, &data_sg);
-		if (type & VIRTIO_BLK_T_OUT)
-			sgs[num_out++] = &data_sg;
-		else
-			sgs[num_out + num_in++] = &data_sg;
+		ret = virtio_blk_add(dev, vq, &out_hdr, &status, sector, type,
+				     buffer, blkcnt * 512);
 		break;
 
 	case VIRTIO_BLK_T_WRITE_ZEROES:
+		virtio_blk_init_header_sg(dev, sector, type, &out_hdr, &hdr_sg);
 		virtio_blk_init_write_zeroes_sg(dev, sector, blkcnt, &wz_hdr, &wz_sg);
-		sgs[num_out++] = &wz_sg;
+		virtio_blk_init_status_sg(&status, &status_sg);
+		sgs[0] = &hdr_sg;
+		sgs[1] = &wz_sg;
+		sgs[2] = &status_sg;
+		ret = virtqueue_add(vq, sgs, 2, 1);
 		break;
 
 	default:
 		return -EINVAL;
 	}
-
-	virtio_blk_init_status_sg(&status, &status_sg);
-	sgs[num_out + num_in++] = &status_sg;
-	log_debug("dev=%s, active=%d, priv=%p, priv->vq=%p\n", dev->name,
-		  device_active(dev), priv, priv->vq);
-
-	ret = virtqueue_add(priv->vq, sgs, num_out, num_in);
+	log_debug("dev=%s, active=%d, priv=%p, vq=%p\n", dev->name,
+		  device_active(dev), priv, vq);
 	if (ret)
 		return ret;
 
-	virtqueue_kick(priv->vq);
+	virtqueue_kick(vq);
 
 	log_debug("wait...");
-	while (!virtqueue_get_buf(priv->vq, NULL))
+	while (!virtqueue_get_buf(vq, NULL))
 		;
 	log_debug("done\n");
 
 	return status == VIRTIO_BLK_S_OK ? blkcnt >> priv->blksz_shift : -EIO;
 }
 
+/* Read or write in requests of at most max_blks blocks */
+static ulong virtio_blk_rw(struct udevice *dev, lbaint_t start,
+			   lbaint_t blkcnt, void *buffer, u32 type)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	lbaint_t done, count;
+	ulong ret;
+
+	for (done = 0; done < blkcnt; done += count) {
+		count = min(blkcnt - done, priv->max_blks);
+		ret = virtio_blk_do_req(dev, start + done, count,
+					buffer + done * desc->blksz, type);
+		if (IS_ERR_VALUE(ret))
+			return done ? done : ret;
+	}
+
+	return blkcnt;
+}
+
 static ulong virtio_blk_read(struct udevice *dev, lbaint_t start,
 			     lbaint_t blkcnt, void *buffer)
 {
 	log_debug("read %s\n", dev->name);
-	return virtio_blk_do_req(dev, start, blkcnt, buffer,
-				 VIRTIO_BLK_T_IN);
+	return virtio_blk_rw(dev, start, blkcnt, buffer, VIRTIO_BLK_T_IN);
 }
 
 static ulong virtio_blk_write(struct udevice *dev, lbaint_t start,
 			      lbaint_t blkcnt, const void *buffer)
 {
-	return virtio_blk_do_req(dev, start, blkcnt, (void *)buffer,
-				 VIRTIO_BLK_T_OUT);
+	return virtio_blk_rw(dev, start, blkcnt, (void *)buffer,
+			     VIRTIO_BLK_T_OUT);
 }
 
 static ulong virtio_blk_erase(struct udevice *dev, lbaint_t start,
@@ -146,6 +240,135 @@ static ulong virtio_blk_erase(struct udevice *dev, lbaint_t start,
 	return virtio_blk_do_req(dev, start, blkcnt, NULL, VIRTIO_BLK_T_WRITE_ZEROES);
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+/**
+ * virtio_blk_issue() - add virtio requests for the rest of a block request
+ *
+ * The block request is split into virtio requests of at most max_blks
+ * blocks, which are spread over the virtqueues. As many are added as there
+ * are free slots and room in the virtqueues. req->priv[0] counts the blocks
+ * added so far and req->priv[1] the virtio requests not yet done.
+ *
+ * @dev:	virtio block device
+ * @req:	block request to continue
+ * Return: 0 if OK, -ve on error
+ */
+static int virtio_blk_issue(struct udevice *dev, struct blk_req *req)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	u32 type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	struct virtio_blk_slot *slot;
+	lbaint_t count;
+	int ret, i;
+
+	while (req->priv[0] < req->blkcnt) {
+		for (i = 0; i < VIRTIO_BLK_QUEUE_DEPTH; i++) {
+			if (!priv->slots[i].req)
+				break;
+		}
+		if (i == VIRTIO_BLK_QUEUE_DEPTH)
+			break;
+		slot = &priv->slots[i];
+
+		count = min(req->blkcnt - req->priv[0], priv->max_blks);
+		ret = virtio_blk_add(dev, priv->vqs[priv->next_vq],
+				     &slot->out_hdr, &slot->status,
+				     (req->start + req->priv[0]) <<
+				     priv->blksz_shift, type,
+				     req->buffer + req->priv[0] * desc->blksz,
+				     count * desc->blksz);
+		if (ret == -ENOSPC)
+			break;
+		if (ret)
+			return ret;
+		slot->req = req;
+		priv->kick |= BIT(priv->next_vq);
+		priv->next_vq = (priv->next_vq + 1) % priv->num_vqs;
+		req->priv[0] += count;
+		req->priv[1]++;
+	}
+
+	return 0;
+}
+
+/* Stop adding virtio requests for a failed block request */
+static void virtio_blk_fail(struct virtio_blk_priv *priv, struct blk_req *req,
+			    int err)
+{
+	if (req->result >= 0)
+		req->result = err;
+	req->priv[0] = req->blkcnt;
+	if (priv->partial == req)
+		priv->partial = NULL;
+}
+
+static int virtio_blk_submit(struct udevice *dev, struct blk_req *req)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	int ret;
+
+	/* Bounce buffers would hide the header address of finished requests */
+	if (IS_ENABLED(CONFIG_BOUNCE_BUFFER) && priv->vqs[0]->vring.bouncebufs)
+		return -ENOSYS;
+	if (priv->partial)
+		return -EBUSY;
+
+	req->result = req->blkcnt;
+	req->priv[0] = 0;
+	req->priv[1] = 0;
+	ret = virtio_blk_issue(dev, req);
+	if (!req->priv[1])
+		return ret ? ret : -EBUSY;
+	if (ret)
+		virtio_blk_fail(priv, req, ret);
+	else if (req->priv[0] < req->blkcnt)
+		priv->partial = req;
+
+	return 0;
+}
+
+static struct blk_req *virtio_blk_poll(struct udevice *dev)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_blk_slot *slot;
+	struct blk_req *req;
+	void *hdr = NULL;
+	int i, ret;
+
+	/* Notify the device once for all the requests added since last time */
+	for (i = 0; i < priv->num_vqs; i++) {
+		if (priv->kick & BIT(i))
+			virtqueue_kick(priv->vqs[i]);
+	}
+	priv->kick = 0;
+
+	for (i = 0; i < priv->num_vqs && !hdr; i++)
+		hdr = virtqueue_get_buf(priv->vqs[i], NULL);
+	if (!hdr)
+		return NULL;
+	slot = container_of(hdr, struct virtio_blk_slot, out_hdr);
+	req = slot->req;
+	slot->req = NULL;
+	if (slot->status != VIRTIO_BLK_S_OK)
+		virtio_blk_fail(priv, req, -EIO);
+
+	/* A slot is free again for a request which did not fit */
+	if (priv->partial) {
+		ret = virtio_blk_issue(dev, priv->partial);
+		if (ret)
+			virtio_blk_fail(priv, priv->partial, ret);
+		else if (priv->partial->priv[0] == priv->partial->blkcnt)
+			priv->partial = NULL;
+	}
+
+	if (--req->priv[1] || req->priv[0] < req->blkcnt)
+		return NULL;
+
+	return req;
+}
+#endif
+
 static int virtio_blk_bind(struct udevice *dev)
 {
 	struct virtio_dev_priv *uc_priv = dev_get_uclass_priv(dev->parent);
@@ -187,9 +410,18 @@ static int virtio_blk_probe(struct udevice *dev)
 	struct blk_desc *desc = dev_get_uclass_plat(dev);
 	u64 cap;
 	int ret;
-	u32 blk_size;
+	u32 blk_size, seg_max, size_max;
 
-	ret = virtio_find_vqs(dev, 1, &priv->vq);
+	priv->num_vqs = 1;
+	if (virtio_has_feature(dev, VIRTIO_BLK_F_MQ)) {
+		u16 num_queues;
+
+		virtio_cread(dev, struct virtio_blk_config, num_queues,
+			     &num_queues);
+		priv->num_vqs = clamp_t(u32, num_queues, 1,
+					VIRTIO_BLK_MAX_QUEUES);
+	}
+	ret = virtio_find_vqs(dev, priv->num_vqs, priv->vqs);
 	if (ret)
 		return ret;
 
@@ -207,6 +439,30 @@ static int virtio_blk_probe(struct udevice *dev)
 	priv->blksz_shift = desc->log2blksz - 9;
 	desc->lba >>= priv->blksz_shift;
 
+	/*
+	 * Each request needs a descriptor for its header and one for its
+	 * status, besides one per data segment
+	 */
+	priv->seg_max = min_t(u32, VIRTIO_BLK_MAX_SEGS,
+			      virtqueue_get_vring_size(priv->vqs[0]) - 2);
+	if (virtio_has_feature(dev, VIRTIO_BLK_F_SEG_MAX)) {
+		virtio_cread(dev, struct virtio_blk_config, seg_max, &seg_max);
+		if (seg_max)
+			priv->seg_max = min(priv->seg_max, seg_max);
+	}
+	priv->size_max = rounddown(U32_MAX, desc->blksz);
+	if (virtio_has_feature(dev, VIRTIO_BLK_F_SIZE_MAX)) {
+		virtio_cread(dev, struct virtio_blk_config, size_max,
+			     &size_max);
+		if (size_max >= desc->blksz)
+			priv->size_max = rounddown(size_max, desc->blksz);
+	}
+	priv->max_blks = min_t(u64, (u64)priv->seg_max * priv->size_max,
+			       rounddown(U32_MAX, desc->blksz)) >>
+			 desc->log2blksz;
+	log_debug("%d queues, %d segments of %#x bytes\n", priv->num_vqs,
+		  priv->seg_max, priv->size_max);
+
 	return 0;
 }
 
@@ -214,6 +470,10 @@ static const struct blk_ops virtio_blk_ops = {
 	.read	= virtio_blk_read,
 	.write	= virtio_blk_write,
 	.erase	= virtio_blk_erase,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.submit	= virtio_blk_submit,
+	.poll	= virtio_blk_poll,
+#endif
 };
 
 U_BOOT_DRIVER(virtio_blk) = {
@@ -133,6 +133,15 @@ static int virtio_net_free_pkt(struct udevice *dev, uchar *packet, int length)
 	return 0;
 }
 
+static int virtio_net_max_held_pkts(struct udevice *dev)
+{
+	/*
+	 * The rx queue is never reset, so a buffer can go back at any time.
+	 * Keep half of them in the ring so that the device can still receive.
+	 */
+	return VIRTIO_NET_NUM_RX_BUFS / 2;
+}
+
 static void virtio_net_stop(struct udevice *dev)
 {
 	/*
@@ -221,6 +230,7 @@ static const struct eth_ops virtio_net_ops = {
 	.send = virtio_net_send,
 	.recv = virtio_net_recv,
 	.free_pkt = virtio_net_free_pkt,
+	.max_held_pkts = virtio_net_max_held_pkts,
 	.stop = virtio_net_stop,
 	.write_hwaddr = virtio_net_write_hwaddr,
 	.read_rom_hwaddr = virtio_net_read_rom_hwaddr,
@@ -6,6 +6,7 @@
  */
 
 #include <dm.h>
+#include <malloc.h>
 #include <virtio_types.h>
 #include <virtio.h>
 #include <virtio_ring.h>
@@ -13,6 +14,15 @@
 #include <linux/compat.h>
 #include <linux/err.h>
 #include <linux/io.h>
+#include "virtio_blk.h"
+
+/* Geometry of the emulated block device */
+#define SANDBOX_BLK_SECTORS	0x8000
+#define SANDBOX_BLK_QUEUES	2
+#define SANDBOX_BLK_SEG_MAX	8
+#define SANDBOX_BLK_SIZE_MAX	0x10000
+#define SANDBOX_BLK_VRING_NUM	128
+#define SANDBOX_VRING_NUM	4
 
 struct virtio_sandbox_priv {
 	u8 id;
@@ -22,11 +32,24 @@ struct virtio_sandbox_priv {
 	ulong queue_desc;
 	ulong queue_available;
 	ulong queue_used;
+	/* emulated block device */
+	struct virtio_blk_config blk_config;
+	u8 *disk;
+	u16 last_avail[SANDBOX_BLK_QUEUES];
 };
 
 static int virtio_sandbox_get_config(struct udevice *udev, unsigned int offset,
 				     void *buf, unsigned int len)
 {
+	struct virtio_sandbox_priv *priv = dev_get_priv(udev);
+	struct virtio_dev_priv *uc_priv = dev_get_uclass_priv(udev);
+
+	if (uc_priv->device != VIRTIO_ID_BLOCK)
+		return 0;
+	if (offset + len > sizeof(priv->blk_config))
+		return -EINVAL;
+	memcpy(buf, (void *)&priv->blk_config + offset, len);
+
 	return 0;
 }
 
@@ -94,8 +117,16 @@ static struct virtqueue *virtio_sandbox_setup_vq(struct udevice *udev,
 	ulong addr;
 	int err;
 
+	struct virtio_dev_priv *uc_priv = dev_get_uclass_priv(udev);
+	unsigned int num = SANDBOX_VRING_NUM;
+
+	if (uc_priv->device == VIRTIO_ID_BLOCK) {
+		num = SANDBOX_BLK_VRING_NUM;
+		priv->last_avail[index] = 0;
+	}
+
 	/* Create the vring */
-	vq = vring_create_virtqueue(index, 4, 4096, udev);
+	vq = vring_create_virtqueue(index, num, 4096, udev);
 	if (!vq) {
 		err = -ENOMEM;
 		goto error_new_virtqueue;
@@ -135,8 +166,12 @@ static int virtio_sandbox_del_vqs(struct udevice *udev)
 static int virtio_sandbox_find_vqs(struct udevice *udev, unsigned int nvqs,
 				   struct virtqueue *vqs[])
 {
+	struct virtio_dev_priv *uc_priv = dev_get_uclass_priv(udev);
 	int i;
 
+	if (uc_priv->device == VIRTIO_ID_BLOCK && nvqs > SANDBOX_BLK_QUEUES)
+		return -EINVAL;
+
 	for (i = 0; i < nvqs; ++i) {
 		vqs[i] = virtio_sandbox_setup_vq(udev, i);
 		if (IS_ERR(vqs[i])) {
@@ -148,8 +183,107 @@ static int virtio_sandbox_find_vqs(struct udevice *udev, unsigned int nvqs,
 	return 0;
 }
 
+/**
+ * virtio_sandbox_blk_req() - carry out a request to the emulated block device
+ *
+ * The request is checked against the limits advertised in the configuration
+ * space, like a strict device would do.
+ *
+ * @priv:	transport private data
+ * @vq:		virtqueue holding the request
+ * @head:	index of the first descriptor of the request
+ * @lenp:	returns the number of bytes written to the request
+ * Return: VIRTIO_BLK_S_OK if OK, another VIRTIO_BLK_S_... value on error
+ */
+static u8 virtio_sandbox_blk_req(struct virtio_sandbox_priv *priv,
+				 struct virtqueue *vq, u16 head, u32 *lenp)
+{
+	struct udevice *vdev = vq->vdev;
+	struct vring_desc *desc = vq->vring.desc;
+	struct virtio_blk_outhdr *hdr;
+	struct vring_desc *data[SANDBOX_BLK_SEG_MAX + 1];
+	u64 offset;
+	u32 type, len;
+	u8 *status;
+	int n = 0, i;
+
+	hdr = (void *)(uintptr_t)virtio64_to_cpu(vdev, desc[head].addr);
+	type = virtio32_to_cpu(vdev, hdr->type);
+	offset = virtio64_to_cpu(vdev, hdr->sector) * 512;
+
+	/* The data segments lie between the header and the status byte */
+	for (i = head;
+	     virtio16_to_cpu(vdev, desc[i].flags) & VRING_DESC_F_NEXT;
+	     i = virtio16_to_cpu(vdev, desc[i].next)) {
+		if (n > SANDBOX_BLK_SEG_MAX)
+			return VIRTIO_BLK_S_IOERR;
+		data[n++] = &desc[virtio16_to_cpu(vdev, desc[i].next)];
+	}
+	if (!n || !(virtio16_to_cpu(vdev, desc[i].flags) & VRING_DESC_F_WRITE))
+		return VIRTIO_BLK_S_IOERR;
+	status = (u8 *)(uintptr_t)virtio64_to_cpu(vdev, desc[i].addr);
+	n--;
+	*lenp = 1;
+
+	if (type != VIRTIO_BLK_T_IN && type != VIRTIO_BLK_T_OUT)
+		return *status = VIRTIO_BLK_S_UNSUPP;
+
+	if (!priv->disk) {
+		priv->disk = calloc(SANDBOX_BLK_SECTORS, 512);
+		if (!priv->disk)
+			return *status = VIRTIO_BLK_S_IOERR;
+	}
+	for (i = 0; i < n; i++) {
+		void *buf = (void *)(uintptr_t)virtio64_to_cpu(vdev,
+							       data[i]->addr);
+		bool write = virtio16_to_cpu(vdev, data[i]->flags) &
+			     VRING_DESC_F_WRITE;
+
+		len = virtio32_to_cpu(vdev, data[i]->len);
+		if (len > SANDBOX_BLK_SIZE_MAX || len % 512 ||
+		    write != (type == VIRTIO_BLK_T_IN) ||
+		    offset + len > (u64)SANDBOX_BLK_SECTORS * 512)
+			return *status = VIRTIO_BLK_S_IOERR;
+		if (write) {
+			memcpy(buf, priv->disk + offset, len);
+			*lenp += len;
+		} else {
+			memcpy(priv->disk + offset, buf, len);
+		}
+		offset += len;
+	}
+
+	return *status = VIRTIO_BLK_S_OK;
+}
+
 static int virtio_sandbox_notify(struct udevice *udev, struct virtqueue *vq)
 {
+	struct virtio_sandbox_priv *priv = dev_get_priv(udev);
+	struct virtio_dev_priv *uc_priv = dev_get_uclass_priv(udev);
+	struct udevice *vdev = vq->vdev;
+	struct vring *vring = &vq->vring;
+	u16 *last_avail, head, used;
+	u32 len = 0;
+
+	if (uc_priv->device != VIRTIO_ID_BLOCK)
+		return 0;
+
+	/* Complete every request which was made available since last time */
+	last_avail = &priv->last_avail[vq->index];
+	while (*last_avail != virtio16_to_cpu(vdev, vring->avail->idx)) {
+		head = virtio16_to_cpu(vdev, vring->avail->ring[*last_avail %
+								vring->num]);
+		virtio_sandbox_blk_req(priv, vq, head, &len);
+
+		used = virtio16_to_cpu(vdev, vring->used->idx);
+		vring->used->ring[used % vring->num].id =
+			cpu_to_virtio32(vdev, head);
+		vring->used->ring[used % vring->num].len =
+			cpu_to_virtio32(vdev, len);
+		vring->used->idx = cpu_to_virtio16(vdev, used + 1);
+		(*last_avail)++;
+	}
+
 	return 0;
 }
 
@@ -157,6 +291,7 @@ static int virtio_sandbox_probe(struct udevice *udev)
 {
 	struct virtio_sandbox_priv *priv = dev_get_priv(udev);
 	struct virtio_dev_priv *uc_priv = dev_get_uclass_priv(udev);
+	struct virtio_blk_config *config = &priv->blk_config;
 
 	/* fake some information for testing */
 	priv->device_features = BIT_ULL(VIRTIO_F_VERSION_1);
@@ -164,6 +299,27 @@ static int virtio_sandbox_probe(struct udevice *udev)
 					       VIRTIO_ID_RNG);
 	uc_priv->vendor = ('u' << 24) | ('b' << 16) | ('o' << 8) | 't';
 
+	/* a small RAM disk, with limits to exercise request splitting */
+	if (uc_priv->device == VIRTIO_ID_BLOCK) {
+		priv->device_features |= BIT_ULL(VIRTIO_BLK_F_SIZE_MAX) |
+					 BIT_ULL(VIRTIO_BLK_F_SEG_MAX) |
+					 BIT_ULL(VIRTIO_BLK_F_MQ);
+		config->capacity = cpu_to_le64(SANDBOX_BLK_SECTORS);
+		config->size_max = cpu_to_le32(SANDBOX_BLK_SIZE_MAX);
+		config->seg_max = cpu_to_le32(SANDBOX_BLK_SEG_MAX);
+		config->num_queues = cpu_to_le16(SANDBOX_BLK_QUEUES);
+	}
+
+	return 0;
+}
+
+static int virtio_sandbox_remove(struct udevice *udev)
+{
+	struct virtio_sandbox_priv *priv = dev_get_priv(udev);
+
+	free(priv->disk);
+	priv->disk = NULL;
+
 	return 0;
 }
 
@@ -191,6 +347,7 @@ U_BOOT_DRIVER(virtio_sandbox1) = {
 	.of_match = virtio_sandbox1_ids,
 	.ops	= &virtio_sandbox1_ops,
 	.probe	= virtio_sandbox_probe,
+	.remove	= virtio_sandbox_remove,
 	.priv_auto	= sizeof(struct virtio_sandbox_priv),
 };
 
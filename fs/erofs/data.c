@@ -1,4 +1,6 @@
 // SPDX-License-Identifier: GPL-2.0+
+#include <env.h>
+#include <uthread.h>
 #include "internal.h"
 #include "decompress.h"
 
@@ -216,27 +218,10 @@ static int erofs_read_raw_data(struct erofs_inode *inode, char *buffer,
 	return 0;
 }
 
-int z_erofs_read_one_data(struct erofs_inode *inode,
-			  struct erofs_map_blocks *map, char *raw, char *buffer,
-			  erofs_off_t skip, erofs_off_t length, bool trimmed)
+static int z_erofs_read_raw(struct erofs_map_blocks *map, char *raw)
 {
 	struct erofs_map_dev mdev;
-	int ret = 0;
-
-	if (map->m_flags & EROFS_MAP_FRAGMENT) {
-		struct erofs_inode packed_inode = {
-			.nid = sbi.packed_nid,
-		};
-
-		ret = erofs_read_inode_from_disk(&packed_inode);
-		if (ret) {
-			erofs_err("failed to read packed inode from disk");
-			return ret;
-		}
-
-		return erofs_pread(&packed_inode, buffer, length - skip,
-				   inode->fragmentoff + skip);
-	}
+	int ret;
 
 	/* no device id here, thus it will always succeed */
 	mdev = (struct erofs_map_dev) {
@@ -251,6 +236,14 @@ int z_erofs_read_one_data(struct erofs_inode *inode,
 	ret = erofs_dev_read(mdev.m_deviceid, raw, mdev.m_pa, map->m_plen);
 	if (ret < 0)
 		return ret;
+	return 0;
+}
+
+static int z_erofs_decompress_one(struct erofs_map_blocks *map, char *raw,
+				  char *buffer, erofs_off_t skip,
+				  erofs_off_t length, bool trimmed)
+{
+	int ret;
 
 	ret = z_erofs_decompress(&(struct z_erofs_decompress_req) {
 			.in = raw,
@@ -271,23 +264,109 @@ int z_erofs_read_one_data(struct erofs_inode *inode,
 	return 0;
 }
 
-static int z_erofs_read_data(struct erofs_inode *inode, char *buffer,
-			     erofs_off_t size, erofs_off_t offset)
+int z_erofs_read_one_data(struct erofs_inode *inode,
+			  struct erofs_map_blocks *map, char *raw, char *buffer,
+			  erofs_off_t skip, erofs_off_t length, bool trimmed)
 {
-	erofs_off_t end, length, skip;
+	int ret = 0;
+
+	if (map->m_flags & EROFS_MAP_FRAGMENT) {
+		struct erofs_inode packed_inode = {
+			.nid = sbi.packed_nid,
+		};
+
+		ret = erofs_read_inode_from_disk(&packed_inode);
+		if (ret) {
+			erofs_err("failed to read packed inode from disk");
+			return ret;
+		}
+
+		return erofs_pread(&packed_inode, buffer, length - skip,
+				   inode->fragmentoff + skip);
+	}
+
+	ret = z_erofs_read_raw(map, raw);
+	if (ret < 0)
+		return ret;
+
+	return z_erofs_decompress_one(map, raw, buffer, skip, length, trimmed);
+}
+
+/* Number of clusters the reader thread may get ahead of the decompressor */
+#define Z_EROFS_PIPE_DEPTH	4
+
+/**
+ * struct z_erofs_pipe_slot - a compressed cluster waiting to be decompressed
+ *
+ * @map: mapping of the cluster
+ * @raw: compressed data
+ * @rawsize: size of the @raw buffer
+ * @out: where the decompressed data goes
+ * @skip: number of decompressed bytes to skip
+ * @length: number of decompressed bytes wanted, including @skip
+ * @trimmed: true if the extent was trimmed to the requested range
+ */
+struct z_erofs_pipe_slot {
+	struct erofs_map_blocks map;
+	char *raw;
+	unsigned int rawsize;
+	char *out;
+	erofs_off_t skip;
+	erofs_off_t length;
+	bool trimmed;
+};
+
+/**
+ * struct z_erofs_pipe - state of one z_erofs_read_data() call
+ *
+ * @inode: inode being read
+ * @buffer: destination buffer
+ * @size: number of bytes to read
+ * @offset: file offset to read from
+ * @slot: ring of clusters read ahead of the decompressor
+ * @produced: number of clusters read so far
+ * @consumed: number of clusters decompressed so far
+ * @threaded: true if the clusters are read by a separate uthread
+ * @done: true once the reader has finished
+ * @stop: tells the reader to stop early
+ * @ret: result of the reader
+ */
+struct z_erofs_pipe {
+	struct erofs_inode *inode;
+	char *buffer;
+	erofs_off_t size;
+	erofs_off_t offset;
+	struct z_erofs_pipe_slot slot[Z_EROFS_PIPE_DEPTH];
+	unsigned int produced;
+	unsigned int consumed;
+	bool threaded;
+	bool done;
+	bool stop;
+	int ret;
+};
+
+/*
+ * Maps and reads the clusters of the requested range, last one first.
+ * Compressed clusters are decompressed straight away, or handed over to
+ * z_erofs_read_data() when running in a uthread. All disk accesses happen
+ * here, so block drivers which yield while waiting for the hardware let the
+ * previous cluster be decompressed in the meantime.
+ */
+static int z_erofs_read_clusters(struct z_erofs_pipe *pipe)
+{
+	erofs_off_t end, length, skip, offset = pipe->offset;
 	struct erofs_map_blocks map = {
 		.index = UINT_MAX,
 	};
+	struct z_erofs_pipe_slot *slot;
 	bool trimmed;
-	unsigned int bufsize = 0;
-	char *raw = NULL;
 	int ret = 0;
 
-	end = offset + size;
-	while (end > offset) {
+	end = offset + pipe->size;
+	while (end > offset && !pipe->stop) {
 		map.m_la = end - 1;
 
-		ret = z_erofs_map_blocks_iter(inode, &map, 0);
+		ret = z_erofs_map_blocks_iter(pipe->inode, &map, 0);
 		if (ret)
 			break;
 
@@ -313,28 +392,126 @@ static int z_erofs_read_data(struct erofs_inode *inode, char *buffer,
 		}
 
 		if (!(map.m_flags & EROFS_MAP_MAPPED)) {
-			memset(buffer + end - offset, 0, length - skip);
+			memset(pipe->buffer + end - offset, 0, length - skip);
 			end = map.m_la;
 			continue;
 		}
 
-		if (map.m_plen > bufsize) {
-			bufsize = map.m_plen;
-			raw = realloc(raw, bufsize);
+		if (map.m_flags & EROFS_MAP_FRAGMENT) {
+			ret = z_erofs_read_one_data(pipe->inode, &map, NULL,
+						    pipe->buffer + end - offset,
+						    skip, length, trimmed);
+			if (ret < 0)
+				break;
+			continue;
+		}
+
+		/* wait for the decompressor to free up a slot */
+		while (pipe->produced - pipe->consumed >= Z_EROFS_PIPE_DEPTH &&
+		       !pipe->stop)
+			uthread_schedule();
+		if (pipe->stop)
+			break;
+
+		slot = &pipe->slot[pipe->produced % Z_EROFS_PIPE_DEPTH];
+		if (map.m_plen > slot->rawsize) {
+			char *raw = realloc(slot->raw, map.m_plen);
+
 			if (!raw) {
 				ret = -ENOMEM;
 				break;
 			}
+			slot->raw = raw;
+			slot->rawsize = map.m_plen;
 		}
 
-		ret = z_erofs_read_one_data(inode, &map, raw,
-					    buffer + end - offset, skip, length,
-					    trimmed);
+		ret = z_erofs_read_raw(&map, slot->raw);
 		if (ret < 0)
 			break;
+
+		if (!pipe->threaded) {
+			ret = z_erofs_decompress_one(&map, slot->raw,
+						     pipe->buffer + end - offset,
+						     skip, length, trimmed);
+			if (ret < 0)
+				break;
+			continue;
+		}
+
+		slot->map = map;
+		slot->out = pipe->buffer + end - offset;
+		slot->skip = skip;
+		slot->length = length;
+		slot->trimmed = trimmed;
+		pipe->produced++;
+	}
+	return ret;
+}
+
+static void z_erofs_pipe_reader(void *arg)
+{
+	struct z_erofs_pipe *pipe = arg;
+
+	pipe->ret = z_erofs_read_clusters(pipe);
+	pipe->done = true;
+}
+
+static int z_erofs_read_data(struct erofs_inode *inode, char *buffer,
+			     erofs_off_t size, erofs_off_t offset)
+{
+	static bool busy;
+	struct z_erofs_pipe pipe = {
+		.inode = inode,
+		.buffer = buffer,
+		.size = size,
+		.offset = offset,
+	};
+	struct z_erofs_pipe_slot *slot;
+	unsigned int grp_id;
+	int i, ret = 0;
+
+	/*
+	 * Fragments are read from the packed inode by the reader itself, so
+	 * only the outermost call gets a reader thread.
+	 */
+	pipe.threaded = CONFIG_IS_ENABLED(FS_EROFS_ZIP_PIPELINE) && !busy &&
+			env_get_yesno("erofs_pipeline");
+	if (pipe.threaded) {
+		grp_id = uthread_grp_new_id();
+		pipe.threaded = !uthread_create(NULL, z_erofs_pipe_reader,
+						&pipe, 0, grp_id);
+	}
+	if (!pipe.threaded) {
+		ret = z_erofs_read_clusters(&pipe);
+		goto out;
+	}
+
+	busy = true;
+	while (pipe.consumed != pipe.produced || !pipe.done) {
+		if (pipe.consumed == pipe.produced) {
+			uthread_schedule();
+			continue;
+		}
+
+		slot = &pipe.slot[pipe.consumed % Z_EROFS_PIPE_DEPTH];
+		ret = z_erofs_decompress_one(&slot->map, slot->raw, slot->out,
+					     slot->skip, slot->length,
+					     slot->trimmed);
+		pipe.consumed++;
+		if (ret < 0) {
+			pipe.stop = true;
+			break;
+		}
 	}
-	if (raw)
-		free(raw);
+	while (!uthread_grp_done(grp_id))
+		uthread_schedule();
+	busy = false;
+	if (!ret)
+		ret = pipe.ret;
+
+out:
+	for (i = 0; i < Z_EROFS_PIPE_DEPTH; i++)
+		free(pipe.slot[i].raw);
 	return ret < 0 ? ret : 0;
 }
 
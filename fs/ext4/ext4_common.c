@@ -1525,10 +1525,15 @@ void ext4fs_allocate_blocks(struct ext2_inode *file_inode,
 
 #endif
 
+/*
+ * Find the leaf of the extent tree which may map @fileblock. If @endp is not
+ * NULL, it is set to the first file block mapped by a later leaf, and left
+ * alone if there is none.
+ */
 static struct ext4_extent_header *ext4fs_get_extent_block
 	(struct ext2_data *data, struct ext_block_cache *cache,
 		struct ext4_extent_header *ext_block,
-		uint32_t fileblock, int log2_blksz)
+		uint32_t fileblock, int log2_blksz, uint32_t *endp)
 {
 	struct ext4_extent_idx *index;
 	unsigned long long block;
@@ -1549,6 +1554,8 @@ static struct ext4_extent_header *ext4fs_get_extent_block
 			if (i >= le16_to_cpu(ext_block->eh_entries))
 				break;
 		} while (fileblock >= le32_to_cpu(index[i].ei_block));
+		if (endp && i < le16_to_cpu(ext_block->eh_entries))
+			*endp = le32_to_cpu(index[i].ei_block);
 
 		/*
 		 * If first logical block number is higher than requested fileblock,
@@ -1642,6 +1649,87 @@ int ext4fs_read_inode(struct ext2_data *data, int ino, struct ext2_inode *inode)
 	return 1;
 }
 
+/**
+ * ext4fs_map_extent() - map a run of file blocks through the extent tree
+ *
+ * Unlike read_allocated_block(), this returns the whole run of blocks covered
+ * by the extent (or hole) containing @fileblock, so a caller can read it with a
+ * single device read. A hole after the last extent runs to the end of the
+ * file.
+ *
+ * @inode:	inode, which must use extents
+ * @fileblock:	first file block to map
+ * @cache:	cache for extent index blocks
+ * @blknrp:	returns the filesystem block holding @fileblock, or 0 if it lies
+ *		in a hole or an unwritten extent, which read as zeroes
+ * Return:	number of blocks from @fileblock mapped contiguously from
+ *		*@blknrp, or -EINVAL if the extent tree is invalid
+ */
+long ext4fs_map_extent(struct ext2_inode *inode, uint32_t fileblock,
+		       struct ext_block_cache *cache, uint64_t *blknrp)
+{
+	struct ext4_extent_header *ext_block;
+	struct ext4_extent *extent;
+	uint32_t end = 0;
+	uint64_t size;
+	int log2_blksz;
+	int i;
+
+	log2_blksz = LOG2_BLOCK_SIZE(ext4fs_root) -
+		get_fs()->dev_desc->log2blksz;
+	ext_block = ext4fs_get_extent_block(ext4fs_root, cache,
+					    (struct ext4_extent_header *)
+					    inode->b.blocks.dir_blocks,
+					    fileblock, log2_blksz, &end);
+	if (!ext_block) {
+		printf("invalid extent block\n");
+		return -EINVAL;
+	}
+
+	*blknrp = 0;
+	extent = (struct ext4_extent *)(ext_block + 1);
+	for (i = 0; i < le16_to_cpu(ext_block->eh_entries); i++) {
+		uint32_t startblock = le32_to_cpu(extent[i].ee_block);
+		uint len = le16_to_cpu(extent[i].ee_len);
+		bool unwritten = false;
+		uint64_t start;
+
+		/* Sparse file, the hole runs up to this extent */
+		if (startblock > fileblock)
+			return startblock - fileblock;
+
+		if (len > EXT_INIT_MAX_LEN) {
+			len -= EXT_INIT_MAX_LEN;
+			unwritten = true;
+		}
+		if (fileblock >= startblock + len)
+			continue;
+
+		if (!unwritten) {
+			start = le16_to_cpu(extent[i].ee_start_hi);
+			start = (start << 32) +
+				le32_to_cpu(extent[i].ee_start_lo);
+			*blknrp = start + fileblock - startblock;
+		}
+
+		return startblock + len - fileblock;
+	}
+
+	/*
+	 * Past the last extent of this leaf, the hole runs up to the next leaf,
+	 * or to the end of the file after the last leaf
+	 */
+	if (end > fileblock)
+		return end - fileblock;
+	size = le32_to_cpu(inode->size) |
+		(uint64_t)le32_to_cpu(inode->size_high) << 32;
+	size = (size + EXT2_BLOCK_SIZE(ext4fs_root) - 1) >>
+		LOG2_BLOCK_SIZE(ext4fs_root);
+
+	return clamp_t(uint64_t, size - min_t(uint64_t, size, fileblock), 1,
+		       INT_MAX);
+}
+
 long int read_allocated_block(struct ext2_inode *inode, int fileblock,
 			      struct ext_block_cache *cache)
 {
@@ -1675,7 +1763,7 @@ long int read_allocated_block(struct ext2_inode *inode, int fileblock,
 			ext4fs_get_extent_block(ext4fs_root, c,
 						(struct ext4_extent_header *)
 						inode->b.blocks.dir_blocks,
-						fileblock, log2_blksz);
+						fileblock, log2_blksz, NULL);
 		if (!ext_block) {
 			printf("invalid extent block\n");
 			if (!cache)
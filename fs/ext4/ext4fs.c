@@ -28,6 +28,7 @@
 #include <malloc.h>
 #include <part.h>
 #include <rtc.h>
+#include <linux/sizes.h>
 #include <u-boot/uuid.h>
 #include "ext4_common.h"
 
@@ -63,6 +64,89 @@ void ext4fs_free_node(struct ext2fs_node *node, struct ext2fs_node *currroot)
 		free(node);
 }
 
+/* Largest single device read, so that byte counts fit in an int */
+#define EXT4_MAX_READ	SZ_1G
+
+/**
+ * ext4fs_read_extents() - read from a file which uses extents
+ *
+ * The extent tree is looked up once per extent rather than once per block, and
+ * physically contiguous extents are merged so that each run is read with a
+ * single ext4fs_devread() straight into @buf. Holes and unwritten extents are
+ * zeroed.
+ *
+ * @node:	file to read
+ * @pos:	position in the file to read from
+ * @len:	number of bytes to read, within the file
+ * @buf:	buffer to read into
+ * @cache:	cache for extent index blocks
+ * Return:	0 if OK, -1 on error
+ */
+static int ext4fs_read_extents(struct ext2fs_node *node, loff_t pos,
+			       loff_t len, char *buf,
+			       struct ext_block_cache *cache)
+{
+	int log2blksz = get_fs()->dev_desc->log2blksz;
+	int log2_fs_blocksize = LOG2_BLOCK_SIZE(node->data);
+	int blocksize = 1 << log2_fs_blocksize;
+	lbaint_t delayed_start = 0;
+	loff_t delayed_extent = 0;
+	int delayed_skipfirst = 0;
+	char *delayed_buf = NULL;
+
+	while (len > 0) {
+		uint32_t fileblock = pos >> log2_fs_blocksize;
+		int skipfirst = pos & (blocksize - 1);
+		lbaint_t sector;
+		uint64_t blknr;
+		loff_t bytes;
+		long count;
+
+		count = ext4fs_map_extent(&node->inode, fileblock, cache,
+					  &blknr);
+		if (count < 0)
+			return -1;
+		bytes = min((loff_t)count * blocksize - skipfirst, len);
+		bytes = min(bytes, (loff_t)EXT4_MAX_READ);
+		sector = (lbaint_t)blknr << (log2_fs_blocksize - log2blksz);
+
+		/* Extend the pending read if this run follows on from it */
+		if (blknr && delayed_extent && !skipfirst &&
+		    !((delayed_skipfirst + delayed_extent) & (blocksize - 1)) &&
+		    delayed_start + ((delayed_skipfirst + delayed_extent) >>
+				     log2blksz) == sector &&
+		    delayed_extent + bytes <= EXT4_MAX_READ) {
+			delayed_extent += bytes;
+		} else {
+			if (delayed_extent &&
+			    !ext4fs_devread(delayed_start, delayed_skipfirst,
+					    delayed_extent, delayed_buf))
+				return -1;
+			delayed_extent = 0;
+
+			if (blknr) {
+				delayed_start = sector;
+				delayed_skipfirst = skipfirst;
+				delayed_extent = bytes;
+				delayed_buf = buf;
+			} else {
+				memset(buf, '\0', bytes);
+			}
+		}
+
+		buf += bytes;
+		pos += bytes;
+		len -= bytes;
+	}
+
+	if (delayed_extent &&
+	    !ext4fs_devread(delayed_start, delayed_skipfirst, delayed_extent,
+			    delayed_buf))
+		return -1;
+
+	return 0;
+}
+
 /*
  * Taken from openmoko-kernel mailing list: By Andy green
  * Optimized read file API : collects and defers contiguous sector
@@ -99,6 +183,16 @@ int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
 		return -1;
 	}
 
+	if (le32_to_cpu(node->inode.flags) & EXT4_EXTENTS_FL) {
+		if (ext4fs_read_extents(node, pos, len, buf, &cache)) {
+			ext_cache_fini(&cache);
+			return -1;
+		}
+		*actread = len;
+		ext_cache_fini(&cache);
+		return 0;
+	}
+
 	blockcnt = lldiv(((len + pos) + blocksize - 1), blocksize);
 
 	for (i = lldiv(pos, blocksize); i < blockcnt; i++) {
@@ -25,6 +25,7 @@
 #include <asm/cache.h>
 #include <linux/compiler.h>
 #include <linux/ctype.h>
+#include <linux/err.h>
 #include <linux/log2.h>
 
 /* maximum number of clusters for FAT12 */
@@ -162,6 +163,115 @@ int flush_dirty_fat_buffer(fsdata *mydata)
 }
 #endif
 
+/**
+ * alloc_fatbuf() - allocate the FAT buffer and read-only windows
+ *
+ * @mydata:	filesystem description
+ * Return:	0 on success, -ENOMEM if out of memory
+ */
+static int alloc_fatbuf(fsdata *mydata)
+{
+	int i;
+
+	mydata->fatbufnum = -1;
+	mydata->fat_dirty = 0;
+	mydata->fatbuf = malloc_cache_aligned(FATBUFSIZE *
+					      (FATCACHE_WINDOWS + 1));
+	if (!mydata->fatbuf)
+		return -ENOMEM;
+
+	for (i = 0; i < FATCACHE_WINDOWS; i++) {
+		mydata->fatwinnum[i] = -1;
+		mydata->fatwinage[i] = 0;
+	}
+	mydata->fatwintick = 0;
+
+	return 0;
+}
+
+/**
+ * drop_fatwin() - drop any read-only window holding a FAT block
+ *
+ * This must be called when @bufnum is loaded into fatbuf for modification, so
+ * that no stale copy of it is left in the windows.
+ *
+ * @mydata:	filesystem description
+ * @bufnum:	FAT block (in units of FATBUFBLOCKS sectors)
+ */
+static __maybe_unused void drop_fatwin(fsdata *mydata, __u32 bufnum)
+{
+	int i;
+
+	for (i = 0; i < FATCACHE_WINDOWS; i++)
+		if (mydata->fatwinnum[i] == bufnum)
+			mydata->fatwinnum[i] = -1;
+}
+
+/**
+ * get_fatbuf() - get a buffer holding a block of the FAT table
+ *
+ * fatbuf is checked first, since it may hold changes not yet written back.
+ * Otherwise the block is looked up in the read-only windows and on a miss is
+ * read into the least recently used one. Without windows, fatbuf is written
+ * back if needed and reused.
+ *
+ * @mydata:	filesystem description
+ * @bufnum:	FAT block (in units of FATBUFBLOCKS sectors)
+ * Return:	pointer to the block, ERR_PTR(-EIO) if it could not be read or
+ *		ERR_PTR(-EPERM) if fatbuf could not be written back
+ */
+static __u8 *get_fatbuf(fsdata *mydata, __u32 bufnum)
+{
+	__u32 getsize = FATBUFBLOCKS;
+	__u32 fatlength = mydata->fatlength;
+	__u32 startblock = bufnum * FATBUFBLOCKS;
+	int i, win = -1;
+	__u8 *bufptr;
+
+	if (bufnum == mydata->fatbufnum)
+		return mydata->fatbuf;
+
+	for (i = 0; i < FATCACHE_WINDOWS; i++) {
+		if (mydata->fatwinnum[i] == bufnum) {
+			mydata->fatwinage[i] = ++mydata->fatwintick;
+			return mydata->fatbuf + (i + 1) * FATBUFSIZE;
+		}
+		if (win < 0 || mydata->fatwinage[i] < mydata->fatwinage[win])
+			win = i;
+	}
+
+	/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
+	if (startblock + getsize > fatlength)
+		getsize = fatlength - startblock;
+
+	startblock += mydata->fat_sect;	/* Offset from start of disk */
+
+	if (win < 0) {
+		/* Write back the fatbuf to the disk */
+		if (flush_dirty_fat_buffer(mydata) < 0)
+			return ERR_PTR(-EPERM);
+		bufptr = mydata->fatbuf;
+		mydata->fatbufnum = -1;
+	} else {
+		bufptr = mydata->fatbuf + (win + 1) * FATBUFSIZE;
+		mydata->fatwinnum[win] = -1;
+	}
+
+	if (disk_read(startblock, getsize, bufptr) < 0) {
+		debug("Error reading FAT blocks\n");
+		return ERR_PTR(-EIO);
+	}
+
+	if (win < 0) {
+		mydata->fatbufnum = bufnum;
+	} else {
+		mydata->fatwinnum[win] = bufnum;
+		mydata->fatwinage[win] = ++mydata->fatwintick;
+	}
+
+	return bufptr;
+}
+
 /*
  * Get the entry at index 'entry' in a FAT (12/16/32) table.
  * On failure 0x00 is returned.
@@ -171,6 +281,7 @@ static __u32 get_fatent(fsdata *mydata, __u32 entry)
 	__u32 bufnum;
 	__u32 offset, off8;
 	__u32 ret = 0x00;
+	__u8 *fatbuf;
 
 	if (CHECK_CLUST(entry, mydata->fatsize)) {
 		log_err("Invalid FAT entry: %#08x\n", entry);
@@ -199,42 +310,24 @@ static __u32 get_fatent(fsdata *mydata, __u32 entry)
 	debug("FAT%d: entry: 0x%08x = %d, offset: 0x%04x = %d\n",
 	       mydata->fatsize, entry, entry, offset, offset);
 
-	/* Read a new block of FAT entries into the cache. */
-	if (bufnum != mydata->fatbufnum) {
-		__u32 getsize = FATBUFBLOCKS;
-		__u8 *bufptr = mydata->fatbuf;
-		__u32 fatlength = mydata->fatlength;
-		__u32 startblock = bufnum * FATBUFBLOCKS;
-
-		/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
-		if (startblock + getsize > fatlength)
-			getsize = fatlength - startblock;
-
-		startblock += mydata->fat_sect;	/* Offset from start of disk */
-
-		/* Write back the fatbuf to the disk */
-		if (flush_dirty_fat_buffer(mydata) < 0)
-			return -1;
-
-		if (disk_read(startblock, getsize, bufptr) < 0) {
-			debug("Error reading FAT blocks\n");
-			return ret;
-		}
-		mydata->fatbufnum = bufnum;
-	}
+	fatbuf = get_fatbuf(mydata, bufnum);
+	if (PTR_ERR(fatbuf) == -EPERM)
+		return -1;
+	if (IS_ERR(fatbuf))
+		return ret;
 
 	/* Get the actual entry from the table */
 	switch (mydata->fatsize) {
 	case 32:
-		ret = FAT2CPU32(((__u32 *) mydata->fatbuf)[offset]);
+		ret = FAT2CPU32(((__u32 *)fatbuf)[offset]);
 		break;
 	case 16:
-		ret = FAT2CPU16(((__u16 *) mydata->fatbuf)[offset]);
+		ret = FAT2CPU16(((__u16 *)fatbuf)[offset]);
 		break;
 	case 12:
 		off8 = (offset * 3) / 2;
 		/* fatbut + off8 may be unaligned, read in byte granularity */
-		ret = mydata->fatbuf[off8] + (mydata->fatbuf[off8 + 1] << 8);
+		ret = fatbuf[off8] + (fatbuf[off8 + 1] << 8);
 
 		if (offset & 0x1)
 			ret >>= 4;
@@ -417,18 +510,18 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 
 		/* get remaining bytes */
 		actsize = filesize;
-		if (get_cluster(mydata, curclust, buffer, (int)actsize) != 0) {
+		if (get_cluster(mydata, curclust, buffer, actsize) != 0) {
 			printf("Error reading cluster\n");
 			return -1;
 		}
 		*gotsize += actsize;
 		return 0;
 getit:
-		if (get_cluster(mydata, curclust, buffer, (int)actsize) != 0) {
+		if (get_cluster(mydata, curclust, buffer, actsize) != 0) {
 			printf("Error reading cluster\n");
 			return -1;
 		}
-		*gotsize += (int)actsize;
+		*gotsize += actsize;
 		filesize -= actsize;
 		buffer += actsize;
 
@@ -684,10 +777,7 @@ static int get_fs_info(fsdata *mydata)
 		mydata->root_cluster = 0;
 	}
 
-	mydata->fatbufnum = -1;
-	mydata->fat_dirty = 0;
-	mydata->fatbuf = malloc_cache_aligned(FATBUFSIZE);
-	if (mydata->fatbuf == NULL) {
+	if (alloc_fatbuf(mydata)) {
 		debug("Error: allocating memory\n");
 		return -1;
 	}
@@ -482,6 +482,7 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 			return -1;
 		}
 		mydata->fatbufnum = bufnum;
+		drop_fatwin(mydata, bufnum);
 	}
 
 	/* Mark as dirty */
@@ -1261,14 +1262,12 @@ static int update_parent_dir_props(fat_itr *dir_itr)
 	fsdata = *itr.fsdata;
 
 	/* allocate local fat buffer */
-	fsdata.fatbuf = malloc_cache_aligned(FATBUFSIZE);
-	if (!fsdata.fatbuf) {
+	if (alloc_fatbuf(&fsdata)) {
 		log_debug("Error: allocating memory\n");
 		ret = -ENOMEM;
 		return ret;
 	}
 
-	fsdata.fatbufnum = -1;
 	itr.fsdata = &fsdata;
 
 	if (!itr.is_root) {
@@ -1586,8 +1585,7 @@ int file_fat_write(const char *filename, void *buffer, loff_t offset,
 static int fat_dir_entries(fat_itr *itr)
 {
 	fat_itr *dirs;
-	fsdata fsdata = { .fatbuf = NULL, }, *mydata = &fsdata;
-						/* for FATBUFSIZE */
+	fsdata fsdata = { .fatbuf = NULL, };
 	int count;
 
 	dirs = malloc_cache_aligned(sizeof(fat_itr));
@@ -1602,13 +1600,11 @@ static int fat_dir_entries(fat_itr *itr)
 	fsdata = *dirs->fsdata;
 
 	/* allocate local fat buffer */
-	fsdata.fatbuf = malloc_cache_aligned(FATBUFSIZE);
-	if (!fsdata.fatbuf) {
+	if (alloc_fatbuf(&fsdata)) {
 		debug("Error: allocating memory\n");
 		count = -ENOMEM;
 		goto exit;
 	}
-	fsdata.fatbufnum = -1;
 	dirs->fsdata = &fsdata;
 
 	for (count = 0; fat_itr_next(dirs); count++)
@@ -1927,7 +1923,7 @@ exit:
 static int check_path_prefix(loff_t prefix_clust, fat_itr *path_itr)
 {
 	fat_itr itr;
-	fsdata fsdata = { .fatbuf = NULL, }, *mydata = &fsdata;
+	fsdata fsdata = { .fatbuf = NULL, };
 	int ret;
 
 	/* duplicate fsdata */
@@ -1935,14 +1931,12 @@ static int check_path_prefix(loff_t prefix_clust, fat_itr *path_itr)
 	fsdata = *itr.fsdata;
 
 	/* allocate local fat buffer */
-	fsdata.fatbuf = malloc_cache_aligned(FATBUFSIZE);
-	if (!fsdata.fatbuf) {
+	if (alloc_fatbuf(&fsdata)) {
 		log_debug("Error: allocating memory\n");
 		ret = -ENOMEM;
 		goto exit;
 	}
 
-	fsdata.fatbufnum = -1;
 	itr.fsdata = &fsdata;
 
 	/* ensure iterator is at the first directory entry */
@@ -9,6 +9,7 @@
 
 #include <asm/unaligned.h>
 #include <div64.h>
+#include <env.h>
 #include <errno.h>
 #include <fs.h>
 #include <linux/types.h>
@@ -19,6 +20,7 @@
 #include <string.h>
 #include <squashfs.h>
 #include <part.h>
+#include <uthread.h>
 
 #include "sqfs_decompressor.h"
 #include "sqfs_filesystem.h"
@@ -27,6 +29,7 @@
 #define MAX_SYMLINK_NEST 8
 
 static struct squashfs_ctxt ctxt;
+static struct squashfs_cache_stats sqfs_stats;
 static int symlinknest;
 
 static int sqfs_readdir_nest(struct fs_dir_stream *fs_dirs, struct fs_dirent **dentp);
@@ -98,9 +101,102 @@ static int sqfs_calc_n_blks(__le64 start, __le64 end, u64 *offset)
 	return DIV_ROUND_UP(table_size + *offset, ctxt.cur_dev->blksz);
 }
 
+/*
+ * Looks up a decompressed block by its position in the image. The data stays
+ * valid until the next sqfs_cache_put() or until another image is probed.
+ */
+static void *sqfs_cache_get(u64 start)
+{
+	int i;
+
+	for (i = 0; i < SQFS_CACHED_BLOCKS; i++) {
+		struct squashfs_cached_block *blk = &ctxt.blocks[i];
+
+		if (blk->data && blk->start == start) {
+			blk->age = ++ctxt.cache_tick;
+			sqfs_stats.block_hits++;
+			return blk->data;
+		}
+	}
+	sqfs_stats.block_misses++;
+
+	return NULL;
+}
+
+/*
+ * Adds a block to the cache, evicting the least recently used one. The cache
+ * takes ownership of 'data'.
+ */
+static void sqfs_cache_put(u64 start, void *data)
+{
+	struct squashfs_cached_block *victim = &ctxt.blocks[0];
+	int i;
+
+	for (i = 1; i < SQFS_CACHED_BLOCKS; i++) {
+		if (ctxt.blocks[i].age < victim->age)
+			victim = &ctxt.blocks[i];
+	}
+
+	free(victim->data);
+	victim->start = start;
+	victim->data = data;
+	victim->age = ++ctxt.cache_tick;
+}
+
+static void sqfs_put_tables(struct squashfs_tables *tables)
+{
+	if (!tables || --tables->refcount)
+		return;
+
+	free(tables->inode_table);
+	free(tables->dir_table);
+	free(tables->pos_list);
+	free(tables);
+}
+
+static void sqfs_cache_free(void)
+{
+	int i;
+
+	sqfs_put_tables(ctxt.tables);
+	ctxt.tables = NULL;
+
+	for (i = 0; i < SQFS_CACHED_BLOCKS; i++) {
+		free(ctxt.blocks[i].data);
+		ctxt.blocks[i].data = NULL;
+		ctxt.blocks[i].age = 0;
+	}
+	ctxt.cache_tick = 0;
+}
+
+/*
+ * Drops the caches unless they belong to the image with superblock 'sblk'
+ * on the device being probed. Each command probes and closes the filesystem
+ * again, so this is what lets one command reuse what another decompressed.
+ */
+static void sqfs_cache_check(struct squashfs_super_block *sblk)
+{
+	if (ctxt.cache_dev == ctxt.cur_dev &&
+	    ctxt.cache_start == ctxt.cur_part_info.start &&
+	    !memcmp(&ctxt.cache_sblk, sblk, sizeof(*sblk)))
+		return;
+
+	sqfs_cache_free();
+	ctxt.cache_dev = ctxt.cur_dev;
+	ctxt.cache_start = ctxt.cur_part_info.start;
+	memcpy(&ctxt.cache_sblk, sblk, sizeof(*sblk));
+}
+
+void sqfs_cache_stats(struct squashfs_cache_stats *stats)
+{
+	memcpy(stats, &sqfs_stats, sizeof(*stats));
+	memset(&sqfs_stats, '\0', sizeof(sqfs_stats));
+}
+
 /*
  * Retrieves fragment block entry and returns true if the fragment block is
- * compressed
+ * compressed. Both the fragment index table and the metadata block holding
+ * the entry are cached until another image is probed.
  */
 static int sqfs_frag_lookup(u32 inode_fragment_index,
 			    struct squashfs_fragment_block_entry *e)
@@ -115,7 +211,6 @@ static int sqfs_frag_lookup(u32 inode_fragment_index,
 
 	metadata_buffer = NULL;
 	entries = NULL;
-	table = NULL;
 
 	if (inode_fragment_index >= get_unaligned_le32(&sblk->fragments))
 		return -EINVAL;
@@ -130,18 +225,19 @@ static int sqfs_frag_lookup(u32 inode_fragment_index,
 	n_blks = sqfs_calc_n_blks(sblk->fragment_table_start,
 				  cpu_to_le64(end), &table_offset);
 
-	start /= ctxt.cur_dev->blksz;
-
-	/* Allocate a proper sized buffer to store the fragment index table */
-	table = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
+	table = sqfs_cache_get(start);
 	if (!table) {
-		ret = -ENOMEM;
-		goto out;
-	}
+		/* Allocate a proper sized buffer to store the fragment index table */
+		table = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
+		if (!table)
+			return -ENOMEM;
 
-	if (sqfs_disk_read(start, n_blks, table) < 0) {
-		ret = -EINVAL;
-		goto out;
+		if (sqfs_disk_read(start / ctxt.cur_dev->blksz, n_blks,
+				   table) < 0) {
+			free(table);
+			return -EINVAL;
+		}
+		sqfs_cache_put(start, table);
 	}
 
 	block = SQFS_FRAGMENT_INDEX(inode_fragment_index);
@@ -154,6 +250,10 @@ static int sqfs_frag_lookup(u32 inode_fragment_index,
 	start_block = get_unaligned_le64(table + table_offset + block *
 					 sizeof(u64));
 
+	entries = sqfs_cache_get(start_block);
+	if (entries)
+		goto found;
+
 	start = start_block / ctxt.cur_dev->blksz;
 	n_blks = sqfs_calc_n_blks(cpu_to_le64(start_block),
 				  sblk->fragment_table_start, &table_offset);
@@ -197,13 +297,16 @@ static int sqfs_frag_lookup(u32 inode_fragment_index,
 		memcpy(entries, metadata, SQFS_METADATA_SIZE(header));
 	}
 
+	sqfs_cache_put(start_block, entries);
+
+found:
 	*e = entries[offset];
 	ret = SQFS_COMPRESSED_BLOCK(e->size);
+	entries = NULL;
 
 out:
 	free(entries);
 	free(metadata_buffer);
-	free(table);
 
 	return ret;
 }
@@ -905,13 +1008,51 @@ out:
 	return metablks_count;
 }
 
+/*
+ * Returns the decompressed inode and directory tables, reading them on the
+ * first call after mounting. The caller must release them with
+ * sqfs_put_tables().
+ */
+static struct squashfs_tables *sqfs_get_tables(void)
+{
+	struct squashfs_tables *tables = ctxt.tables;
+
+	if (tables) {
+		sqfs_stats.table_hits++;
+		tables->refcount++;
+		return tables;
+	}
+	sqfs_stats.table_misses++;
+
+	tables = calloc(1, sizeof(*tables));
+	if (!tables)
+		return NULL;
+
+	if (sqfs_read_inode_table(&tables->inode_table)) {
+		free(tables);
+		return NULL;
+	}
+
+	tables->metablks_count = sqfs_read_directory_table(&tables->dir_table,
+							   &tables->pos_list);
+	if (tables->metablks_count < 1) {
+		free(tables->inode_table);
+		free(tables);
+		return NULL;
+	}
+
+	/* One reference for the mount, one for the caller */
+	tables->refcount = 2;
+	ctxt.tables = tables;
+
+	return tables;
+}
+
 static int sqfs_opendir_nest(const char *filename, struct fs_dir_stream **dirsp)
 {
-	unsigned char *inode_table = NULL, *dir_table = NULL;
-	int j, token_count = 0, ret = 0, metablks_count;
+	int j, token_count = 0, ret = 0;
 	struct squashfs_dir_stream *dirs;
 	char **token_list = NULL, *path = NULL;
-	u32 *pos_list = NULL;
 
 	dirs = calloc(1, sizeof(*dirs));
 	if (!dirs)
@@ -924,14 +1065,8 @@ static int sqfs_opendir_nest(const char *filename, struct fs_dir_stream **dirsp)
 	dirs->inode_table = NULL;
 	dirs->dir_table = NULL;
 
-	ret = sqfs_read_inode_table(&inode_table);
-	if (ret) {
-		ret = -EINVAL;
-		goto out;
-	}
-
-	metablks_count = sqfs_read_directory_table(&dir_table, &pos_list);
-	if (metablks_count < 1) {
+	dirs->tables = sqfs_get_tables();
+	if (!dirs->tables) {
 		ret = -EINVAL;
 		goto out;
 	}
@@ -963,10 +1098,11 @@ static int sqfs_opendir_nest(const char *filename, struct fs_dir_stream **dirsp)
 	 * ldir's (extended directory) size is greater than dir, so it works as
 	 * a general solution for the malloc size, since 'i' is a union.
 	 */
-	dirs->inode_table = inode_table;
-	dirs->dir_table = dir_table;
-	ret = sqfs_search_dir(dirs, token_list, token_count, pos_list,
-			      metablks_count);
+	dirs->inode_table = dirs->tables->inode_table;
+	dirs->dir_table = dirs->tables->dir_table;
+	ret = sqfs_search_dir(dirs, token_list, token_count,
+			      dirs->tables->pos_list,
+			      dirs->tables->metablks_count);
 	if (ret)
 		goto out;
 
@@ -992,10 +1128,10 @@ out:
 			free(token_list[j]);
 		free(token_list);
 	}
-	free(pos_list);
 	free(path);
 	if (ret) {
-		free(inode_table);
+		sqfs_put_tables(dirs->tables);
+		free(dirs->dir_header);
 		free(dirs);
 	}
 
@@ -1151,6 +1287,7 @@ int sqfs_probe(struct blk_desc *fs_dev_desc, struct disk_partition *fs_partition
 	}
 
 	ctxt.sblk = sblk;
+	sqfs_cache_check(sblk);
 
 	ret = sqfs_decompressor_init(&ctxt);
 	if (ret) {
@@ -1159,6 +1296,8 @@ int sqfs_probe(struct blk_desc *fs_dev_desc, struct disk_partition *fs_partition
 
 	return 0;
 error:
+	sqfs_cache_free();
+	ctxt.cache_dev = NULL;
 	ctxt.cur_dev = NULL;
 	free(ctxt.sblk);
 	ctxt.sblk = NULL;
@@ -1360,6 +1499,175 @@ static int sqfs_get_lregfile_info(struct squashfs_lreg_inode *lreg,
 	return datablk_count;
 }
 
+/* Number of data blocks the reader thread may get ahead of the decompressor */
+#define SQFS_PIPE_DEPTH 4
+
+/**
+ * struct sqfs_pipe_slot - a data block read ahead of the decompressor
+ *
+ * @buf: buffer holding the disk blocks covering the data block
+ * @data: start of the data block within @buf, NULL for a sparse block
+ * @ret: result of reading the data block
+ * @ready: true once the reader thread has filled the slot
+ */
+struct sqfs_pipe_slot {
+	char *buf;
+	char *data;
+	int ret;
+	bool ready;
+};
+
+/**
+ * struct sqfs_pipe - state shared by the reader thread and sqfs_read_nest()
+ *
+ * @slot: ring of read-ahead data blocks
+ * @blk_sizes: on-disk sizes of the data blocks
+ * @data_offset: position of the first data block in the image
+ * @count: number of data blocks to read
+ * @consumed: number of data blocks released by the decompressor
+ * @grp_id: uthread group of the reader thread
+ * @stop: tells the reader thread to stop early
+ */
+struct sqfs_pipe {
+	struct sqfs_pipe_slot slot[SQFS_PIPE_DEPTH];
+	const u32 *blk_sizes;
+	u64 data_offset;
+	int count;
+	int consumed;
+	unsigned int grp_id;
+	bool stop;
+};
+
+/*
+ * Runs in a uthread and reads the data blocks of a file into the pipe slots.
+ * Block drivers yield while waiting for the hardware, which lets the
+ * decompressor work on the previous block in the meantime.
+ */
+static void sqfs_pipe_reader(void *arg)
+{
+	u32 block_size = get_unaligned_le32(&ctxt.sblk->block_size);
+	struct sqfs_pipe *pipe = arg;
+	u64 data_offset = pipe->data_offset;
+	int j;
+
+	for (j = 0; j < pipe->count; j++) {
+		struct sqfs_pipe_slot *slot = &pipe->slot[j % SQFS_PIPE_DEPTH];
+		u64 start, n_blks, table_offset;
+		u32 table_size;
+
+		while (j - pipe->consumed >= SQFS_PIPE_DEPTH && !pipe->stop)
+			uthread_schedule();
+		if (pipe->stop)
+			break;
+
+		table_size = SQFS_BLOCK_SIZE(pipe->blk_sizes[j]);
+		slot->data = NULL;
+		slot->ret = 0;
+		if (pipe->blk_sizes[j] && table_size > block_size) {
+			slot->ret = -EINVAL;
+		} else if (pipe->blk_sizes[j]) {
+			start = lldiv(data_offset, ctxt.cur_dev->blksz);
+			table_offset = data_offset - start * ctxt.cur_dev->blksz;
+			n_blks = DIV_ROUND_UP(table_size + table_offset,
+					      ctxt.cur_dev->blksz);
+			slot->ret = sqfs_disk_read(start, n_blks, slot->buf);
+			if (slot->ret >= 0) {
+				slot->data = slot->buf + table_offset;
+				slot->ret = 0;
+			}
+		}
+		slot->ready = true;
+		if (slot->ret)
+			break;
+
+		data_offset += table_size;
+	}
+}
+
+/*
+ * Starts a reader thread for the data blocks of a file. Returns NULL when the
+ * blocks should be read in line instead.
+ */
+static struct sqfs_pipe *sqfs_pipe_start(const u32 *blk_sizes, int count,
+					 u64 data_offset)
+{
+	u32 block_size = get_unaligned_le32(&ctxt.sblk->block_size);
+	struct sqfs_pipe *pipe;
+	size_t size;
+	int i;
+
+	if (!CONFIG_IS_ENABLED(FS_SQUASHFS_PIPELINE) || count < 2 ||
+	    !env_get_yesno("sqfs_pipeline"))
+		return NULL;
+
+	pipe = calloc(1, sizeof(*pipe));
+	if (!pipe)
+		return NULL;
+
+	size = (DIV_ROUND_UP(block_size, ctxt.cur_dev->blksz) + 1) *
+		ctxt.cur_dev->blksz;
+	for (i = 0; i < SQFS_PIPE_DEPTH; i++) {
+		pipe->slot[i].buf = malloc_cache_aligned(size);
+		if (!pipe->slot[i].buf)
+			goto err;
+	}
+
+	pipe->blk_sizes = blk_sizes;
+	pipe->data_offset = data_offset;
+	pipe->count = count;
+	pipe->grp_id = uthread_grp_new_id();
+	if (uthread_create(NULL, sqfs_pipe_reader, pipe, 0, pipe->grp_id))
+		goto err;
+
+	return pipe;
+
+err:
+	for (i = 0; i < SQFS_PIPE_DEPTH; i++)
+		free(pipe->slot[i].buf);
+	free(pipe);
+
+	return NULL;
+}
+
+/* Waits for data block 'j' and returns it in 'data' */
+static int sqfs_pipe_get(struct sqfs_pipe *pipe, int j, char **data)
+{
+	struct sqfs_pipe_slot *slot = &pipe->slot[j % SQFS_PIPE_DEPTH];
+
+	while (!slot->ready) {
+		/* The reader gave up before getting this far */
+		if (uthread_grp_done(pipe->grp_id))
+			return -EIO;
+		uthread_schedule();
+	}
+	*data = slot->data;
+
+	return slot->ret;
+}
+
+/* Hands the slot of data block 'j' back to the reader thread */
+static void sqfs_pipe_release(struct sqfs_pipe *pipe, int j)
+{
+	pipe->slot[j % SQFS_PIPE_DEPTH].ready = false;
+	pipe->consumed = j + 1;
+}
+
+static void sqfs_pipe_stop(struct sqfs_pipe *pipe)
+{
+	int i;
+
+	if (!pipe)
+		return;
+
+	pipe->stop = true;
+	while (!uthread_grp_done(pipe->grp_id))
+		uthread_schedule();
+
+	for (i = 0; i < SQFS_PIPE_DEPTH; i++)
+		free(pipe->slot[i].buf);
+	free(pipe);
+}
+
 static int sqfs_read_nest(const char *filename, void *buf, loff_t offset,
 			  loff_t len, loff_t *actread)
 {
@@ -1371,6 +1679,7 @@ static int sqfs_read_nest(const char *filename, void *buf, loff_t offset,
 	struct squashfs_fragment_block_entry frag_entry;
 	struct squashfs_file_info finfo = {0};
 	struct squashfs_symlink_inode *symlink;
+	struct sqfs_pipe *pipe = NULL;
 	struct fs_dir_stream *dirsp = NULL;
 	struct squashfs_dir_stream *dirs;
 	struct squashfs_lreg_inode *lreg;
@@ -1502,6 +1811,8 @@ static int sqfs_read_nest(const char *filename, void *buf, loff_t offset,
 		}
 	}
 
+	pipe = sqfs_pipe_start(finfo.blk_sizes, datablk_count, data_offset);
+
 	for (j = 0; j < datablk_count; j++) {
 		char *data_buffer;
 
@@ -1511,8 +1822,14 @@ static int sqfs_read_nest(const char *filename, void *buf, loff_t offset,
 		n_blks = DIV_ROUND_UP(table_size + table_offset,
 				      ctxt.cur_dev->blksz);
 
-		/* Don't load any data for sparse blocks */
-		if (finfo.blk_sizes[j] == 0) {
+		if (pipe) {
+			/* The reader thread has loaded the block already */
+			data_buffer = NULL;
+			ret = sqfs_pipe_get(pipe, j, &data);
+			if (ret)
+				goto out;
+		} else if (finfo.blk_sizes[j] == 0) {
+			/* Don't load any data for sparse blocks */
 			n_blks = 0;
 			table_offset = 0;
 			data_buffer = NULL;
@@ -1567,10 +1884,16 @@ static int sqfs_read_nest(const char *filename, void *buf, loff_t offset,
 
 		data_offset += table_size;
 		free(data_buffer);
+		if (pipe)
+			sqfs_pipe_release(pipe, j);
 		if (*actread >= len)
 			break;
 	}
 
+	/* The fragment is read in line, so the reader must be done by now */
+	sqfs_pipe_stop(pipe);
+	pipe = NULL;
+
 	/*
 	 * There is no need to continue if the file is not fragmented.
 	 */
@@ -1579,6 +1902,14 @@ static int sqfs_read_nest(const char *filename, void *buf, loff_t offset,
 		goto out;
 	}
 
+	/*
+	 * Fragment blocks are shared by many small files, so keep the
+	 * decompressed block around for the next file in the same fragment.
+	 */
+	fragment_block = sqfs_cache_get(frag_entry.start);
+	if (fragment_block)
+		goto copy_fragment;
+
 	start = lldiv(frag_entry.start, ctxt.cur_dev->blksz);
 	table_size = SQFS_BLOCK_SIZE(frag_entry.size);
 	table_offset = frag_entry.start - (start * ctxt.cur_dev->blksz);
@@ -1600,15 +1931,15 @@ static int sqfs_read_nest(const char *filename, void *buf, loff_t offset,
 	if (ret < 0)
 		goto out;
 
-	/* File compressed and fragmented */
-	if (finfo.frag && finfo.comp) {
-		dest_len = get_unaligned_le32(&sblk->block_size);
-		fragment_block = malloc(dest_len);
-		if (!fragment_block) {
-			ret = -ENOMEM;
-			goto out;
-		}
+	dest_len = get_unaligned_le32(&sblk->block_size);
+	fragment_block = malloc(dest_len);
+	if (!fragment_block) {
+		ret = -ENOMEM;
+		goto out;
+	}
 
+	/* File compressed and fragmented */
+	if (finfo.comp) {
 		ret = sqfs_decompress(&ctxt, fragment_block, &dest_len,
 				      (void *)fragment  + table_offset,
 				      frag_entry.size);
@@ -1616,20 +1947,20 @@ static int sqfs_read_nest(const char *filename, void *buf, loff_t offset,
 			free(fragment_block);
 			goto out;
 		}
+	} else {
+		memcpy(fragment_block, (void *)fragment + table_offset,
+		       min_t(u32, table_size, dest_len));
+	}
 
-		memcpy(buf + *actread, &fragment_block[finfo.offset], finfo.size - *actread);
-		*actread = finfo.size;
-
-		free(fragment_block);
-
-	} else if (finfo.frag && !finfo.comp) {
-		fragment_block = (void *)fragment + table_offset;
+	sqfs_cache_put(frag_entry.start, fragment_block);
 
-		memcpy(buf + *actread, &fragment_block[finfo.offset], finfo.size - *actread);
-		*actread = finfo.size;
-	}
+copy_fragment:
+	memcpy(buf + *actread, &fragment_block[finfo.offset], finfo.size - *actread);
+	*actread = finfo.size;
+	ret = 0;
 
 out:
+	sqfs_pipe_stop(pipe);
 	free(fragment);
 	free(datablock);
 	free(file);
@@ -1796,6 +2127,7 @@ int sqfs_size(const char *filename, loff_t *size)
 
 void sqfs_close(void)
 {
+	/* The caches are kept for the next command on the same image */
 	sqfs_decompressor_cleanup(&ctxt);
 	free(ctxt.sblk);
 	ctxt.sblk = NULL;
@@ -1810,8 +2142,7 @@ void sqfs_closedir(struct fs_dir_stream *dirs)
 		return;
 
 	sqfs_dirs = (struct squashfs_dir_stream *)dirs;
-	free(sqfs_dirs->inode_table);
-	free(sqfs_dirs->dir_table);
+	sqfs_put_tables(sqfs_dirs->tables);
 	free(sqfs_dirs->dir_header);
 	free(sqfs_dirs);
 }
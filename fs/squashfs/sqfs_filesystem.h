@@ -71,6 +71,28 @@ struct squashfs_super_block {
 	__le64 export_table_start;
 };
 
+/* Number of decompressed metadata and fragment blocks kept per mount */
+#define SQFS_CACHED_BLOCKS 4
+
+/*
+ * Decompressed inode and directory tables. They are shared by the mount and
+ * every directory stream using them, and freed when the last one lets go.
+ */
+struct squashfs_tables {
+	int refcount;
+	unsigned char *inode_table;
+	unsigned char *dir_table;
+	u32 *pos_list;
+	int metablks_count;
+};
+
+/* A decompressed block, identified by its position in the image */
+struct squashfs_cached_block {
+	u64 start;
+	void *data;
+	u32 age;
+};
+
 struct squashfs_ctxt {
 	struct disk_partition cur_part_info;
 	struct blk_desc *cur_dev;
@@ -78,6 +100,16 @@ struct squashfs_ctxt {
 #if IS_ENABLED(CONFIG_ZSTD)
 	void *zstd_workspace;
 #endif
+	/*
+	 * Caches below are kept across sqfs_close() and dropped when an image
+	 * with another superblock, or on another device, is probed
+	 */
+	struct blk_desc *cache_dev;
+	lbaint_t cache_start;
+	struct squashfs_super_block cache_sblk;
+	struct squashfs_tables *tables;
+	struct squashfs_cached_block blocks[SQFS_CACHED_BLOCKS];
+	u32 cache_tick;
 };
 
 struct squashfs_directory_index {
@@ -272,8 +304,9 @@ struct squashfs_dir_stream {
 	struct squashfs_ldir_inode i_ldir;
 	/*
 	 * References to the tables' beginnings. They are assigned in
-	 * sqfs_opendir() and freed in sqfs_closedir().
+	 * sqfs_opendir() and 'tables' is released in sqfs_closedir().
 	 */
+	struct squashfs_tables *tables;
 	unsigned char *inode_table;
 	unsigned char *dir_table;
 };
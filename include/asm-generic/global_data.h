@@ -29,6 +29,7 @@
 #include <asm-offsets.h>
 
 struct acpi_ctx;
+struct dm_compat_index;
 struct driver_rt;
 struct upl;
 
@@ -246,6 +247,13 @@ struct global_data {
 	/** @dm_driver_rt: Dynamic info about the driver */
 	struct driver_rt *dm_driver_rt;
 # endif
+#if CONFIG_IS_ENABLED(DM_COMPAT_INDEX)
+	/**
+	 * @dm_compat_index: Index of the compatible strings of all drivers,
+	 * built by the first lists_bind_fdt()
+	 */
+	struct dm_compat_index *dm_compat_index;
+#endif
 #if CONFIG_IS_ENABLED(OF_PLATDATA_RT)
 	/** @dm_udevice_rt: Dynamic info about the udevice */
 	struct udevice_rt *dm_udevice_rt;
@@ -483,6 +491,14 @@ static_assert(sizeof(struct global_data) == GD_SIZE);
 #define gd_dm_driver_rt()		NULL
 #endif
 
+#if CONFIG_IS_ENABLED(DM_COMPAT_INDEX)
+#define gd_set_dm_compat_index(idx)	gd->dm_compat_index = idx
+#define gd_dm_compat_index()		gd->dm_compat_index
+#else
+#define gd_set_dm_compat_index(idx)
+#define gd_dm_compat_index()		NULL
+#endif
+
 #if CONFIG_IS_ENABLED(OF_PLATDATA_RT)
 #define gd_set_dm_udevice_rt(dyn)	gd->dm_udevice_rt = dyn
 #define gd_dm_udevice_rt()		gd->dm_udevice_rt
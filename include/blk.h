@@ -140,6 +140,31 @@ void blkcache_fill(int iftype, int dev,
 		   lbaint_t start, lbaint_t blkcnt,
 		   unsigned long blksz, void const *buffer);
 
+/**
+ * blkcache_readahead() - widen a missed read so that it fills whole lines
+ *
+ * Rounds the request out to cache-line boundaries and, if it follows on
+ * from the previous request to the same device, extends it by the
+ * configured readahead. The caller reads the returned range into the
+ * returned buffer, passes it to blkcache_fill() and copies out its data.
+ *
+ * @param iftype - uclass_id_x for type of device
+ * @param dev - device index of particular type
+ * @param start - starting block number
+ * @param blkcnt - number of blocks requested
+ * @param blksz - size in bytes of each block
+ * @param lba - number of blocks on the device, 0 if unknown
+ * @param ra_startp - returns the first block to read
+ * @param ra_cntp - returns the number of blocks to read
+ *
+ * Return: cache-aligned buffer to read into, or NULL to read the request
+ * as-is
+ */
+void *blkcache_readahead(int iftype, int dev,
+			 lbaint_t start, lbaint_t blkcnt,
+			 unsigned long blksz, lbaint_t lba,
+			 lbaint_t *ra_startp, lbaint_t *ra_cntp);
+
 /**
  * blkcache_invalidate() - discard the cache for a set of blocks
  * because of a write or device (re)initialization.
@@ -149,14 +174,30 @@ void blkcache_fill(int iftype, int dev,
  */
 void blkcache_invalidate(int iftype, int dev);
 
+/**
+ * blkcache_remove() - discard the cache and statistics of a device
+ * because it is being removed.
+ *
+ * @iftype - UCLASS_ID_ for type of device
+ * @dev - device index of particular type
+ */
+void blkcache_remove(int iftype, int dev);
+
 /**
  * blkcache_configure() - configure block cache
  *
- * @param blocks - maximum blocks per entry
+ * @param blocks - blocks per entry (cache line), rounded up to a power of two
  * @param entries - maximum entries in cache
  */
 void blkcache_configure(unsigned blocks, unsigned entries);
 
+/**
+ * blkcache_set_readahead() - set the sequential readahead
+ *
+ * @param blocks - blocks to read ahead of a sequential miss, 0 to disable
+ */
+void blkcache_set_readahead(unsigned blocks);
+
 /*
  * statistics of the block cache
  */
@@ -166,6 +207,20 @@ struct block_cache_stats {
 	unsigned entries; /* current entry count */
 	unsigned max_blocks_per_entry;
 	unsigned max_entries;
+	unsigned readahead; /* blocks read ahead on a sequential miss */
+	unsigned sets; /* sets currently allocated, 0 if none */
+	unsigned ways; /* entries per set */
+};
+
+/*
+ * per-device statistics of the block cache
+ */
+struct block_cache_dev_stats {
+	int iftype;
+	int devnum;
+	unsigned hits;
+	unsigned misses;
+	unsigned long readahead; /* blocks read but not requested */
 };
 
 /**
@@ -175,6 +230,16 @@ struct block_cache_stats {
  */
 void blkcache_stats(struct block_cache_stats *stats);
 
+/**
+ * blkcache_dev_stats() - return statistics for a device and reset
+ *
+ * @param seq - index of the device, counting from 0 in order of first use
+ * @param stats - statistics are copied here
+ *
+ * Return: 0 if OK, -ENOENT if there is no device with that index
+ */
+int blkcache_dev_stats(int seq, struct block_cache_dev_stats *stats);
+
 /** blkcache_free() - free all memory allocated to the block cache */
 void blkcache_free(void);
 
@@ -191,14 +256,47 @@ static inline void blkcache_fill(int iftype, int dev,
 				 lbaint_t start, lbaint_t blkcnt,
 				 unsigned long blksz, void const *buffer) {}
 
+static inline void *blkcache_readahead(int iftype, int dev,
+				       lbaint_t start, lbaint_t blkcnt,
+				       unsigned long blksz, lbaint_t lba,
+				       lbaint_t *ra_startp, lbaint_t *ra_cntp)
+{
+	return NULL;
+}
+
 static inline void blkcache_invalidate(int iftype, int dev) {}
 
+static inline void blkcache_remove(int iftype, int dev) {}
+
 static inline void blkcache_free(void) {}
 
 #endif
 
 struct udevice;
 
+/**
+ * struct blk_req - a read or write which is submitted to a block device
+ *
+ * The request belongs to the caller, who must keep it, and the buffer, until
+ * the driver's poll() operation returns it.
+ *
+ * @start: Start block number (0=first)
+ * @blkcnt: Number of blocks
+ * @buffer: Data to write, or place to put the data read
+ * @write: true to write, false to read
+ * @result: Set by the driver when the request is finished: number of blocks
+ *	transferred, or -ve error number
+ * @priv: For the driver's use while the request is in flight
+ */
+struct blk_req {
+	lbaint_t start;
+	lbaint_t blkcnt;
+	void *buffer;
+	bool write;
+	long result;
+	ulong priv[2];
+};
+
 /* Operations on block devices */
 struct blk_ops {
 	/**
@@ -258,6 +356,36 @@ struct blk_ops {
 	 */
 	int (*select_hwpart)(struct udevice *dev, int hwpart);
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	/**
+	 * submit() - start a read or write without waiting for it
+	 *
+	 * Requests may finish in any order. The driver must not wait for
+	 * other requests to finish before accepting this one.
+	 *
+	 * @dev:	Device to access
+	 * @req:	Request to start
+	 * @return 0 if submitted, -EBUSY if the device cannot take another
+	 * request until one finishes, -ENOSYS if the device cannot queue
+	 * requests at all (read() or write() is used instead), other -ve
+	 * error number on failure
+	 */
+	int (*submit)(struct udevice *dev, struct blk_req *req);
+
+	/**
+	 * poll() - collect a finished request
+	 *
+	 * This checks for a request which has finished, without waiting.
+	 * Each submitted request is returned once, with its @result set. A
+	 * request which the driver gives up on, e.g. after a timeout, is
+	 * returned with an error.
+	 *
+	 * @dev:	Device to check
+	 * @return finished request, or NULL if none has finished yet
+	 */
+	struct blk_req *(*poll)(struct udevice *dev);
+#endif
+
 #if IS_ENABLED(CONFIG_BOUNCE_BUFFER)
 	/**
 	 * buffer_aligned() - test memory alignment of block operation buffer
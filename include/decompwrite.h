@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Decompress an image to a block device as it arrives
+ */
+
+#ifndef __DECOMPWRITE_H
+#define __DECOMPWRITE_H
+
+#include <linux/types.h>
+
+struct blk_desc;
+struct decompwrite;
+
+/**
+ * decompwrite_init() - start writing a compressed image as it arrives
+ *
+ * The format of the image is taken from its magic number: gzip, zstd or
+ * LZ4 frame. It is decompressed with a fixed amount of memory, whatever the
+ * size of the image: the write buffer, plus the zstd window or two LZ4
+ * blocks. The image is given in pieces of any size through
+ * decompwrite_write(). For gzip and zstd, the first piece must hold the
+ * whole header of the image.
+ *
+ * @dev:	block device descriptor
+ * @szwritebuf:	bytes per write, a multiple of the block size
+ * @start:	first block to write
+ * @count:	number of blocks available from @start
+ * Return: stream, or NULL on error
+ */
+struct decompwrite *decompwrite_init(struct blk_desc *dev, ulong szwritebuf,
+				     u64 start, u64 count);
+
+/**
+ * decompwrite_write() - decompress and write the next piece of an image
+ *
+ * @dw:		stream
+ * @src:	compressed data, which is not needed once this returns
+ * @len:	number of bytes at @src
+ * Return: 0 if OK, -ve on error
+ */
+int decompwrite_write(struct decompwrite *dw, const void *src, ulong len);
+
+/**
+ * decompwrite_finish() - write the end of an image and check it
+ *
+ * This frees @dw in any case.
+ *
+ * @dw:		stream
+ * @sizep:	returns the uncompressed size
+ * Return: 0 if the image was complete and passed the checks of its format,
+ *	-ve on error
+ */
+int decompwrite_finish(struct decompwrite *dw, u64 *sizep);
+
+/**
+ * decompwrite() - decompress and write an image from memory to a block device
+ *
+ * @src:	compressed image address
+ * @len:	compressed image length in bytes
+ * @dev:	block device descriptor
+ * @szwritebuf:	bytes per write (pad to erase size)
+ * @startoffs:	offset in bytes of first write
+ * @szexpected:	expected uncompressed length, or 0 to not check it
+ * Return: 0 if OK, -ve on error
+ */
+int decompwrite(const void *src, ulong len, struct blk_desc *dev,
+		ulong szwritebuf, u64 startoffs, u64 szexpected);
+
+#endif
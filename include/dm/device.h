@@ -298,12 +298,25 @@ static inline __attribute_const__ bool dev_has_ofnode(const struct udevice *dev)
 #endif
 }
 
+#if CONFIG_IS_ENABLED(DM_UCLASS_INDEX) && CONFIG_IS_ENABLED(OF_REAL)
+/**
+ * dev_set_ofnode() - Set the device tree node of a device
+ *
+ * This also moves the device to its new node and phandle in the index of its
+ * uclass, so that lookups by either find it.
+ *
+ * @dev: Device to update
+ * @node: New node
+ */
+void dev_set_ofnode(struct udevice *dev, ofnode node);
+#else
 static inline void dev_set_ofnode(struct udevice *dev, ofnode node)
 {
 #if CONFIG_IS_ENABLED(OF_REAL)
 	dev->node_ = node;
 #endif
 }
+#endif
 
 static inline int dev_seq(const struct udevice *dev)
 {
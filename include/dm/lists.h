@@ -23,6 +23,21 @@
  */
 struct driver *lists_driver_lookup_name(const char *name);
 
+/**
+ * lists_driver_lookup_compat() - Find the driver for a compatible string
+ *
+ * This returns the first driver in the linker list whose of_match table
+ * holds @compat, which is the driver lists_bind_fdt() binds to a node with
+ * that compatible string. With CONFIG_DM_COMPAT_INDEX the driver is found
+ * through an index, which is built on the first call.
+ *
+ * @compat: Compatible string to look up
+ * @idp: Returns the entry for @compat in the driver's of_match table
+ * Return: pointer to driver, or NULL if not found
+ */
+struct driver *lists_driver_lookup_compat(const char *compat,
+					  const struct udevice_id **idp);
+
 /**
  * lists_uclass_lookup() - Return uclass_driver based on ID of the class
  *
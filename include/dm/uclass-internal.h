@@ -257,6 +257,31 @@ int uclass_find_device_by_phandle(enum uclass_id id, struct udevice *parent,
  */
 int uclass_bind_device(struct udevice *dev);
 
+#if CONFIG_IS_ENABLED(DM_UCLASS_INDEX)
+/**
+ * uclass_index_add() - Add a device to the index of its uclass
+ *
+ * This is called once the device is in its uclass's list of devices, and
+ * again after its name changes. It does nothing if the index is not built.
+ *
+ * @dev:	Pointer to the device
+ */
+void uclass_index_add(struct udevice *dev);
+
+/**
+ * uclass_index_del() - Remove a device from the index of its uclass
+ *
+ * This is called before the device leaves its uclass's list of devices, and
+ * before its name changes.
+ *
+ * @dev:	Pointer to the device
+ */
+void uclass_index_del(struct udevice *dev);
+#else
+static inline void uclass_index_add(struct udevice *dev) {}
+static inline void uclass_index_del(struct udevice *dev) {}
+#endif
+
 #if CONFIG_IS_ENABLED(DM_DEVICE_REMOVE)
 /**
  * uclass_pre_unbind_device() - Prepare to deassociate device with a uclass
@@ -30,12 +30,17 @@
  * @dev_head: List of devices in this uclass (devices are attached to their
  * uclass when their bind method is called)
  * @sibling_node: Next uclass in the linked list of uclasses
+ * @index_: Hash tables to find devices by sequence number, name, node or
+ * phandle, or NULL if not built yet (do not access outside driver model)
  */
 struct uclass {
 	void *priv_;
 	struct uclass_driver *uc_drv;
 	struct list_head dev_head;
 	struct list_head sibling_node;
+#if CONFIG_IS_ENABLED(DM_UCLASS_INDEX)
+	struct uclass_index *index_;
+#endif
 };
 
 struct driver;
@@ -30,6 +30,16 @@ struct disk_partition;
 #define FAT16BUFSIZE	(FATBUFSIZE/2)
 #define FAT32BUFSIZE	(FATBUFSIZE/4)
 
+/*
+ * Number of extra read-only FAT windows kept by get_fatent(), in addition to
+ * fatbuf. SPL keeps to the single window to save memory.
+ */
+#if defined(CONFIG_FS_FAT_CACHE_WINDOWS) && !defined(CONFIG_XPL_BUILD)
+#define FATCACHE_WINDOWS	CONFIG_FS_FAT_CACHE_WINDOWS
+#else
+#define FATCACHE_WINDOWS	0
+#endif
+
 /* Maximum number of entry for long file name according to spec */
 #define MAX_LFN_SLOT	20
 
@@ -175,6 +185,9 @@ typedef struct {
 	__u32	root_cluster;	/* First cluster of root dir for FAT32 */
 	u32	total_sect;	/* Number of sectors */
 	int	fats;		/* Number of FATs */
+	int	fatwinnum[FATCACHE_WINDOWS];	/* FAT block held in each window */
+	__u32	fatwinage[FATCACHE_WINDOWS];	/* LRU stamp of each window */
+	__u32	fatwintick;	/* LRU clock for the windows */
 } fsdata;
 
 struct fat_itr;
@@ -6,6 +6,8 @@
 #ifndef _FB_MMC_H_
 #define _FB_MMC_H_
 
+#include <linux/types.h>
+
 struct blk_desc;
 struct disk_partition;
 
@@ -39,4 +41,57 @@ void fastboot_mmc_flash_write(const char *cmd, void *download_buffer,
  * @response: Pointer to fastboot response buffer
  */
 void fastboot_mmc_erase(const char *cmd, char *response);
+
+/**
+ * fastboot_mmc_stream_arm() - Flash downloads to eMMC while they arrive
+ *
+ * Each following download is written to the partition while it is
+ * received, until this is called again without a partition. The
+ * partition named by the "flash" command is only known once the download
+ * is complete, so a download is written to this partition whatever the
+ * "flash" command which follows it says.
+ *
+ * @cmd: Named partition to write downloads to, or NULL or "" to stop
+ * @response: Pointer to fastboot response buffer
+ */
+void fastboot_mmc_stream_arm(const char *cmd, char *response);
+
+/**
+ * fastboot_mmc_stream_limit() - Get the largest download which can be flashed
+ *				 while it arrives
+ *
+ * Return: Maximum download size, or 0 if fastboot_mmc_stream_arm() was not
+ *	   given a partition
+ */
+u32 fastboot_mmc_stream_limit(void);
+
+/**
+ * fastboot_mmc_stream_start() - Start flashing a download
+ *
+ * @response: Pointer to fastboot response buffer
+ * Return: 0 if OK, -ve on error (with a FAIL response)
+ */
+int fastboot_mmc_stream_start(char *response);
+
+/**
+ * fastboot_mmc_stream_write() - Flash the next piece of a download
+ *
+ * @data: Pointer to received data
+ * @len: Length of received data
+ * Return: 0 if OK, -ve on error
+ */
+int fastboot_mmc_stream_write(const void *data, u32 len);
+
+/**
+ * fastboot_mmc_stream_finish() - Finish flashing a download
+ *
+ * This writes out the end of the image and sends OKAY with the time spent
+ * receiving, writing while receiving, and writing afterwards. If @cmd is not
+ * the partition given to fastboot_mmc_stream_arm() this fails, but by then
+ * most of the image has already been written to that partition.
+ *
+ * @cmd: Named partition given to the "flash" command
+ * @response: Pointer to fastboot response buffer
+ */
+void fastboot_mmc_stream_finish(const char *cmd, char *response);
 #endif
@@ -80,6 +80,49 @@ void gzwrite_progress_finish(int retcode, ulong totalwritten, ulong totalsize,
 int gzwrite(unsigned char *src, int len, struct blk_desc *dev, ulong szwritebuf,
 	    ulong startoffs, ulong szexpected);
 
+struct gzwrite_stream;
+
+/**
+ * gzwrite_stream_init() - start writing a gzipped image as it arrives
+ *
+ * Unlike gzwrite(), which needs the whole image in memory, this takes the
+ * image in pieces of any size through gzwrite_stream_write(). The image may
+ * be made of several gzip members, e.g. gzip files put together, whose
+ * output is written one after the other.
+ *
+ * @dev:	block device descriptor
+ * @szwritebuf:	bytes per write, a multiple of the block size
+ * @start:	first block to write
+ * @count:	number of blocks available from @start
+ * Return: stream, or NULL on error
+ */
+struct gzwrite_stream *gzwrite_stream_init(struct blk_desc *dev,
+					   ulong szwritebuf, u64 start,
+					   u64 count);
+
+/**
+ * gzwrite_stream_write() - decompress and write the next piece of an image
+ *
+ * @gz:		stream
+ * @src:	compressed data, which is not needed once this returns
+ * @len:	number of bytes at @src
+ * Return: 0 if OK, -ve on error
+ */
+int gzwrite_stream_write(struct gzwrite_stream *gz, const void *src,
+			 ulong len);
+
+/**
+ * gzwrite_stream_finish() - write the end of an image and check it
+ *
+ * This frees @gz in any case.
+ *
+ * @gz:		stream
+ * @sizep:	returns the uncompressed size
+ * Return: 0 if the image ended after a complete member and every member
+ *	matched the CRC and size in its trailer, -ve on error
+ */
+int gzwrite_stream_finish(struct gzwrite_stream *gz, ulong *sizep);
+
 /**
  * gzip()- Compress data into a buffer using the gzip algorithm
  *
@@ -44,6 +44,22 @@ struct hash_algo {
 	void (*hash_func_ws)(const unsigned char *input, unsigned int ilen,
 		unsigned char *output, unsigned int chunk_sz);
 	int chunk_size;				/* Watchdog chunk size */
+	/**
+	 * hash_func_multi: Hash several buffers at once (optional)
+	 *
+	 * This gives the same results as calling hash_func_ws() on each
+	 * buffer in turn, but may be faster.
+	 *
+	 * @input:	Input buffers
+	 * @ilen:	Length of each input buffer
+	 * @output:	Checksum result of each buffer
+	 * @count:	Number of buffers
+	 * @chunk_sz:	Trigger watchdog after processing this many bytes
+	 */
+	void (*hash_func_multi)(const unsigned char *const input[],
+				const unsigned int ilen[],
+				unsigned char *const output[],
+				unsigned int count, unsigned int chunk_sz);
 	/*
 	 * hash_init: Create the context for progressive hashing
 	 *
@@ -120,6 +136,40 @@ int hash_command(const char *algo_name, int flags, struct cmd_tbl *cmdtp,
 int hash_block(const char *algo_name, const void *data, unsigned int len,
 	       uint8_t *output, int *output_size);
 
+/**
+ * struct hash_req - A request to hash one block, for hash_block_multi()
+ *
+ * @algo_name:	Hash algorithm to use
+ * @data:	Data to hash
+ * @len:	Length of data to hash in bytes
+ * @output:	Place to put the hash value, which must have room for the
+ *		digest of the algorithm
+ * @algo:	Private to hash_block_multi()
+ */
+struct hash_req {
+	const char *algo_name;
+	const void *data;
+	unsigned int len;
+	uint8_t *output;
+	struct hash_algo *algo;
+};
+
+/**
+ * hash_block_multi() - Hash several blocks together
+ *
+ * This gives the same results as calling hash_block() for each request, but
+ * requests which use the same algorithm are hashed together where the
+ * algorithm supports it (see hash_func_multi in struct hash_algo), so that
+ * several blocks share one pass of the hash function. The requests can be
+ * in any order.
+ *
+ * @reqs:	Requests to process
+ * @count:	Number of requests
+ * Return: 0 if ok, -EPROTONOSUPPORT if any algorithm is unknown, in which
+ * case nothing is hashed
+ */
+int hash_block_multi(struct hash_req *reqs, int count);
+
 #endif /* !USE_HOSTCC */
 
 /**
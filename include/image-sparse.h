@@ -42,3 +42,38 @@ static inline int is_sparse_image(void *buf)
 
 int write_sparse_image(struct sparse_storage *info, const char *part_name,
 		       void *data, char *response);
+
+struct sparse_stream;
+
+/**
+ * sparse_stream_init() - start writing a sparse image as it arrives
+ *
+ * Unlike write_sparse_image(), which needs the whole image in memory, this
+ * takes the image in pieces of any size through sparse_stream_write().
+ *
+ * @info:	storage to write to, which must stay valid until
+ *		sparse_stream_finish() is called
+ * Return: stream, or NULL if out of memory
+ */
+struct sparse_stream *sparse_stream_init(struct sparse_storage *info);
+
+/**
+ * sparse_stream_write() - write the next piece of a sparse image
+ *
+ * @ss:		stream
+ * @src:	data, which is not needed once this returns
+ * @len:	number of bytes at @src
+ * Return: 0 if OK, -ve on error
+ */
+int sparse_stream_write(struct sparse_stream *ss, const void *src,
+			ulong len);
+
+/**
+ * sparse_stream_finish() - check that a sparse image is complete
+ *
+ * This frees @ss in any case.
+ *
+ * @ss:		stream
+ * Return: 0 if the whole image was written, -ve on error
+ */
+int sparse_stream_finish(struct sparse_stream *ss);
@@ -348,6 +348,9 @@ struct image_info {
  * Legacy and FIT format headers used by do_bootm() and do_bootm_<os>()
  * routines.
  */
+/* Most images of a configuration that bootm checks together */
+#define BOOTM_MAX_VERIFIED	8
+
 struct bootm_headers {
 	/*
 	 * Legacy os image header, if it is a multi component image
@@ -399,6 +402,15 @@ struct bootm_headers {
 
 	int		verify;		/* env_get("verify")[0] != 'n' */
 
+	/*
+	 * Images of the selected configuration whose hashes were checked
+	 * together, see fit_config_verify_images(). An image is forgotten
+	 * when another one is copied over its data.
+	 */
+	const void	*fit_hdr_verified;
+	int		fit_noffset_verified[BOOTM_MAX_VERIFIED];
+	int		fit_num_verified;
+
 #define BOOTM_STATE_START	0x00000001
 #define BOOTM_STATE_FINDOS	0x00000002
 #define BOOTM_STATE_FINDOTHER	0x00000004
@@ -1259,6 +1271,7 @@ int fit_get_data_conf_prop(const void *fit, const char *prop_name,
 int fit_image_hash_get_algo(const void *fit, int noffset, const char **algo);
 int fit_image_hash_get_value(const void *fit, int noffset, uint8_t **value,
 				int *value_len);
+int fit_image_hash_get_ignore(const void *fit, int noffset, int *ignore);
 
 int fit_set_timestamp(void *fit, int noffset, time_t timestamp);
 
@@ -1343,6 +1356,99 @@ int fit_image_verify_with_data(const void *fit, int image_noffset,
 			       size_t size);
 
 int fit_image_verify(const void *fit, int noffset);
+
+/**
+ * fit_config_verify_images() - Check the hashes of a configuration's images
+ *
+ * The hashes of all the images used by the configuration (kernel, FDTs,
+ * ramdisk, setup, loadables and FPGA images) are calculated together with
+ * hash_block_multi(), so that several images can share one pass of the hash
+ * function. This does not print anything.
+ *
+ * Images which have a signature node or may need one, and images without
+ * hashes or whose hashes do not match, are left out; they must be checked
+ * with fit_image_verify() as usual, which reports any error.
+ *
+ * @fit:	FIT to check
+ * @conf_noffset: Offset of the configuration node
+ * @noffsets:	Returns the offsets of the images whose hashes all match
+ * @max:	Maximum number of offsets to return
+ * Return: number of offsets returned in @noffsets, or -ve on error
+ */
+int fit_config_verify_images(const void *fit, int conf_noffset, int *noffsets,
+			     int max);
+
+/**
+ * struct fit_stream - a FIT which is read piece by piece
+ *
+ * @read: Read @size bytes at @offset from the start of the FIT into @buf,
+ *	returning 0 on success or -ve error (short reads are errors)
+ * @priv: Private data for @read
+ */
+struct fit_stream {
+	int (*read)(struct fit_stream *stream, ulong offset, ulong size,
+		    void *buf);
+	void *priv;
+};
+
+/**
+ * fit_stream_read_header() - Read the devicetree part of a FIT
+ *
+ * This reads everything up to fdt_totalsize(), i.e. the whole FIT unless
+ * it uses external data, and checks its format.
+ *
+ * @stream:	FIT to read
+ * @fitp:	Returns the allocated header, which the caller must free
+ * Return: 0 if OK, -ENOEXEC if this is not a FIT, other -ve on error
+ */
+int fit_stream_read_header(struct fit_stream *stream, void **fitp);
+
+/**
+ * fit_stream_load_image() - Load a sub-image, reading its data in chunks
+ *
+ * Each chunk is hashed and decompressed as soon as it has been read, so the
+ * data is only passed over once. Uncompressed, gzip and zstd images are
+ * streamed. Other compression types, image-level signatures and hash
+ * algorithms without progressive support fall back to reading the whole
+ * sub-image before checking and decompressing it. So does any image when the
+ * control devicetree marks a signature key as required, so that the usual
+ * signature checks are applied.
+ *
+ * @stream:	FIT to read
+ * @fit:	Header from fit_stream_read_header()
+ * @noffset:	Offset of the image node in @fit
+ * @verify:	true to check the image hashes
+ * @out:	Buffer for the (decompressed) image
+ * @out_size:	Size of @out
+ * @lenp:	Returns the size of the loaded image
+ * Return: 0 if OK, -EACCES on a hash mismatch, -ENOSPC if @out is too small,
+ * -EPROTONOSUPPORT for ciphered images, other -ve on error
+ */
+int fit_stream_load_image(struct fit_stream *stream, const void *fit,
+			  int noffset, bool verify, void *out, ulong out_size,
+			  ulong *lenp);
+
+/**
+ * fit_stream_load_file() - Load a sub-image from a FIT stored in a file
+ *
+ * The file is read from the filesystem once per sub-image. The output region
+ * is reserved in the LMB while loading, so it may not overlap reserved memory.
+ *
+ * @ifname:	Interface name, e.g. "mmc"
+ * @dev_part:	Device and partition, e.g. "0:1"
+ * @fstype:	Filesystem type (FS_TYPE_...)
+ * @filename:	Path of the FIT
+ * @image_uname: Name of the image node to load
+ * @verify:	true to check the image hashes
+ * @addr:	Address to load to, or -1UL to use the image's load address
+ * @lenp:	Returns the size of the loaded image
+ * Return: 0 if OK, -ENOSPC if the image does not fit in free memory at @addr,
+ * other -ve on error
+ */
+int fit_stream_load_file(const char *ifname, const char *dev_part,
+			 int fstype, const char *filename,
+			 const char *image_uname, bool verify, ulong addr,
+			 ulong *lenp);
 #if CONFIG_IS_ENABLED(FIT_SIGNATURE)
 int fit_config_verify(const void *fit, int conf_noffset);
 #else
@@ -8,6 +8,7 @@
 #include <linux/types.h>
 /* #include <linux/bitrev.h> */
 
+/* Provided by lib/crc32.c, the same as crc32_no_comp() */
 extern u32  crc32_le(u32 crc, unsigned char const *p, size_t len);
 /* extern u32  crc32_be(u32 crc, unsigned char const *p, size_t len); */
 
@@ -255,6 +255,10 @@ enum eth_recv_flags {
  * free_pkt: Give the driver an opportunity to manage its packet buffer memory
  *	     when the network stack is finished processing it. This will only be
  *	     called when no error was returned from recv - optional
+ * max_held_pkts: Number of received packets the network stack may keep at
+ *		  once without copying them. These are handed back with
+ *		  free_pkt later and in any order, possibly after the device
+ *		  has been stopped and started again - optional
  * stop: Stop the hardware from looking for packets - may be called even if
  *	 state == PASSIVE
  * mcast: Join or leave a multicast group (for TFTP) - optional
@@ -277,6 +281,7 @@ struct eth_ops {
 	int (*send)(struct udevice *dev, void *packet, int length);
 	int (*recv)(struct udevice *dev, int flags, uchar **packetp);
 	int (*free_pkt)(struct udevice *dev, uchar *packet, int length);
+	int (*max_held_pkts)(struct udevice *dev);
 	void (*stop)(struct udevice *dev);
 	int (*mcast)(struct udevice *dev, const u8 *enetaddr, int join);
 	int (*write_hwaddr)(struct udevice *dev);
@@ -587,6 +592,9 @@ enum wget_http_method {
  * @hdr_cont_len:	content length according to headers. Filled by wget
  * @headers:		buffer for headers. Filled by wget.
  * @silent:		do not print anything to the console. Filled by client.
+ * @jobs:		number of byte ranges to fetch in parallel, 0 or 1 for a
+ *			single request. Only used by GET requests on the legacy
+ *			network stack. Filled by client.
  */
 struct wget_http_info {
 	enum wget_http_method method;
@@ -598,6 +606,7 @@ struct wget_http_info {
 	u32 hdr_cont_len;
 	char *headers;
 	bool silent;
+	u32 jobs;
 };
 
 extern struct wget_http_info default_wget_info;
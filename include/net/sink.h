@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Write a network download to a block device as it arrives
+ */
+
+#ifndef __NET_SINK_H__
+#define __NET_SINK_H__
+
+#include <blk.h>
+
+/**
+ * enum net_sink_format - how the downloaded file is written out
+ *
+ * @NET_SINK_RAW:	as it is
+ * @NET_SINK_GZIP:	decompressed from gzip, like gzwrite
+ * @NET_SINK_SPARSE:	expanded from an Android sparse image
+ */
+enum net_sink_format {
+	NET_SINK_RAW,
+	NET_SINK_GZIP,
+	NET_SINK_SPARSE,
+};
+
+/**
+ * net_sink_setup() - send the next download to a block device
+ *
+ * The file loaded by the next tftpboot or wget is written to the device
+ * while it is received, instead of being kept in memory. Only a staging
+ * buffer at the load address is used, of CONFIG_NET_SINK_BUF_SIZE bytes or
+ * the size in the 'netsinksize' environment variable.
+ *
+ * @desc:	block device
+ * @start:	first block to write
+ * @count:	number of blocks available from @start
+ * @fmt:	format of the file
+ * Return: 0 if OK, -EPROTONOSUPPORT if @fmt is not enabled
+ */
+int net_sink_setup(struct blk_desc *desc, lbaint_t start, lbaint_t count,
+		   enum net_sink_format fmt);
+
+/**
+ * net_sink_off() - keep the next download in memory again
+ */
+void net_sink_off(void);
+
+/**
+ * net_sink_enabled() - check whether downloads go to a block device
+ *
+ * Return: true if net_sink_setup() was called and the download it applies
+ *	to has not finished yet
+ */
+bool net_sink_enabled(void);
+
+/**
+ * net_sink_begin() - start (or restart) writing a download
+ *
+ * This is called by the protocol when it starts to receive a file.
+ *
+ * @addr:	address of the staging buffer
+ * Return: 0 if OK, -ve on error
+ */
+int net_sink_begin(ulong addr);
+
+/**
+ * net_sink_window() - get how far ahead data can be received
+ *
+ * Return: number of bytes past the end of the data received in order which
+ *	can be held in the staging buffer
+ */
+ulong net_sink_window(void);
+
+/**
+ * net_sink_store() - store received data in the staging buffer
+ *
+ * Data may arrive out of order, within net_sink_window() bytes of the end of
+ * the data received in order. Data which was already written out is
+ * ignored.
+ *
+ * @offset:	offset of the data in the file
+ * @src:	data
+ * @len:	number of bytes at @src
+ * Return: 0 if OK, -ENOSPC if the data does not fit in the staging buffer
+ */
+int net_sink_store(ulong offset, const void *src, ulong len);
+
+/**
+ * net_sink_advance() - note how much of the file was received in order
+ *
+ * Each half of the staging buffer is written out as soon as it is complete,
+ * while the other half goes on receiving data.
+ *
+ * @size:	number of bytes from the start of the file all received
+ * Return: 0 if OK, -ve on error
+ */
+int net_sink_advance(ulong size);
+
+/**
+ * net_sink_end() - finish writing a download
+ *
+ * This writes out the rest of the file and checks it, or gives up if the
+ * download failed. The next download is kept in memory again, unless this
+ * one never started to receive a file.
+ *
+ * @err:	0 if the download succeeded, -ve if it failed
+ * @size:	size of the file, which may not fit in an int
+ * Return: 0 if the whole file was written, -ve on error
+ */
+int net_sink_end(int err, ulong size);
+
+#endif /* __NET_SINK_H__ */
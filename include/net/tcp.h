@@ -87,6 +87,8 @@ struct ip_tcp_hdr {
 #define TCP_OPT_LEN_A	0x0a		/* Timestamp Length		*/
 #define TCP_MSS		1460		/* Max segment size		*/
 #define TCP_SCALE	0x01		/* Scale			*/
+#define TCP_MAX_SCALE	14		/* Largest window scale allowed	*/
+#define TCP_MAX_WIN	0xffff		/* Largest unscaled window	*/
 
 /**
  * struct tcp_mss - TCP option structure for MSS (Max segment size)
@@ -144,6 +146,18 @@ struct sack_edges {
 
 #define TCP_SACK_HILLS	4
 
+/*
+ * Only three SACK blocks fit in the TCP options next to the timestamp, so
+ * the last hill of struct tcp_sack_v is always padding.
+ */
+#define TCP_SACK_BLOCKS	(TCP_SACK_HILLS - 1)
+
+/*
+ * Number of hills tracked while reassembling the stream. The data itself is
+ * stored by the user's rx() callback, so each hill only costs its edges.
+ */
+#define TCP_REASS_HILLS	32
+
 /**
  * struct tcp_sack_v - TCP option structure for SACK
  * @kind: Field ID
@@ -352,14 +366,20 @@ enum tcp_status {
  *
  * @irs:		Initial receive sequence number
  * @rcv_nxt:		Receive next
- * @rcv_wnd:		Receive window (in bytes)
+ * @rcv_wnd:		Receive window (in bytes). The user may enlarge it in
+ *			  the on_create() callback if rx() stores data
+ *			  anywhere in the window, e.g. straight into memory
  *
  * @loc_timestamp:	Local timestamp
  * @rmt_timestamp:	Remote timestamp
  *
  * @rmt_win_scale:	Remote window scale factor
+ * @loc_win_scale:	Local window scale factor
+ * @win_scale_ok:	Non-zero if the remote sent a window scale option
  *
  * @lost:		Used for SACK
+ * @hill:		Data received beyond @rcv_nxt, in sequence order
+ * @hill_cnt:		Number of entries used in @hill
  *
  * @retry_cnt:		Number of retry attempts remaining. Only SYN, FIN
  *			  or DATA segments are tried to retransmit.
@@ -420,10 +440,16 @@ struct tcp_stream {
 
 	/* TCP window scale */
 	u8		rmt_win_scale;
+	u8		loc_win_scale;
+	u8		win_scale_ok;
 
 	/* TCP sliding window control used to request re-TX */
 	struct tcp_sack_v lost;
 
+	/* TCP reassembly of out-of-order data */
+	struct sack_edges hill[TCP_REASS_HILLS];
+	int		hill_cnt;
+
 	/* used for data retransmission */
 	int		retry_cnt;
 	int		retry_timeout;
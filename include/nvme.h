@@ -78,6 +78,17 @@ int nvme_scan_namespace(void);
  */
 int nvme_print_info(struct udevice *udev);
 
+/**
+ * nvme_print_stats - print the time spent on the I/O command path
+ *
+ * This prints how many I/O commands an NVMe controller got and how the
+ * time they took splits between building them, cache maintenance, submitting
+ * them and waiting for their completion.
+ *
+ * @udev:	NVMe controller device
+ */
+void nvme_print_stats(struct udevice *udev);
+
 /**
  * nvme_get_namespace_id - return namespace identifier
  *
@@ -12,6 +12,22 @@
 
 struct disk_partition;
 
+/**
+ * struct squashfs_cache_stats - hits and misses of the SquashFS caches
+ *
+ * @table_hits: directory lookups served from the cached inode and directory
+ *	tables
+ * @table_misses: directory lookups which decompressed the tables
+ * @block_hits: fragment and fragment table blocks found in the block cache
+ * @block_misses: fragment and fragment table blocks read from the image
+ */
+struct squashfs_cache_stats {
+	unsigned int table_hits;
+	unsigned int table_misses;
+	unsigned int block_hits;
+	unsigned int block_misses;
+};
+
 int sqfs_opendir(const char *filename, struct fs_dir_stream **dirsp);
 int sqfs_readdir(struct fs_dir_stream *dirs, struct fs_dirent **dentp);
 int sqfs_probe(struct blk_desc *fs_dev_desc,
@@ -23,4 +39,14 @@ int sqfs_exists(const char *filename);
 void sqfs_close(void);
 void sqfs_closedir(struct fs_dir_stream *dirs);
 
+/**
+ * sqfs_cache_stats() - return the cache statistics and reset them
+ *
+ * The statistics are kept across mounts, since each command mounts and
+ * closes the filesystem again.
+ *
+ * @stats: statistics are copied here
+ */
+void sqfs_cache_stats(struct squashfs_cache_stats *stats);
+
 #endif /* SQFS_H  */
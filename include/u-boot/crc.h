@@ -99,6 +99,36 @@ uint32_t crc32_no_comp(uint32_t crc, const unsigned char *buf, uint len);
 void crc32_wd_buf(const uint8_t *input, uint ilen, uint8_t *output,
 		  uint chunk_sz);
 
+/**
+ * enum crc32_impl - ways of calculating a CRC32
+ *
+ * @CRC32_IMPL_AUTO: use the fastest one the CPU supports
+ * @CRC32_IMPL_TABLE: a byte at a time with a 256-entry table
+ * @CRC32_IMPL_SLICE8: eight bytes at a time with eight tables
+ * @CRC32_IMPL_HW: CPU instructions (ARMv8 CRC32 or x86 PCLMULQDQ)
+ * @CRC32_IMPL_COUNT: number of values
+ */
+enum crc32_impl {
+	CRC32_IMPL_AUTO,
+	CRC32_IMPL_TABLE,
+	CRC32_IMPL_SLICE8,
+	CRC32_IMPL_HW,
+
+	CRC32_IMPL_COUNT,
+};
+
+/**
+ * crc32_select() - Choose how crc32() and crc32_no_comp() do their work
+ *
+ * The choice is normally made on first use, by checking what the CPU
+ * supports. This allows overriding it, e.g. to compare the methods.
+ *
+ * @impl: Method to use, or CRC32_IMPL_AUTO to go back to the fastest
+ * Return: 0 if OK, -ENOSYS if the method is not built in or the CPU does not
+ * support it
+ */
+int crc32_select(enum crc32_impl impl);
+
 /* lib/crc32c.c */
 
 /**
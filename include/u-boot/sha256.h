@@ -37,6 +37,41 @@ void sha256_finish(sha256_context * ctx, uint8_t digest[SHA256_SUM_LEN]);
 void sha256_csum_wd(const unsigned char *input, unsigned int ilen,
 		unsigned char *output, unsigned int chunk_sz);
 
+/* Number of buffers sha256_mb_process() hashes side by side */
+#define SHA256_MB_LANES	4
+
+/**
+ * sha256_mb_process() - Hash blocks of several buffers at once
+ *
+ * This is the core of sha256_csum_multi(). It is weak so that an
+ * architecture can supply its own version.
+ *
+ * @state: SHA-256 state of each lane, updated on return
+ * @data: Next block of each lane, advanced by @blocks blocks on return.
+ *	  Both arrays hold SHA256_MB_LANES entries but only the first @lanes
+ *	  are used.
+ * @lanes: Number of lanes in use, 1 to SHA256_MB_LANES
+ * @blocks: Number of 64-byte blocks to hash in each lane
+ */
+void sha256_mb_process(uint32_t state[][8], const uint8_t *data[],
+		       unsigned int lanes, unsigned int blocks);
+
+/**
+ * sha256_csum_multi() - Calculate the SHA-256 of several buffers
+ *
+ * This gives the same results as calling sha256_csum_wd() on each buffer,
+ * but hashes up to SHA256_MB_LANES buffers side by side.
+ *
+ * @input: Buffers to hash
+ * @ilen: Length of each buffer in bytes
+ * @output: Place to put the digest of each buffer
+ * @count: Number of buffers
+ * @chunk_sz: Trigger the watchdog after hashing this many bytes per lane
+ */
+void sha256_csum_multi(const unsigned char *const input[],
+		       const unsigned int ilen[], unsigned char *const output[],
+		       unsigned int count, unsigned int chunk_sz);
+
 int sha256_hmac(const unsigned char *key, int keylen,
 		const unsigned char *input, unsigned int ilen,
 		unsigned char *output);
@@ -809,6 +809,67 @@ struct dm_usb_ops {
 	 * driver to do just that.
 	 */
 	int (*lock_async)(struct udevice *udev, int lock);
+
+	/**
+	 * alloc_streams() - Set up streams on bulk endpoints
+	 *
+	 * Streams let a USB 3 device pick which of several transfers queued
+	 * on a bulk endpoint it serves next. Stream 0 is reserved, so
+	 * transfers use stream IDs from 1 up to one less than the number of
+	 * streams set up. The caller must not ask for more streams than the
+	 * endpoints' companion descriptors allow.
+	 *
+	 * @pipes: Bulk pipes of the endpoints
+	 * @num_pipes: Number of pipes
+	 * @num_streams: Number of streams wanted, including stream 0
+	 *
+	 * @return number of streams set up including stream 0, -ENOSYS if
+	 *	   the controller or device cannot use streams, other -ve on
+	 *	   error
+	 */
+	int (*alloc_streams)(struct udevice *bus, struct usb_device *udev,
+			     unsigned long *pipes, int num_pipes,
+			     int num_streams);
+
+	/**
+	 * free_streams() - Go back to a single transfer ring
+	 *
+	 * Transfers still queued on the streams are thrown away.
+	 *
+	 * @pipes: Bulk pipes of the endpoints given to alloc_streams()
+	 * @num_pipes: Number of pipes
+	 *
+	 * @return 0 if OK, -ve on error
+	 */
+	int (*free_streams)(struct udevice *bus, struct usb_device *udev,
+			    unsigned long *pipes, int num_pipes);
+
+	/**
+	 * submit_stream() - Queue a bulk message on a stream
+	 *
+	 * This returns once the message is queued. It is finished with
+	 * poll_stream(). Only one message may be in flight on each stream.
+	 *
+	 * @stream_id: Stream to queue the message on, from 1
+	 *
+	 * @return 0 if OK, -ve on error
+	 */
+	int (*submit_stream)(struct udevice *bus, struct usb_device *udev,
+			     unsigned long pipe, unsigned int stream_id,
+			     void *buffer, int length);
+
+	/**
+	 * poll_stream() - Check whether a message on a stream has finished
+	 *
+	 * @stream_id: Stream the message was queued on
+	 * @actual_length: Returns the number of bytes transferred
+	 *
+	 * @return 0 if finished, -EINPROGRESS if still in flight, -EPIPE if
+	 *	   the endpoint stalled, other -ve on error
+	 */
+	int (*poll_stream)(struct udevice *bus, struct usb_device *udev,
+			   unsigned long pipe, unsigned int stream_id,
+			   int *actual_length);
 };
 
 #define usb_get_ops(dev)	((struct dm_usb_ops *)(dev)->driver->ops)
@@ -998,6 +1059,62 @@ int usb_update_hub_device(struct usb_device *dev);
  */
 int usb_get_max_xfer_size(struct usb_device *dev, size_t *size);
 
+/**
+ * usb_alloc_streams() - Set up streams on bulk endpoints
+ *
+ * Stream 0 is reserved, so transfers use stream IDs from 1 up to one less
+ * than the return value. See alloc_streams() in struct dm_usb_ops.
+ *
+ * @dev:		USB device
+ * @pipes:		bulk pipes of the endpoints
+ * @num_pipes:		number of pipes
+ * @num_streams:	number of streams wanted, including stream 0
+ * Return: number of streams set up including stream 0, -ENOSYS if streams
+ * cannot be used, other -ve on error
+ */
+int usb_alloc_streams(struct usb_device *dev, unsigned long *pipes,
+		      int num_pipes, int num_streams);
+
+/**
+ * usb_free_streams() - Go back to a single transfer ring on bulk endpoints
+ *
+ * @dev:		USB device
+ * @pipes:		bulk pipes given to usb_alloc_streams()
+ * @num_pipes:		number of pipes
+ * Return: 0 if OK, -ve on error
+ */
+int usb_free_streams(struct usb_device *dev, unsigned long *pipes,
+		     int num_pipes);
+
+/**
+ * usb_submit_stream_msg() - Queue a bulk message on a stream
+ *
+ * This returns without waiting for the message to finish, see
+ * usb_poll_stream_msg().
+ *
+ * @dev:		USB device
+ * @pipe:		bulk pipe
+ * @stream_id:		stream to queue the message on, from 1
+ * @buffer:		buffer to send or receive, DMA-aligned
+ * @length:		length of the message in bytes
+ * Return: 0 if OK, -ve on error
+ */
+int usb_submit_stream_msg(struct usb_device *dev, unsigned long pipe,
+			  unsigned int stream_id, void *buffer, int length);
+
+/**
+ * usb_poll_stream_msg() - Check whether a message on a stream has finished
+ *
+ * @dev:		USB device
+ * @pipe:		bulk pipe
+ * @stream_id:		stream the message was queued on
+ * @actual_length:	returns the number of bytes transferred
+ * Return: 0 if finished, -EINPROGRESS if still in flight, -EPIPE if the
+ * endpoint stalled, other -ve on error
+ */
+int usb_poll_stream_msg(struct usb_device *dev, unsigned long pipe,
+			unsigned int stream_id, int *actual_length);
+
 /**
  * usb_emul_setup_device() - Set up a new USB device emulation
  *
@@ -1056,8 +1056,70 @@ struct xhci_scratchpad {
 #define XHCI_STOP_EP_CMD_TIMEOUT	5
 /* XXX: Make these module parameters */
 
+/**
+ * struct xhci_stream_ctx - Stream Context, section 6.2.4.1
+ *
+ * @stream_ring:	64-bit dequeue pointer of the stream's transfer ring,
+ *			with the cycle state and the stream context type in
+ *			the low bits
+ */
+struct xhci_stream_ctx {
+	__le64	stream_ring;
+	/* offset 0x8 - 0xf reserved for HC internal use */
+	__le32	reserved[2];
+};
+
+/* Stream Context Type - bits 3:1 of the dequeue pointer */
+#define SCT_FOR_CTX(p)		(((p) & 0x7) << 1)
+/* Secondary stream array type, dequeue pointer is to a transfer ring */
+#define SCT_SEC_TR		0
+/* Primary stream array type, dequeue pointer is to a transfer ring */
+#define SCT_PRI_TR		1
+
+/**
+ * struct xhci_stream - A transfer queued on a stream
+ *
+ * Only one transfer is in flight on each stream at a time, so this is all
+ * the state needed to match its completion event.
+ *
+ * @ring:	transfer ring of the stream
+ * @buffer:	buffer of the transfer, NULL if none is in flight
+ * @buf_64:	bus address of @buffer
+ * @length:	length of the transfer in bytes
+ * @last_trb:	bus address of the last TRB of the transfer
+ * @act_len:	bytes left to transfer, then bytes transferred once done
+ * @status:	USB_ST_... status of the transfer once done
+ * @done:	true once the completion event for @last_trb was seen
+ */
+struct xhci_stream {
+	struct xhci_ring	*ring;
+	void			*buffer;
+	u64			buf_64;
+	int			length;
+	dma_addr_t		last_trb;
+	int			act_len;
+	unsigned long		status;
+	bool			done;
+};
+
+/**
+ * struct xhci_stream_info - Streams set up on a bulk endpoint
+ *
+ * @ctx_array:		linear primary stream context array
+ * @ctx_array_dma:	bus address of @ctx_array
+ * @num_streams:	number of streams, including the reserved stream 0
+ * @streams:		state of each stream, indexed by stream ID
+ */
+struct xhci_stream_info {
+	struct xhci_stream_ctx	*ctx_array;
+	dma_addr_t		ctx_array_dma;
+	unsigned int		num_streams;
+	struct xhci_stream	*streams;
+};
+
 struct xhci_virt_ep {
 	struct xhci_ring		*ring;
+	struct xhci_stream_info		*stream_info;
 	unsigned int			ep_state;
 #define SET_DEQ_PENDING		(1 << 0)
 #define EP_HALTED		(1 << 1)	/* For stall handling */
@@ -1263,6 +1325,14 @@ void xhci_inval_cache(uintptr_t addr, u32 type_len);
 void xhci_cleanup(struct xhci_ctrl *ctrl);
 struct xhci_ring *xhci_ring_alloc(struct xhci_ctrl *ctrl, unsigned int num_segs,
 				  bool link_trbs);
+struct xhci_stream_info *xhci_alloc_stream_info(struct xhci_ctrl *ctrl,
+						unsigned int num_streams);
+void xhci_free_stream_info(struct xhci_ctrl *ctrl,
+			   struct xhci_stream_info *stream_info);
+int xhci_stream_tx(struct usb_device *udev, unsigned long pipe,
+		   unsigned int stream_id, int length, void *buffer);
+int xhci_stream_poll(struct usb_device *udev, unsigned long pipe,
+		     unsigned int stream_id, int *actual_length);
 int xhci_alloc_virt_device(struct xhci_ctrl *ctrl, unsigned int slot_id);
 int xhci_mem_init(struct xhci_ctrl *ctrl, struct xhci_hccr *hccr,
 		  struct xhci_hcor *hcor);
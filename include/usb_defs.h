@@ -44,6 +44,7 @@
 #define US_PR_CB               1		/* Control/Bulk w/o interrupt */
 #define US_PR_CBI              0		/* Control/Bulk/Interrupt */
 #define US_PR_BULK             0x50		/* bulk only */
+#define US_PR_UAS              0x62		/* USB Attached SCSI */
 
 /* USB types */
 #define USB_TYPE_STANDARD   (0x00 << 5)
@@ -391,4 +392,50 @@ struct umass_bbb_csw {
 #define US_BBB_RESET		0xff
 #define US_BBB_GET_MAX_LUN	0xfe
 
+/*
+ * USB Attached SCSI (UAS)
+ */
+
+/* Pipe Usage descriptor, following each endpoint descriptor of UAS */
+struct uas_pipe_usage_desc {
+	__u8		bLength;
+	__u8		bDescriptorType;
+	__u8		bPipeID;
+#	define UAS_CMD_PIPE_ID		1
+#	define UAS_STATUS_PIPE_ID	2
+#	define UAS_DATA_IN_PIPE_ID	3
+#	define UAS_DATA_OUT_PIPE_ID	4
+	__u8		Reserved;
+} __packed;
+
+/* Command IU, sent on the command pipe */
+struct uas_cmd_iu {
+	__u8		bIUID;
+#	define UAS_IU_ID_COMMAND	0x01
+#	define UAS_IU_ID_STATUS		0x03
+#	define UAS_IU_ID_RESPONSE	0x04
+	__u8		Reserved1;
+	__be16		wTag;
+	__u8		bPrioAttr;
+	__u8		Reserved5;
+	__u8		bAddCDBLength;
+	__u8		Reserved7;
+	__u8		LUN[8];
+	__u8		CDB[16];
+} __packed;
+#define UAS_CMD_IU_SIZE		32
+
+/* Sense IU, received on the status pipe once a command has finished */
+struct uas_sense_iu {
+	__u8		bIUID;
+	__u8		Reserved1;
+	__be16		wTag;
+	__be16		wStatusQualifier;
+	__u8		bStatus;
+	__u8		Reserved7[7];
+	__be16		wLength;
+	__u8		SenseData[96];
+} __packed;
+#define UAS_SENSE_IU_SIZE	112
+
 #endif /*_USB_DEFS_H_ */
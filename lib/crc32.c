@@ -12,6 +12,7 @@
 #include <arpa/inet.h>
 #else
 #include <efi_loader.h>
+#include <linux/errno.h>
 #endif
 #include <compiler.h>
 #include <u-boot/crc.h>
@@ -29,6 +30,33 @@
 
 #define tole(x) cpu_to_le32(x)
 
+/*
+ * U-Boot proper checks for the ARMv8 CRC32 instructions at run time and
+ * falls back to the tables without them. xPL phases trust the Kconfig
+ * option and use the instructions directly, which saves the table.
+ */
+#if defined(CONFIG_ARM64_CRC32) && !defined(USE_HOSTCC)
+# ifdef CONFIG_XPL_BUILD
+#  define CRC32_ARM64_ONLY
+# else
+#  define CRC32_ARM64
+# endif
+#endif
+
+#ifndef USE_HOSTCC
+# if CONFIG_IS_ENABLED(CRC32_SLICE_BY_8)
+#  define CRC32_SLICE8
+# endif
+# if CONFIG_IS_ENABLED(CRC32_PCLMUL) && defined(__x86_64__)
+#  define CRC32_PCLMUL
+#  include <immintrin.h>
+# endif
+#endif
+
+#if defined(CRC32_ARM64) || defined(CRC32_PCLMUL) || defined(CRC32_SLICE8)
+# define CRC32_DISPATCH
+#endif
+
 #ifdef CONFIG_DYNAMIC_CRC_TABLE
 
 static int __efi_runtime_data crc_table_empty = 1;
@@ -82,7 +110,7 @@ static void __efi_runtime make_crc_table(void)
   }
   crc_table_empty = 0;
 }
-#elif !defined(CONFIG_ARM64_CRC32)
+#elif !defined(CRC32_ARM64_ONLY)
 /* ========================================================================
  * Table of CRC-32's of all single-byte values (made by make_crc_table)
  */
@@ -177,12 +205,11 @@ const uint32_t * ZEXPORT get_crc_table()
 
 /* ========================================================================= */
 
-/* No ones complement version. JFFS2 (and other things ?)
- * don't use ones compliment in their CRC calculations.
- */
-uint32_t __efi_runtime crc32_no_comp(uint32_t crc, const Bytef *buf, uInt len)
+/* One byte at a time using crc_table, or the CRC32 instructions in xPL */
+static uint32_t __efi_runtime crc32_bytewise(uint32_t crc, const Bytef *buf,
+					     uInt len)
 {
-#ifdef CONFIG_ARM64_CRC32
+#ifdef CRC32_ARM64_ONLY
     crc = cpu_to_le32(crc);
     while (len--)
         crc = __builtin_aarch64_crc32b(crc, *buf++);
@@ -229,11 +256,267 @@ uint32_t __efi_runtime crc32_no_comp(uint32_t crc, const Bytef *buf, uInt len)
 }
 #undef DO_CRC
 
+#ifdef CRC32_SLICE8
+/*
+ * Slicing-by-8: crc_slice[k][n] is the CRC of byte n followed by k zero
+ * bytes, in CPU byte order. The CRC of eight bytes is then the exclusive-or
+ * of eight independent lookups rather than a chain of eight dependent ones.
+ */
+static int __efi_runtime_data crc_slice_empty = 1;
+static uint32_t __efi_runtime_data crc_slice[8][256];
+
+static void __efi_runtime make_crc_slice(void)
+{
+	uint32_t c;
+	int n, k;
+
+#ifdef CONFIG_DYNAMIC_CRC_TABLE
+	if (crc_table_empty)
+		make_crc_table();
+#endif
+	for (n = 0; n < 256; n++)
+		crc_slice[0][n] = le32_to_cpu(crc_table[n]);
+	for (n = 0; n < 256; n++) {
+		c = crc_slice[0][n];
+		for (k = 1; k < 8; k++) {
+			c = crc_slice[0][c & 255] ^ (c >> 8);
+			crc_slice[k][n] = c;
+		}
+	}
+	crc_slice_empty = 0;
+}
+
+static uint32_t __efi_runtime crc32_slice8(uint32_t crc, const Bytef *buf,
+					   uInt len)
+{
+	uint32_t (*t)[256] = crc_slice;
+	uint32_t hi;
+
+	if (crc_slice_empty)
+		make_crc_slice();
+
+	for (; len && ((ulong)buf & 7); len--)
+		crc = t[0][(crc ^ *buf++) & 255] ^ (crc >> 8);
+	for (; len >= 8; len -= 8, buf += 8) {
+		crc ^= le32_to_cpu(*(const uint32_t *)buf);
+		hi = le32_to_cpu(*(const uint32_t *)(buf + 4));
+		crc = t[7][crc & 255] ^ t[6][(crc >> 8) & 255] ^
+		      t[5][(crc >> 16) & 255] ^ t[4][crc >> 24] ^
+		      t[3][hi & 255] ^ t[2][(hi >> 8) & 255] ^
+		      t[1][(hi >> 16) & 255] ^ t[0][hi >> 24];
+	}
+	for (; len; len--)
+		crc = t[0][(crc ^ *buf++) & 255] ^ (crc >> 8);
+
+	return crc;
+}
+#endif
+
+#ifdef CRC32_ARM64
+static uint32_t __efi_runtime crc32_hw(uint32_t crc, const Bytef *buf,
+				       uInt len)
+{
+	for (; len && ((ulong)buf & 7); len--)
+		crc = __builtin_aarch64_crc32b(crc, *buf++);
+	for (; len >= 8; len -= 8, buf += 8)
+		crc = __builtin_aarch64_crc32x(crc,
+					le64_to_cpu(*(const uint64_t *)buf));
+	for (; len; len--)
+		crc = __builtin_aarch64_crc32b(crc, *buf++);
+
+	return crc;
+}
+#elif defined(CRC32_PCLMUL)
+/* The fastest software method available */
+static uint32_t __efi_runtime crc32_soft(uint32_t crc, const Bytef *buf,
+					 uInt len)
+{
+#ifdef CRC32_SLICE8
+	return crc32_slice8(crc, buf, len);
+#else
+	return crc32_bytewise(crc, buf, len);
+#endif
+}
+
+/*
+ * Fold the data 64 bytes at a time with carry-less multiplication, then
+ * reduce to 32 bits with Barrett reduction. The constants are powers of x
+ * modulo the bit-reflected CRC32 polynomial, from Intel's paper "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+ *
+ * @len must be a multiple of 16 and at least 64
+ */
+static uint32_t __efi_runtime __attribute__((target("pclmul,sse4.1")))
+crc32_pclmul(uint32_t crc, const Bytef *buf, uInt len)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4;
+
+#define FOLD(x, k, y) \
+	_mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), \
+				    _mm_clmulepi64_si128(x, k, 0x11)), y)
+
+	x1 = _mm_loadu_si128((const __m128i *)buf);
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 32));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 48));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	buf += 64;
+	len -= 64;
+
+	/* Four independent folds per 64 bytes */
+	for (; len >= 64; len -= 64, buf += 64) {
+		x1 = FOLD(x1, k1k2, _mm_loadu_si128((const __m128i *)buf));
+		x2 = FOLD(x2, k1k2,
+			  _mm_loadu_si128((const __m128i *)(buf + 16)));
+		x3 = FOLD(x3, k1k2,
+			  _mm_loadu_si128((const __m128i *)(buf + 32)));
+		x4 = FOLD(x4, k1k2,
+			  _mm_loadu_si128((const __m128i *)(buf + 48)));
+	}
+
+	/* Combine them into one 128-bit value, then fold in the rest */
+	x1 = FOLD(x1, k3k4, x2);
+	x1 = FOLD(x1, k3k4, x3);
+	x1 = FOLD(x1, k3k4, x4);
+	for (; len >= 16; len -= 16, buf += 16)
+		x1 = FOLD(x1, k3k4, _mm_loadu_si128((const __m128i *)buf));
+#undef FOLD
+
+	/* Fold 128 bits down to 64 */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask);
+	x1 = _mm_clmulepi64_si128(x1, k5, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x2 = _mm_and_si128(x1, mask);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t __efi_runtime crc32_hw(uint32_t crc, const Bytef *buf,
+				       uInt len)
+{
+	uInt bulk = len & ~15;
+
+	if (len >= 64) {
+		crc = crc32_pclmul(crc, buf, bulk);
+		buf += bulk;
+		len -= bulk;
+	}
+
+	return crc32_soft(crc, buf, len);
+}
+#endif
+
+#ifdef CRC32_DISPATCH
+static enum crc32_impl __efi_runtime_data crc32_impl;
+
+/* Check which methods this CPU supports, returning the fastest */
+static bool __efi_runtime crc32_impl_ok(enum crc32_impl impl)
+{
+	switch (impl) {
+	case CRC32_IMPL_TABLE:
+		return true;
+	case CRC32_IMPL_SLICE8:
+#ifdef CRC32_SLICE8
+		return true;
+#else
+		return false;
+#endif
+	case CRC32_IMPL_HW: {
+#ifdef CRC32_ARM64
+		uint64_t isar0;
+
+		asm volatile("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+		return (isar0 >> 16) & 0xf;
+#elif defined(CRC32_PCLMUL)
+		/* CPUID leaf 1: ECX bit 1 is PCLMULQDQ, bit 19 is SSE4.1 */
+		uint32_t a = 1, b, c = 0, d;
+
+		asm volatile("cpuid" : "+a" (a), "=b" (b), "+c" (c), "=d" (d));
+		return (c & (1 << 1)) && (c & (1 << 19));
+#else
+		return false;
+#endif
+	}
+	default:
+		return false;
+	}
+}
+
+static enum crc32_impl __efi_runtime crc32_probe(void)
+{
+	if (crc32_impl_ok(CRC32_IMPL_HW))
+		return CRC32_IMPL_HW;
+	if (crc32_impl_ok(CRC32_IMPL_SLICE8))
+		return CRC32_IMPL_SLICE8;
+
+	return CRC32_IMPL_TABLE;
+}
+#endif
+
+#ifndef USE_HOSTCC
+int crc32_select(enum crc32_impl impl)
+{
+#ifdef CRC32_DISPATCH
+	if (impl == CRC32_IMPL_AUTO)
+		impl = crc32_probe();
+	else if (!crc32_impl_ok(impl))
+		return -ENOSYS;
+	crc32_impl = impl;
+
+	return 0;
+#else
+	return impl == CRC32_IMPL_AUTO || impl == CRC32_IMPL_TABLE ? 0 : -ENOSYS;
+#endif
+}
+#endif
+
+/* No ones complement version. JFFS2 (and other things ?)
+ * don't use ones compliment in their CRC calculations.
+ */
+uint32_t __efi_runtime crc32_no_comp(uint32_t crc, const Bytef *buf, uInt len)
+{
+#ifdef CRC32_DISPATCH
+	if (crc32_impl == CRC32_IMPL_AUTO)
+		crc32_impl = crc32_probe();
+#if defined(CRC32_ARM64) || defined(CRC32_PCLMUL)
+	if (crc32_impl == CRC32_IMPL_HW)
+		return crc32_hw(crc, buf, len);
+#endif
+#ifdef CRC32_SLICE8
+	if (crc32_impl == CRC32_IMPL_SLICE8)
+		return crc32_slice8(crc, buf, len);
+#endif
+#endif
+	return crc32_bytewise(crc, buf, len);
+}
+
 uint32_t __efi_runtime crc32(uint32_t crc, const Bytef *p, uInt len)
 {
      return crc32_no_comp(crc ^ 0xffffffffL, p, len) ^ 0xffffffffL;
 }
 
+#ifndef USE_HOSTCC
+/* The name used by code from Linux, such as UBI, see <linux/crc32.h> */
+u32 crc32_le(u32 crc, unsigned char const *p, size_t len)
+{
+	return crc32_no_comp(crc, p, len);
+}
+#endif
+
 /*
  * Calculate the crc32 checksum triggering the watchdog every 'chunk_sz' bytes
  * of input.
@@ -0,0 +1,625 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Decompress an image to a block device as it arrives
+ *
+ * gzip images go through gzwrite_stream_*(). zstd images are decoded by a
+ * zstd streaming context, which keeps the window of the frame and hands
+ * out the output in pieces of the size of the write buffer. LZ4 frames
+ * are decoded block by block.
+ */
+
+#include <blk.h>
+#include <console.h>
+#include <decompwrite.h>
+#include <div64.h>
+#include <gzip.h>
+#include <image.h>
+#include <malloc.h>
+#include <memalign.h>
+#include <watchdog.h>
+#include <u-boot/lz4.h>
+#include <asm/unaligned.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/zstd.h>
+
+#define LZ4F_BLOCKUNCOMPRESSED_FLAG	0x80000000U
+
+enum decompwrite_fmt {
+	DECOMPWRITE_UNKNOWN,
+	DECOMPWRITE_GZIP,
+	DECOMPWRITE_ZSTD,
+	DECOMPWRITE_LZ4,
+};
+
+/* Parts of an LZ4 frame, in the order they arrive */
+enum lz4_state {
+	LZ4_FRAME,		/* magic number, FLG and BD bytes */
+	LZ4_DESC,		/* rest of the frame descriptor */
+	LZ4_BLOCK_SIZE,
+	LZ4_BLOCK,
+	LZ4_BLOCK_SUM,
+	LZ4_CONTENT_SUM,
+};
+
+/**
+ * struct decompwrite - compressed image written as it arrives
+ *
+ * @fmt:	format of the image, known once the first piece arrives
+ * @dev:	block device to write to
+ * @outblock:	next block to write
+ * @endblock:	block just past the space available
+ * @writebuf:	output on its way to @dev (zstd and LZ4)
+ * @szwritebuf:	size of @writebuf
+ * @filled:	number of bytes held in @writebuf
+ * @total:	number of bytes of output so far
+ * @gz:		gzip stream
+ * @zds:	zstd streaming context
+ * @zws:	workspace holding @zds
+ * @zended:	true if the last zstd frame seen is complete
+ * @lz:		LZ4 frame decoder
+ * @lz.state:	part of the frame expected next
+ * @lz.hdr:	header bytes collected so far
+ * @lz.hdr_len:	number of bytes held in @lz.hdr
+ * @lz.need:	number of header bytes needed for @lz.state
+ * @lz.flags:	FLG byte of the frame
+ * @lz.blkmax:	maximum uncompressed size of a block in the frame
+ * @lz.in:	compressed block, when it arrives in several pieces
+ * @lz.insize:	size of @lz.in
+ * @lz.out:	uncompressed block, when @writebuf has no room for it
+ * @lz.outsize:	size of @lz.out
+ * @lz.size:	size of the current block
+ * @lz.have:	number of bytes of the current block held in @lz.in
+ * @lz.raw:	true if the current block is stored uncompressed
+ * @lz.content_size: uncompressed size of the frame, 0 if not given
+ * @lz.frame_start: value of @total at the start of the frame
+ * @lz.ended:	true if the last frame seen is complete
+ */
+struct decompwrite {
+	enum decompwrite_fmt fmt;
+	struct blk_desc *dev;
+	lbaint_t outblock;
+	lbaint_t endblock;
+	u8 *writebuf;
+	ulong szwritebuf;
+	ulong filled;
+	u64 total;
+	struct gzwrite_stream *gz;
+	zstd_dstream *zds;
+	void *zws;
+	bool zended;
+	struct {
+		enum lz4_state state;
+		u8 hdr[15];
+		uint hdr_len;
+		uint need;
+		u8 flags;
+		ulong blkmax;
+		u8 *in;
+		ulong insize;
+		u8 *out;
+		ulong outsize;
+		ulong size;
+		ulong have;
+		bool raw;
+		u64 content_size;
+		u64 frame_start;
+		bool ended;
+	} lz;
+};
+
+static const char *const decompwrite_name[] = {
+	[DECOMPWRITE_UNKNOWN]	= "unknown",
+	[DECOMPWRITE_GZIP]	= "gzip",
+	[DECOMPWRITE_ZSTD]	= "zstd",
+	[DECOMPWRITE_LZ4]	= "lz4",
+};
+
+struct decompwrite *decompwrite_init(struct blk_desc *dev, ulong szwritebuf,
+				     u64 start, u64 count)
+{
+	struct decompwrite *dw;
+
+	if (!szwritebuf || szwritebuf % dev->blksz) {
+		printf("%s: size %lu not a multiple of %lu\n",
+		       __func__, szwritebuf, dev->blksz);
+		return NULL;
+	}
+
+	dw = calloc(1, sizeof(*dw));
+	if (!dw)
+		return NULL;
+	dw->dev = dev;
+	dw->szwritebuf = szwritebuf;
+	dw->outblock = start;
+	dw->endblock = start + count;
+
+	return dw;
+}
+
+/* Write out the bytes held in the write buffer, padded to a block */
+static int decompwrite_flush(struct decompwrite *dw)
+{
+	struct blk_desc *dev = dw->dev;
+	lbaint_t writeblocks = DIV_ROUND_UP(dw->filled, dev->blksz);
+
+	if (!dw->filled)
+		return 0;
+	if (writeblocks > dw->endblock - dw->outblock) {
+		printf("%s: uncompressed size exceeds device size\n",
+		       __func__);
+		return -ENOSPC;
+	}
+
+	memset(dw->writebuf + dw->filled, 0,
+	       writeblocks * dev->blksz - dw->filled);
+	if (blk_dwrite(dev, dw->outblock, writeblocks,
+		       dw->writebuf) != writeblocks)
+		return -EIO;
+	dw->outblock += writeblocks;
+	dw->filled = 0;
+
+	return 0;
+}
+
+/* Add output to the write buffer, writing it out each time it is full */
+static int decompwrite_put(struct decompwrite *dw, const u8 *data, ulong len)
+{
+	ulong n;
+	int ret;
+
+	while (len) {
+		n = min(len, dw->szwritebuf - dw->filled);
+		memcpy(dw->writebuf + dw->filled, data, n);
+		dw->filled += n;
+		dw->total += n;
+		data += n;
+		len -= n;
+		if (dw->filled == dw->szwritebuf) {
+			ret = decompwrite_flush(dw);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int decompwrite_zstd_start(struct decompwrite *dw, const void *src,
+				  ulong len)
+{
+	zstd_frame_header fh;
+	size_t window, wsize, ret;
+
+	ret = zstd_get_frame_header(&fh, src, len);
+	if (ret) {
+		printf("Error: bad zstd frame header\n");
+		return -EINVAL;
+	}
+
+	/*
+	 * The context keeps the window of the first frame. Skippable frames
+	 * have none, so allow the largest one for the frames after them.
+	 */
+	window = fh.windowSize ?: CONFIG_DECOMPWRITE_ZSTD_WINDOW;
+	if (fh.windowSize > CONFIG_DECOMPWRITE_ZSTD_WINDOW) {
+		printf("Error: zstd window of %llu bytes exceeds limit of %u\n",
+		       fh.windowSize, CONFIG_DECOMPWRITE_ZSTD_WINDOW);
+		return -E2BIG;
+	}
+
+	wsize = zstd_dstream_workspace_bound(window);
+	dw->zws = malloc(wsize);
+	if (!dw->zws)
+		return -ENOMEM;
+	dw->zds = zstd_init_dstream(window, dw->zws, wsize);
+	if (!dw->zds) {
+		printf("Error: zstd_init_dstream() failed\n");
+		return -EPERM;
+	}
+
+	return 0;
+}
+
+static int decompwrite_zstd(struct decompwrite *dw, const void *src,
+			    ulong len)
+{
+	zstd_in_buffer in = { .src = src, .size = len };
+	zstd_out_buffer out;
+	size_t ret;
+	bool full;
+	int err;
+
+	/*
+	 * Once the write buffer is full, the context may still hold output,
+	 * so keep going until it returns less than was asked for
+	 */
+	do {
+		out.dst = dw->writebuf;
+		out.size = dw->szwritebuf;
+		out.pos = dw->filled;
+		ret = zstd_decompress_stream(dw->zds, &out, &in);
+		if (zstd_is_error(ret)) {
+			printf("Error: zstd decompression failed: %d\n",
+			       zstd_get_error_code(ret));
+			return -EINVAL;
+		}
+		dw->total += out.pos - dw->filled;
+		dw->filled = out.pos;
+		dw->zended = !ret;
+
+		full = dw->filled == dw->szwritebuf;
+		if (full) {
+			err = decompwrite_flush(dw);
+			if (err)
+				return err;
+		}
+		schedule();
+	} while (in.pos < in.size || full);
+
+	return 0;
+}
+
+/*
+ * Make sure *@bufp holds at least @size bytes. The buffers are only grown as
+ * far as the blocks actually seen need, since the block size in the frame
+ * descriptor is just an upper bound of up to 4MiB.
+ */
+static int decompwrite_lz4_buf(u8 **bufp, ulong *sizep, ulong size)
+{
+	if (size <= *sizep)
+		return 0;
+
+	free(*bufp);
+	*sizep = 0;
+	*bufp = malloc(size);
+	if (!*bufp)
+		return -ENOMEM;
+	*sizep = size;
+
+	return 0;
+}
+
+/* Check the start of an LZ4 frame */
+static int decompwrite_lz4_frame(struct decompwrite *dw)
+{
+	u8 flags = dw->lz.hdr[4], block_desc = dw->lz.hdr[5];
+	ulong blkmax;
+
+	if (get_unaligned_le32(dw->lz.hdr) != LZ4F_MAGIC ||
+	    (flags >> 6) != 1) {
+		printf("Error: bad lz4 frame\n");
+		return -EPROTONOSUPPORT;
+	}
+	if ((flags & 0x03) || (block_desc & 0x8f) || block_desc < 0x40) {
+		printf("Error: reserved bits set in lz4 frame\n");
+		return -EINVAL;
+	}
+	/* Like ulz4fn(), only independent blocks are supported */
+	if (!(flags & 0x20)) {
+		printf("Error: lz4 frame with linked blocks\n");
+		return -EPROTONOSUPPORT;
+	}
+
+	blkmax = 1UL << (8 + 2 * (block_desc >> 4));
+	dw->lz.flags = flags;
+	dw->lz.blkmax = blkmax;
+	dw->lz.frame_start = dw->total;
+	dw->lz.ended = false;
+
+	return 0;
+}
+
+/* Decompress a whole LZ4 block and add it to the output */
+static int decompwrite_lz4_block(struct decompwrite *dw, const u8 *in)
+{
+	u64 done = dw->total - dw->lz.frame_start;
+	ulong outmax = dw->lz.blkmax;
+	u8 *out;
+	int ret;
+
+	if (dw->lz.raw)
+		return decompwrite_put(dw, in, dw->lz.size);
+
+	/* A block cannot hold more than what is left of the frame */
+	if (dw->lz.content_size)
+		outmax = min_t(u64, outmax, dw->lz.content_size -
+			       min(done, dw->lz.content_size));
+
+	/* Decompress straight into the write buffer if there is room */
+	if (dw->szwritebuf - dw->filled >= outmax) {
+		out = dw->writebuf + dw->filled;
+	} else {
+		ret = decompwrite_lz4_buf(&dw->lz.out, &dw->lz.outsize,
+					  outmax);
+		if (ret)
+			return ret;
+		out = dw->lz.out;
+	}
+	ret = LZ4_decompress_safe((const char *)in, (char *)out, dw->lz.size,
+				  outmax);
+	if (ret < 0) {
+		printf("Error: lz4 decompression failed\n");
+		return -EPROTO;
+	}
+	if (out == dw->lz.out)
+		return decompwrite_put(dw, out, ret);
+
+	dw->filled += ret;
+	dw->total += ret;
+	if (dw->filled == dw->szwritebuf)
+		return decompwrite_flush(dw);
+
+	return 0;
+}
+
+/* Act on the header bytes collected for the current part of the frame */
+static int decompwrite_lz4_header(struct decompwrite *dw)
+{
+	u32 block_header;
+	int ret;
+
+	switch (dw->lz.state) {
+	case LZ4_FRAME:
+		ret = decompwrite_lz4_frame(dw);
+		if (ret)
+			return ret;
+		dw->lz.state = LZ4_DESC;
+		/* Content size and header checksum */
+		dw->lz.need = (dw->lz.flags & 0x08 ? 8 : 0) + 1;
+		break;
+	case LZ4_DESC:
+		dw->lz.content_size = 0;
+		if (dw->lz.flags & 0x08)
+			dw->lz.content_size = get_unaligned_le64(dw->lz.hdr);
+		dw->lz.state = LZ4_BLOCK_SIZE;
+		dw->lz.need = 4;
+		break;
+	case LZ4_BLOCK_SIZE:
+		block_header = get_unaligned_le32(dw->lz.hdr);
+		dw->lz.size = block_header & ~LZ4F_BLOCKUNCOMPRESSED_FLAG;
+		dw->lz.raw = block_header & LZ4F_BLOCKUNCOMPRESSED_FLAG;
+		if (dw->lz.size > dw->lz.blkmax) {
+			printf("Error: lz4 block too large\n");
+			return -EINVAL;
+		}
+		if (dw->lz.size) {
+			dw->lz.state = LZ4_BLOCK;
+			break;
+		}
+		if (dw->lz.content_size &&
+		    dw->total - dw->lz.frame_start != dw->lz.content_size) {
+			printf("Error: lz4 frame size %llu/%llu\n",
+			       dw->total - dw->lz.frame_start,
+			       dw->lz.content_size);
+			return -EIO;
+		}
+		if (dw->lz.flags & 0x04) {
+			dw->lz.state = LZ4_CONTENT_SUM;
+			break;
+		}
+		fallthrough;
+	case LZ4_CONTENT_SUM:
+		/* Checksums are skipped, as in ulz4fn() */
+		dw->lz.ended = true;
+		dw->lz.state = LZ4_FRAME;
+		dw->lz.need = 6;
+		break;
+	case LZ4_BLOCK_SUM:
+		dw->lz.state = LZ4_BLOCK_SIZE;
+		break;
+	case LZ4_BLOCK:
+		break;
+	}
+
+	return 0;
+}
+
+static int decompwrite_lz4(struct decompwrite *dw, const u8 *src, ulong len)
+{
+	const u8 *in;
+	ulong n;
+	int ret;
+
+	while (len) {
+		if (dw->lz.state != LZ4_BLOCK) {
+			n = min_t(ulong, len, dw->lz.need - dw->lz.hdr_len);
+			memcpy(dw->lz.hdr + dw->lz.hdr_len, src, n);
+			dw->lz.hdr_len += n;
+			src += n;
+			len -= n;
+			if (dw->lz.hdr_len < dw->lz.need)
+				break;
+			dw->lz.hdr_len = 0;
+			ret = decompwrite_lz4_header(dw);
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		/* Use the block in place if it arrived in one piece */
+		if (!dw->lz.have && len >= dw->lz.size) {
+			in = src;
+			n = dw->lz.size;
+		} else {
+			ret = decompwrite_lz4_buf(&dw->lz.in, &dw->lz.insize,
+						  dw->lz.size);
+			if (ret)
+				return ret;
+			n = min(len, dw->lz.size - dw->lz.have);
+			memcpy(dw->lz.in + dw->lz.have, src, n);
+			dw->lz.have += n;
+			in = dw->lz.in;
+		}
+		src += n;
+		len -= n;
+		if (in == dw->lz.in && dw->lz.have < dw->lz.size)
+			break;
+		dw->lz.have = 0;
+
+		ret = decompwrite_lz4_block(dw, in);
+		if (ret)
+			return ret;
+		dw->lz.state = dw->lz.flags & 0x10 ? LZ4_BLOCK_SUM :
+			       LZ4_BLOCK_SIZE;
+		schedule();
+	}
+
+	return 0;
+}
+
+/* Work out the format of the image from its first piece */
+static int decompwrite_start(struct decompwrite *dw, const u8 *src,
+			     ulong len)
+{
+	int ret;
+
+	if (len >= 2 && src[0] == 0x1f && src[1] == 0x8b &&
+	    IS_ENABLED(CONFIG_GZIP)) {
+		dw->gz = gzwrite_stream_init(dw->dev, dw->szwritebuf,
+					     dw->outblock,
+					     dw->endblock - dw->outblock);
+		if (!dw->gz)
+			return -ENOMEM;
+		dw->fmt = DECOMPWRITE_GZIP;
+		return 0;
+	}
+
+	dw->writebuf = malloc_cache_aligned(dw->szwritebuf);
+	if (!dw->writebuf)
+		return -ENOMEM;
+
+	if (len >= 4 && get_unaligned_le32(src) == ZSTD_MAGICNUMBER &&
+	    IS_ENABLED(CONFIG_ZSTD)) {
+		ret = decompwrite_zstd_start(dw, src, len);
+		if (!ret)
+			dw->fmt = DECOMPWRITE_ZSTD;
+		return ret;
+	}
+	if (len >= 4 && get_unaligned_le32(src) == LZ4F_MAGIC &&
+	    IS_ENABLED(CONFIG_LZ4)) {
+		dw->fmt = DECOMPWRITE_LZ4;
+		dw->lz.need = 6;
+		return 0;
+	}
+
+	printf("Error: unknown compression format\n");
+
+	return -EPROTONOSUPPORT;
+}
+
+int decompwrite_write(struct decompwrite *dw, const void *src, ulong len)
+{
+	int ret;
+
+	if (!len)
+		return 0;
+	if (dw->fmt == DECOMPWRITE_UNKNOWN) {
+		ret = decompwrite_start(dw, src, len);
+		if (ret)
+			return ret;
+	}
+
+	switch (dw->fmt) {
+	case DECOMPWRITE_GZIP:
+		return gzwrite_stream_write(dw->gz, src, len);
+	case DECOMPWRITE_ZSTD:
+		return decompwrite_zstd(dw, src, len);
+	case DECOMPWRITE_LZ4:
+		return decompwrite_lz4(dw, src, len);
+	default:
+		return -EPROTONOSUPPORT;
+	}
+}
+
+int decompwrite_finish(struct decompwrite *dw, u64 *sizep)
+{
+	ulong size;
+	bool ended;
+	int ret;
+
+	if (dw->fmt == DECOMPWRITE_GZIP) {
+		ret = gzwrite_stream_finish(dw->gz, &size);
+		*sizep = size;
+		free(dw);
+		return ret;
+	}
+	/* Nothing arrived, or its format was not recognised */
+	if (dw->fmt == DECOMPWRITE_UNKNOWN) {
+		*sizep = 0;
+		ret = -ENODATA;
+		goto out;
+	}
+
+	ret = decompwrite_flush(dw);
+	ended = dw->fmt == DECOMPWRITE_ZSTD ? dw->zended :
+		dw->lz.ended && !dw->lz.hdr_len;
+	if (!ret && !ended) {
+		printf("Error: %s image is truncated\n",
+		       decompwrite_name[dw->fmt]);
+		ret = -EIO;
+	}
+	*sizep = dw->total;
+
+out:
+	free(dw->zws);
+	free(dw->lz.in);
+	free(dw->lz.out);
+	free(dw->writebuf);
+	free(dw);
+
+	return ret;
+}
+
+int decompwrite(const void *src, ulong len, struct blk_desc *dev,
+		ulong szwritebuf, u64 startoffs, u64 szexpected)
+{
+	struct decompwrite *dw;
+	lbaint_t start;
+	u64 size;
+	ulong n;
+	int ret, err;
+
+	if (startoffs & (dev->blksz - 1)) {
+		printf("%s: start offset %llu not a multiple of %lu\n",
+		       __func__, startoffs, dev->blksz);
+		return -EINVAL;
+	}
+	start = lldiv(startoffs, dev->blksz);
+	if (start >= dev->lba) {
+		printf("%s: start offset beyond end of device\n", __func__);
+		return -ENOSPC;
+	}
+	if (szexpected &&
+	    lldiv(szexpected + dev->blksz - 1, dev->blksz) > dev->lba - start) {
+		printf("%s: expected size %llu exceeds device size\n",
+		       __func__, szexpected);
+		return -ENOSPC;
+	}
+
+	dw = decompwrite_init(dev, szwritebuf, start, dev->lba - start);
+	if (!dw)
+		return -ENOMEM;
+
+	/* Hand over one write buffer's worth at a time, to allow aborting */
+	for (ret = 0; len && !ret; src += n, len -= n) {
+		n = min(len, szwritebuf);
+		ret = decompwrite_write(dw, src, n);
+		if (!ret && ctrlc()) {
+			puts("abort\n");
+			ret = -EINTR;
+		}
+	}
+
+	err = decompwrite_finish(dw, &size);
+	if (!ret)
+		ret = err;
+	if (!ret && szexpected && size != szexpected) {
+		printf("Error: size %llu/%llu\n", size, szexpected);
+		ret = -EIO;
+	}
+	if (!ret)
+		printf("%llu bytes written\n", size);
+
+	return ret;
+}
@@ -15,7 +15,9 @@
 #include <u-boot/crc.h>
 #include <watchdog.h>
 #include <u-boot/zlib.h>
+#include <uthread.h>
 #include <asm/sections.h>
+#include <asm/unaligned.h>
 
 #define HEADER0			'\x1f'
 #define HEADER1			'\x8b'
@@ -82,6 +84,428 @@ __rcode int gunzip(void *dst, int dstlen, unsigned char *src, unsigned long *len
 	return zunzip(dst, dstlen, src, lenp, 1, offset);
 }
 
+#if CONFIG_IS_ENABLED(GZWRITE_PIPELINE)
+#define GZWRITE_PIPE_DEPTH	2
+#else
+#define GZWRITE_PIPE_DEPTH	1
+#endif
+
+/**
+ * struct gzwrite_pipe - output buffers of a gzip stream waiting to be written
+ *
+ * @dev:	block device
+ * @buf:	output buffers of szwritebuf bytes
+ * @blkcnt:	number of blocks to write from each buffer
+ * @outblock:	next block to write
+ * @next:	next buffer to write
+ * @queued:	number of buffers waiting to be written
+ * @ret:	0, or -EIO once a write failed
+ * @grp_id:	uthread group of the writer thread
+ * @stop:	tells the writer thread to stop early
+ */
+struct gzwrite_pipe {
+	struct blk_desc *dev;
+	unsigned char *buf[GZWRITE_PIPE_DEPTH];
+	lbaint_t blkcnt[GZWRITE_PIPE_DEPTH];
+	lbaint_t outblock;
+	int next;
+	int queued;
+	int ret;
+	unsigned int grp_id;
+	bool stop;
+};
+
+/*
+ * Runs in a uthread and writes the inflated buffers in order. Block drivers
+ * which wait for the hardware with udelay() or schedule() let the stream
+ * inflate the next buffer in the meantime.
+ */
+static void gzwrite_pipe_writer(void *arg)
+{
+	struct gzwrite_pipe *pipe = arg;
+	lbaint_t blks;
+
+	while (pipe->queued && !pipe->stop) {
+		blks = blk_dwrite(pipe->dev, pipe->outblock,
+				  pipe->blkcnt[pipe->next],
+				  pipe->buf[pipe->next]);
+		pipe->outblock += blks;
+		if (blks != pipe->blkcnt[pipe->next]) {
+			printf("%s: write failed at block " LBAFU "\n",
+			       __func__, pipe->outblock);
+			pipe->ret = -EIO;
+			break;
+		}
+		pipe->next = (pipe->next + 1) % GZWRITE_PIPE_DEPTH;
+		pipe->queued--;
+	}
+}
+
+/* Waits until at most @max buffers are queued */
+static int gzwrite_pipe_wait(struct gzwrite_pipe *pipe, int max)
+{
+	while (pipe->queued > max && !pipe->ret)
+		uthread_schedule();
+
+	return pipe->ret;
+}
+
+/* Queues buffer @i for writing, then waits for the next buffer to be free */
+static int gzwrite_pipe_queue(struct gzwrite_pipe *pipe, int i,
+			      lbaint_t blkcnt)
+{
+	pipe->blkcnt[i] = blkcnt;
+	pipe->queued++;
+	if (GZWRITE_PIPE_DEPTH == 1)
+		gzwrite_pipe_writer(pipe);
+	else if (uthread_grp_done(pipe->grp_id) &&
+		 uthread_create(NULL, gzwrite_pipe_writer, pipe, 0,
+				pipe->grp_id))
+		gzwrite_pipe_writer(pipe);
+
+	return gzwrite_pipe_wait(pipe, GZWRITE_PIPE_DEPTH - 1);
+}
+
+/* Longest gzip member header which gzwrite_stream_write() accepts */
+#define GZWRITE_STREAM_HDR_MAX	1024
+
+enum gzwrite_stream_state {
+	GZS_HEADER,
+	GZS_INFLATE,
+	GZS_TRAILER,
+	GZS_DONE,
+};
+
+/**
+ * struct gzwrite_stream - gzipped image written as it arrives
+ *
+ * An image may hold several gzip members one after the other, as produced by
+ * concatenating gzip files. Each is checked against its own trailer and their
+ * output is written one after the other. Anything after the last member
+ * which does not start with a gzip header is ignored.
+ *
+ * @s:		inflate state
+ * @pipe:	output buffers and the writer which empties them
+ * @outblock:	next block to queue for writing
+ * @endblock:	block just past the space available
+ * @szwritebuf:	size of each output buffer
+ * @fill:	output buffer being filled
+ * @filled:	number of bytes held in that buffer
+ * @totalfilled: number of bytes of output so far
+ * @state:	part of the member expected next
+ * @members:	number of members completed
+ * @crc:	CRC32 of the output of this member so far
+ * @membersize:	number of bytes of output of this member so far
+ * @hdr:	member header, collected until it is complete
+ * @hdr_len:	number of bytes held in @hdr
+ * @trailer:	member trailer, collected after the deflate stream
+ * @trailer_len: number of bytes held in @trailer
+ */
+struct gzwrite_stream {
+	z_stream s;
+	struct gzwrite_pipe pipe;
+	lbaint_t outblock;
+	lbaint_t endblock;
+	ulong szwritebuf;
+	int fill;
+	ulong filled;
+	ulong totalfilled;
+	enum gzwrite_stream_state state;
+	int members;
+	u32 crc;
+	u32 membersize;
+	u8 hdr[GZWRITE_STREAM_HDR_MAX];
+	int hdr_len;
+	u8 trailer[8];
+	int trailer_len;
+};
+
+struct gzwrite_stream *gzwrite_stream_init(struct blk_desc *dev,
+					   ulong szwritebuf, u64 start,
+					   u64 count)
+{
+	struct gzwrite_stream *gz;
+	int i;
+
+	if (!szwritebuf || szwritebuf % dev->blksz) {
+		printf("%s: size %lu not a multiple of %lu\n",
+		       __func__, szwritebuf, dev->blksz);
+		return NULL;
+	}
+
+	gz = calloc(1, sizeof(*gz));
+	if (!gz)
+		return NULL;
+	for (i = 0; i < GZWRITE_PIPE_DEPTH; i++) {
+		gz->pipe.buf[i] = malloc_cache_aligned(szwritebuf);
+		if (!gz->pipe.buf[i])
+			goto err;
+	}
+
+	gz->s.zalloc = gzalloc;
+	gz->s.zfree = gzfree;
+	if (inflateInit2(&gz->s, -MAX_WBITS) != Z_OK) {
+		printf("Error: inflateInit2() failed\n");
+		goto err;
+	}
+
+	gz->pipe.dev = dev;
+	gz->pipe.outblock = start;
+	gz->pipe.grp_id = uthread_grp_new_id();
+	gz->szwritebuf = szwritebuf;
+	gz->outblock = start;
+	gz->endblock = start + count;
+
+	return gz;
+
+err:
+	for (i = 0; i < GZWRITE_PIPE_DEPTH; i++)
+		free(gz->pipe.buf[i]);
+	free(gz);
+
+	return NULL;
+}
+
+/* Stop the writer and free the stream */
+static void gzwrite_stream_free(struct gzwrite_stream *gz)
+{
+	int i;
+
+	gz->pipe.stop = true;
+	while (!uthread_grp_done(gz->pipe.grp_id))
+		uthread_schedule();
+	inflateEnd(&gz->s);
+	for (i = 0; i < GZWRITE_PIPE_DEPTH; i++)
+		free(gz->pipe.buf[i]);
+	free(gz);
+}
+
+/*
+ * Queue the first @len bytes of the output buffer for writing, padded to a
+ * block, and move on to the next buffer once it is free
+ */
+static int gzwrite_stream_flush(struct gzwrite_stream *gz, ulong len)
+{
+	struct blk_desc *dev = gz->pipe.dev;
+	lbaint_t writeblocks = DIV_ROUND_UP(len, dev->blksz);
+	int ret;
+
+	if (!len)
+		return 0;
+	if (writeblocks > gz->endblock - gz->outblock) {
+		printf("%s: uncompressed size exceeds device size\n",
+		       __func__);
+		return -ENOSPC;
+	}
+
+	memset(gz->pipe.buf[gz->fill] + len, 0,
+	       writeblocks * dev->blksz - len);
+	gz->outblock += writeblocks;
+	ret = gzwrite_pipe_queue(&gz->pipe, gz->fill, writeblocks);
+	gz->fill = (gz->fill + 1) % GZWRITE_PIPE_DEPTH;
+	gz->filled = 0;
+
+	return ret;
+}
+
+/*
+ * Work out the length of the gzip header at @src, of which @len bytes are
+ * available. Returns 0 if more bytes are needed, -EINVAL if this is not a
+ * gzip header.
+ */
+static int gzwrite_stream_header_len(const u8 *src, ulong len)
+{
+	ulong i = 10;
+	int flags;
+
+	if ((len > 0 && src[0] != HEADER0) ||
+	    (len > 1 && src[1] != (u8)HEADER1))
+		return -EINVAL;
+	if (len < 10)
+		return 0;
+	flags = src[3];
+	if (src[2] != DEFLATED || (flags & RESERVED) != 0)
+		return -EINVAL;
+	if (flags & EXTRA_FIELD) {
+		if (len < 12)
+			return 0;
+		i = 12 + src[10] + (src[11] << 8);
+	}
+	if (flags & ORIG_NAME) {
+		while (i < len && src[i])
+			i++;
+		if (i++ >= len)
+			return 0;
+	}
+	if (flags & COMMENT) {
+		while (i < len && src[i])
+			i++;
+		if (i++ >= len)
+			return 0;
+	}
+	if (flags & HEAD_CRC)
+		i += 2;
+
+	return i > len ? 0 : i;
+}
+
+/* Collect the header of a member, returning the number of bytes used */
+static int gzwrite_stream_header(struct gzwrite_stream *gz, const u8 *src,
+				 ulong len)
+{
+	int n = min_t(ulong, len, sizeof(gz->hdr) - gz->hdr_len);
+	int used, i;
+
+	memcpy(gz->hdr + gz->hdr_len, src, n);
+	i = gzwrite_stream_header_len(gz->hdr, gz->hdr_len + n);
+	if (i < 0) {
+		if (!gz->members) {
+			puts("Error: Bad gzipped data\n");
+			return -EINVAL;
+		}
+		/* not another member, so the image has ended */
+		gz->state = GZS_DONE;
+		return len;
+	}
+	if (!i) {
+		if (gz->hdr_len + n == sizeof(gz->hdr)) {
+			puts("Error: gzip header too long\n");
+			return -EINVAL;
+		}
+		gz->hdr_len += n;
+		return n;
+	}
+
+	used = i - gz->hdr_len;
+	gz->hdr_len = 0;
+	gz->crc = 0;
+	gz->membersize = 0;
+	inflateReset(&gz->s);
+	gz->state = GZS_INFLATE;
+
+	return used;
+}
+
+/* Inflate the data of a member, returning the number of bytes used */
+static int gzwrite_stream_inflate(struct gzwrite_stream *gz, const u8 *src,
+				  ulong len)
+{
+	bool full = false;
+	unsigned char *writebuf;
+	ulong before;
+	int r, ret;
+
+	gz->s.next_in = (u8 *)src;
+	gz->s.avail_in = len;
+	do {
+		writebuf = gz->pipe.buf[gz->fill];
+		before = gz->filled;
+		gz->s.next_out = writebuf + gz->filled;
+		gz->s.avail_out = gz->szwritebuf - gz->filled;
+		r = inflate(&gz->s, Z_SYNC_FLUSH);
+		/* no progress possible until more data arrives */
+		if (r == Z_BUF_ERROR)
+			break;
+		if (r != Z_OK && r != Z_STREAM_END) {
+			printf("Error: inflate() returned %d\n", r);
+			return -EINVAL;
+		}
+		gz->filled = gz->szwritebuf - gz->s.avail_out;
+		gz->crc = crc32(gz->crc, writebuf + before,
+				gz->filled - before);
+		gz->membersize += gz->filled - before;
+		gz->totalfilled += gz->filled - before;
+
+		/* a full buffer may mean there is more output to come */
+		full = gz->filled == gz->szwritebuf;
+		if (full) {
+			ret = gzwrite_stream_flush(gz, gz->filled);
+			if (ret)
+				return ret;
+		}
+		schedule();
+	} while ((gz->s.avail_in || full) && r != Z_STREAM_END);
+
+	if (r == Z_STREAM_END)
+		gz->state = GZS_TRAILER;
+
+	return len - gz->s.avail_in;
+}
+
+/* Collect and check the trailer of a member, returning the bytes used */
+static int gzwrite_stream_trailer(struct gzwrite_stream *gz, const u8 *src,
+				  ulong len)
+{
+	int n = min_t(ulong, len, sizeof(gz->trailer) - gz->trailer_len);
+	u32 expected_crc, szuncompressed;
+
+	memcpy(gz->trailer + gz->trailer_len, src, n);
+	gz->trailer_len += n;
+	if (gz->trailer_len < sizeof(gz->trailer))
+		return n;
+
+	expected_crc = get_unaligned_le32(gz->trailer);
+	szuncompressed = get_unaligned_le32(gz->trailer + 4);
+	if (gz->crc != expected_crc || gz->membersize != szuncompressed) {
+		printf("Error: member %d crc 0x%08x/0x%08x, size %u/%u\n",
+		       gz->members + 1, gz->crc, expected_crc, gz->membersize,
+		       szuncompressed);
+		return -EIO;
+	}
+	gz->members++;
+	gz->trailer_len = 0;
+	gz->state = GZS_HEADER;
+
+	return n;
+}
+
+int gzwrite_stream_write(struct gzwrite_stream *gz, const void *src,
+			 ulong len)
+{
+	const u8 *ptr = src;
+	int used;
+
+	while (len && gz->state != GZS_DONE) {
+		switch (gz->state) {
+		case GZS_HEADER:
+			used = gzwrite_stream_header(gz, ptr, len);
+			break;
+		case GZS_INFLATE:
+			used = gzwrite_stream_inflate(gz, ptr, len);
+			break;
+		case GZS_TRAILER:
+		default:
+			used = gzwrite_stream_trailer(gz, ptr, len);
+			break;
+		}
+		if (used < 0)
+			return used;
+		ptr += used;
+		len -= used;
+	}
+
+	return 0;
+}
+
+int gzwrite_stream_finish(struct gzwrite_stream *gz, ulong *sizep)
+{
+	int ret;
+
+	ret = gzwrite_stream_flush(gz, gz->filled);
+	if (!ret)
+		ret = gzwrite_pipe_wait(&gz->pipe, 0);
+	/* the image may end after any complete member */
+	if (!ret && (!gz->members ||
+		     (gz->state != GZS_HEADER && gz->state != GZS_DONE))) {
+		puts("Error: gunzip out of data\n");
+		ret = -EIO;
+	}
+	*sizep = gz->totalfilled;
+	gzwrite_stream_free(gz);
+
+	return ret;
+}
+
 #ifdef CONFIG_CMD_UNZIP
 __weak
 void gzwrite_progress_init(ulong expectedsize)
@@ -122,16 +546,15 @@ int gzwrite(unsigned char *src, int len,
 	    ulong startoffs,
 	    ulong szexpected)
 {
-	int i, flags;
-	z_stream s;
-	int r = 0;
-	unsigned char *writebuf;
-	unsigned crc = 0;
+	struct gzwrite_stream *gz;
+	lbaint_t startblock;
 	ulong totalfilled = 0;
-	lbaint_t blksperbuf, outblock;
-	u32 expected_crc;
-	u32 payload_size;
+	u32 expected_crc, crc;
+	bool check_size;
 	int iteration = 0;
+	int members;
+	ulong chunk;
+	int i, r;
 
 	if (!szwritebuf ||
 	    (szwritebuf % dev->blksz) ||
@@ -147,126 +570,62 @@ int gzwrite(unsigned char *src, int len,
 		return -1;
 	}
 
-	blksperbuf = szwritebuf / dev->blksz;
-	outblock = lldiv(startoffs, dev->blksz);
-
-	/* skip header */
-	i = 10;
-	flags = src[3];
-	if (src[2] != DEFLATED || (flags & RESERVED) != 0) {
-		puts("Error: Bad gzipped data\n");
-		return -1;
-	}
-	if ((flags & EXTRA_FIELD) != 0)
-		i = 12 + src[10] + (src[11] << 8);
-	if ((flags & ORIG_NAME) != 0)
-		while (src[i++] != 0)
-			;
-	if ((flags & COMMENT) != 0)
-		while (src[i++] != 0)
-			;
-	if ((flags & HEAD_CRC) != 0)
-		i += 2;
-
-	if (i >= len-8) {
+	if (len < 18) {
 		puts("Error: gunzip out of data in header");
 		return -1;
 	}
 
-	payload_size = len - i - 8;
-
-	memcpy(&expected_crc, src + len - 8, sizeof(expected_crc));
-	expected_crc = le32_to_cpu(expected_crc);
-	u32 szuncompressed;
-	memcpy(&szuncompressed, src + len - 4, sizeof(szuncompressed));
-	if (szexpected == 0) {
-		szexpected = le32_to_cpu(szuncompressed);
-	} else if (szuncompressed != (u32)szexpected) {
-		printf("size of %lx doesn't match trailer low bits %x\n",
-		       szexpected, szuncompressed);
-		return -1;
-	}
-	if (lldiv(szexpected, dev->blksz) > (dev->lba - outblock)) {
+	/*
+	 * The trailer at the end of the file only covers the last member of a
+	 * multi-member image (e.g. several gzip files put together), so the
+	 * total size can only be checked when it is given or there is a
+	 * single member. Each member is checked against its own trailer.
+	 */
+	expected_crc = get_unaligned_le32(src + len - 8);
+	check_size = szexpected;
+	if (szexpected == 0)
+		szexpected = get_unaligned_le32(src + len - 4);
+	startblock = lldiv(startoffs, dev->blksz);
+	if (lldiv(szexpected, dev->blksz) > (dev->lba - startblock)) {
 		printf("%s: uncompressed size %lu exceeds device size\n",
 		       __func__, szexpected);
 		return -1;
 	}
 
-	gzwrite_progress_init(szexpected);
-
-	s.zalloc = gzalloc;
-	s.zfree = gzfree;
-
-	r = inflateInit2(&s, -MAX_WBITS);
-	if (r != Z_OK) {
-		printf("Error: inflateInit2() returned %d\n", r);
+	gz = gzwrite_stream_init(dev, szwritebuf, startblock,
+				 dev->lba - startblock);
+	if (!gz)
 		return -1;
-	}
 
-	s.next_in = src + i;
-	s.avail_in = payload_size+8;
-	writebuf = (unsigned char *)malloc_cache_aligned(szwritebuf);
+	gzwrite_progress_init(szexpected);
 
-	/* decompress until deflate stream ends or end of file */
-	do {
-		if (s.avail_in == 0) {
-			printf("%s: weird termination with result %d\n",
-			       __func__, r);
-			break;
+	/* feed the image in pieces, to show progress and allow an abort */
+	r = 0;
+	for (i = 0; i < len && !r; i += chunk) {
+		chunk = min_t(ulong, len - i, szwritebuf);
+		r = gzwrite_stream_write(gz, src + i, chunk);
+		gzwrite_progress(iteration++, gz->totalfilled, szexpected);
+		if (!r && ctrlc()) {
+			puts("abort\n");
+			r = -EINTR;
 		}
+		schedule();
+	}
+
+	members = gz->members;
+	crc = gz->crc;
+	if (r) {
+		totalfilled = gz->totalfilled;
+		gzwrite_stream_free(gz);
+	} else {
+		r = gzwrite_stream_finish(gz, &totalfilled);
+	}
+	if (!r && (check_size || members == 1) && szexpected != totalfilled)
+		r = -EIO;
+	r = r ? -1 : 0;
 
-		/* run inflate() on input until output buffer not full */
-		do {
-			unsigned long blocks_written;
-			int numfilled;
-			lbaint_t writeblocks;
-
-			s.avail_out = szwritebuf;
-			s.next_out = writebuf;
-			r = inflate(&s, Z_SYNC_FLUSH);
-			if ((r != Z_OK) &&
-			    (r != Z_STREAM_END)) {
-				printf("Error: inflate() returned %d\n", r);
-				goto out;
-			}
-			numfilled = szwritebuf - s.avail_out;
-			crc = crc32(crc, writebuf, numfilled);
-			totalfilled += numfilled;
-			if (numfilled < szwritebuf) {
-				writeblocks = (numfilled+dev->blksz-1)
-						/ dev->blksz;
-				memset(writebuf+numfilled, 0,
-				       dev->blksz-(numfilled%dev->blksz));
-			} else {
-				writeblocks = blksperbuf;
-			}
-
-			gzwrite_progress(iteration++,
-					 totalfilled,
-					 szexpected);
-			blocks_written = blk_dwrite(dev, outblock,
-						    writeblocks, writebuf);
-			outblock += blocks_written;
-			if (ctrlc()) {
-				puts("abort\n");
-				goto out;
-			}
-			schedule();
-		} while (s.avail_out == 0);
-		/* done when inflate() says it's done */
-	} while (r != Z_STREAM_END);
-
-	if ((szexpected != totalfilled) ||
-	    (crc != expected_crc))
-		r = -1;
-	else
-		r = 0;
-
-out:
 	gzwrite_progress_finish(r, totalfilled, szexpected,
 				expected_crc, crc);
-	free(writebuf);
-	inflateEnd(&s);
 
 	return r;
 }
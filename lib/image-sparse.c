@@ -316,3 +316,297 @@ int write_sparse_image(struct sparse_storage *info,
 
 	return 0;
 }
+
+/**
+ * enum sparse_stream_state - what a sparse stream expects next
+ *
+ * @SPARSE_STREAM_HEADER:	image header
+ * @SPARSE_STREAM_CHUNK:	chunk header
+ * @SPARSE_STREAM_RAW:		data of a raw chunk
+ * @SPARSE_STREAM_FILL:		pattern of a fill chunk
+ * @SPARSE_STREAM_DONE:		nothing, all chunks are written
+ */
+enum sparse_stream_state {
+	SPARSE_STREAM_HEADER,
+	SPARSE_STREAM_CHUNK,
+	SPARSE_STREAM_RAW,
+	SPARSE_STREAM_FILL,
+	SPARSE_STREAM_DONE,
+};
+
+/**
+ * struct sparse_stream - sparse image written as it arrives
+ *
+ * @info:	storage to write to
+ * @state:	what is expected next
+ * @hdr:	image header
+ * @chunk:	header of the current chunk
+ * @buf:	header or fill pattern collected so far
+ * @len:	number of bytes held in @buf
+ * @skip:	number of bytes to drop before going on
+ * @left:	number of bytes of raw data still to come in the current chunk
+ * @chunks:	number of chunks done
+ * @blocks:	number of output blocks done, in units of @hdr.blk_sz
+ * @blk:	next storage block to write
+ * @data:	raw data or fill pattern on its way to storage
+ * @data_blks:	size of @data in storage blocks
+ * @data_len:	number of bytes held in @data
+ */
+struct sparse_stream {
+	struct sparse_storage *info;
+	enum sparse_stream_state state;
+	sparse_header_t hdr;
+	chunk_header_t chunk;
+	u8 buf[sizeof(sparse_header_t)];
+	uint len;
+	ulong skip;
+	u64 left;
+	uint chunks;
+	uint blocks;
+	lbaint_t blk;
+	u8 *data;
+	lbaint_t data_blks;
+	ulong data_len;
+};
+
+struct sparse_stream *sparse_stream_init(struct sparse_storage *info)
+{
+	struct sparse_stream *ss;
+
+	ss = calloc(1, sizeof(*ss));
+	if (!ss)
+		return NULL;
+
+	ss->data_blks = max_t(lbaint_t,
+			      CONFIG_IMAGE_SPARSE_FILLBUF_SIZE / info->blksz, 1);
+	ss->data = memalign(ARCH_DMA_MINALIGN,
+			    ROUNDUP(info->blksz * ss->data_blks,
+				    ARCH_DMA_MINALIGN));
+	if (!ss->data) {
+		free(ss);
+		return NULL;
+	}
+	ss->info = info;
+	ss->blk = info->start;
+
+	return ss;
+}
+
+/* Collect up to @want bytes of a header, returning true once it is all here */
+static bool sparse_stream_take(struct sparse_stream *ss, const u8 **src,
+			       ulong *len, uint want)
+{
+	uint n = min_t(ulong, want - ss->len, *len);
+
+	memcpy(ss->buf + ss->len, *src, n);
+	ss->len += n;
+	*src += n;
+	*len -= n;
+
+	return ss->len == want;
+}
+
+static int sparse_stream_flush(struct sparse_stream *ss, lbaint_t blkcnt)
+{
+	struct sparse_storage *info = ss->info;
+	lbaint_t blks;
+
+	blks = info->write(info, ss->blk, blkcnt, ss->data);
+	/* blks might be > blkcnt (eg. NAND bad-blocks) */
+	if (IS_ERR_VALUE(blks) || blks < blkcnt) {
+		printf("%s: Write failed, block #" LBAFU " [" LBAFU "]\n",
+		       __func__, ss->blk, blkcnt);
+		return -EIO;
+	}
+	ss->blk += blks;
+
+	return 0;
+}
+
+static void sparse_stream_next(struct sparse_stream *ss)
+{
+	ss->chunks++;
+	ss->blocks += ss->chunk.chunk_sz;
+	ss->len = 0;
+	ss->state = ss->chunks == ss->hdr.total_chunks ?
+		SPARSE_STREAM_DONE : SPARSE_STREAM_CHUNK;
+}
+
+static int sparse_stream_header(struct sparse_stream *ss)
+{
+	struct sparse_storage *info = ss->info;
+
+	if (!is_sparse_image(ss->buf)) {
+		printf("%s: Not a sparse image\n", __func__);
+		return -EINVAL;
+	}
+	memcpy(&ss->hdr, ss->buf, sizeof(ss->hdr));
+	if (ss->hdr.file_hdr_sz < sizeof(sparse_header_t) ||
+	    ss->hdr.chunk_hdr_sz < sizeof(chunk_header_t) ||
+	    !ss->hdr.blk_sz || ss->hdr.blk_sz % info->blksz) {
+		printf("%s: Sparse image header issue [%u]\n", __func__,
+		       ss->hdr.blk_sz);
+		return -EINVAL;
+	}
+
+	ss->skip = ss->hdr.file_hdr_sz - sizeof(sparse_header_t);
+	ss->len = 0;
+	ss->state = ss->hdr.total_chunks ? SPARSE_STREAM_CHUNK :
+		SPARSE_STREAM_DONE;
+
+	return 0;
+}
+
+static int sparse_stream_chunk(struct sparse_stream *ss)
+{
+	struct sparse_storage *info = ss->info;
+	chunk_header_t *chunk = &ss->chunk;
+	u64 chunk_data_sz;
+	lbaint_t blkcnt;
+
+	memcpy(chunk, ss->buf, sizeof(*chunk));
+	ss->skip = ss->hdr.chunk_hdr_sz - sizeof(chunk_header_t);
+	ss->len = 0;
+	chunk_data_sz = (u64)ss->hdr.blk_sz * chunk->chunk_sz;
+	blkcnt = div_u64(chunk_data_sz, info->blksz);
+
+	if (chunk->total_sz < ss->hdr.chunk_hdr_sz) {
+		printf("%s: Bogus chunk size\n", __func__);
+		return -EINVAL;
+	}
+
+	switch (chunk->chunk_type) {
+	case CHUNK_TYPE_RAW:
+	case CHUNK_TYPE_FILL:
+		if (chunk->total_sz != ss->hdr.chunk_hdr_sz +
+		    (chunk->chunk_type == CHUNK_TYPE_RAW ?
+		     chunk_data_sz : sizeof(uint32_t))) {
+			printf("%s: Bogus chunk size for chunk type %x\n",
+			       __func__, chunk->chunk_type);
+			return -EINVAL;
+		}
+		if (ss->blk + blkcnt > info->start + info->size) {
+			printf("%s: Request would exceed partition size!\n",
+			       __func__);
+			return -ENOSPC;
+		}
+		ss->left = chunk_data_sz;
+		ss->data_len = 0;
+		ss->state = chunk->chunk_type == CHUNK_TYPE_RAW ?
+			SPARSE_STREAM_RAW : SPARSE_STREAM_FILL;
+		if (ss->state == SPARSE_STREAM_RAW && !ss->left)
+			sparse_stream_next(ss);
+		break;
+	case CHUNK_TYPE_DONT_CARE:
+	case CHUNK_TYPE_CRC32:
+		if (chunk->chunk_type == CHUNK_TYPE_DONT_CARE)
+			ss->blk += info->reserve ?
+				info->reserve(info, ss->blk, blkcnt) : blkcnt;
+		ss->skip += chunk->total_sz - ss->hdr.chunk_hdr_sz;
+		sparse_stream_next(ss);
+		break;
+	default:
+		printf("%s: Unknown chunk type: %x\n", __func__,
+		       chunk->chunk_type);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int sparse_stream_fill(struct sparse_stream *ss)
+{
+	struct sparse_storage *info = ss->info;
+	lbaint_t blkcnt = div_u64(ss->left, info->blksz);
+	u32 *fill = (u32 *)ss->data;
+	lbaint_t n;
+	ulong i;
+	int ret;
+
+	for (i = 0; i < ss->data_blks * info->blksz / sizeof(u32); i++)
+		memcpy(&fill[i], ss->buf, sizeof(u32));
+
+	while (blkcnt) {
+		n = min(blkcnt, ss->data_blks);
+		ret = sparse_stream_flush(ss, n);
+		if (ret)
+			return ret;
+		blkcnt -= n;
+	}
+	sparse_stream_next(ss);
+
+	return 0;
+}
+
+int sparse_stream_write(struct sparse_stream *ss, const void *src, ulong len)
+{
+	struct sparse_storage *info = ss->info;
+	const u8 *ptr = src;
+	ulong n;
+	int ret = 0;
+
+	while (len && !ret) {
+		if (ss->skip) {
+			n = min(ss->skip, len);
+			ss->skip -= n;
+			ptr += n;
+			len -= n;
+			continue;
+		}
+
+		switch (ss->state) {
+		case SPARSE_STREAM_HEADER:
+			if (sparse_stream_take(ss, &ptr, &len,
+					       sizeof(sparse_header_t)))
+				ret = sparse_stream_header(ss);
+			break;
+		case SPARSE_STREAM_CHUNK:
+			if (sparse_stream_take(ss, &ptr, &len,
+					       sizeof(chunk_header_t)))
+				ret = sparse_stream_chunk(ss);
+			break;
+		case SPARSE_STREAM_RAW:
+			n = min_t(u64, ss->left,
+				  ss->data_blks * info->blksz - ss->data_len);
+			n = min(n, len);
+			memcpy(ss->data + ss->data_len, ptr, n);
+			ss->data_len += n;
+			ss->left -= n;
+			ptr += n;
+			len -= n;
+			if (ss->left &&
+			    ss->data_len < ss->data_blks * info->blksz)
+				break;
+			ret = sparse_stream_flush(ss,
+						  ss->data_len / info->blksz);
+			ss->data_len = 0;
+			if (!ss->left)
+				sparse_stream_next(ss);
+			break;
+		case SPARSE_STREAM_FILL:
+			if (sparse_stream_take(ss, &ptr, &len, sizeof(u32)))
+				ret = sparse_stream_fill(ss);
+			break;
+		case SPARSE_STREAM_DONE:
+			/* Ignore anything after the last chunk */
+			len = 0;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+int sparse_stream_finish(struct sparse_stream *ss)
+{
+	int ret = 0;
+
+	if (ss->state != SPARSE_STREAM_DONE ||
+	    ss->blocks != ss->hdr.total_blks)
+		ret = -EIO;
+
+	free(ss->data);
+	free(ss);
+
+	return ret;
+}
@@ -66,6 +66,9 @@
 
 #define MEMP_NUM_TCP_SEG                16
 #define PBUF_POOL_SIZE                  8
+#if defined(CONFIG_LWIP_RX_ZERO_COPY)
+#define LWIP_SUPPORT_CUSTOM_PBUF        1
+#endif
 
 #define LWIP_ARP                        1
 #define ARP_TABLE_SIZE                  4
@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Multi-buffer SHA-256: hash several independent buffers at once
+ *
+ * SHA-256 is a long chain of dependent 32-bit operations, so a single
+ * stream leaves most of a CPU idle. Running SHA256_MB_LANES streams side by
+ * side lets each operation work on one vector of lanes instead of a single
+ * word, and needs no special instructions: GCC vector types turn into SSE
+ * on x86 or NEON on ARM, and into plain scalar code elsewhere.
+ *
+ * This file only handles whole buffers and keeps its own state, so it works
+ * the same whichever SHA-256 library provides sha256_csum_wd().
+ */
+
+#include <string.h>
+#include <asm/unaligned.h>
+#include <u-boot/schedule.h>
+#include <u-boot/sha256.h>
+#include <linux/compiler_attributes.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+
+typedef u32 sha256_mb_vec __attribute__((vector_size(SHA256_MB_LANES * 4)));
+
+static const u32 sha256_mb_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const u32 sha256_mb_h0[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+#define ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define S0(x)		(ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define S1(x)		(ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+#define S2(x)		(ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S3(x)		(ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define F0(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+#define F1(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+
+static inline u32 sha256_mb_be32(const u8 *p)
+{
+	return (u32)p[0] << 24 | (u32)p[1] << 16 | (u32)p[2] << 8 | p[3];
+}
+
+__weak void sha256_mb_process(u32 state[][8], const u8 *data[],
+			      unsigned int lanes, unsigned int blocks)
+{
+	const u8 *p[SHA256_MB_LANES];
+	sha256_mb_vec s[8], v[8], w[16], t1, t2;
+	unsigned int i, l, t;
+
+	/* Spare lanes repeat lane 0 and their results are dropped */
+	for (l = 0; l < SHA256_MB_LANES; l++) {
+		unsigned int src = l < lanes ? l : 0;
+
+		p[l] = data[src];
+		for (i = 0; i < 8; i++)
+			s[i][l] = state[src][i];
+	}
+
+	while (blocks--) {
+		for (t = 0; t < 16; t++)
+			for (l = 0; l < SHA256_MB_LANES; l++)
+				w[t][l] = sha256_mb_be32(p[l] + t * 4);
+		for (i = 0; i < 8; i++)
+			v[i] = s[i];
+
+		for (t = 0; t < 64; t++) {
+			if (t >= 16)
+				w[t & 15] += S1(w[(t - 2) & 15]) +
+					w[(t - 7) & 15] + S0(w[(t - 15) & 15]);
+			t1 = v[7] + S3(v[4]) + F1(v[4], v[5], v[6]) +
+				sha256_mb_k[t] + w[t & 15];
+			t2 = S2(v[0]) + F0(v[0], v[1], v[2]);
+			v[7] = v[6];
+			v[6] = v[5];
+			v[5] = v[4];
+			v[4] = v[3] + t1;
+			v[3] = v[2];
+			v[2] = v[1];
+			v[1] = v[0];
+			v[0] = t1 + t2;
+		}
+
+		for (i = 0; i < 8; i++)
+			s[i] += v[i];
+		for (l = 0; l < SHA256_MB_LANES; l++)
+			p[l] += 64;
+	}
+
+	for (l = 0; l < lanes; l++) {
+		for (i = 0; i < 8; i++)
+			state[l][i] = s[i][l];
+		data[l] = p[l];
+	}
+}
+
+/**
+ * struct sha256_mb_lane - a buffer being hashed in one lane
+ *
+ * @job: index of the buffer, or -1 if the lane is idle
+ * @data: next block to hash
+ * @left: number of blocks left at @data
+ * @in_tail: true once @data points into @tail
+ * @tail: last partial block of the buffer followed by the padding
+ */
+struct sha256_mb_lane {
+	int job;
+	const u8 *data;
+	unsigned int left;
+	bool in_tail;
+	u8 tail[128];
+};
+
+/* Start hashing buffer @job in @lane */
+static void sha256_mb_start(struct sha256_mb_lane *lane, u32 state[8],
+			    int job, const u8 *input, unsigned int ilen)
+{
+	lane->job = job;
+	lane->data = input;
+	lane->left = ilen / 64;
+	lane->in_tail = false;
+	memcpy(state, sha256_mb_h0, sizeof(sha256_mb_h0));
+}
+
+/* Move the lane onto the padded tail, returning false if already there */
+static bool sha256_mb_tail(struct sha256_mb_lane *lane, const u8 *input,
+			   unsigned int ilen)
+{
+	unsigned int rest = ilen & 63;
+	u64 bits = (u64)ilen << 3;
+	unsigned int size;
+	int i;
+
+	if (lane->in_tail)
+		return false;
+
+	size = rest < 56 ? 64 : 128;
+	memset(lane->tail, '\0', size);
+	memcpy(lane->tail, input + ilen - rest, rest);
+	lane->tail[rest] = 0x80;
+	for (i = 0; i < 8; i++)
+		lane->tail[size - 1 - i] = bits >> (i * 8);
+	lane->data = lane->tail;
+	lane->left = size / 64;
+	lane->in_tail = true;
+
+	return true;
+}
+
+void sha256_csum_multi(const unsigned char *const input[],
+		       const unsigned int ilen[], unsigned char *const output[],
+		       unsigned int count, unsigned int chunk_sz)
+{
+	struct sha256_mb_lane lanes[SHA256_MB_LANES];
+	u32 state[SHA256_MB_LANES][8];
+	const u8 *data[SHA256_MB_LANES];
+	unsigned int next = 0, active, step, done = 0;
+	unsigned int i, l;
+
+	for (l = 0; l < SHA256_MB_LANES; l++)
+		lanes[l].job = -1;
+
+	for (;;) {
+		/*
+		 * Finish any lane which has run out of blocks, refill idle
+		 * lanes from the queue and pack the busy ones at the front
+		 */
+		active = 0;
+		for (l = 0; l < SHA256_MB_LANES; l++) {
+			struct sha256_mb_lane *lane = &lanes[l];
+
+			for (;;) {
+				if (lane->job == -1) {
+					if (next == count)
+						break;
+					sha256_mb_start(lane, state[l], next,
+							input[next], ilen[next]);
+					next++;
+				}
+				if (lane->left)
+					break;
+				if (sha256_mb_tail(lane, input[lane->job],
+						   ilen[lane->job]))
+					continue;
+				for (i = 0; i < 8; i++)
+					put_unaligned_be32(state[l][i],
+						output[lane->job] + i * 4);
+				lane->job = -1;
+			}
+			if (lane->job == -1)
+				continue;
+			if (l != active) {
+				lanes[active] = *lane;
+				if (lane->in_tail)
+					lanes[active].data = lanes[active].tail +
+						(lane->data - lane->tail);
+				memcpy(state[active], state[l],
+				       sizeof(state[l]));
+				lane->job = -1;
+			}
+			active++;
+		}
+		if (!active)
+			break;
+
+		/* Run all busy lanes until the first one needs attention */
+		step = chunk_sz / 64 ? chunk_sz / 64 : 1;
+		for (l = 0; l < active; l++) {
+			step = min(step, lanes[l].left);
+			data[l] = lanes[l].data;
+		}
+		sha256_mb_process(state, data, active, step);
+		for (l = 0; l < active; l++) {
+			lanes[l].data = data[l];
+			lanes[l].left -= step;
+		}
+
+		done += step * 64;
+		if (done >= chunk_sz) {
+			schedule();
+			done = 0;
+		}
+	}
+}
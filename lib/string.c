@@ -15,6 +15,7 @@
  *    reentrant and should be faster). Use only strsep() in new code, please.
  */
 
+#include <asm/byteorder.h>
 #include <asm/sections.h>
 #include <config.h>
 #include <limits.h>
@@ -513,6 +514,113 @@ char *strswab(const char *s)
 }
 #endif
 
+#if CONFIG_IS_ENABLED(FAST_MEMCPY)
+/*
+ * Helpers for the word-at-a-time versions below. All word accesses are
+ * aligned, so these suit CPUs which trap on unaligned access.
+ */
+#define WSIZE		sizeof(unsigned long)
+#define WMASK		(WSIZE - 1)
+
+/*
+ * Make a word from the two aligned words @lo and @hi which hold the bytes
+ * of a word starting @shift bits into @lo
+ */
+#ifdef __BIG_ENDIAN
+#define MERGE(lo, hi, shift) \
+	((lo) << (shift) | (hi) >> (WSIZE * 8 - (shift)))
+#else
+#define MERGE(lo, hi, shift) \
+	((lo) >> (shift) | (hi) << (WSIZE * 8 - (shift)))
+#endif
+
+/*
+ * Copy @count bytes forwards from @src to @dest, where @dest is word-aligned
+ * and @count is a multiple of the word size. A misaligned @src is read a
+ * word at a time and shifted into place.
+ */
+static __rcode __always_inline void copy_words_fwd(unsigned long *dl,
+						   const u8 *src, size_t count)
+{
+	const unsigned long *sl;
+	unsigned long lo, hi;
+	uint shift;
+
+	if (!((ulong)src & WMASK)) {
+		sl = (const unsigned long *)src;
+		for (; count >= 4 * WSIZE; count -= 4 * WSIZE) {
+			dl[0] = sl[0];
+			dl[1] = sl[1];
+			dl[2] = sl[2];
+			dl[3] = sl[3];
+			dl += 4;
+			sl += 4;
+		}
+		for (; count; count -= WSIZE)
+			*dl++ = *sl++;
+		return;
+	}
+
+	shift = ((ulong)src & WMASK) * 8;
+	sl = (const unsigned long *)((ulong)src & ~WMASK);
+	lo = *sl++;
+	for (; count >= 4 * WSIZE; count -= 4 * WSIZE) {
+		hi = sl[0];
+		dl[0] = MERGE(lo, hi, shift);
+		lo = sl[1];
+		dl[1] = MERGE(hi, lo, shift);
+		hi = sl[2];
+		dl[2] = MERGE(lo, hi, shift);
+		lo = sl[3];
+		dl[3] = MERGE(hi, lo, shift);
+		dl += 4;
+		sl += 4;
+	}
+	for (; count; count -= WSIZE) {
+		hi = *sl++;
+		*dl++ = MERGE(lo, hi, shift);
+		lo = hi;
+	}
+}
+
+/*
+ * Copy the @count bytes before @send backwards to the @count bytes before
+ * @dl, where @dl is word-aligned and @count is a multiple of the word size
+ */
+static __rcode __always_inline void copy_words_bwd(unsigned long *dl,
+						   const u8 *send,
+						   size_t count)
+{
+	const unsigned long *sl;
+	unsigned long lo, hi;
+	uint shift;
+
+	if (!((ulong)send & WMASK)) {
+		sl = (const unsigned long *)send;
+		for (; count >= 4 * WSIZE; count -= 4 * WSIZE) {
+			dl -= 4;
+			sl -= 4;
+			dl[3] = sl[3];
+			dl[2] = sl[2];
+			dl[1] = sl[1];
+			dl[0] = sl[0];
+		}
+		for (; count; count -= WSIZE)
+			*--dl = *--sl;
+		return;
+	}
+
+	shift = ((ulong)send & WMASK) * 8;
+	sl = (const unsigned long *)((ulong)send & ~WMASK);
+	hi = *sl;
+	for (; count; count -= WSIZE) {
+		lo = *--sl;
+		*--dl = MERGE(lo, hi, shift);
+		hi = lo;
+	}
+}
+#endif
+
 #ifndef __HAVE_ARCH_MEMSET
 /**
  * memset - Fill a region of memory with the given value
@@ -527,7 +635,25 @@ __used void * memset(void * s,int c,size_t count)
 	unsigned long *sl = (unsigned long *) s;
 	char *s8;
 
-#if !CONFIG_IS_ENABLED(TINY_MEMSET)
+#if CONFIG_IS_ENABLED(FAST_MEMCPY) && !CONFIG_IS_ENABLED(TINY_MEMSET)
+	unsigned long cl = (c & 0xff) * (~0UL / 0xff);
+
+	if (count >= 2 * WSIZE) {
+		/* align the start, then fill four words at a time */
+		for (s8 = s; (ulong)s8 & WMASK; count--)
+			*s8++ = c;
+		sl = (unsigned long *)s8;
+		for (; count >= 4 * WSIZE; count -= 4 * WSIZE) {
+			sl[0] = cl;
+			sl[1] = cl;
+			sl[2] = cl;
+			sl[3] = cl;
+			sl += 4;
+		}
+		for (; count >= WSIZE; count -= WSIZE)
+			*sl++ = cl;
+	}
+#elif !CONFIG_IS_ENABLED(TINY_MEMSET)
 	unsigned long cl = 0;
 	int i;
 
@@ -569,6 +695,22 @@ __rcode __used void *memcpy(void *dest, const void *src, size_t count)
 	if (src == dest)
 		return dest;
 
+#if CONFIG_IS_ENABLED(FAST_MEMCPY)
+	if (count >= 2 * WSIZE) {
+		size_t words;
+
+		/* align the destination, then copy whole words */
+		d8 = dest;
+		s8 = (char *)src;
+		for (; (ulong)d8 & WMASK; count--)
+			*d8++ = *s8++;
+		words = count & ~WMASK;
+		copy_words_fwd((unsigned long *)d8, (u8 *)s8, words);
+		dl = (unsigned long *)(d8 + words);
+		sl = (unsigned long *)(s8 + words);
+		count -= words;
+	}
+#else
 	/* while all data is aligned (common case), copy a word at a time */
 	if ( (((ulong)dest | (ulong)src) & (sizeof(*dl) - 1)) == 0) {
 		while (count >= sizeof(*dl)) {
@@ -576,6 +718,7 @@ __rcode __used void *memcpy(void *dest, const void *src, size_t count)
 			count -= sizeof(*dl);
 		}
 	}
+#endif
 	/* copy the reset one byte at a time */
 	d8 = (char *)dl;
 	s8 = (char *)sl;
@@ -616,6 +759,20 @@ __rcode __used void *memmove(void *dest, const void *src, size_t count)
 	} else {
 		tmp = (char *) dest + count;
 		s = (char *) src + count;
+#if CONFIG_IS_ENABLED(FAST_MEMCPY)
+		if (count >= 2 * WSIZE) {
+			size_t words;
+
+			/* align the end of the destination, copy words */
+			for (; (ulong)tmp & WMASK; count--)
+				*--tmp = *--s;
+			words = count & ~WMASK;
+			copy_words_bwd((unsigned long *)tmp, (u8 *)s, words);
+			tmp -= words;
+			s -= words;
+			count -= words;
+		}
+#endif
 		while (count--)
 			*--tmp = *--s;
 		}
@@ -312,6 +312,80 @@ static struct pbuf *alloc_pbuf_and_copy(uchar *data, int len)
 	return p;
 }
 
+#if CONFIG_IS_ENABLED(LWIP_RX_ZERO_COPY)
+/* Upper limit on the number of driver buffers held by lwIP at once */
+#define RX_PBUF_COUNT	32
+
+/**
+ * struct rx_pbuf - a driver receive buffer lent to lwIP
+ *
+ * @pc: custom pbuf pointing at @packet
+ * @udev: device which owns the buffer, or NULL if the slot is free
+ * @packet: buffer returned by the recv() method
+ * @len: length returned by the recv() method
+ */
+struct rx_pbuf {
+	struct pbuf_custom pc;
+	struct udevice *udev;
+	uchar *packet;
+	int len;
+};
+
+static struct rx_pbuf rx_pbufs[RX_PBUF_COUNT];
+static int rx_pbufs_held;
+
+static void rx_pbuf_free(struct pbuf *p)
+{
+	struct rx_pbuf *rp = container_of((struct pbuf_custom *)p,
+					  struct rx_pbuf, pc);
+
+	eth_get_ops(rp->udev)->free_pkt(rp->udev, rp->packet, rp->len);
+	rp->udev = NULL;
+	rx_pbufs_held--;
+}
+
+/*
+ * Wrap a received packet in a pbuf without copying it. Returns NULL if the
+ * driver cannot spare the buffer, in which case the caller copies it.
+ */
+static struct pbuf *alloc_pbuf_ref(struct udevice *udev, uchar *data, int len)
+{
+	struct eth_ops *ops = eth_get_ops(udev);
+	struct rx_pbuf *rp;
+	struct pbuf *p;
+	int i;
+
+	if (!ops->max_held_pkts || !ops->free_pkt ||
+	    rx_pbufs_held >= min(ops->max_held_pkts(udev), RX_PBUF_COUNT))
+		return NULL;
+
+	for (i = 0; i < RX_PBUF_COUNT; i++)
+		if (!rx_pbufs[i].udev)
+			break;
+	if (i == RX_PBUF_COUNT)
+		return NULL;
+
+	rp = &rx_pbufs[i];
+	rp->pc.custom_free_function = rx_pbuf_free;
+	p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &rp->pc, data, len);
+	if (!p)
+		return NULL;
+	rp->udev = udev;
+	rp->packet = data;
+	rp->len = len;
+	rx_pbufs_held++;
+
+	LINK_STATS_INC(link.recv);
+
+	return p;
+}
+#else
+static struct pbuf *alloc_pbuf_ref(struct udevice *udev, uchar *data, int len)
+{
+	return NULL;
+}
+#endif
+
 int net_lwip_rx(struct udevice *udev, struct netif *netif)
 {
 	struct pbuf *pbuf;
@@ -330,6 +404,8 @@ int net_lwip_rx(struct udevice *udev, struct netif *netif)
 
 	flags = ETH_RECV_CHECK_DEVICE;
 	for (i = 0; i < ETH_PACKETS_BATCH_RECV; i++) {
+		/* Never hand a packet lent to lwIP back to the driver below */
+		packet = NULL;
 		len = eth_get_ops(udev)->recv(udev, flags, &packet);
 		flags = 0;
 
@@ -341,6 +417,12 @@ int net_lwip_rx(struct udevice *udev, struct netif *netif)
 					       packet, len, true);
 			}
 
+			pbuf = alloc_pbuf_ref(udev, packet, len);
+			if (pbuf) {
+				/* lwIP frees the packet when it is done */
+				netif->input(pbuf, netif);
+				continue;
+			}
 			pbuf = alloc_pbuf_and_copy(packet, len);
 			if (pbuf)
 				netif->input(pbuf, netif);
@@ -739,7 +739,11 @@ restart:
 
 			eth_set_last_protocol(protocol);
 
-			ret = net_boot_file_size;
+			/*
+			 * Success must not look like an error, so the size of
+			 * a file of 2GiB or more is only in net_boot_file_size
+			 */
+			ret = min_t(u32, net_boot_file_size, INT_MAX);
 			debug_cond(DEBUG_INT_STATE, "--- net_loop Success!\n");
 			goto done;
 
@@ -0,0 +1,301 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Write a network download to a block device as it arrives
+ *
+ * The protocols store what they receive at its offset in the file. While a
+ * sink is set up, that offset is taken modulo the size of a staging buffer
+ * at the load address, which is split in two halves. As soon as one half
+ * holds a complete part of the file, it is written out to the block device,
+ * through a decompressor or sparse image parser if needed, while the other
+ * half goes on receiving data. The block device writes are synchronous, but
+ * the sender keeps a whole window of data in flight meanwhile, which is
+ * buffered by the network and the half not being written.
+ */
+
+#include <env.h>
+#include <gzip.h>
+#include <image-sparse.h>
+#include <lmb.h>
+#include <log.h>
+#include <mapmem.h>
+#include <net/sink.h>
+#include <linux/sizes.h>
+
+/* Smallest half buffer: a TFTP block and a TCP window both need room */
+#define NET_SINK_MIN_HALF	SZ_128K
+
+/**
+ * struct net_sink - state of the block device sink
+ *
+ * @desc:	block device
+ * @start:	first block to write
+ * @count:	number of blocks available from @start
+ * @fmt:	format of the file
+ * @armed:	true if the next download goes to the block device
+ * @begun:	true once the protocol has started receiving the file
+ * @addr:	address of the staging buffer
+ * @size:	size of the staging buffer, a multiple of two blocks
+ * @flushed:	file offset of the first byte not yet written out, always at
+ *		the start of a half of the staging buffer
+ * @blk:	number of blocks written by NET_SINK_RAW
+ * @gz:		gzip stream for NET_SINK_GZIP
+ * @info:	storage for NET_SINK_SPARSE
+ * @sparse:	sparse stream for NET_SINK_SPARSE
+ */
+struct net_sink {
+	struct blk_desc *desc;
+	lbaint_t start;
+	lbaint_t count;
+	enum net_sink_format fmt;
+	bool armed;
+	bool begun;
+	ulong addr;
+	ulong size;
+	ulong flushed;
+	lbaint_t blk;
+	struct gzwrite_stream *gz;
+	struct sparse_storage info;
+	struct sparse_stream *sparse;
+};
+
+static struct net_sink sink;
+
+static lbaint_t net_sink_sparse_write(struct sparse_storage *info,
+				      lbaint_t blk, lbaint_t blkcnt,
+				      const void *buffer)
+{
+	return blk_dwrite(sink.desc, blk, blkcnt, buffer);
+}
+
+static lbaint_t net_sink_sparse_reserve(struct sparse_storage *info,
+					lbaint_t blk, lbaint_t blkcnt)
+{
+	return blkcnt;
+}
+
+static const char *const net_sink_formats[] = {
+	[NET_SINK_RAW]		= "raw",
+	[NET_SINK_GZIP]		= "gzip",
+	[NET_SINK_SPARSE]	= "sparse",
+};
+
+int net_sink_setup(struct blk_desc *desc, lbaint_t start, lbaint_t count,
+		   enum net_sink_format fmt)
+{
+	if ((fmt == NET_SINK_GZIP && !IS_ENABLED(CONFIG_GZIP)) ||
+	    (fmt == NET_SINK_SPARSE && !IS_ENABLED(CONFIG_IMAGE_SPARSE)))
+		return -EPROTONOSUPPORT;
+
+	net_sink_off();
+	sink.desc = desc;
+	sink.start = start;
+	sink.count = count;
+	sink.fmt = fmt;
+	sink.armed = true;
+
+	return 0;
+}
+
+/* Free the state of the format, if any */
+static int net_sink_close(ulong *sizep)
+{
+	int ret = 0;
+
+	if (IS_ENABLED(CONFIG_GZIP) && sink.gz)
+		ret = gzwrite_stream_finish(sink.gz, sizep);
+	if (IS_ENABLED(CONFIG_IMAGE_SPARSE) && sink.sparse)
+		ret = sparse_stream_finish(sink.sparse);
+	sink.gz = NULL;
+	sink.sparse = NULL;
+
+	return ret;
+}
+
+void net_sink_off(void)
+{
+	ulong size;
+
+	net_sink_close(&size);
+	sink.armed = false;
+	sink.begun = false;
+}
+
+bool net_sink_enabled(void)
+{
+	return sink.armed;
+}
+
+int net_sink_begin(ulong addr)
+{
+	struct blk_desc *desc = sink.desc;
+	ulong size;
+
+	/* A restarted transfer starts again from the start of the file */
+	net_sink_close(&size);
+	sink.begun = false;
+	sink.flushed = 0;
+	sink.blk = 0;
+
+	size = env_get_hex("netsinksize", CONFIG_NET_SINK_BUF_SIZE);
+	size = rounddown(size, 2 * desc->blksz);
+	if (size < 2 * NET_SINK_MIN_HALF) {
+		printf("netsink: staging buffer of %#lx bytes is too small\n",
+		       size);
+		return -EINVAL;
+	}
+	if (CONFIG_IS_ENABLED(LMB) && lmb_read_check(addr, size)) {
+		puts("netsink: staging buffer overlaps reserved memory\n");
+		return -EINVAL;
+	}
+	sink.addr = addr;
+	sink.size = size;
+
+	if (IS_ENABLED(CONFIG_GZIP) && sink.fmt == NET_SINK_GZIP) {
+		sink.gz = gzwrite_stream_init(desc, size / 2, sink.start,
+					      sink.count);
+		if (!sink.gz)
+			return -ENOMEM;
+	} else if (IS_ENABLED(CONFIG_IMAGE_SPARSE) &&
+		   sink.fmt == NET_SINK_SPARSE) {
+		sink.info.blksz = desc->blksz;
+		sink.info.start = sink.start;
+		sink.info.size = sink.count;
+		sink.info.write = net_sink_sparse_write;
+		sink.info.reserve = net_sink_sparse_reserve;
+		sink.sparse = sparse_stream_init(&sink.info);
+		if (!sink.sparse)
+			return -ENOMEM;
+	}
+	sink.begun = true;
+
+	return 0;
+}
+
+ulong net_sink_window(void)
+{
+	/*
+	 * Data received in order always reaches into the half not being
+	 * written, so a window of a whole half would fit. Leave room for a
+	 * segment starting just inside the window, and for the HTTP header
+	 * which wget stores before the file.
+	 */
+	return sink.size / 2 - SZ_16K;
+}
+
+int net_sink_store(ulong offset, const void *src, ulong len)
+{
+	ulong pos, n;
+	void *ptr;
+
+	if (offset < sink.flushed) {
+		n = min(len, sink.flushed - offset);
+		offset += n;
+		src += n;
+		len -= n;
+	}
+	if (!len)
+		return 0;
+	if (offset + len > sink.flushed + sink.size)
+		return -ENOSPC;
+
+	/* Data may wrap around the end of the staging buffer */
+	while (len) {
+		pos = offset % sink.size;
+		n = min(len, sink.size - pos);
+		ptr = map_sysmem(sink.addr + pos, n);
+		memcpy(ptr, src, n);
+		unmap_sysmem(ptr);
+		offset += n;
+		src += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Write out @len bytes of the file from the start of a half buffer */
+static int net_sink_write(ulong len)
+{
+	struct blk_desc *desc = sink.desc;
+	lbaint_t blkcnt;
+	void *ptr;
+	int ret = 0;
+
+	ptr = map_sysmem(sink.addr + sink.flushed % sink.size, sink.size / 2);
+	if (IS_ENABLED(CONFIG_GZIP) && sink.fmt == NET_SINK_GZIP) {
+		ret = gzwrite_stream_write(sink.gz, ptr, len);
+	} else if (IS_ENABLED(CONFIG_IMAGE_SPARSE) &&
+		   sink.fmt == NET_SINK_SPARSE) {
+		ret = sparse_stream_write(sink.sparse, ptr, len);
+	} else {
+		blkcnt = DIV_ROUND_UP(len, desc->blksz);
+		if (blkcnt > sink.count - sink.blk) {
+			puts("netsink: file is larger than the device\n");
+			ret = -ENOSPC;
+		} else {
+			/* Only the last part of the file can end in a block */
+			memset(ptr + len, '\0', blkcnt * desc->blksz - len);
+			if (blk_dwrite(desc, sink.start + sink.blk, blkcnt,
+				       ptr) != blkcnt)
+				ret = -EIO;
+			sink.blk += blkcnt;
+		}
+	}
+	unmap_sysmem(ptr);
+	sink.flushed += len;
+
+	return ret;
+}
+
+int net_sink_advance(ulong size)
+{
+	int ret;
+
+	while (size >= sink.flushed + sink.size / 2) {
+		ret = net_sink_write(sink.size / 2);
+		if (ret) {
+			printf("\nnetsink: write failed (%d)\n", ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+int net_sink_end(int err, ulong size)
+{
+	ulong written = size;
+	bool begun = sink.begun;
+	int ret;
+
+	/* Stay set up for the next download if nothing was received */
+	if (!begun && (err || !size))
+		return 0;
+
+	sink.armed = false;
+	sink.begun = false;
+	if (err) {
+		net_sink_close(&written);
+		return err;
+	}
+	if (!begun) {
+		puts("netsink: file was loaded into memory instead\n");
+		return -ENOSYS;
+	}
+
+	ret = net_sink_advance(size);
+	if (!ret && size > sink.flushed)
+		ret = net_sink_write(size - sink.flushed);
+	if (net_sink_close(&written) && !ret)
+		ret = -EIO;
+	if (ret) {
+		printf("netsink: %s image not written (%d)\n",
+		       net_sink_formats[sink.fmt], ret);
+		return ret;
+	}
+
+	printf("netsink: %lu bytes written to %s %d\n", written,
+	       blk_get_uclass_name(sink.desc->uclass_id), sink.desc->devnum);
+
+	return 0;
+}
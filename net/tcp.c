@@ -45,7 +45,7 @@
 #define TCP_PACKET_OK		0
 #define TCP_PACKET_DROP		1
 
-static struct tcp_stream tcp_stream;
+static struct tcp_stream tcp_streams[CONFIG_PROT_TCP_STREAMS];
 
 static int (*tcp_stream_on_create)(struct tcp_stream *tcp);
 
@@ -76,6 +76,27 @@ static uint random_port(void)
 	return RANDOM_PORT_START + (get_timer(0) % RANDOM_PORT_RANGE);
 }
 
+/**
+ * tcp_free_port() - pick a local port not used by another stream
+ * @rhost: remote host
+ * @rport: remote port
+ *
+ * Streams opened to the same server within one timer tick would otherwise
+ * all get the same port from random_port().
+ *
+ * Return: local port number from 1024 to 17407
+ */
+static uint tcp_free_port(struct in_addr rhost, u16 rport)
+{
+	uint port = random_port();
+
+	while (tcp_stream_get(0, rhost, rport, port))
+		port = RANDOM_PORT_START +
+			(port + 1 - RANDOM_PORT_START) % RANDOM_PORT_RANGE;
+
+	return port;
+}
+
 static inline s32 tcp_seq_cmp(u32 a, u32 b)
 {
 	return (s32)(a - b);
@@ -172,17 +193,20 @@ static void tcp_stream_destroy(struct tcp_stream *tcp)
 void tcp_init(void)
 {
 	static int initialized;
-	struct tcp_stream *tcp = &tcp_stream;
+	struct tcp_stream *tcp;
 
 	tcp_stream_on_create = NULL;
 	if (!initialized) {
 		initialized = 1;
-		memset(tcp, 0, sizeof(struct tcp_stream));
+		memset(tcp_streams, 0, sizeof(tcp_streams));
 	}
 
-	tcp_stream_set_state(tcp, TCP_CLOSED);
-	tcp_stream_set_status(tcp, TCP_ERR_RST);
-	tcp_stream_destroy(tcp);
+	for (tcp = tcp_streams; tcp < tcp_streams + ARRAY_SIZE(tcp_streams);
+	     tcp++) {
+		tcp_stream_set_state(tcp, TCP_CLOSED);
+		tcp_stream_set_status(tcp, TCP_ERR_RST);
+		tcp_stream_destroy(tcp);
+	}
 }
 
 void tcp_stream_set_on_create_handler(int (*on_create)(struct tcp_stream *))
@@ -193,12 +217,16 @@ void tcp_stream_set_on_create_handler(int (*on_create)(struct tcp_stream *))
 static struct tcp_stream *tcp_stream_add(struct in_addr rhost,
 					 u16 rport, u16 lport)
 {
-	struct tcp_stream *tcp = &tcp_stream;
+	struct tcp_stream *tcp;
 
-	if (!tcp_stream_on_create ||
-	    tcp->state != TCP_CLOSED)
+	if (!tcp_stream_on_create)
 		return NULL;
 
+	for (tcp = tcp_streams; tcp->state != TCP_CLOSED; tcp++) {
+		if (tcp == tcp_streams + ARRAY_SIZE(tcp_streams) - 1)
+			return NULL;
+	}
+
 	tcp_stream_init(tcp, rhost, rport, lport);
 	if (!tcp_stream_on_create(tcp))
 		return NULL;
@@ -209,12 +237,15 @@ static struct tcp_stream *tcp_stream_add(struct in_addr rhost,
 struct tcp_stream *tcp_stream_get(int is_new, struct in_addr rhost,
 				  u16 rport, u16 lport)
 {
-	struct tcp_stream *tcp = &tcp_stream;
+	struct tcp_stream *tcp;
 
-	if (tcp->rhost.s_addr == rhost.s_addr &&
-	    tcp->rport == rport &&
-	    tcp->lport == lport)
-		return tcp;
+	for (tcp = tcp_streams; tcp < tcp_streams + ARRAY_SIZE(tcp_streams);
+	     tcp++) {
+		if (tcp->rhost.s_addr == rhost.s_addr &&
+		    tcp->rport == rport &&
+		    tcp->lport == lport)
+			return tcp;
+	}
 
 	return is_new ? tcp_stream_add(rhost, rport, lport) : NULL;
 }
@@ -434,8 +465,9 @@ void tcp_streams_poll(void)
 	struct tcp_stream	*tcp;
 
 	time = get_timer(0);
-	tcp = &tcp_stream;
-	tcp_stream_poll(tcp, time);
+	for (tcp = tcp_streams; tcp < tcp_streams + ARRAY_SIZE(tcp_streams);
+	     tcp++)
+		tcp_stream_poll(tcp, time);
 }
 
 /**
@@ -540,16 +572,23 @@ int net_set_ack_options(struct tcp_stream *tcp, union tcp_build_pkt *b)
  */
 void net_set_syn_options(struct tcp_stream *tcp, union tcp_build_pkt *b)
 {
+	u8 scale = 0;
+
 	if (IS_ENABLED(CONFIG_PROT_TCP_SACK))
 		tcp->lost.len = 0;
 
+	/* Use the smallest scale which can express the whole window */
+	while ((tcp->rcv_wnd >> scale) > TCP_MAX_WIN && scale < TCP_MAX_SCALE)
+		scale++;
+	tcp->loc_win_scale = scale;
+
 	b->ip.hdr.tcp_hlen = 0xa0;
 
 	b->ip.mss.kind = TCP_O_MSS;
 	b->ip.mss.len = TCP_OPT_LEN_4;
 	b->ip.mss.mss = htons(TCP_MSS);
 	b->ip.scale.kind = TCP_O_SCL;
-	b->ip.scale.scale = TCP_SCALE;
+	b->ip.scale.scale = scale;
 	b->ip.scale.len = TCP_OPT_LEN_3;
 	if (IS_ENABLED(CONFIG_PROT_TCP_SACK)) {
 		b->ip.sack_p.kind = TCP_P_SACK;
@@ -594,6 +633,7 @@ int tcp_set_tcp_header(struct tcp_stream *tcp, uchar *pkt, int payload_len,
 {
 	union tcp_build_pkt *b = (union tcp_build_pkt *)pkt;
 	char buf[24];
+	u32 win;
 	int pkt_hdr_len;
 	int pkt_len;
 	int tcp_len;
@@ -656,7 +696,11 @@ int tcp_set_tcp_header(struct tcp_stream *tcp, uchar *pkt, int payload_len,
 	 * it is, then the u-boot tftp or nfs kernel netboot should be
 	 * considered.
 	 */
-	b->ip.hdr.tcp_win = htons(tcp->rcv_wnd >> TCP_SCALE);
+	if (action & TCP_SYN)
+		win = tcp->rcv_wnd;	/* never scaled */
+	else
+		win = tcp->rcv_wnd >> tcp->loc_win_scale;
+	b->ip.hdr.tcp_win = htons(min_t(u32, win, TCP_MAX_WIN));
 
 	b->ip.hdr.tcp_xsum = 0;
 	b->ip.hdr.tcp_ugr = 0;
@@ -670,17 +714,34 @@ int tcp_set_tcp_header(struct tcp_stream *tcp, uchar *pkt, int payload_len,
 	return pkt_hdr_len;
 }
 
-static void tcp_update_rcv_nxt(struct tcp_stream *tcp)
+/**
+ * tcp_sack_update() - rebuild the SACK option from the received hills
+ * @tcp: tcp stream
+ * @tcp_seq_num: sequence number of the latest segment
+ *
+ * Following RFC 2018, the hill holding the latest segment goes first and
+ * the lowest other hills fill the remaining blocks.
+ */
+static void tcp_sack_update(struct tcp_stream *tcp, u32 tcp_seq_num)
 {
-	if (tcp_seq_cmp(tcp->rcv_nxt, tcp->lost.hill[0].l) >= 0) {
-		tcp->rcv_nxt = tcp->lost.hill[0].r;
+	int i, cnt = 0, first = -1;
 
-		memmove(&tcp->lost.hill[0], &tcp->lost.hill[1],
-			(TCP_SACK_HILLS - 1) * sizeof(struct sack_edges));
-
-		tcp->lost.len -= TCP_OPT_LEN_8;
-		tcp->lost.hill[TCP_SACK_HILLS - 1].l = TCP_O_NOP;
-		tcp->lost.hill[TCP_SACK_HILLS - 1].r = TCP_O_NOP;
+	for (i = 0; i < tcp->hill_cnt; i++) {
+		if (tcp_seq_cmp(tcp->hill[i].l, tcp_seq_num) <= 0 &&
+		    tcp_seq_cmp(tcp_seq_num, tcp->hill[i].r) < 0) {
+			first = i;
+			tcp->lost.hill[cnt++] = tcp->hill[i];
+			break;
+		}
+	}
+	for (i = 0; i < tcp->hill_cnt && cnt < TCP_SACK_BLOCKS; i++) {
+		if (i != first)
+			tcp->lost.hill[cnt++] = tcp->hill[i];
+	}
+	tcp->lost.len = TCP_OPT_LEN_2 + cnt * TCP_OPT_LEN_8;
+	for (i = cnt; i < TCP_SACK_HILLS; i++) {
+		tcp->lost.hill[i].l = TCP_O_NOP;
+		tcp->lost.hill[i].r = TCP_O_NOP;
 	}
 }
 
@@ -689,82 +750,59 @@ static void tcp_update_rcv_nxt(struct tcp_stream *tcp)
  * @tcp: tcp stream
  * @tcp_seq_num: TCP sequence start number
  * @len: the length of sequence numbers
+ *
+ * Record that [@tcp_seq_num, @tcp_seq_num + @len) has been received and
+ * move rcv_nxt past any data which is now contiguous. The hills are kept in
+ * order and never touch, so that the holes between them are what is still
+ * missing.
  */
 void tcp_hole(struct tcp_stream *tcp, u32 tcp_seq_num, u32 len)
 {
-	int i, j, cnt, cnt_move;
+	struct sack_edges *hill = tcp->hill;
+	u32 l = tcp_seq_num, r = tcp_seq_num + len;
+	int i, j, cnt = tcp->hill_cnt;
 
-	cnt = (tcp->lost.len - TCP_OPT_LEN_2) / TCP_OPT_LEN_8;
-	for (i = 0; i < cnt; i++) {
-		if (tcp_seq_cmp(tcp->lost.hill[i].r, tcp_seq_num) < 0)
-			continue;
-		if (tcp_seq_cmp(tcp->lost.hill[i].l, tcp_seq_num + len) > 0)
+	/* Skip the hills which end before the new data */
+	for (i = 0; i < cnt; i++)
+		if (tcp_seq_cmp(hill[i].r, l) >= 0)
 			break;
 
-		if (tcp_seq_cmp(tcp->lost.hill[i].l, tcp_seq_num) > 0)
-			tcp->lost.hill[i].l = tcp_seq_num;
-		if (tcp_seq_cmp(tcp->lost.hill[i].l, tcp_seq_num) < 0) {
-			len += tcp_seq_num - tcp->lost.hill[i].l;
-			tcp_seq_num = tcp->lost.hill[i].l;
-		}
-		if (tcp_seq_cmp(tcp->lost.hill[i].r, tcp_seq_num + len) >= 0) {
-			tcp_update_rcv_nxt(tcp);
-			return;
-		}
-
-		/* check overlapping with next hills */
-		cnt_move = 0;
-		tcp->lost.hill[i].r = tcp_seq_num + len;
-		for (j = i + 1; j < cnt; j++) {
-			if (tcp_seq_cmp(tcp->lost.hill[j].l, tcp->lost.hill[i].r) > 0)
-				break;
-
-			tcp->lost.hill[i].r = tcp->lost.hill[j].r;
-			cnt_move++;
-		}
-
-		if (cnt_move > 0) {
-			if (cnt > i + cnt_move + 1)
-				memmove(&tcp->lost.hill[i + 1],
-					&tcp->lost.hill[i + cnt_move + 1],
-					cnt_move * sizeof(struct sack_edges));
-
-			cnt -= cnt_move;
-			tcp->lost.len = TCP_OPT_LEN_2 + cnt * TCP_OPT_LEN_8;
-			for (j = cnt; j < TCP_SACK_HILLS; j++) {
-				tcp->lost.hill[j].l = TCP_O_NOP;
-				tcp->lost.hill[j].r = TCP_O_NOP;
-			}
-		}
-
-		tcp_update_rcv_nxt(tcp);
-		return;
+	/* Merge the hills which overlap or touch the new data */
+	for (j = i; j < cnt && tcp_seq_cmp(hill[j].l, r) <= 0; j++) {
+		if (tcp_seq_cmp(hill[j].l, l) < 0)
+			l = hill[j].l;
+		if (tcp_seq_cmp(hill[j].r, r) > 0)
+			r = hill[j].r;
 	}
 
-	if (i == TCP_SACK_HILLS) {
-		tcp_update_rcv_nxt(tcp);
-		return;
+	if (i == j && cnt == TCP_REASS_HILLS) {
+		/*
+		 * No room for another hill, so forget about the highest one.
+		 * Its data has not been acknowledged and will come again.
+		 */
+		if (i == cnt)
+			goto out;
+		cnt--;
 	}
 
-	if (cnt < TCP_SACK_HILLS) {
-		cnt_move = cnt - i;
-		cnt++;
-	} else {
-		cnt = TCP_SACK_HILLS;
-		cnt_move = TCP_SACK_HILLS - i;
+	/* Replace hills i..j-1 with the merged one */
+	memmove(&hill[i + 1], &hill[j], (cnt - j) * sizeof(*hill));
+	hill[i].l = l;
+	hill[i].r = r;
+	cnt += 1 - (j - i);
+
+	/* The first hill may now follow on from the data already received */
+	if (tcp_seq_cmp(hill[0].l, tcp->rcv_nxt) <= 0) {
+		if (tcp_seq_cmp(hill[0].r, tcp->rcv_nxt) > 0)
+			tcp->rcv_nxt = hill[0].r;
+		cnt--;
+		memmove(&hill[0], &hill[1], cnt * sizeof(*hill));
 	}
+	tcp->hill_cnt = cnt;
 
-	if (cnt_move > 0)
-		memmove(&tcp->lost.hill[i + 1],
-			&tcp->lost.hill[i],
-			cnt_move * sizeof(struct sack_edges));
-
-	tcp->lost.hill[i].l = tcp_seq_num;
-	tcp->lost.hill[i].r = tcp_seq_num + len;
-	tcp->lost.len = TCP_OPT_LEN_2 + cnt * TCP_OPT_LEN_8;
-
-	tcp_update_rcv_nxt(tcp);
-};
+out:
+	tcp_sack_update(tcp, tcp_seq_num);
+}
 
 /**
  * tcp_parse_options() - parsing TCP options
@@ -794,8 +832,14 @@ void tcp_parse_options(struct tcp_stream *tcp, uchar *o, int o_len)
 		case TCP_V_SACK:
 			break;
 		case TCP_O_SCL:
+			/* Only allowed in SYN segments */
+			if (tcp->state != TCP_CLOSED &&
+			    tcp->state != TCP_SYN_SENT)
+				break;
 			wsopt = (struct tcp_scale *)p;
-			tcp->rmt_win_scale = wsopt->scale;
+			tcp->rmt_win_scale = min_t(u8, wsopt->scale,
+						   TCP_MAX_SCALE);
+			tcp->win_scale_ok = 1;
 			break;
 		case TCP_O_TS:
 			tsopt = (struct tcp_t_opt *)p;
@@ -984,10 +1028,13 @@ void tcp_rx_state_machine(struct tcp_stream *tcp,
 	 */
 	tcp_seq_num = ntohl(b->ip.hdr.tcp_seq);
 	tcp_ack_num = ntohl(b->ip.hdr.tcp_ack);
-	tcp_win_size = ntohs(b->ip.hdr.tcp_win) << tcp->rmt_win_scale;
-
 	tcp_flags = b->ip.hdr.tcp_flags;
 
+	/* The window in a SYN segment is never scaled */
+	tcp_win_size = ntohs(b->ip.hdr.tcp_win);
+	if (!(tcp_flags & TCP_SYN))
+		tcp_win_size <<= tcp->rmt_win_scale;
+
 //	printf("pkt: seq=%d, ack=%d, flags=%x, len=%d\n",
 //		tcp_seq_num - tcp->irs, tcp_ack_num - tcp->iss, tcp_flags, pkt_len);
 //	printf("tcp: rcv_nxt=%d, snd_una=%d, snd_nxt=%d\n\n",
@@ -1009,6 +1056,10 @@ void tcp_rx_state_machine(struct tcp_stream *tcp,
 		tcp->irs = tcp_seq_num;
 		tcp->rcv_nxt = tcp->irs + 1;
 
+		/* Our SYN+ACK has no options, so there is no window scaling */
+		tcp->rmt_win_scale = 0;
+		tcp->loc_win_scale = 0;
+
 		tcp->iss = tcp_get_start_seq();
 		tcp->snd_una = tcp->iss;
 		tcp->snd_nxt = tcp->iss + 1;
@@ -1044,6 +1095,12 @@ void tcp_rx_state_machine(struct tcp_stream *tcp,
 		/* stop retransmit of SYN */
 		tcp_stream_set_time_handler(tcp, 0, NULL);
 
+		/* Scaling is only used if both sides asked for it */
+		if (!tcp->win_scale_ok) {
+			tcp->rmt_win_scale = 0;
+			tcp->loc_win_scale = 0;
+		}
+
 		tcp->irs = tcp_seq_num;
 		tcp->rcv_nxt = tcp->irs + 1;
 		tcp->snd_una = tcp_ack_num;
@@ -1212,7 +1269,7 @@ struct tcp_stream *tcp_stream_connect(struct in_addr rhost, u16 rport)
 {
 	struct tcp_stream *tcp;
 
-	tcp = tcp_stream_add(rhost, rport, random_port());
+	tcp = tcp_stream_add(rhost, rport, tcp_free_port(rhost, rport));
 	if (!tcp)
 		return NULL;
 
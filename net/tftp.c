@@ -17,6 +17,7 @@
 #include <net.h>
 #include <net6.h>
 #include <asm/global_data.h>
+#include <net/sink.h>
 #include <net/tftp.h>
 #include "bootp.h"
 
@@ -103,6 +104,22 @@ static int	tftp_put_final_block_sent;
 #else
 #define tftp_put_active	0
 #endif
+#ifdef CONFIG_TFTP_ADAPTIVE
+/* Window size to ask for in the next download */
+static ushort	tftp_window_next = CONFIG_TFTP_WINDOWSIZE;
+/* 1 if the window size is adapted, i.e. tftpwindowsize is not set */
+static int	tftp_window_auto;
+/* 1 if the block size is chosen here, i.e. tftpblocksize is not set */
+static int	tftp_blksize_auto;
+/* 1 once blocks needing IP fragmentation have failed, for all downloads */
+static int	tftp_blksize_fallback;
+/* Number of times we asked for blocks again in this download */
+static ulong	tftp_retransmits;
+/* Number of those which were due to a timeout */
+static ulong	tftp_timeouts;
+/* Server port for the request, in case it must be sent again */
+static int	tftp_request_port;
+#endif
 
 #define STATE_SEND_RRQ	1
 #define STATE_DATA	2
@@ -115,6 +132,9 @@ static int	tftp_put_final_block_sent;
 
 /* default TFTP block size */
 #define TFTP_BLOCK_SIZE		512
+/* largest block size which fits in an ethernet frame, and RFC2348's limit */
+#define TFTP_MTU_BLOCKSIZE	1468
+#define TFTP_MAX_BLOCKSIZE	65464
 #define TFTP_MTU_BLOCKSIZE6 (CONFIG_TFTP_BLOCKSIZE - 20)
 /* sequence number is 16 bit */
 #define TFTP_SEQUENCE_SIZE	((ulong)(1<<16))
@@ -146,6 +166,12 @@ static char tftp_filename[MAX_LEN];
 #define TFTP_WINDOWSIZE 1
 #endif
 
+#ifdef CONFIG_TFTP_WINDOWSIZE_MAX
+#define TFTP_WINDOWSIZE_MAX CONFIG_TFTP_WINDOWSIZE_MAX
+#else
+#define TFTP_WINDOWSIZE_MAX TFTP_WINDOWSIZE
+#endif
+
 static unsigned short tftp_block_size = TFTP_BLOCK_SIZE;
 static unsigned short tftp_block_size_option = CONFIG_TFTP_BLOCKSIZE;
 static unsigned short tftp_window_size_option = TFTP_WINDOWSIZE;
@@ -158,6 +184,19 @@ static inline int store_block(int block, uchar *src, unsigned int len)
 	ulong store_addr = tftp_load_addr + offset;
 	void *ptr;
 
+	if (IS_ENABLED(CONFIG_CMD_NETSINK) && net_sink_enabled()) {
+		/* Blocks arrive in order, so all of the file so far is here */
+		if (net_sink_store(offset, src, len) ||
+		    net_sink_advance(newsize)) {
+			puts("\nTFTP error: cannot write to the block device\n");
+			return -1;
+		}
+		if (net_boot_file_size < newsize)
+			net_boot_file_size = newsize;
+
+		return 0;
+	}
+
 	if (CONFIG_IS_ENABLED(LMB)) {
 		if (store_addr < tftp_load_addr ||
 		    lmb_read_check(store_addr, len)) {
@@ -277,6 +316,74 @@ static void update_block_number(void)
 	show_block_marker();
 }
 
+#ifdef CONFIG_TFTP_ADAPTIVE
+/* Largest block size which does not need IP fragmentation */
+static int tftp_mtu_block_size(void)
+{
+	/* The IPv6 header is 20 bytes longer */
+	if (IS_ENABLED(CONFIG_IPV6) && use_ip6)
+		return TFTP_MTU_BLOCKSIZE - 20;
+
+	return TFTP_MTU_BLOCKSIZE;
+}
+
+/*
+ * After a download, choose the window size for the next one:
+ * double it after a download with no retransmissions, as long as the server
+ * gave us what we asked for, and halve it if more than 1% of the blocks had
+ * to be sent again. If large blocks are losing data, stop asking for them.
+ */
+static void tftp_adapt(void)
+{
+	ulong blocks = net_boot_file_size / tftp_block_size + 1;
+	int lossy = tftp_retransmits * 100 > blocks;
+
+	if (tftp_window_auto) {
+		if (lossy)
+			tftp_window_next = max_t(int, tftp_windowsize / 2, 1);
+		else if (!tftp_retransmits &&
+			 tftp_windowsize >= tftp_window_next)
+			tftp_window_next = min_t(int, tftp_window_next * 2,
+						 TFTP_WINDOWSIZE_MAX);
+	}
+	if (tftp_blksize_auto && lossy &&
+	    tftp_block_size > tftp_mtu_block_size())
+		tftp_blksize_fallback = 1;
+
+	printf("\n\t window %d, block size %d, %lu retransmits (%lu timeouts)",
+	       tftp_windowsize, tftp_block_size, tftp_retransmits,
+	       tftp_timeouts);
+	if (tftp_window_auto)
+		printf(", next window %d", tftp_window_next);
+}
+
+/*
+ * The server accepted our block size but no data has arrived. Blocks larger
+ * than the MTU are sent as IP fragments, which some paths drop, so ask again
+ * with a block size which fits the MTU.
+ */
+static void tftp_restart_mtu_block_size(void)
+{
+	printf("\nNo data with block size %d; trying %d\n", tftp_block_size,
+	       tftp_mtu_block_size());
+	tftp_blksize_fallback = 1;
+	tftp_block_size_option = tftp_mtu_block_size();
+	tftp_block_size = TFTP_BLOCK_SIZE;
+	tftp_windowsize = 1;
+	tftp_cur_block = 0;
+	tftp_last_nack = 0;
+	tftp_remote_port = tftp_request_port;
+	/* A new port keeps late packets from the old transfer away */
+	if (!env_get("tftpsrcp"))
+		tftp_our_port = 1024 + (get_timer(0) % 3072);
+	tftp_state = STATE_SEND_RRQ;
+	timeout_count = 0;
+	puts("Loading: *\b");
+	net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
+	tftp_send();
+}
+#endif
+
 /* The TFTP get or put is complete */
 static void tftp_complete(void)
 {
@@ -295,11 +402,16 @@ static void tftp_complete(void)
 		print_size(net_boot_file_size /
 			time_start * 1000, "/s");
 	}
+#ifdef CONFIG_TFTP_ADAPTIVE
+	if (!tftp_put_active)
+		tftp_adapt();
+#endif
 	puts("\ndone\n");
 
 	led_activity_off();
 
-	if (!tftp_put_active)
+	if (!tftp_put_active &&
+	    !(IS_ENABLED(CONFIG_CMD_NETSINK) && net_sink_enabled()))
 		efi_set_bootdev("Net", "", tftp_filename,
 				map_sysmem(tftp_load_addr, 0),
 				net_boot_file_size);
@@ -612,6 +724,9 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			 */
 			if (tftp_last_nack != tftp_cur_block) {
 				tftp_send();
+#ifdef CONFIG_TFTP_ADAPTIVE
+				tftp_retransmits++;
+#endif
 				tftp_last_nack = tftp_cur_block;
 				tftp_next_ack = (ushort)(tftp_cur_block +
 							 tftp_windowsize);
@@ -704,6 +819,17 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 
 static void tftp_timeout_handler(void)
 {
+#ifdef CONFIG_TFTP_ADAPTIVE
+	if (tftp_state == STATE_OACK && tftp_blksize_auto &&
+	    tftp_block_size > tftp_mtu_block_size()) {
+		tftp_restart_mtu_block_size();
+		return;
+	}
+	if (tftp_state == STATE_DATA || tftp_state == STATE_OACK) {
+		tftp_retransmits++;
+		tftp_timeouts++;
+	}
+#endif
 	if (++timeout_count > timeout_count_max) {
 		restart("Retry count exceeded");
 	} else {
@@ -720,8 +846,8 @@ static int tftp_init_load_addr(void)
 	return 0;
 }
 
-static int saved_tftp_block_size_option;
-static void sanitize_tftp_block_size_option(enum proto_t protocol)
+/* Largest block size we can ask for, before allowing for the MTU */
+static int tftp_block_size_cap(enum proto_t protocol)
 {
 	int cap, max_defrag;
 
@@ -732,7 +858,7 @@ static void sanitize_tftp_block_size_option(enum proto_t protocol)
 			/* Account for IP, UDP and TFTP headers. */
 			cap = max_defrag - (20 + 8 + 4);
 			/* RFC2348 sets a hard upper limit. */
-			cap = min(cap, 65464);
+			cap = min(cap, TFTP_MAX_BLOCKSIZE);
 			break;
 		}
 		/*
@@ -749,8 +875,17 @@ static void sanitize_tftp_block_size_option(enum proto_t protocol)
 		 * (and small enough that it fits net_tx_packet which
 		 * has room for PKTSIZE_ALIGN bytes).
 		 */
-		cap = 1468;
+		cap = TFTP_MTU_BLOCKSIZE;
 	}
+
+	return cap;
+}
+
+static int saved_tftp_block_size_option;
+static void sanitize_tftp_block_size_option(enum proto_t protocol)
+{
+	int cap = tftp_block_size_cap(protocol);
+
 	if (tftp_block_size_option > cap) {
 		printf("Capping tftp block size option to %d (was %d)\n",
 		       cap, tftp_block_size_option);
@@ -768,6 +903,29 @@ void tftp_start(enum proto_t protocol)
 		saved_tftp_block_size_option = 0;
 	}
 
+#ifdef CONFIG_TFTP_ADAPTIVE
+	/*
+	 * Unless told otherwise, ask for the window size which suited the last
+	 * download, and for the configured block size unless that has failed
+	 */
+	tftp_window_auto = !IS_ENABLED(CONFIG_NET_TFTP_VARS) ||
+			   !env_get("tftpwindowsize");
+	if (tftp_window_auto)
+		tftp_window_size_option = tftp_window_next;
+	tftp_blksize_auto = !IS_ENABLED(CONFIG_NET_TFTP_VARS) ||
+			    !env_get("tftpblocksize");
+	if (tftp_blksize_auto)
+		tftp_block_size_option = tftp_blksize_fallback ?
+			tftp_mtu_block_size() :
+			min(CONFIG_TFTP_BLOCKSIZE,
+			    tftp_block_size_cap(protocol));
+	else
+		/* Try large blocks again once the user has had a say */
+		tftp_blksize_fallback = 0;
+	tftp_retransmits = 0;
+	tftp_timeouts = 0;
+#endif
+
 	if (IS_ENABLED(CONFIG_NET_TFTP_VARS)) {
 
 		/*
@@ -908,6 +1066,12 @@ void tftp_start(enum proto_t protocol)
 			puts("trying to overwrite reserved memory...\n");
 			return;
 		}
+		if (IS_ENABLED(CONFIG_CMD_NETSINK) && net_sink_enabled() &&
+		    net_sink_begin(tftp_load_addr)) {
+			eth_halt();
+			net_set_state(NETLOOP_FAIL);
+			return;
+		}
 		printf("Load address: 0x%lx\n", tftp_load_addr);
 		puts("Loading: *\b");
 		tftp_state = STATE_SEND_RRQ;
@@ -932,6 +1096,9 @@ void tftp_start(enum proto_t protocol)
 	ep = env_get("tftpsrcp");
 	if (ep != NULL)
 		tftp_our_port = simple_strtol(ep, NULL, 10);
+#ifdef CONFIG_TFTP_ADAPTIVE
+	tftp_request_port = tftp_remote_port;
+#endif
 
 	tftp_cur_block = 0;
 	tftp_windowsize = 1;
@@ -13,9 +13,11 @@
 #include <lmb.h>
 #include <mapmem.h>
 #include <net.h>
+#include <net/sink.h>
 #include <net/tcp.h>
 #include <net/wget.h>
 #include <stdlib.h>
+#include <linux/sizes.h>
 
 DECLARE_GLOBAL_DATA_PTR;
 
@@ -28,10 +30,17 @@ DECLARE_GLOBAL_DATA_PTR;
 
 #define HTTP_STATUS_BAD		0
 #define HTTP_STATUS_OK		200
+#define HTTP_STATUS_PARTIAL	206
+
+/* Ranges smaller than this are not worth a connection of their own */
+#define WGET_RANGE_MIN		SZ_64K
+#define WGET_RANGE_RETRIES	3
+#define WGET_RANGE_TICK		10
 
 static const char http_proto[] = "HTTP/1.0";
 static const char http_eom[] = "\r\n\r\n";
 static const char content_len[] = "Content-Length:";
+static const char content_range[] = "Content-Range: bytes ";
 static const char linefeed[] = "\r\n";
 static struct in_addr web_server_ip;
 static unsigned int server_port;
@@ -56,6 +65,8 @@ static inline int store_block(uchar *src, unsigned int offset, unsigned int len)
 	// Avoid overflow
 	if (wget_info->buffer_size && wget_info->buffer_size < offset + len)
 		return -1;
+	if (IS_ENABLED(CONFIG_CMD_NETSINK) && net_sink_enabled())
+		return net_sink_store(offset, src, len) ? -1 : 0;
 	if (CONFIG_IS_ENABLED(LMB) && wget_info->set_bootdev) {
 		if (store_addr < image_load_addr ||
 		    lmb_read_check(store_addr, len)) {
@@ -98,6 +109,40 @@ static void show_block_marker(u32 packets)
 	}
 }
 
+static void wget_success(void)
+{
+	wget_info->file_size = net_boot_file_size;
+	/* The file is on a block device, not at the load address */
+	if (IS_ENABLED(CONFIG_CMD_NETSINK) && net_sink_enabled())
+		return;
+	if (wget_info->method == WGET_HTTP_METHOD_GET && wget_info->set_bootdev) {
+		efi_set_bootdev("Http", NULL, image_url,
+				map_sysmem(image_load_addr, 0),
+				net_boot_file_size);
+		env_set_hex("filesize", net_boot_file_size);
+	}
+}
+
+/* Return the Content-Length of a reply header, or -1 if there is none */
+static unsigned long http_content_length(char *hdr)
+{
+	unsigned long len;
+	char *pos, *tail;
+
+	pos = strstr(hdr, content_len);
+	if (!pos)
+		return -1;
+
+	pos += strlen(content_len) + 1;
+	while (*pos == ' ')
+		pos++;
+	len = simple_strtoul(pos, &tail, 10);
+	if (*tail != '\r' && *tail != '\n' && *tail != '\0')
+		return -1;
+
+	return len;
+}
+
 static void tcp_stream_on_closed(struct tcp_stream *tcp)
 {
 	if (tcp->status != TCP_ERR_OK)
@@ -115,13 +160,7 @@ static void tcp_stream_on_closed(struct tcp_stream *tcp)
 	if (!wget_info->silent)
 		printf("\nPackets received %d, Transfer Successful\n",
 		       tcp->rx_packets);
-	wget_info->file_size = net_boot_file_size;
-	if (wget_info->method == WGET_HTTP_METHOD_GET && wget_info->set_bootdev) {
-		efi_set_bootdev("Http", NULL, image_url,
-				map_sysmem(image_load_addr, 0),
-				net_boot_file_size);
-		env_set_hex("filesize", net_boot_file_size);
-	}
+	wget_success();
 }
 
 static void tcp_stream_on_rcv_nxt_update(struct tcp_stream *tcp, u32 rx_bytes)
@@ -132,6 +171,11 @@ static void tcp_stream_on_rcv_nxt_update(struct tcp_stream *tcp, u32 rx_bytes)
 
 	if (http_hdr_size) {
 		net_boot_file_size = rx_bytes - http_hdr_size;
+		if (IS_ENABLED(CONFIG_CMD_NETSINK) && net_sink_enabled() &&
+		    net_sink_advance(net_boot_file_size)) {
+			tcp_stream_reset(tcp);
+			return;
+		}
 		show_block_marker(tcp->rx_packets);
 		return;
 	}
@@ -203,16 +247,7 @@ static void tcp_stream_on_rcv_nxt_update(struct tcp_stream *tcp, u32 rx_bytes)
 	debug_cond(DEBUG_WGET, "wget: Connctd pkt %p  hlen %x\n",
 		   ptr, http_hdr_size);
 
-	content_length = -1;
-	pos = strstr((char *)ptr, content_len);
-	if (pos) {
-		pos += strlen(content_len) + 1;
-		while (*pos == ' ')
-			pos++;
-		content_length = simple_strtoul(pos, &tail, 10);
-		if (*tail != '\r' && *tail != '\n' && *tail != '\0')
-			content_length = -1;
-	}
+	content_length = http_content_length((char *)ptr);
 
 	if (content_length != -1) {
 		debug_cond(DEBUG_WGET,
@@ -278,6 +313,10 @@ static int tcp_stream_on_create(struct tcp_stream *tcp)
 
 	tcp->max_retry_count = WGET_RETRY_COUNT;
 	tcp->initial_timeout = WGET_TIMEOUT;
+	/* Segments are stored in place, so any of the window can arrive */
+	tcp->rcv_wnd = CONFIG_WGET_TCP_WND;
+	if (IS_ENABLED(CONFIG_CMD_NETSINK) && net_sink_enabled())
+		tcp->rcv_wnd = min_t(ulong, tcp->rcv_wnd, net_sink_window());
 	tcp->on_closed = tcp_stream_on_closed;
 	tcp->on_rcv_nxt_update = tcp_stream_on_rcv_nxt_update;
 	tcp->rx = tcp_stream_rx;
@@ -286,6 +325,383 @@ static int tcp_stream_on_create(struct tcp_stream *tcp)
 	return 1;
 }
 
+/**
+ * enum wget_range_state - state of one part of a parallel download
+ *
+ * @WGET_RANGE_IDLE:	waiting for a connection
+ * @WGET_RANGE_BUSY:	connection open
+ * @WGET_RANGE_DONE:	all data received
+ * @WGET_RANGE_FAILED:	connection lost before all data was received
+ */
+enum wget_range_state {
+	WGET_RANGE_IDLE,
+	WGET_RANGE_BUSY,
+	WGET_RANGE_DONE,
+	WGET_RANGE_FAILED,
+};
+
+/**
+ * struct wget_range - one part of a parallel download
+ *
+ * With 'wget -j' a HEAD request first finds the size of the file, which is
+ * then split into ranges. Each range is fetched over its own connection
+ * with a Range header, and its data is stored at its offset in the file. A
+ * range whose connection fails is requested again from the first byte not
+ * yet received.
+ *
+ * @tcp:	connection, or NULL if there is none
+ * @state:	state of the range
+ * @first:	file offset of the first byte of the range
+ * @start:	file offset of the first byte requested on @tcp
+ * @end:	file offset just past the range
+ * @done:	number of bytes received in order from @start
+ * @hdr_size:	size of the HTTP reply header, 0 until it is complete
+ * @hdr_len:	number of bytes held in @hdr
+ * @retries:	number of times the range was requested again
+ * @hdr:	start of the reply, kept aside until the header is complete
+ */
+struct wget_range {
+	struct tcp_stream *tcp;
+	enum wget_range_state state;
+	ulong first;
+	ulong start;
+	ulong end;
+	ulong done;
+	u32 hdr_size;
+	u32 hdr_len;
+	int retries;
+	char hdr[HTTP_MAX_HDR_LEN + 1];
+};
+
+static struct wget_range wget_ranges[CONFIG_PROT_TCP_STREAMS];
+static struct wget_range *wget_range_new;
+static int wget_range_count;
+static u32 wget_range_packets;
+static bool wget_range_head;
+static bool wget_range_error;
+
+/*
+ * Look for the end of the reply header of @r in the first @rx_bytes
+ * received. Return 1 once it is found and valid, 0 if more data is needed or
+ * a negative error code.
+ */
+static int wget_range_hdr(struct wget_range *r, u32 rx_bytes)
+{
+	ulong status;
+	char *pos;
+	char saved;
+
+	saved = r->hdr[rx_bytes];
+	r->hdr[rx_bytes] = '\0';
+	pos = strstr(r->hdr, http_eom);
+	r->hdr[rx_bytes] = saved;
+	if (!pos)
+		return rx_bytes < HTTP_MAX_HDR_LEN ? 0 : -EMSGSIZE;
+
+	r->hdr_size = pos - r->hdr + strlen(http_eom);
+	*pos = '\0';
+
+	if (strncasecmp(r->hdr, "HTTP/", 5))
+		return -EPROTO;
+	pos = strchr(r->hdr, ' ');
+	if (!pos)
+		return -EPROTO;
+	status = simple_strtoul(pos + 1, NULL, 10);
+	debug_cond(DEBUG_WGET, "wget: range %lu HTTP Status Code %lu\n",
+		   r->start, status);
+
+	if (wget_range_head) {
+		wget_info->status_code = status;
+		if (status != HTTP_STATUS_OK)
+			return -EPROTO;
+		if (wget_info->headers && r->hdr_size < MAX_HTTP_HEADERS_SIZE)
+			strcpy(wget_info->headers, r->hdr);
+		content_length = http_content_length(r->hdr);
+		if (content_length == -1)
+			return -ENODATA;
+		wget_info->hdr_cont_len = content_length;
+		if (wget_info->buffer_size &&
+		    wget_info->buffer_size < content_length)
+			return -EFBIG;
+
+		return 1;
+	}
+
+	/* A server which ignores the Range header sends the whole file */
+	if (status != HTTP_STATUS_PARTIAL)
+		return -EOPNOTSUPP;
+	pos = strstr(r->hdr, content_range);
+	if (!pos ||
+	    simple_strtoul(pos + strlen(content_range), NULL, 10) != r->start)
+		return -EPROTO;
+
+	return 1;
+}
+
+static void wget_range_progress(void)
+{
+	struct wget_range *r;
+
+	net_boot_file_size = 0;
+	for (r = wget_ranges; r < wget_ranges + wget_range_count; r++)
+		net_boot_file_size += r->start + r->done - r->first;
+	show_block_marker(wget_range_packets);
+}
+
+static void wget_range_on_rcv_nxt_update(struct tcp_stream *tcp, u32 rx_bytes)
+{
+	struct wget_range *r = tcp->priv;
+	u32 len;
+	int ret;
+
+	if (!r->hdr_size) {
+		ret = wget_range_hdr(r, rx_bytes);
+		if (!ret)
+			return;
+		if (ret < 0) {
+			if (!wget_info->silent)
+				printf("\nwget: %s (%d)\n",
+				       ret == -EOPNOTSUPP ?
+				       "server does not support byte ranges" :
+				       "bad HTTP reply", ret);
+			wget_range_error = true;
+			tcp_stream_close(tcp);
+			return;
+		}
+		if (wget_range_head)
+			return;
+
+		/* Move any data which came with the header into place */
+		len = r->hdr_len - r->hdr_size;
+		if (len > r->end - r->start ||
+		    store_block((uchar *)r->hdr + r->hdr_size, r->start, len)) {
+			wget_range_error = true;
+			tcp_stream_reset(tcp);
+			return;
+		}
+	}
+
+	if (wget_range_head)
+		return;
+	r->done = rx_bytes - r->hdr_size;
+	wget_range_progress();
+}
+
+static int wget_range_rx(struct tcp_stream *tcp, u32 rx_offs, void *buf,
+			 int len)
+{
+	struct wget_range *r = tcp->priv;
+	u32 skip;
+
+	if (!r->hdr_size) {
+		/* Data past the header space is taken again once it is parsed */
+		if (rx_offs >= HTTP_MAX_HDR_LEN)
+			return 0;
+		len = min_t(u32, len, HTTP_MAX_HDR_LEN - rx_offs);
+		memcpy(r->hdr + rx_offs, buf, len);
+		r->hdr_len = max(r->hdr_len, rx_offs + len);
+
+		return len;
+	}
+
+	skip = rx_offs < r->hdr_size ? r->hdr_size - rx_offs : 0;
+	if (skip >= len)
+		return len;
+	rx_offs += skip - r->hdr_size;
+	if (rx_offs + len - skip > r->end - r->start ||
+	    store_block(buf + skip, r->start + rx_offs, len - skip) < 0)
+		return -1;
+
+	return len;
+}
+
+static int wget_range_tx(struct tcp_stream *tcp, u32 tx_offs, void *buf,
+			 int maxlen)
+{
+	struct wget_range *r = tcp->priv;
+
+	if (tx_offs)
+		return 0;
+
+	if (wget_range_head)
+		return snprintf(buf, maxlen, "HEAD %s %s\r\n\r\n", image_url,
+				http_proto);
+
+	return snprintf(buf, maxlen, "GET %s %s\r\nRange: bytes=%lu-%lu\r\n\r\n",
+			image_url, http_proto, r->start, r->end - 1);
+}
+
+static void wget_range_on_closed(struct tcp_stream *tcp)
+{
+	struct wget_range *r = tcp->priv;
+
+	/* Ignore a stream left over from a download which was stopped */
+	if (r->tcp != tcp)
+		return;
+
+	r->tcp = NULL;
+	wget_range_packets += tcp->rx_packets;
+	/* A range with all its data is done, even if the server reset it */
+	if (r->hdr_size && (wget_range_head ? tcp->status == TCP_ERR_OK :
+			    r->start + r->done == r->end))
+		r->state = WGET_RANGE_DONE;
+	else
+		r->state = WGET_RANGE_FAILED;
+}
+
+static int wget_range_on_create(struct tcp_stream *tcp)
+{
+	if (!wget_range_new ||
+	    tcp->rhost.s_addr != web_server_ip.s_addr ||
+	    tcp->rport != server_port)
+		return 0;
+
+	tcp->max_retry_count = WGET_RETRY_COUNT;
+	tcp->initial_timeout = WGET_TIMEOUT;
+	tcp->rcv_wnd = CONFIG_WGET_TCP_WND;
+	tcp->priv = wget_range_new;
+	tcp->on_closed = wget_range_on_closed;
+	tcp->on_rcv_nxt_update = wget_range_on_rcv_nxt_update;
+	tcp->rx = wget_range_rx;
+	tcp->tx = wget_range_tx;
+
+	return 1;
+}
+
+static void wget_range_connect(struct wget_range *r)
+{
+	struct tcp_stream *tcp;
+
+	r->hdr_size = 0;
+	r->hdr_len = 0;
+	wget_range_new = r;
+	tcp = tcp_stream_connect(web_server_ip, server_port);
+	wget_range_new = NULL;
+	/* With no free stream, try again on the next tick */
+	if (!tcp)
+		return;
+
+	r->tcp = tcp;
+	r->state = WGET_RANGE_BUSY;
+	tcp_stream_put(tcp);
+}
+
+/* Split the file into ranges once the HEAD request has given its size */
+static void wget_range_split(void)
+{
+	struct wget_range *r;
+	ulong size;
+	int i;
+
+	wget_range_head = false;
+	wget_range_count = clamp_t(ulong, content_length / WGET_RANGE_MIN, 1,
+				   min_t(ulong, wget_info->jobs,
+					 ARRAY_SIZE(wget_ranges)));
+	size = content_length / wget_range_count;
+	debug_cond(DEBUG_WGET, "wget: %lu bytes in %d ranges\n",
+		   content_length, wget_range_count);
+
+	memset(wget_ranges, '\0', sizeof(wget_ranges));
+	for (i = 0; i < wget_range_count; i++) {
+		r = &wget_ranges[i];
+		r->first = i * size;
+		r->start = r->first;
+		r->end = i == wget_range_count - 1 ? content_length :
+			r->first + size;
+	}
+}
+
+static void wget_range_abort(void)
+{
+	struct tcp_stream *tcp;
+	struct wget_range *r;
+
+	for (r = wget_ranges; r < wget_ranges + wget_range_count; r++) {
+		tcp = r->tcp;
+		r->tcp = NULL;
+		if (tcp)
+			tcp_stream_reset(tcp);
+	}
+
+	net_boot_file_size = 0;
+	if (!wget_info->silent)
+		printf("\nwget: Transfer Fail\n");
+	net_set_state(NETLOOP_FAIL);
+}
+
+/*
+ * Drive a parallel download: (re)connect ranges which need it and notice
+ * when all of them are done. TCP callbacks cannot open a stream from
+ * on_closed, since the stream is cleared afterwards, so this runs from the
+ * net_loop() timeout handler instead.
+ */
+static void wget_range_tick(void)
+{
+	struct wget_range *r;
+	int done = 0;
+
+	if (wget_range_error) {
+		wget_range_abort();
+		return;
+	}
+
+	for (r = wget_ranges; r < wget_ranges + wget_range_count; r++) {
+		switch (r->state) {
+		case WGET_RANGE_FAILED:
+			if (r->retries == WGET_RANGE_RETRIES) {
+				wget_range_abort();
+				return;
+			}
+			r->retries++;
+			r->start += r->done;
+			r->done = 0;
+			debug_cond(DEBUG_WGET, "wget: retry range %lu-%lu\n",
+				   r->start, r->end);
+			fallthrough;
+		case WGET_RANGE_IDLE:
+			wget_range_connect(r);
+			break;
+		case WGET_RANGE_DONE:
+			done++;
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (done == wget_range_count && wget_range_head) {
+		wget_range_split();
+		if (content_length) {
+			wget_range_tick();
+			return;
+		}
+	}
+
+	if (done == wget_range_count) {
+		net_boot_file_size = content_length;
+		net_set_state(NETLOOP_SUCCESS);
+		if (!wget_info->silent)
+			printf("\nPackets received %u in %d ranges, Transfer Successful\n",
+			       wget_range_packets, wget_range_count);
+		wget_success();
+		return;
+	}
+
+	net_set_timeout_handler(WGET_RANGE_TICK, wget_range_tick);
+}
+
+static void wget_range_start(void)
+{
+	memset(wget_ranges, '\0', sizeof(wget_ranges));
+	wget_range_count = 1;
+	wget_range_packets = 0;
+	wget_range_head = true;
+	wget_range_error = false;
+
+	tcp_stream_set_on_create_handler(wget_range_on_create);
+	wget_range_tick();
+}
+
 #define BLOCKSIZE 512
 
 void wget_start(void)
@@ -353,6 +769,22 @@ void wget_start(void)
 		wget_info->headers[0] = 0;
 
 	server_port = env_get_ulong("httpdstp", 10, SERVER_PORT) & 0xffff;
+	if (IS_ENABLED(CONFIG_CMD_NETSINK) && net_sink_enabled()) {
+		if (wget_info->jobs > 1) {
+			printf("wget: -j cannot be used with netsink\n");
+			net_set_state(NETLOOP_FAIL);
+			return;
+		}
+		if (net_sink_begin(image_load_addr)) {
+			net_set_state(NETLOOP_FAIL);
+			return;
+		}
+	}
+	if (wget_info->jobs > 1 && wget_info->method == WGET_HTTP_METHOD_GET) {
+		wget_range_start();
+		return;
+	}
+
 	tcp_stream_set_on_create_handler(tcp_stream_on_create);
 	tcp = tcp_stream_connect(web_server_ip, server_port);
 	if (!tcp) {
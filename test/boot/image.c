@@ -6,8 +6,18 @@
  * Written by Simon Glass <sjg@chromium.org>
  */
 
+#include <gzip.h>
+#include <hash.h>
 #include <image.h>
+#include <fs.h>
+#include <lmb.h>
+#include <malloc.h>
+#include <mapmem.h>
+#include <os.h>
 #include <test/ut.h>
+#include <u-boot/sha256.h>
+#include <linux/libfdt.h>
+#include <linux/sizes.h>
 #include "bootstd_common.h"
 
 /* Test of image phase */
@@ -32,3 +42,264 @@ static int test_image_phase(struct unit_test_state *uts)
 	return 0;
 }
 BOOTSTD_TEST(test_image_phase, 0);
+
+/* Reads a FIT held in memory, standing in for a file */
+static int image_stream_read(struct fit_stream *stream, ulong offset,
+			     ulong size, void *buf)
+{
+	struct abuf *fit = stream->priv;
+
+	if (offset + size > fit->size)
+		return -EIO;
+	memcpy(buf, fit->data + offset, size);
+
+	return 0;
+}
+
+/*
+ * Build a FIT with one kernel using external data, compressed as @comp,
+ * followed by the data itself
+ */
+static int make_stream_fit(struct unit_test_state *uts, struct abuf *fit,
+			   const char *comp, const void *data, ulong size)
+{
+	uint8_t digest[SHA256_SUM_LEN];
+	int images, node, hash;
+	ulong hdr_size;
+	void *hdr;
+
+	sha256_csum_wd(data, size, digest, CHUNKSZ_SHA256);
+
+	hdr = malloc(SZ_4K);
+	ut_assertnonnull(hdr);
+	ut_assertok(fdt_create_empty_tree(hdr, SZ_4K));
+	ut_assertok(fdt_setprop_string(hdr, 0, FIT_DESC_PROP, "stream test"));
+	ut_assertok(fdt_setprop_u32(hdr, 0, FIT_TIMESTAMP_PROP, 0));
+	images = fdt_add_subnode(hdr, 0, "images");
+	ut_assert(images >= 0);
+	node = fdt_add_subnode(hdr, images, "kernel");
+	ut_assert(node >= 0);
+	ut_assertok(fdt_setprop_string(hdr, node, FIT_TYPE_PROP, "kernel"));
+	ut_assertok(fdt_setprop_string(hdr, node, FIT_COMP_PROP, comp));
+	ut_assertok(fdt_setprop_u32(hdr, node, FIT_DATA_OFFSET_PROP, 0));
+	ut_assertok(fdt_setprop_u32(hdr, node, FIT_DATA_SIZE_PROP, size));
+	hash = fdt_add_subnode(hdr, node, "hash-1");
+	ut_assert(hash >= 0);
+	ut_assertok(fdt_setprop_string(hdr, hash, FIT_ALGO_PROP, "sha256"));
+	ut_assertok(fdt_setprop(hdr, hash, FIT_VALUE_PROP, digest,
+				sizeof(digest)));
+	ut_assertok(fdt_pack(hdr));
+
+	hdr_size = ALIGN(fdt_totalsize(hdr), 4);
+	ut_assert(abuf_init_size(fit, hdr_size + size));
+	memcpy(fit->data, hdr, fdt_totalsize(hdr));
+	memcpy(fit->data + hdr_size, data, size);
+	free(hdr);
+
+	return 0;
+}
+
+/*
+ * Build a FIT holding @size bytes of test data compressed with gzip, which
+ * spans several chunks once compressed, returning the data in @datap
+ */
+static int make_stream_gzip_fit(struct unit_test_state *uts, struct abuf *fit,
+				ulong size, u8 **datap)
+{
+	ulong gz_size = size;
+	uint seed = 1;
+	u8 *data;
+	void *gz;
+	int i;
+
+	/* half noise, so that it does not compress too well */
+	data = malloc(size);
+	ut_assertnonnull(data);
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = i & 1 ? seed >> 16 : i >> 10;
+	}
+
+	gz = malloc(gz_size);
+	ut_assertnonnull(gz);
+	ut_assertok(gzip(gz, &gz_size, data, size));
+	ut_assertok(make_stream_fit(uts, fit, "gzip", gz, gz_size));
+	free(gz);
+	*datap = data;
+
+	return 0;
+}
+
+/* Test loading a compressed sub-image with fit_stream_load_image() */
+static int test_image_fit_stream(struct unit_test_state *uts)
+{
+	const ulong size = 3 * SZ_1M + 123;
+	struct fit_stream stream;
+	struct abuf fit;
+	void *hdr, *out;
+	u8 *data, *value;
+	int node, hash;
+	ulong len;
+
+	if (!CONFIG_IS_ENABLED(FIT_STREAM))
+		return -EAGAIN;
+
+	ut_assertok(make_stream_gzip_fit(uts, &fit, size, &data));
+
+	stream.read = image_stream_read;
+	stream.priv = &fit;
+	ut_assertok(fit_stream_read_header(&stream, &hdr));
+	node = fit_image_get_node(hdr, "kernel");
+	ut_assert(node >= 0);
+
+	out = malloc(size + SZ_4K);
+	ut_assertnonnull(out);
+	ut_assertok(fit_stream_load_image(&stream, hdr, node, true, out,
+					  size + SZ_4K, &len));
+	ut_asserteq(size, len);
+	ut_asserteq_mem(data, out, size);
+
+	/* the output buffer must be large enough */
+	ut_asserteq(-ENOSPC, fit_stream_load_image(&stream, hdr, node, false,
+						   out, size / 2, &len));
+
+	/* a wrong hash value must be caught */
+	hash = fdt_subnode_offset(hdr, node, "hash-1");
+	ut_assert(hash >= 0);
+	value = (u8 *)fdt_getprop(hdr, hash, FIT_VALUE_PROP, NULL);
+	ut_assertnonnull(value);
+	value[0] ^= 0x10;
+	ut_asserteq(-EACCES, fit_stream_load_image(&stream, hdr, node, true,
+						   out, size + SZ_4K, &len));
+
+	free(out);
+	free(hdr);
+	abuf_uninit(&fit);
+	free(data);
+
+	return 0;
+}
+BOOTSTD_TEST(test_image_fit_stream, 0);
+
+/* zstd -19 -c of the text below */
+static const char stream_plain[] =
+	"I am a highly compressable bit of text.\n"
+	"I am a highly compressable bit of text.\n"
+	"I am a highly compressable bit of text.\n"
+	"There are many like me, but this one is mine.\n"
+	"If I were any shorter, there wouldn't be much sense in\n"
+	"compressing me in the first place. At least with lzo, anyway,\n"
+	"which appears to behave poorly in the face of short text\n"
+	"messages.\n";
+
+static const char stream_zstd[] =
+	"\x28\xb5\x2f\xfd\x64\x5e\x00\xbd\x05\x00\x02\x0e\x26\x1a\x70\x17"
+	"\xb8\x0d\x0c\x53\x5c\x9d\x97\xee\xa0\x5d\x84\x89\x3f\x5c\x7a\x78"
+	"\x00\x80\x80\x0f\xe8\xdf\xaf\x06\x66\xd0\x23\xa6\x7a\x64\x8e\xf4"
+	"\x0d\x5b\x47\x65\x26\x7e\x81\xdd\x0b\xe7\x5a\x95\x3d\x49\xcc\x67"
+	"\xe0\x2d\x46\x58\xb6\xac\x64\x16\xf2\xe0\xf8\x16\x17\xaf\xda\x8f"
+	"\x37\xc0\xc3\x0d\x3b\x89\x57\x15\x1e\x46\x46\x12\x9a\x84\xbe\xa6"
+	"\xab\xcf\x50\x90\x5f\x78\x01\xd2\xc0\x51\x72\x59\x0b\xea\xab\xf2"
+	"\xd4\x2b\x2d\x26\x7c\x10\x66\x78\x42\x64\x45\x3f\xa5\x15\x6f\xbd"
+	"\x4a\x61\xe1\xc8\x27\xc0\xe3\x95\x0c\xf9\xca\x7c\xf5\x13\x30\xc3"
+	"\x1a\x7c\x7d\xa4\x17\x0b\xff\x14\xa6\x7a\x95\xa0\x34\xbc\xce\x21"
+	"\x78\x36\x23\x33\x11\x09\x00\x60\x13\x00\x63\xa3\x8e\x28\x94\x55"
+	"\x15\xb6\x26\x68\x05\x4f\x23\x12\xee\x53\x55\x2d\x44\x2f\x54\x95"
+	"\x01\xe4\xf4\x6e\xfa";
+
+/* Load a zstd sub-image of @size bytes of stream_zstd[] into @out */
+static int image_stream_zstd(struct unit_test_state *uts, ulong size,
+			     void *out, ulong out_size, ulong *lenp)
+{
+	struct fit_stream stream;
+	struct abuf fit;
+	void *hdr;
+	int node, ret;
+
+	ut_assertok(make_stream_fit(uts, &fit, "zstd", stream_zstd, size));
+	stream.read = image_stream_read;
+	stream.priv = &fit;
+	ut_assertok(fit_stream_read_header(&stream, &hdr));
+	node = fit_image_get_node(hdr, "kernel");
+	ut_assert(node >= 0);
+
+	ret = fit_stream_load_image(&stream, hdr, node, true, out, out_size,
+				    lenp);
+	free(hdr);
+	abuf_uninit(&fit);
+
+	return ret;
+}
+
+/* Test that a zstd sub-image must hold a whole frame */
+static int test_image_fit_stream_zstd(struct unit_test_state *uts)
+{
+	const ulong size = sizeof(stream_zstd) - 1;
+	char out[sizeof(stream_plain) + 64];
+	ulong len;
+
+	if (!CONFIG_IS_ENABLED(FIT_STREAM) || !CONFIG_IS_ENABLED(ZSTD))
+		return -EAGAIN;
+
+	ut_assertok(image_stream_zstd(uts, size, out, sizeof(out), &len));
+	ut_asserteq(sizeof(stream_plain) - 1, len);
+	ut_asserteq_mem(stream_plain, out, len);
+
+	/*
+	 * Without its checksum the frame gives all the data, but has not
+	 * ended. Cut further, the data is short as well.
+	 */
+	ut_asserteq(-EINVAL, image_stream_zstd(uts, size - 4, out, sizeof(out),
+					       &len));
+	ut_asserteq(-EINVAL, image_stream_zstd(uts, size / 2, out, sizeof(out),
+					       &len));
+
+	return 0;
+}
+BOOTSTD_TEST(test_image_fit_stream_zstd, 0);
+
+/* Test loading a compressed sub-image from a FIT in a file */
+static int test_image_fit_stream_file(struct unit_test_state *uts)
+{
+	const ulong size = SZ_1M + 123;
+	const ulong addr = 0x1000000;
+	struct abuf fit;
+	ulong len;
+	u8 *data;
+	void *out;
+
+	if (!CONFIG_IS_ENABLED(FIT_STREAM))
+		return -EAGAIN;
+
+	ut_assertok(make_stream_gzip_fit(uts, &fit, size, &data));
+	ut_assertok(os_write_file("fitstream.itb", fit.data, fit.size));
+	abuf_uninit(&fit);
+
+	ut_assertok(fit_stream_load_file("hostfs", "-", FS_TYPE_ANY,
+					 "fitstream.itb", "kernel", true, addr,
+					 &len));
+	ut_asserteq(size, len);
+	out = map_sysmem(addr, size);
+	ut_asserteq_mem(data, out, size);
+	unmap_sysmem(out);
+
+	/* Only the loaded image stays reserved, not the compressed data */
+	if (CONFIG_IS_ENABLED(LMB)) {
+		ut_asserteq(0, lmb_get_free_size(addr));
+		ut_assert(lmb_get_free_size(addr + size));
+		ut_assertok(lmb_free(addr, size, LMB_NONE));
+		ut_asserteq(lmb_get_free_size(addr),
+			    lmb_get_free_size(addr + size) + size);
+	}
+
+	/* A missing image is reported */
+	ut_asserteq(-ENOENT, fit_stream_load_file("hostfs", "-", FS_TYPE_ANY,
+						  "fitstream.itb", "ramdisk",
+						  true, addr, &len));
+
+	os_unlink("fitstream.itb");
+	free(data);
+
+	return 0;
+}
+BOOTSTD_TEST(test_image_fit_stream_file, 0);
@@ -0,0 +1,388 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for TFTP downloads
+ */
+
+#include <blk.h>
+#include <command.h>
+#include <dm.h>
+#include <env.h>
+#include <malloc.h>
+#include <mapmem.h>
+#include <memalign.h>
+#include <net.h>
+#include <part.h>
+#include <vsprintf.h>
+#include <asm/eth.h>
+#include <test/cmd.h>
+#include <test/test.h>
+#include <test/ut.h>
+
+#define TFTP_PORT	69
+#define TFTP_TID	21313
+
+#define TFTP_RRQ	1
+#define TFTP_DATA	3
+#define TFTP_ACK	4
+#define TFTP_OACK	6
+
+#define TFTP_TEST_BLKSIZE	512
+/* Largest block which fits in an ethernet frame, as in net/tftp.c */
+#define TFTP_TEST_MTU_BLKSIZE	1468
+#define TFTP_TEST_SIZE		(16 * TFTP_TEST_BLKSIZE + 100)
+/* Largest window granted, so a window fits in the receive buffers */
+#define TFTP_TEST_MAX_WINDOW	2
+/* File written by netsink, larger than half of its staging buffer */
+#define TFTP_NETSINK_SIZE	(600 * TFTP_TEST_BLKSIZE + 300)
+
+/**
+ * struct tftp_test_state - a TFTP server which grants a limited window
+ *
+ * @data: contents of the file
+ * @size: size of the file
+ * @req_window: window size asked for in the last request (1 if none)
+ * @window: window size granted
+ * @drop: block to drop once, to make the client ask for it again, or 0
+ * @frag_loss: grant the block size asked for, but lose all blocks larger
+ *	than TFTP_TEST_MTU_BLKSIZE, like a path which drops IP fragments;
+ *	otherwise grant TFTP_TEST_BLKSIZE
+ * @req_blksize: block size asked for in the last request (0 if none)
+ * @blksize: block size granted
+ */
+struct tftp_test_state {
+	u8 *data;
+	int size;
+	int req_window;
+	int window;
+	int drop;
+	bool frag_loss;
+	int req_blksize;
+	int blksize;
+};
+
+/* Queue a UDP packet from the server in reply to @req */
+static int tftp_test_reply(struct udevice *dev, void *req, const void *payload,
+			   int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct ethernet_hdr *eth = req;
+	struct ip_udp_hdr *ip = req + ETHER_HDR_SIZE;
+	struct ethernet_hdr *eth_send;
+	struct ip_udp_hdr *ip_send;
+
+	/* Don't allow the buffer to overrun */
+	if (priv->recv_packets >= PKTBUFSRX)
+		return 0;
+
+	eth_send = (void *)priv->recv_packet_buffer[priv->recv_packets];
+	memcpy(eth_send->et_dest, eth->et_src, ARP_HLEN);
+	memcpy(eth_send->et_src, priv->fake_host_hwaddr, ARP_HLEN);
+	eth_send->et_protlen = htons(PROT_IP);
+
+	ip_send = (void *)eth_send + ETHER_HDR_SIZE;
+	net_set_ip_header((uchar *)ip_send, ip->ip_src, ip->ip_dst,
+			  IP_UDP_HDR_SIZE + len, IPPROTO_UDP);
+	ip_send->udp_src = htons(TFTP_TID);
+	ip_send->udp_dst = ip->udp_src;
+	ip_send->udp_len = htons(UDP_HDR_SIZE + len);
+	ip_send->udp_xsum = 0;
+	memcpy((void *)ip_send + IP_UDP_HDR_SIZE, payload, len);
+
+	priv->recv_packet_length[priv->recv_packets] =
+		ETHER_HDR_SIZE + IP_UDP_HDR_SIZE + len;
+	++priv->recv_packets;
+
+	return 0;
+}
+
+/* Answer a read request with the block size and window we allow */
+static int tftp_test_rrq(struct udevice *dev, void *packet, unsigned int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct tftp_test_state *st = priv->priv;
+	struct ip_udp_hdr *ip = packet + ETHER_HDR_SIZE;
+	char *pkt = (void *)ip + IP_UDP_HDR_SIZE + 2;
+	char *end = packet + len;
+	char oack[64];
+	int oack_len;
+
+	/* skip the filename and mode, then look through the options */
+	st->req_window = 1;
+	st->req_blksize = 0;
+	pkt += strnlen(pkt, end - pkt) + 1;
+	pkt += strnlen(pkt, end - pkt) + 1;
+	while (pkt < end) {
+		char *val = pkt + strnlen(pkt, end - pkt) + 1;
+
+		if (val >= end)
+			break;
+		if (!strcmp(pkt, "windowsize"))
+			st->req_window = dectoul(val, NULL);
+		if (!strcmp(pkt, "blksize"))
+			st->req_blksize = dectoul(val, NULL);
+		pkt = val + strnlen(val, end - val) + 1;
+	}
+	st->window = min(st->req_window, TFTP_TEST_MAX_WINDOW);
+	st->blksize = st->frag_loss && st->req_blksize ? st->req_blksize :
+		TFTP_TEST_BLKSIZE;
+
+	*(__be16 *)oack = htons(TFTP_OACK);
+	oack_len = 2;
+	oack_len += sprintf(oack + oack_len, "blksize%c%d%c", 0,
+			    st->blksize, 0);
+	if (st->req_window > 1)
+		oack_len += sprintf(oack + oack_len, "windowsize%c%d%c", 0,
+				    st->window, 0);
+
+	return tftp_test_reply(dev, packet, oack, oack_len);
+}
+
+/* Send the window of blocks which follows an ACK */
+static int tftp_test_ack(struct udevice *dev, void *packet, int acked)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct tftp_test_state *st = priv->priv;
+	u8 buf[4 + TFTP_TEST_MTU_BLKSIZE];
+	int block, ofs, size, ret;
+
+	/* Nothing gets through, so the client times out */
+	if (st->blksize > TFTP_TEST_MTU_BLKSIZE) {
+		sandbox_eth_skip_timeout();
+		return 0;
+	}
+
+	for (block = acked + 1; block <= acked + st->window; block++) {
+		ofs = (block - 1) * st->blksize;
+		if (ofs > st->size)
+			break;
+		if (block == st->drop) {
+			/* with no later block to notice the gap, it times out */
+			st->drop = 0;
+			if (block == acked + st->window)
+				sandbox_eth_skip_timeout();
+			continue;
+		}
+		size = min(st->size - ofs, st->blksize);
+		*(__be16 *)buf = htons(TFTP_DATA);
+		*(__be16 *)(buf + 2) = htons(block);
+		memcpy(buf + 4, st->data + ofs, size);
+		ret = tftp_test_reply(dev, packet, buf, 4 + size);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int tftp_test_handler(struct udevice *dev, void *packet,
+			     unsigned int len)
+{
+	struct ethernet_hdr *eth = packet;
+	struct ip_udp_hdr *ip = packet + ETHER_HDR_SIZE;
+	__be16 *op = (void *)ip + IP_UDP_HDR_SIZE;
+
+	if (ntohs(eth->et_protlen) == PROT_ARP)
+		return sandbox_eth_arp_req_to_reply(dev, packet, len);
+	if (ntohs(eth->et_protlen) != PROT_IP || ip->ip_p != IPPROTO_UDP)
+		return -EPROTONOSUPPORT;
+
+	if (ntohs(ip->udp_dst) == TFTP_PORT && ntohs(op[0]) == TFTP_RRQ)
+		return tftp_test_rrq(dev, packet, len);
+	if (ntohs(ip->udp_dst) == TFTP_TID && ntohs(op[0]) == TFTP_ACK)
+		return tftp_test_ack(dev, packet, ntohs(op[1]));
+
+	return 0;
+}
+
+/* Download the file, checking its contents */
+static int tftp_test_load(struct unit_test_state *uts,
+			  struct tftp_test_state *st)
+{
+	u8 *buf;
+
+	ut_assertok(run_command("tftpboot 20000 1.1.2.2:file", 0));
+	ut_assert_skip_to_line("Bytes transferred = %d (%x hex)",
+			       st->size, st->size);
+	ut_assert_console_end();
+
+	buf = map_sysmem(0x20000, st->size);
+	ut_asserteq_mem(st->data, buf, st->size);
+	unmap_sysmem(buf);
+
+	return 0;
+}
+
+static int tftp_test_adaptive(struct unit_test_state *uts,
+			      struct tftp_test_state *st)
+{
+	/* A lossy download halves the window, here to 1 */
+	st->drop = 5;
+	ut_assertok(tftp_test_load(uts, st));
+	ut_asserteq(0, st->drop);
+
+	/* Without losses it doubles, as long as the server grants it */
+	ut_assertok(tftp_test_load(uts, st));
+	ut_asserteq(1, st->req_window);
+	ut_assertok(tftp_test_load(uts, st));
+	ut_asserteq(2, st->req_window);
+	ut_assertok(tftp_test_load(uts, st));
+	ut_asserteq(4, st->req_window);
+	ut_asserteq(TFTP_TEST_MAX_WINDOW, st->window);
+
+	/* The server only granted 2, so 4 is not doubled */
+	ut_assertok(tftp_test_load(uts, st));
+	ut_asserteq(4, st->req_window);
+
+	/* Setting the window size turns off the adaptation */
+	env_set("tftpwindowsize", "2");
+	ut_assertok(tftp_test_load(uts, st));
+	ut_asserteq(2, st->req_window);
+	st->drop = 5;
+	ut_assertok(tftp_test_load(uts, st));
+	ut_asserteq(2, st->req_window);
+	env_set("tftpwindowsize", NULL);
+	ut_assertok(run_command("tftpboot 20000 1.1.2.2:file", 0));
+	ut_assert_skip_to_line("\t window 2, block size %d, 0 retransmits (0 timeouts), next window 4",
+			       TFTP_TEST_BLKSIZE);
+	ut_assert_skip_to_line("Bytes transferred = %d (%x hex)",
+			       st->size, st->size);
+	ut_assert_console_end();
+	ut_asserteq(4, st->req_window);
+
+	return 0;
+}
+
+static int tftp_test_mtu(struct unit_test_state *uts,
+			 struct tftp_test_state *st)
+{
+	u8 *buf;
+
+	/* Forget any earlier fallback, with blocks which get through */
+	st->frag_loss = true;
+	env_set("tftpblocksize", "1024");
+	ut_assertok(tftp_test_load(uts, st));
+	ut_asserteq(1024, st->blksize);
+	env_set("tftpblocksize", NULL);
+
+	/* Large blocks are lost, so the request is sent again */
+	ut_assertok(run_command("tftpboot 20000 1.1.2.2:file", 0));
+	ut_assert_skip_to_line("No data with block size %d; trying %d",
+			       CONFIG_TFTP_BLOCKSIZE, TFTP_TEST_MTU_BLKSIZE);
+	ut_assert_skip_to_line("Bytes transferred = %d (%x hex)",
+			       st->size, st->size);
+	ut_assert_console_end();
+	ut_asserteq(TFTP_TEST_MTU_BLKSIZE, st->blksize);
+
+	buf = map_sysmem(0x20000, st->size);
+	ut_asserteq_mem(st->data, buf, st->size);
+	unmap_sysmem(buf);
+
+	/* The next download asks for the smaller blocks straight away */
+	ut_assertok(tftp_test_load(uts, st));
+	ut_asserteq(TFTP_TEST_MTU_BLKSIZE, st->req_blksize);
+
+	return 0;
+}
+
+/* Set up a server for a file of @size bytes and run @check with it */
+static int tftp_test_run(struct unit_test_state *uts, int size,
+			 int (*check)(struct unit_test_state *uts,
+				      struct tftp_test_state *st))
+{
+	char *prev_ethact = env_get("ethact");
+	char *prev_ethrotate = env_get("ethrotate");
+	struct tftp_test_state *st;
+	int i, ret;
+
+	st = calloc(1, sizeof(*st));
+	ut_assertnonnull(st);
+	st->data = malloc(size);
+	ut_assertnonnull(st->data);
+	st->size = size;
+	for (i = 0; i < size; i++)
+		st->data[i] = i * 7 + i / TFTP_TEST_BLKSIZE;
+	sandbox_eth_set_tx_handler(0, tftp_test_handler);
+	sandbox_eth_set_priv(0, st);
+	env_set("ethact", "eth@10002000");
+	env_set("ethrotate", "no");
+
+	ret = check(uts, st);
+
+	sandbox_eth_set_tx_handler(0, NULL);
+	env_set("tftpwindowsize", NULL);
+	env_set("tftpblocksize", NULL);
+	env_set("ethact", prev_ethact);
+	env_set("ethrotate", prev_ethrotate);
+	free(st->data);
+	free(st);
+
+	return ret;
+}
+
+static int net_test_tftp_adaptive(struct unit_test_state *uts)
+{
+	if (!IS_ENABLED(CONFIG_TFTP_ADAPTIVE))
+		return -EAGAIN;
+
+	return tftp_test_run(uts, TFTP_TEST_SIZE, tftp_test_adaptive);
+}
+CMD_TEST(net_test_tftp_adaptive, UTF_CONSOLE);
+
+/* Test falling back to blocks which fit the MTU when large ones are lost */
+static int net_test_tftp_mtu(struct unit_test_state *uts)
+{
+	/* Only a block size needing IP fragmentation is ever replaced */
+	if (!IS_ENABLED(CONFIG_TFTP_ADAPTIVE) ||
+	    !IS_ENABLED(CONFIG_NET_TFTP_VARS) ||
+	    CONFIG_TFTP_BLOCKSIZE <= TFTP_TEST_MTU_BLKSIZE)
+		return -EAGAIN;
+
+	return tftp_test_run(uts, TFTP_TEST_SIZE * 4, tftp_test_mtu);
+}
+CMD_TEST(net_test_tftp_mtu, UTF_CONSOLE);
+
+/* Write a download to a block device while it is received */
+static int tftp_test_netsink(struct unit_test_state *uts,
+			     struct tftp_test_state *st)
+{
+	struct blk_desc *desc;
+	lbaint_t blkcnt;
+	u8 *buf;
+
+	ut_asserteq(0, blk_get_device_by_str("mmc", "0", &desc));
+	blkcnt = DIV_ROUND_UP(st->size, desc->blksz);
+
+	env_set("netsinksize", "40000");
+	ut_assertok(run_command("netsink mmc 0:0", 0));
+	ut_assertok(run_command("tftpboot 20000 1.1.2.2:file", 0));
+	ut_assert_skip_to_line("Bytes transferred = %d (%x hex)",
+			       st->size, st->size);
+	ut_assert_nextline("netsink: %d bytes written to mmc 0", st->size);
+	ut_assert_console_end();
+
+	buf = malloc_cache_aligned(blkcnt * desc->blksz);
+	ut_assertnonnull(buf);
+	ut_asserteq(blkcnt, blk_dread(desc, 0, blkcnt, buf));
+	ut_asserteq_mem(st->data, buf, st->size);
+
+	/* Leave the device blank for other tests */
+	memset(buf, '\0', blkcnt * desc->blksz);
+	ut_asserteq(blkcnt, blk_dwrite(desc, 0, blkcnt, buf));
+	free(buf);
+
+	return 0;
+}
+
+static int net_test_tftp_netsink(struct unit_test_state *uts)
+{
+	int ret;
+
+	if (!IS_ENABLED(CONFIG_CMD_NETSINK))
+		return -EAGAIN;
+
+	ret = tftp_test_run(uts, TFTP_NETSINK_SIZE, tftp_test_netsink);
+	env_set("netsinksize", NULL);
+
+	return ret;
+}
+CMD_TEST(net_test_tftp_netsink, UTF_CONSOLE);
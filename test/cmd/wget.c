@@ -6,16 +6,23 @@
  * Ying-Chun Liu (PaulLiu) <paul.liu@linaro.org>
  */
 
+#include <blk.h>
 #include <command.h>
 #include <dm.h>
 #include <env.h>
 #include <fdtdec.h>
+#include <gzip.h>
+#include <image-sparse.h>
 #include <log.h>
 #include <malloc.h>
+#include <mapmem.h>
+#include <memalign.h>
 #include <net.h>
+#include <part.h>
 #include <net/tcp.h>
 #include <net/wget.h>
 #include <asm/eth.h>
+#include <asm/unaligned.h>
 #include <dm/test.h>
 #include <dm/device-internal.h>
 #include <dm/uclass-internal.h>
@@ -242,6 +249,285 @@ static int net_test_wget(struct unit_test_state *uts)
 }
 CMD_TEST(net_test_wget, UTF_CONSOLE);
 
+/*
+ * Queue a TCP segment to client port @dport, taking the addresses from @req.
+ * @opts go after the header, followed by @len bytes of @data.
+ */
+static int sb_tcp_send(struct udevice *dev, void *req, u16 dport, u8 flags,
+		       u32 seq, u32 ack, const u8 *opts, int opts_len,
+		       const u8 *data, u32 len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct ethernet_hdr *eth = req;
+	struct ip_tcp_hdr *tcp = req + ETHER_HDR_SIZE;
+	struct ethernet_hdr *eth_send;
+	struct ip_tcp_hdr *tcp_send;
+	int hdr_len = IP_TCP_HDR_SIZE + opts_len;
+	int pkt_len = hdr_len + len;
+
+	if (priv->recv_packets >= PKTBUFSRX)
+		return -ENOBUFS;
+
+	eth_send = (void *)priv->recv_packet_buffer[priv->recv_packets];
+	memcpy(eth_send->et_dest, eth->et_src, ARP_HLEN);
+	memcpy(eth_send->et_src, priv->fake_host_hwaddr, ARP_HLEN);
+	eth_send->et_protlen = htons(PROT_IP);
+	tcp_send = (void *)eth_send + ETHER_HDR_SIZE;
+	tcp_send->tcp_src = tcp->tcp_dst;
+	tcp_send->tcp_dst = htons(dport);
+	tcp_send->tcp_seq = htonl(seq);
+	tcp_send->tcp_ack = htonl(ack);
+	tcp_send->tcp_hlen = SHIFT_TO_TCPHDRLEN_FIELD(LEN_B_TO_DW(hdr_len -
+								  IP_HDR_SIZE));
+	tcp_send->tcp_flags = flags;
+	tcp_send->tcp_win = htons(TCP_MAX_WIN);
+	tcp_send->tcp_ugr = 0;
+	memcpy((void *)tcp_send + IP_TCP_HDR_SIZE, opts, opts_len);
+	memcpy((void *)tcp_send + hdr_len, data, len);
+	tcp_send->tcp_xsum = 0;
+	tcp_send->tcp_xsum = tcp_set_pseudo_header((uchar *)tcp_send,
+						   tcp->ip_src, tcp->ip_dst,
+						   pkt_len - IP_HDR_SIZE,
+						   pkt_len);
+	net_set_ip_header((uchar *)tcp_send, tcp->ip_src, tcp->ip_dst,
+			  pkt_len, IPPROTO_TCP);
+
+	priv->recv_packet_length[priv->recv_packets] = ETHER_HDR_SIZE + pkt_len;
+	++priv->recv_packets;
+
+	return 0;
+}
+
+/*
+ * Emulate a server at the end of a long, reordering path: after the HTTP
+ * header it sends all the odd segments of the file before the even ones,
+ * as if every other segment had been delayed. The client must advertise a
+ * window covering the whole file and keep track of all the holes, or the
+ * server has to send data again.
+ */
+#define REORDER_DATA_SIZE	80000
+#define REORDER_SEG_SIZE	TCP_MSS
+#define REORDER_MAX_SEGS	64
+
+struct reorder_state {
+	char hdr[80];
+	u8 data[REORDER_DATA_SIZE];
+	u32 size;		/* header plus data */
+	int order[REORDER_MAX_SEGS];
+	bool sent[REORDER_MAX_SEGS];
+	int segs;
+	int next;
+	u32 cli_nxt;		/* next sequence number from the client */
+	int cli_scale;		/* client window scale, -1 if not offered */
+	u32 max_win;		/* largest window seen, in bytes */
+	bool started;
+	bool fin_sent;
+	int retransmits;
+};
+
+static u8 reorder_byte(u32 pos)
+{
+	return (pos * 2654435761U) >> 24;
+}
+
+static void reorder_fill(struct reorder_state *st, u32 pos, u8 *buf, u32 len)
+{
+	u32 hlen = strlen(st->hdr);
+
+	for (; len; len--, pos++)
+		*buf++ = pos < hlen ? st->hdr[pos] : st->data[pos - hlen];
+}
+
+static void reorder_init(struct reorder_state *st)
+{
+	int i, k = 0;
+
+	memset(st, '\0', sizeof(*st));
+	snprintf(st->hdr, sizeof(st->hdr),
+		 "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n",
+		 REORDER_DATA_SIZE);
+	for (i = 0; i < REORDER_DATA_SIZE; i++)
+		st->data[i] = reorder_byte(i);
+	st->size = strlen(st->hdr) + REORDER_DATA_SIZE;
+	st->segs = DIV_ROUND_UP(st->size, REORDER_SEG_SIZE);
+	st->cli_scale = -1;
+
+	/* Header first, then odd segments, then even ones */
+	st->order[k++] = 0;
+	for (i = 1; i < st->segs; i += 2)
+		st->order[k++] = i;
+	for (i = 2; i < st->segs; i += 2)
+		st->order[k++] = i;
+}
+
+/* Queue a reply to @req with @len bytes of the stream at @offs */
+static int reorder_send(struct udevice *dev, void *req, u8 flags, u32 offs,
+			u32 len, const u8 *opts, int opts_len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct reorder_state *st = priv->priv;
+	struct ip_tcp_hdr *tcp = req + ETHER_HDR_SIZE;
+	u8 buf[REORDER_SEG_SIZE];
+
+	reorder_fill(st, offs, buf, len);
+
+	return sb_tcp_send(dev, req, ntohs(tcp->tcp_src), flags,
+			   priv->iss + (flags & TCP_SYN ? 0 : 1 + offs),
+			   st->cli_nxt, opts, opts_len, buf, len);
+}
+
+static int reorder_send_seg(struct udevice *dev, void *req, int seg)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct reorder_state *st = priv->priv;
+	u32 offs = seg * REORDER_SEG_SIZE;
+
+	return reorder_send(dev, req, TCP_ACK, offs,
+			    min_t(u32, REORDER_SEG_SIZE, st->size - offs),
+			    NULL, 0);
+}
+
+static int reorder_tcp_handler(struct udevice *dev, void *packet,
+			       unsigned int len)
+{
+	static const u8 syn_opts[] = { TCP_1_NOP, TCP_O_SCL, TCP_OPT_LEN_3, 0 };
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct reorder_state *st = priv->priv;
+	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
+	int hdr_len = GET_TCP_HDR_LEN_IN_BYTES(tcp->tcp_hlen);
+	int data_len = len - ETHER_HDR_SIZE - IP_HDR_SIZE - hdr_len;
+	u8 *opt = (u8 *)tcp + IP_TCP_HDR_SIZE;
+	u32 acked, win, offs;
+	int seg;
+
+	if (tcp->tcp_flags == TCP_SYN) {
+		while (opt < (u8 *)tcp + IP_HDR_SIZE + hdr_len &&
+		       *opt != TCP_O_END) {
+			if (*opt == TCP_1_NOP) {
+				opt++;
+				continue;
+			}
+			if (*opt == TCP_O_SCL)
+				st->cli_scale = opt[2];
+			opt += opt[1];
+		}
+		priv->irs = ntohl(tcp->tcp_seq);
+		priv->iss = ~priv->irs;
+		st->cli_nxt = priv->irs + 1;
+		return reorder_send(dev, packet, TCP_SYN | TCP_ACK, 0, 0,
+				    syn_opts, sizeof(syn_opts));
+	}
+	if (!(tcp->tcp_flags & TCP_ACK))
+		return 0;
+
+	if ((int)(ntohl(tcp->tcp_seq) + data_len - st->cli_nxt) > 0)
+		st->cli_nxt = ntohl(tcp->tcp_seq) + data_len;
+	if (tcp->tcp_flags & TCP_FIN)
+		st->cli_nxt++;
+	if (data_len)
+		st->started = true;
+
+	acked = ntohl(tcp->tcp_ack) - priv->iss - 1;
+	win = ntohs(tcp->tcp_win) << max(st->cli_scale, 0);
+	st->max_win = max(st->max_win, win);
+
+	if (acked > st->size || (tcp->tcp_flags & TCP_FIN))
+		return reorder_send(dev, packet, TCP_ACK, st->size + 1, 0,
+				    NULL, 0);
+	if (!st->started)
+		return 0;
+	if (acked == st->size) {
+		if (st->fin_sent)
+			return 0;
+		st->fin_sent = true;
+		return reorder_send(dev, packet, TCP_ACK | TCP_FIN, st->size,
+				    0, NULL, 0);
+	}
+
+	/* Send the next segments which fit in the window */
+	while (st->next < st->segs && priv->recv_packets < PKTBUFSRX) {
+		seg = st->order[st->next];
+		offs = seg * REORDER_SEG_SIZE;
+		if (!st->sent[seg] &&
+		    offs + REORDER_SEG_SIZE > acked + win)
+			break;
+		st->next++;
+		if (st->sent[seg] || offs + REORDER_SEG_SIZE <= acked)
+			continue;
+		st->sent[seg] = true;
+		reorder_send_seg(dev, packet, seg);
+	}
+
+	/* Everything sent and nothing in flight, so something was lost */
+	if (st->next == st->segs && priv->recv_packets == priv->recv_held) {
+		st->retransmits++;
+		return reorder_send_seg(dev, packet, acked / REORDER_SEG_SIZE);
+	}
+
+	return 0;
+}
+
+static int reorder_handler(struct udevice *dev, void *packet, unsigned int len)
+{
+	struct ethernet_hdr *eth = packet;
+	struct ip_hdr *ip = packet + ETHER_HDR_SIZE;
+
+	if (ntohs(eth->et_protlen) == PROT_ARP)
+		return sb_arp_handler(dev, packet, len);
+	if (ntohs(eth->et_protlen) == PROT_IP && ip->ip_p == IPPROTO_TCP)
+		return reorder_tcp_handler(dev, packet, len);
+
+	return -EPROTONOSUPPORT;
+}
+
+static int wget_reorder_check(struct unit_test_state *uts,
+			      struct reorder_state *st)
+{
+	u8 *buf;
+
+	env_set("wgetaddr", "0x20000");
+	ut_assertok(run_command("wget ${wgetaddr} 1.1.2.2:/file", 0));
+	ut_assert_skip_to_line("Bytes transferred = 80000 (13880 hex)");
+	ut_assert_console_end();
+
+	/* The window needed scaling and every hole was remembered */
+	ut_assert(st->cli_scale > 0);
+	ut_assert(st->max_win >= st->size);
+	ut_asserteq(0, st->retransmits);
+
+	buf = map_sysmem(0x20000, REORDER_DATA_SIZE);
+	ut_asserteq_mem(st->data, buf, REORDER_DATA_SIZE);
+	unmap_sysmem(buf);
+
+	return 0;
+}
+
+static int net_test_wget_reorder(struct unit_test_state *uts)
+{
+	char *prev_ethact = env_get("ethact");
+	char *prev_ethrotate = env_get("ethrotate");
+	struct reorder_state *st;
+	int ret;
+
+	st = malloc(sizeof(*st));
+	ut_assertnonnull(st);
+	reorder_init(st);
+	sandbox_eth_set_tx_handler(0, reorder_handler);
+	sandbox_eth_set_priv(0, st);
+	env_set("ethact", "eth@10002000");
+	env_set("ethrotate", "no");
+
+	ret = wget_reorder_check(uts, st);
+
+	sandbox_eth_set_tx_handler(0, NULL);
+	free(st);
+	env_set("ethact", prev_ethact);
+	env_set("ethrotate", prev_ethrotate);
+
+	return ret;
+}
+CMD_TEST(net_test_wget_reorder, UTF_CONSOLE);
+
 static int net_test_wget_uri_validate(struct unit_test_state *uts)
 {
 	ut_asserteq(true, wget_validate_uri("http://foo.com/bar.html"));
@@ -261,3 +547,570 @@ static int net_test_wget_uri_validate(struct unit_test_state *uts)
 	return 0;
 }
 CMD_TEST(net_test_wget_uri_validate, UTF_CONSOLE);
+
+/*
+ * Emulate a server which answers HEAD requests, Range requests and plain GET
+ * requests on any number of connections at once. It shares the receive queue between the
+ * connections and resets one of them part way through, so the client has to
+ * request the rest of that range again.
+ */
+#define RANGE_DATA_SIZE		300000
+#define RANGE_CONNS		8
+#define RANGE_WIN		(8 * TCP_MSS)
+#define RANGE_RESET_AT		20000
+
+struct range_conn {
+	u16 port;		/* client port, 0 if the slot is free */
+	u32 iss;
+	u32 cli_nxt;		/* next sequence number from the client */
+	char hdr[128];
+	u32 start;		/* file offset of the data */
+	u32 total;		/* header plus data */
+	u32 sent;
+	u32 acked;
+	bool replied;
+	bool fin_sent;
+	bool fin_rcvd;
+	bool reset;
+};
+
+struct range_state {
+	u8 data[RANGE_DATA_SIZE];
+	u32 size;		/* size of the file in @data */
+	struct range_conn conn[RANGE_CONNS];
+	int next;
+	int heads;
+	int gets;
+	int busy;		/* most connections open at once */
+	int resets;
+	bool reset_end;		/* reset once all the data is acked, not before */
+};
+
+static void range_fill(struct range_state *st, struct range_conn *c, u32 pos,
+		       u8 *buf, u32 len)
+{
+	u32 hlen = strlen(c->hdr);
+
+	for (; len; len--, pos++)
+		*buf++ = pos < hlen ? c->hdr[pos] : st->data[c->start + pos - hlen];
+}
+
+/* Queue a segment of connection @c, taking the addresses from @req */
+static int range_send(struct udevice *dev, void *req, struct range_conn *c,
+		      u8 flags, u32 offs, u32 len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	u8 buf[TCP_MSS];
+
+	range_fill(priv->priv, c, offs, buf, len);
+
+	return sb_tcp_send(dev, req, c->port, flags,
+			   c->iss + (flags & TCP_SYN ? 0 : 1 + offs),
+			   c->cli_nxt, NULL, 0, buf, len);
+}
+
+/* Answer the HTTP request which came in on connection @c */
+static void range_reply(struct range_state *st, struct range_conn *c,
+			const char *req)
+{
+	const char *pos = strstr(req, "Range: bytes=");
+	u32 start = 0, end = 0;
+
+	if (!strncmp(req, "HEAD ", 5)) {
+		st->heads++;
+		snprintf(c->hdr, sizeof(c->hdr),
+			 "HTTP/1.1 200 OK\r\nAccept-Ranges: bytes\r\n"
+			 "Content-Length: %u\r\n\r\n", st->size);
+		c->total = strlen(c->hdr);
+	} else if (pos) {
+		st->gets++;
+		pos += strlen("Range: bytes=");
+		start = simple_strtoul(pos, (char **)&pos, 10);
+		end = simple_strtoul(pos + 1, NULL, 10);
+		snprintf(c->hdr, sizeof(c->hdr),
+			 "HTTP/1.1 206 Partial Content\r\n"
+			 "Content-Range: bytes %u-%u/%u\r\n"
+			 "Content-Length: %u\r\n\r\n",
+			 start, end, st->size, end + 1 - start);
+		c->start = start;
+		c->total = strlen(c->hdr) + end + 1 - start;
+	} else if (!strncmp(req, "GET ", 4)) {
+		snprintf(c->hdr, sizeof(c->hdr),
+			 "HTTP/1.1 200 OK\r\nContent-Length: %u\r\n\r\n",
+			 st->size);
+		c->total = strlen(c->hdr) + st->size;
+	} else {
+		snprintf(c->hdr, sizeof(c->hdr),
+			 "HTTP/1.1 400 Bad Request\r\n\r\n");
+		c->total = strlen(c->hdr);
+	}
+	c->replied = true;
+}
+
+/*
+ * Send what every connection has to say until the queue is full: first the
+ * segments without data, then data from each connection in turn. Anything
+ * left over goes out when the client sends its next segment.
+ */
+static void range_pump(struct udevice *dev, void *req)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct range_state *st = priv->priv;
+	struct range_conn *c;
+	int i, idle = 0;
+	u32 len;
+
+	for (i = 0; i < RANGE_CONNS; i++) {
+		c = &st->conn[i];
+		if (!c->port || priv->recv_packets == PKTBUFSRX)
+			continue;
+		if (c->reset) {
+			range_send(dev, req, c, TCP_RST, c->sent, 0);
+			c->port = 0;
+		} else if (c->fin_rcvd) {
+			range_send(dev, req, c, TCP_ACK, c->total + 1, 0);
+			c->port = 0;
+		} else if (c->replied && c->acked == c->total && !c->fin_sent) {
+			range_send(dev, req, c, TCP_ACK | TCP_FIN, c->total, 0);
+			c->fin_sent = true;
+		}
+	}
+
+	while (idle < RANGE_CONNS && priv->recv_packets < PKTBUFSRX) {
+		c = &st->conn[st->next];
+		st->next = (st->next + 1) % RANGE_CONNS;
+		if (!c->port || c->reset || !c->replied || c->sent == c->total ||
+		    c->sent - c->acked >= RANGE_WIN) {
+			idle++;
+			continue;
+		}
+		idle = 0;
+		len = min_t(u32, TCP_MSS, c->total - c->sent);
+		range_send(dev, req, c, TCP_ACK, c->sent, len);
+		c->sent += len;
+	}
+}
+
+static int range_tcp_handler(struct udevice *dev, void *packet,
+			     unsigned int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct range_state *st = priv->priv;
+	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
+	int hdr_len = GET_TCP_HDR_LEN_IN_BYTES(tcp->tcp_hlen);
+	int data_len = len - ETHER_HDR_SIZE - IP_HDR_SIZE - hdr_len;
+	struct range_conn *c = NULL;
+	u16 port = ntohs(tcp->tcp_src);
+	u32 seq = ntohl(tcp->tcp_seq);
+	char req[256];
+	int i, busy = 0;
+
+	for (i = 0; i < RANGE_CONNS; i++) {
+		if (st->conn[i].port == port)
+			c = &st->conn[i];
+	}
+
+	if (tcp->tcp_flags == TCP_SYN) {
+		for (i = 0; !c && i < RANGE_CONNS; i++) {
+			if (!st->conn[i].port)
+				c = &st->conn[i];
+		}
+		if (!c)
+			return 0;
+		memset(c, '\0', sizeof(*c));
+		c->port = port;
+		c->iss = ~seq ^ port;
+		c->cli_nxt = seq + 1;
+		for (i = 0; i < RANGE_CONNS; i++)
+			busy += !!st->conn[i].port;
+		st->busy = max(st->busy, busy);
+		return range_send(dev, packet, c, TCP_SYN | TCP_ACK, 0, 0);
+	}
+	if (!c)
+		return 0;
+	if (tcp->tcp_flags & TCP_RST) {
+		c->port = 0;
+		return 0;
+	}
+	if (!(tcp->tcp_flags & TCP_ACK))
+		return 0;
+
+	if (data_len && !c->replied) {
+		memcpy(req, (void *)tcp + IP_HDR_SIZE + hdr_len,
+		       min_t(int, data_len, sizeof(req) - 1));
+		req[min_t(int, data_len, sizeof(req) - 1)] = '\0';
+		range_reply(st, c, req);
+	}
+	if ((int)(seq + data_len - c->cli_nxt) > 0)
+		c->cli_nxt = seq + data_len;
+	c->acked = max(c->acked, ntohl(tcp->tcp_ack) - c->iss - 1);
+
+	if ((tcp->tcp_flags & TCP_FIN) && !c->fin_rcvd) {
+		c->cli_nxt++;
+		c->fin_rcvd = true;
+	}
+
+	/* Drop one connection with nothing in flight */
+	if (!st->resets && c->start && c->acked == c->sent &&
+	    (st->reset_end ? c->sent == c->total : c->sent > RANGE_RESET_AT)) {
+		st->resets++;
+		c->reset = true;
+	}
+	range_pump(dev, packet);
+
+	return 0;
+}
+
+static int range_handler(struct udevice *dev, void *packet, unsigned int len)
+{
+	struct ethernet_hdr *eth = packet;
+	struct ip_hdr *ip = packet + ETHER_HDR_SIZE;
+
+	if (ntohs(eth->et_protlen) == PROT_ARP)
+		return sb_arp_handler(dev, packet, len);
+	if (ntohs(eth->et_protlen) == PROT_IP && ip->ip_p == IPPROTO_TCP)
+		return range_tcp_handler(dev, packet, len);
+
+	return -EPROTONOSUPPORT;
+}
+
+/* Set up the range server and run @check with it, cleaning up after */
+static int wget_range_run(struct unit_test_state *uts,
+			  int (*check)(struct unit_test_state *uts,
+				       struct range_state *st))
+{
+	char *prev_ethact = env_get("ethact");
+	char *prev_ethrotate = env_get("ethrotate");
+	struct range_state *st;
+	int i, ret;
+
+	st = malloc(sizeof(*st));
+	ut_assertnonnull(st);
+	memset(st, '\0', sizeof(*st));
+	for (i = 0; i < RANGE_DATA_SIZE; i++)
+		st->data[i] = reorder_byte(i);
+	st->size = RANGE_DATA_SIZE;
+	sandbox_eth_set_tx_handler(0, range_handler);
+	sandbox_eth_set_priv(0, st);
+	env_set("ethact", "eth@10002000");
+	env_set("ethrotate", "no");
+
+	ret = check(uts, st);
+
+	sandbox_eth_set_tx_handler(0, NULL);
+	free(st);
+	env_set("ethact", prev_ethact);
+	env_set("ethrotate", prev_ethrotate);
+
+	return ret;
+}
+
+static int wget_parallel_check(struct unit_test_state *uts,
+			       struct range_state *st)
+{
+	u8 *buf;
+
+	env_set("wgetaddr", "0x20000");
+	ut_assertok(run_command("wget -j 4 ${wgetaddr} 1.1.2.2:/file", 0));
+	ut_assert_skip_to_line("Bytes transferred = 300000 (493e0 hex)");
+	ut_assert_console_end();
+
+	/* One HEAD, four ranges at once, and the reset range again */
+	ut_asserteq(1, st->heads);
+	ut_asserteq(5, st->gets);
+	ut_asserteq(4, st->busy);
+	ut_asserteq(1, st->resets);
+
+	buf = map_sysmem(0x20000, RANGE_DATA_SIZE);
+	ut_asserteq_mem(st->data, buf, RANGE_DATA_SIZE);
+	unmap_sysmem(buf);
+
+	return 0;
+}
+
+static int net_test_wget_parallel(struct unit_test_state *uts)
+{
+	return wget_range_run(uts, wget_parallel_check);
+}
+CMD_TEST(net_test_wget_parallel, UTF_CONSOLE);
+
+static int wget_parallel_reset_end_check(struct unit_test_state *uts,
+					 struct range_state *st)
+{
+	u8 *buf;
+
+	st->reset_end = true;
+	env_set("wgetaddr", "0x20000");
+	ut_assertok(run_command("wget -j 4 ${wgetaddr} 1.1.2.2:/file", 0));
+	ut_assert_skip_to_line("Bytes transferred = 300000 (493e0 hex)");
+	ut_assert_console_end();
+
+	/* The range which was reset had all its data, so is not fetched again */
+	ut_asserteq(1, st->heads);
+	ut_asserteq(4, st->gets);
+	ut_asserteq(1, st->resets);
+
+	buf = map_sysmem(0x20000, RANGE_DATA_SIZE);
+	ut_asserteq_mem(st->data, buf, RANGE_DATA_SIZE);
+	unmap_sysmem(buf);
+
+	return 0;
+}
+
+/* Test a parallel download where the server resets a complete range */
+static int net_test_wget_parallel_reset_end(struct unit_test_state *uts)
+{
+	return wget_range_run(uts, wget_parallel_reset_end_check);
+}
+CMD_TEST(net_test_wget_parallel_reset_end, UTF_CONSOLE);
+
+
+/*
+ * The netsink tests write through a staging buffer of two halves, each
+ * smaller than the file, and check that nothing past it is touched
+ */
+#define NETSINK_STAGING		0x40000
+/* Size of the gzip-compressed file once decompressed */
+#define NETSINK_GZIP_SIZE	290000
+/* Blocks of each chunk of the sparse image */
+#define NETSINK_SPARSE_RAW1	200
+#define NETSINK_SPARSE_FILL	100
+#define NETSINK_SPARSE_SKIP	50
+#define NETSINK_SPARSE_RAW2	300
+#define NETSINK_SPARSE_BLKS	(NETSINK_SPARSE_RAW1 + NETSINK_SPARSE_FILL + \
+				 NETSINK_SPARSE_SKIP + NETSINK_SPARSE_RAW2)
+#define NETSINK_FILL_VAL	0x5aa5c33c
+
+/* Data which does not compress well, unlike reorder_byte() */
+static void netsink_fill(u8 *buf, u32 len)
+{
+	u32 seed = 1;
+
+	for (; len; len--) {
+		seed = seed * 1103515245 + 12345;
+		*buf++ = seed >> 16;
+	}
+}
+
+/* Set the first @blkcnt blocks of @desc to @val */
+static int netsink_blank(struct unit_test_state *uts, struct blk_desc *desc,
+			 lbaint_t blkcnt, u8 val)
+{
+	u8 *buf;
+
+	buf = malloc_cache_aligned(blkcnt * desc->blksz);
+	ut_assertnonnull(buf);
+	memset(buf, val, blkcnt * desc->blksz);
+	ut_asserteq(blkcnt, blk_dwrite(desc, 0, blkcnt, buf));
+	free(buf);
+
+	return 0;
+}
+
+/* Read the first @blkcnt blocks of @desc into a new buffer */
+static int netsink_read(struct unit_test_state *uts, struct blk_desc *desc,
+			lbaint_t blkcnt, u8 **bufp)
+{
+	*bufp = malloc_cache_aligned(blkcnt * desc->blksz);
+	ut_assertnonnull(*bufp);
+	ut_asserteq(blkcnt, blk_dread(desc, 0, blkcnt, *bufp));
+
+	return 0;
+}
+
+/* Fetch the file of @st with netsink set to @fmt, which writes @written bytes */
+static int wget_netsink_load(struct unit_test_state *uts,
+			     struct range_state *st, const char *fmt,
+			     ulong written)
+{
+	u8 *buf;
+	int i;
+
+	buf = map_sysmem(0x20000, NETSINK_STAGING + RANGE_DATA_SIZE);
+	memset(buf + NETSINK_STAGING, 0xaa, RANGE_DATA_SIZE);
+
+	env_set("wgetaddr", "0x20000");
+	env_set_hex("netsinksize", NETSINK_STAGING);
+	ut_assertok(run_commandf("netsink mmc 0:0 %s", fmt));
+	ut_assertok(run_command("wget ${wgetaddr} 1.1.2.2:/file", 0));
+	ut_assert_skip_to_line("Bytes transferred = %u (%x hex)", st->size,
+			       st->size);
+	ut_assert_nextline("netsink: %lu bytes written to mmc 0", written);
+	ut_assert_console_end();
+
+	for (i = 0; i < RANGE_DATA_SIZE; i++)
+		ut_asserteq(0xaa, buf[NETSINK_STAGING + i]);
+	unmap_sysmem(buf);
+
+	return 0;
+}
+
+/* Write a download to a block device through a staging buffer of two halves */
+static int wget_netsink_check(struct unit_test_state *uts,
+			      struct range_state *st)
+{
+	struct blk_desc *desc;
+	lbaint_t blkcnt;
+	u8 *buf;
+
+	ut_asserteq(0, blk_get_device_by_str("mmc", "0", &desc));
+	blkcnt = DIV_ROUND_UP(RANGE_DATA_SIZE, desc->blksz);
+
+	ut_assertok(wget_netsink_load(uts, st, "raw", RANGE_DATA_SIZE));
+	ut_assertok(netsink_read(uts, desc, blkcnt, &buf));
+	ut_asserteq_mem(st->data, buf, RANGE_DATA_SIZE);
+	free(buf);
+
+	/* Leave the device blank for other tests */
+	return netsink_blank(uts, desc, blkcnt, 0);
+}
+
+static int net_test_wget_netsink(struct unit_test_state *uts)
+{
+	int ret;
+
+	if (!IS_ENABLED(CONFIG_CMD_NETSINK))
+		return -EAGAIN;
+
+	ret = wget_range_run(uts, wget_netsink_check);
+	env_set("netsinksize", NULL);
+
+	return ret;
+}
+CMD_TEST(net_test_wget_netsink, UTF_CONSOLE);
+
+/* Decompress a gzip file while it is received */
+static int wget_netsink_gzip_check(struct unit_test_state *uts,
+				   struct range_state *st)
+{
+	ulong size = RANGE_DATA_SIZE;
+	struct blk_desc *desc;
+	lbaint_t blkcnt;
+	u8 *plain, *buf;
+
+	ut_asserteq(0, blk_get_device_by_str("mmc", "0", &desc));
+	blkcnt = DIV_ROUND_UP(NETSINK_GZIP_SIZE, desc->blksz);
+
+	/* Half of it compresses, so the file is smaller but spans both halves */
+	plain = malloc(NETSINK_GZIP_SIZE);
+	ut_assertnonnull(plain);
+	memcpy(plain, st->data, NETSINK_GZIP_SIZE / 2);
+	netsink_fill(plain + NETSINK_GZIP_SIZE / 2, NETSINK_GZIP_SIZE / 2);
+	ut_assertok(gzip(st->data, &size, plain, NETSINK_GZIP_SIZE));
+	ut_assert(size > NETSINK_STAGING / 2);
+	st->size = size;
+
+	ut_assertok(wget_netsink_load(uts, st, "gzip", NETSINK_GZIP_SIZE));
+	ut_assertok(netsink_read(uts, desc, blkcnt, &buf));
+	ut_asserteq_mem(plain, buf, NETSINK_GZIP_SIZE);
+	free(buf);
+	free(plain);
+
+	return netsink_blank(uts, desc, blkcnt, 0);
+}
+
+static int net_test_wget_netsink_gzip(struct unit_test_state *uts)
+{
+	int ret;
+
+	if (!IS_ENABLED(CONFIG_CMD_NETSINK) ||
+	    !IS_ENABLED(CONFIG_GZIP_COMPRESSED))
+		return -EAGAIN;
+
+	ret = wget_range_run(uts, wget_netsink_gzip_check);
+	env_set("netsinksize", NULL);
+
+	return ret;
+}
+CMD_TEST(net_test_wget_netsink_gzip, UTF_CONSOLE);
+
+/* Add a chunk covering @blocks blocks to the sparse image at @p */
+static u8 *netsink_sparse_chunk(u8 *p, u16 type, u32 blocks, const void *data,
+				u32 len)
+{
+	chunk_header_t *chunk = (void *)p;
+
+	chunk->chunk_type = cpu_to_le16(type);
+	chunk->reserved1 = 0;
+	chunk->chunk_sz = cpu_to_le32(blocks);
+	chunk->total_sz = cpu_to_le32(sizeof(*chunk) + len);
+	memcpy(p + sizeof(*chunk), data, len);
+
+	return p + sizeof(*chunk) + len;
+}
+
+/*
+ * Expand a sparse image while it is received: raw data, a fill, blocks which
+ * are left alone and more raw data
+ */
+static int wget_netsink_sparse_check(struct unit_test_state *uts,
+				     struct range_state *st)
+{
+	u32 fill = cpu_to_le32(NETSINK_FILL_VAL);
+	sparse_header_t *hdr = (void *)st->data;
+	struct blk_desc *desc;
+	u8 *raw, *p, *buf;
+	ulong ofs;
+	int i;
+
+	ut_asserteq(0, blk_get_device_by_str("mmc", "0", &desc));
+	ut_asserteq(512, desc->blksz);
+	ut_assertok(netsink_blank(uts, desc, NETSINK_SPARSE_BLKS, 0x55));
+
+	raw = malloc((NETSINK_SPARSE_RAW1 + NETSINK_SPARSE_RAW2) * 512);
+	ut_assertnonnull(raw);
+	netsink_fill(raw, (NETSINK_SPARSE_RAW1 + NETSINK_SPARSE_RAW2) * 512);
+
+	memset(hdr, '\0', sizeof(*hdr));
+	hdr->magic = cpu_to_le32(SPARSE_HEADER_MAGIC);
+	hdr->major_version = cpu_to_le16(1);
+	hdr->file_hdr_sz = cpu_to_le16(sizeof(sparse_header_t));
+	hdr->chunk_hdr_sz = cpu_to_le16(sizeof(chunk_header_t));
+	hdr->blk_sz = cpu_to_le32(512);
+	hdr->total_blks = cpu_to_le32(NETSINK_SPARSE_BLKS);
+	hdr->total_chunks = cpu_to_le32(4);
+	p = st->data + sizeof(*hdr);
+	p = netsink_sparse_chunk(p, CHUNK_TYPE_RAW, NETSINK_SPARSE_RAW1, raw,
+				 NETSINK_SPARSE_RAW1 * 512);
+	p = netsink_sparse_chunk(p, CHUNK_TYPE_FILL, NETSINK_SPARSE_FILL, &fill,
+				 sizeof(fill));
+	p = netsink_sparse_chunk(p, CHUNK_TYPE_DONT_CARE, NETSINK_SPARSE_SKIP,
+				 NULL, 0);
+	p = netsink_sparse_chunk(p, CHUNK_TYPE_RAW, NETSINK_SPARSE_RAW2,
+				 raw + NETSINK_SPARSE_RAW1 * 512,
+				 NETSINK_SPARSE_RAW2 * 512);
+	st->size = p - st->data;
+
+	ut_assertok(wget_netsink_load(uts, st, "sparse", st->size));
+	ut_assertok(netsink_read(uts, desc, NETSINK_SPARSE_BLKS, &buf));
+	ofs = 0;
+	ut_asserteq_mem(raw, buf, NETSINK_SPARSE_RAW1 * 512);
+	ofs += NETSINK_SPARSE_RAW1 * 512;
+	for (i = 0; i < NETSINK_SPARSE_FILL * 512; i += 4)
+		ut_asserteq(NETSINK_FILL_VAL,
+			    get_unaligned_le32(buf + ofs + i));
+	ofs += NETSINK_SPARSE_FILL * 512;
+	for (i = 0; i < NETSINK_SPARSE_SKIP * 512; i++)
+		ut_asserteq(0x55, buf[ofs + i]);
+	ofs += NETSINK_SPARSE_SKIP * 512;
+	ut_asserteq_mem(raw + NETSINK_SPARSE_RAW1 * 512, buf + ofs,
+			NETSINK_SPARSE_RAW2 * 512);
+	free(buf);
+	free(raw);
+
+	return netsink_blank(uts, desc, NETSINK_SPARSE_BLKS, 0);
+}
+
+static int net_test_wget_netsink_sparse(struct unit_test_state *uts)
+{
+	int ret;
+
+	if (!IS_ENABLED(CONFIG_CMD_NETSINK) || !IS_ENABLED(CONFIG_IMAGE_SPARSE))
+		return -EAGAIN;
+
+	ret = wget_range_run(uts, wget_netsink_sparse_check);
+	env_set("netsinksize", NULL);
+
+	return ret;
+}
+CMD_TEST(net_test_wget_netsink_sparse, UTF_CONSOLE);
@@ -5,11 +5,15 @@
 
 #include <blk.h>
 #include <dm.h>
+#include <mapmem.h>
+#include <os.h>
 #include <part.h>
 #include <sandbox_host.h>
 #include <usb.h>
 #include <asm/global_data.h>
 #include <asm/state.h>
+#include <asm/test.h>
+#include <dm/device-internal.h>
 #include <dm/test.h>
 #include <test/test.h>
 #include <test/ut.h>
@@ -294,3 +298,192 @@ static int dm_test_blk_foreach(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_blk_foreach, UTF_SCAN_PDATA | UTF_SCAN_FDT);
+
+/* Test the set-associative block cache and its readahead */
+static int dm_test_blk_cache(struct unit_test_state *uts)
+{
+	struct block_cache_dev_stats dev_stats;
+	struct block_cache_stats stats;
+	struct udevice *dev, *blk;
+	struct blk_desc *desc;
+	int size = 0x40000;
+	char *src, *buf;
+	int i;
+
+	src = map_sysmem(0x20000, size);
+	for (i = 0; i < size; i++)
+		src[i] = i * 7 + i / DEFAULT_BLKSZ;
+	ut_assertok(os_write_file("blkcache.img", src, size));
+	buf = map_sysmem(0x20000 + size, size);
+
+	ut_assertok(host_create_device("test0", false, DEFAULT_BLKSZ, &dev));
+	ut_assertok(host_attach_file(dev, "blkcache.img"));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+	desc = dev_get_uclass_plat(blk);
+
+	/* start from an empty cache, ignoring reads done while probing */
+	blkcache_configure(8, 32);
+	blkcache_set_readahead(16);
+	blkcache_invalidate(desc->uclass_id, desc->devnum);
+	blkcache_stats(&stats);
+	for (i = 0; !blkcache_dev_stats(i, &dev_stats); i++)
+		;
+
+	/*
+	 * The first read is widened to its line (96-103); the read at 104
+	 * follows on, so it also reads 16 blocks ahead (104-127)
+	 */
+	for (i = 100; i < 124; i++) {
+		ut_asserteq(1, blk_read(blk, i, 1, buf));
+		ut_asserteq_mem(src + i * DEFAULT_BLKSZ, buf, DEFAULT_BLKSZ);
+	}
+	blkcache_stats(&stats);
+	ut_asserteq(22, stats.hits);
+	ut_asserteq(2, stats.misses);
+	ut_asserteq(4, stats.entries);
+	ut_asserteq(8, stats.sets);
+	ut_asserteq(4, stats.ways);
+
+	ut_assertok(blkcache_dev_stats(0, &dev_stats));
+	ut_asserteq(UCLASS_HOST, dev_stats.iftype);
+	ut_asserteq(desc->devnum, dev_stats.devnum);
+	ut_asserteq(22, dev_stats.hits);
+	ut_asserteq(2, dev_stats.misses);
+	ut_asserteq(30, dev_stats.readahead);
+	ut_asserteq(-ENOENT, blkcache_dev_stats(1, &dev_stats));
+
+	/* a read spanning two cached lines is served from the cache */
+	ut_asserteq(4, blk_read(blk, 110, 4, buf));
+	ut_asserteq_mem(src + 110 * DEFAULT_BLKSZ, buf, 4 * DEFAULT_BLKSZ);
+	blkcache_stats(&stats);
+	ut_asserteq(1, stats.hits);
+
+	/* large reads bypass the cache */
+	ut_asserteq(64, blk_read(blk, 256, 64, buf));
+	ut_asserteq_mem(src + 256 * DEFAULT_BLKSZ, buf, 64 * DEFAULT_BLKSZ);
+	blkcache_stats(&stats);
+	ut_asserteq(4, stats.entries);
+
+	/* a write drops the device's lines */
+	ut_asserteq(1, blk_write(blk, 100, 1, src + 100 * DEFAULT_BLKSZ));
+	blkcache_stats(&stats);
+	ut_asserteq(0, stats.entries);
+	ut_asserteq(1, blk_read(blk, 101, 1, buf));
+	blkcache_stats(&stats);
+	ut_asserteq(0, stats.hits);
+	ut_asserteq(1, stats.misses);
+
+	blkcache_set_readahead(CONFIG_BLOCK_CACHE_READAHEAD);
+	ut_assertok(host_detach_file(dev));
+
+	/* removing the device drops its statistics */
+	ut_asserteq(-ENOENT, blkcache_dev_stats(0, &dev_stats));
+	ut_assertok(device_unbind(dev));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_cache, UTF_SCAN_PDATA | UTF_SCAN_FDT);
+
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+/* Test that large transfers are split into requests kept in flight */
+static int dm_test_blk_async(struct unit_test_state *uts)
+{
+	struct udevice *dev, *blk;
+	int size = CONFIG_BLK_ASYNC_REQ_SIZE * 9 / 2;
+	lbaint_t blkcnt = size / DEFAULT_BLKSZ;
+	char *src, *buf;
+	int i;
+
+	src = map_sysmem(0x1000000, size);
+	for (i = 0; i < size; i++)
+		src[i] = i * 3 + i / DEFAULT_BLKSZ;
+	ut_assertok(os_write_file("blkasync.img", src, size));
+	buf = map_sysmem(0x1000000 + size, size + CONFIG_BLK_ASYNC_REQ_SIZE);
+
+	ut_assertok(host_create_device("test0", false, DEFAULT_BLKSZ, &dev));
+	ut_assertok(host_attach_file(dev, "blkasync.img"));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+
+	/* The requests finish out of order, newest first */
+	memset(buf, '\0', size);
+	ut_asserteq(blkcnt, blk_read(blk, 0, blkcnt, buf));
+	ut_asserteq_mem(src, buf, size);
+
+	/* A read past the end stops at the end */
+	ut_asserteq(blkcnt - 1, blk_read(blk, 1, blkcnt + 100, buf));
+	ut_asserteq_mem(src + DEFAULT_BLKSZ, buf, size - DEFAULT_BLKSZ);
+
+	/* Write the image back one block later and check it */
+	ut_asserteq(blkcnt - 1, blk_write(blk, 1, blkcnt - 1, src));
+	ut_asserteq(blkcnt, blk_read(blk, 0, blkcnt, buf));
+	ut_asserteq_mem(src, buf, DEFAULT_BLKSZ);
+	ut_asserteq_mem(src, buf + DEFAULT_BLKSZ, size - DEFAULT_BLKSZ);
+
+	ut_assertok(host_detach_file(dev));
+	ut_assertok(device_unbind(dev));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_async, UTF_SCAN_PDATA | UTF_SCAN_FDT);
+
+/* Test that a transfer stops at the first request which fails */
+static int dm_test_blk_async_fail(struct unit_test_state *uts)
+{
+	lbaint_t per_req = CONFIG_BLK_ASYNC_REQ_SIZE / DEFAULT_BLKSZ;
+	int size = CONFIG_BLK_ASYNC_REQ_SIZE * 9 / 2;
+	lbaint_t blkcnt = size / DEFAULT_BLKSZ;
+	struct udevice *dev, *blk;
+	int busy, max_count;
+	char *src, *buf;
+	int i;
+
+	src = map_sysmem(0x1000000, size);
+	for (i = 0; i < size; i++)
+		src[i] = i * 5 + i / DEFAULT_BLKSZ;
+	ut_assertok(os_write_file("blkasync.img", src, size));
+	buf = map_sysmem(0x1000000 + size, size);
+
+	ut_assertok(host_create_device("test0", false, DEFAULT_BLKSZ, &dev));
+	ut_assertok(host_attach_file(dev, "blkasync.img"));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+	ut_assertok(device_probe(blk));
+
+	/* Requests beyond what the device holds wait for one to finish */
+	sandbox_host_blk_set_fail(blk, -1, -1);
+	memset(buf, '\0', size);
+	ut_asserteq(blkcnt, blk_read(blk, 0, blkcnt, buf));
+	ut_asserteq_mem(src, buf, size);
+	busy = sandbox_host_blk_get_busy(blk, &max_count);
+	ut_assert(max_count > 1 || CONFIG_BLK_ASYNC_DEPTH == 1);
+	ut_assert(busy > 0 || CONFIG_BLK_ASYNC_DEPTH <= max_count);
+
+	/* A request which cannot be submitted ends the transfer before it */
+	sandbox_host_blk_set_fail(blk, 2 * per_req, -1);
+	memset(buf, '\0', size);
+	ut_asserteq(2 * per_req, blk_read(blk, 0, blkcnt, buf));
+	ut_asserteq_mem(src, buf, 2 * per_req * DEFAULT_BLKSZ);
+	sandbox_host_blk_set_fail(blk, 0, -1);
+	ut_asserteq(-EIO, blk_read(blk, 0, blkcnt, buf));
+
+	/* So does one which stops part of the way through */
+	sandbox_host_blk_set_fail(blk, -1, 3 * per_req + 5);
+	memset(buf, '\0', size);
+	ut_asserteq(3 * per_req + 5, blk_read(blk, 0, blkcnt, buf));
+	ut_asserteq_mem(src, buf, (3 * per_req + 5) * DEFAULT_BLKSZ);
+	sandbox_host_blk_set_fail(blk, -1, 0);
+	ut_asserteq(-EIO, blk_read(blk, 0, blkcnt, buf));
+
+	/* Writes stop in the same way */
+	sandbox_host_blk_set_fail(blk, -1, per_req + 1);
+	ut_asserteq(per_req + 1, blk_write(blk, 0, blkcnt, src));
+	sandbox_host_blk_set_fail(blk, per_req, -1);
+	ut_asserteq(per_req, blk_write(blk, 0, blkcnt, src));
+
+	sandbox_host_blk_set_fail(blk, -1, -1);
+	ut_assertok(host_detach_file(dev));
+	ut_assertok(device_unbind(dev));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_async_fail, UTF_SCAN_PDATA | UTF_SCAN_FDT);
+#endif
@@ -10,8 +10,10 @@
 #include <fdtdec.h>
 #include <log.h>
 #include <malloc.h>
+#include <time.h>
 #include <asm/global_data.h>
 #include <dm/device-internal.h>
+#include <dm/lists.h>
 #include <dm/root.h>
 #include <dm/util.h>
 #include <dm/test.h>
@@ -1410,3 +1412,230 @@ static int dm_test_try_first_device(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_try_first_device, 0);
+
+/* Test lists_driver_lookup_compat() finds the first driver for each string */
+static int dm_test_lists_compat(struct unit_test_state *uts)
+{
+	struct driver *driver = ll_entry_start(struct driver, driver);
+	const int n_ents = ll_entry_count(struct driver, driver);
+	const struct udevice_id *of_match, *id, *expect_id;
+	struct driver *entry, *first;
+	int count = 0;
+
+	for (entry = driver; entry != driver + n_ents; entry++) {
+		for (of_match = entry->of_match;
+		     of_match && of_match->compatible; of_match++) {
+			/* Drivers earlier in the list take priority */
+			for (first = driver; first != entry; first++) {
+				for (expect_id = first->of_match;
+				     expect_id && expect_id->compatible;
+				     expect_id++) {
+					if (!strcmp(expect_id->compatible,
+						    of_match->compatible))
+						break;
+				}
+				if (expect_id && expect_id->compatible)
+					break;
+			}
+			if (first == entry)
+				expect_id = of_match;
+
+			id = NULL;
+			ut_asserteq_ptr(first,
+					lists_driver_lookup_compat(of_match->compatible,
+								   &id));
+			ut_asserteq_ptr(expect_id, id);
+			count++;
+		}
+	}
+	ut_assert(count > 0);
+	ut_assertnull(lists_driver_lookup_compat("denx,u-boot-no-such-device",
+						 &id));
+
+	return 0;
+}
+DM_TEST(dm_test_lists_compat, 0);
+
+/* Bind @count test devices, the last one to a node which has a phandle */
+static int uclass_find_bind(struct unit_test_state *uts, int count,
+			    struct udevice ***devsp, ofnode *nodep,
+			    uint *phandlep)
+{
+	struct udevice **devs;
+	char name[30];
+	int i;
+
+	/* A node which has a phandle but no device of its own */
+	*nodep = ofnode_path("/phandle-node-1");
+	*phandlep = ofnode_read_u32_default(*nodep, "phandle", 0);
+	ut_assert(*phandlep);
+
+	devs = calloc(count, sizeof(*devs));
+	ut_assertnonnull(devs);
+	for (i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "find_speed%d", i);
+		ut_assertok(device_bind(dm_root(), DM_DRIVER_GET(test_drv),
+					"find_speed", NULL,
+					i == count - 1 ? *nodep : ofnode_null(),
+					&devs[i]));
+		ut_assertok(device_set_name(devs[i], name));
+	}
+	*devsp = devs;
+
+	return 0;
+}
+
+/*
+ * Find each device in a large uclass by name and by sequence number, and the
+ * last one by device tree node and phandle, then check that the lookups
+ * follow changes to the devices
+ */
+static int dm_test_uclass_find(struct unit_test_state *uts)
+{
+	const int count = 200;
+	struct udevice **devs, *found, *last;
+	uint phandle1, phandle2;
+	ofnode node1, node2;
+	int i;
+
+	ut_assertok(uclass_find_bind(uts, count, &devs, &node1, &phandle1));
+	last = devs[count - 1];
+	node2 = ofnode_path("/phandle-node-2");
+	phandle2 = ofnode_read_u32_default(node2, "phandle", 0);
+	ut_assert(phandle2);
+
+	for (i = 0; i < count; i++) {
+		ut_assertok(uclass_find_device_by_name(UCLASS_TEST,
+						       devs[i]->name, &found));
+		ut_asserteq_ptr(devs[i], found);
+		ut_assertok(uclass_find_device_by_seq(UCLASS_TEST,
+						      dev_seq(devs[i]),
+						      &found));
+		ut_asserteq_ptr(devs[i], found);
+	}
+	ut_assertok(uclass_find_device_by_ofnode(UCLASS_TEST, node1, &found));
+	ut_asserteq_ptr(last, found);
+	ut_assertok(uclass_get_device_by_phandle_id(UCLASS_TEST, phandle1,
+						    &found));
+	ut_asserteq_ptr(last, found);
+
+	/* A device moved to another node is found by its new node only */
+	dev_set_ofnode(last, node2);
+	ut_asserteq(-ENODEV, uclass_find_device_by_ofnode(UCLASS_TEST, node1,
+							  &found));
+	ut_asserteq(-ENODEV, uclass_get_device_by_phandle_id(UCLASS_TEST,
+							     phandle1,
+							     &found));
+	ut_assertok(uclass_find_device_by_ofnode(UCLASS_TEST, node2, &found));
+	ut_asserteq_ptr(last, found);
+	ut_assertok(uclass_get_device_by_phandle_id(UCLASS_TEST, phandle2,
+						    &found));
+	ut_asserteq_ptr(last, found);
+
+	/* A renamed or unbound device must no longer be found */
+	ut_assertok(device_set_name(devs[0], "find_speed_renamed"));
+	ut_asserteq(-ENODEV, uclass_find_device_by_name(UCLASS_TEST,
+							"find_speed0",
+							&found));
+	ut_assertok(uclass_find_device_by_name(UCLASS_TEST,
+					       "find_speed_renamed", &found));
+	ut_asserteq_ptr(devs[0], found);
+	ut_assertok(device_unbind(devs[1]));
+	ut_asserteq(-ENODEV, uclass_find_device_by_name(UCLASS_TEST,
+							"find_speed1",
+							&found));
+	free(devs);
+
+	return 0;
+}
+DM_TEST(dm_test_uclass_find, 0);
+
+/*
+ * Show how long it takes to find each device in a large uclass by name and by
+ * sequence number, and the last one by device tree node and phandle, with
+ * uclass_find_device_by_...() and by walking the uclass's list. Run this
+ * with 'ut dm dm_test_uclass_find_speed_norun' on sandbox.
+ */
+static int dm_test_uclass_find_speed_norun(struct unit_test_state *uts)
+{
+	const int count = 200, reps = 10;
+	struct udevice **devs, *dev, *found, *last;
+	ulong start, list_us, find_us;
+	struct uclass *uc;
+	uint phandle1;
+	ofnode node1;
+	int i, rep;
+
+	ut_assertok(uclass_find_bind(uts, count, &devs, &node1, &phandle1));
+	last = devs[count - 1];
+	ut_assertok(uclass_get(UCLASS_TEST, &uc));
+
+	start = timer_get_us();
+	for (rep = 0; rep < reps; rep++) {
+		for (i = 0; i < count; i++) {
+			found = NULL;
+			uclass_foreach_dev(dev, uc) {
+				if (!strcmp(dev->name, devs[i]->name)) {
+					found = dev;
+					break;
+				}
+			}
+			ut_asserteq_ptr(devs[i], found);
+			found = NULL;
+			uclass_foreach_dev(dev, uc) {
+				if (dev->seq_ == dev_seq(devs[i])) {
+					found = dev;
+					break;
+				}
+			}
+			ut_asserteq_ptr(devs[i], found);
+			found = NULL;
+			uclass_foreach_dev(dev, uc) {
+				if (ofnode_equal(dev_ofnode(dev), node1)) {
+					found = dev;
+					break;
+				}
+			}
+			ut_asserteq_ptr(last, found);
+			found = NULL;
+			uclass_foreach_dev(dev, uc) {
+				if (dev_read_phandle(dev) == phandle1) {
+					found = dev;
+					break;
+				}
+			}
+			ut_asserteq_ptr(last, found);
+		}
+	}
+	list_us = timer_get_us() - start;
+
+	start = timer_get_us();
+	for (rep = 0; rep < reps; rep++) {
+		for (i = 0; i < count; i++) {
+			ut_assertok(uclass_find_device_by_name(UCLASS_TEST,
+							       devs[i]->name,
+							       &found));
+			ut_asserteq_ptr(devs[i], found);
+			ut_assertok(uclass_find_device_by_seq(UCLASS_TEST,
+							      dev_seq(devs[i]),
+							      &found));
+			ut_asserteq_ptr(devs[i], found);
+			ut_assertok(uclass_find_device_by_ofnode(UCLASS_TEST,
+								 node1,
+								 &found));
+			ut_asserteq_ptr(last, found);
+			ut_assertok(uclass_get_device_by_phandle_id(UCLASS_TEST,
+								    phandle1,
+								    &found));
+			ut_asserteq_ptr(last, found);
+		}
+	}
+	find_us = timer_get_us() - start;
+
+	printf("%d lookups: list walk %lu us, uclass_find %lu us\n",
+	       count * reps * 4, list_us, find_us);
+	free(devs);
+
+	return 0;
+}
+DM_TEST(dm_test_uclass_find_speed_norun, UTF_MANUAL);
@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for writing DFU buffers to the medium from a uthread
+ */
+
+#include <dfu.h>
+#include <dm.h>
+#include <env.h>
+#include <mapmem.h>
+#include <vsprintf.h>
+#include <dm/test.h>
+#include <test/test.h>
+#include <test/ut.h>
+#include <linux/stringify.h>
+
+#define DFU_TEST_SRC		0x100000
+#define DFU_TEST_DST		0x200000
+#define DFU_TEST_BUFSIZ		0x4000
+#define DFU_TEST_CHUNK		0x1000
+/* Enough to go round the ring several times, ending part-way into a buffer */
+#define DFU_TEST_SIZE		(DFU_TEST_BUFSIZ * 7 + DFU_TEST_CHUNK * 2)
+
+/* Set up a RAM entity of @size bytes at DFU_TEST_DST */
+static int dfu_test_entity(struct unit_test_state *uts, ulong size,
+			   struct dfu_entity **dfup)
+{
+	char alt_info[64];
+
+	dfu_free_entities();
+	snprintf(alt_info, sizeof(alt_info), "data ram %#x %#lx", DFU_TEST_DST,
+		 size);
+	ut_assertok(dfu_config_entities(alt_info, "ram", "0"));
+	*dfup = dfu_get_entity(0);
+	ut_assertnonnull(*dfup);
+
+	return 0;
+}
+
+static int dfu_test_async_write(struct unit_test_state *uts, const u8 *src,
+				u8 *dst)
+{
+	struct dfu_entity *dfu;
+	int i, ret;
+
+	/* The first full buffer is queued, but not written yet */
+	ut_assertok(dfu_test_entity(uts, DFU_TEST_SIZE, &dfu));
+	for (i = 0; i < DFU_TEST_BUFSIZ / DFU_TEST_CHUNK; i++)
+		ut_assertok(dfu_write(dfu, (void *)src + i * DFU_TEST_CHUNK,
+				      DFU_TEST_CHUNK, i));
+	ut_asserteq(0, dst[0]);
+
+	/* The rest goes round the ring and arrives in order */
+	for (; i * DFU_TEST_CHUNK < DFU_TEST_SIZE; i++)
+		ut_assertok(dfu_write(dfu, (void *)src + i * DFU_TEST_CHUNK,
+				      DFU_TEST_CHUNK, i));
+	ut_assertok(dfu_flush(dfu, NULL, 0, i));
+	ut_asserteq_mem(src, dst, DFU_TEST_SIZE);
+
+	/*
+	 * The RAM back end only checks where a write starts, so with an area
+	 * of two buffers the third still fits and the fourth fails in the
+	 * writer thread, which a later dfu_write() or dfu_flush() reports
+	 */
+	memset(dst, '\0', DFU_TEST_SIZE);
+	ut_assertok(dfu_test_entity(uts, DFU_TEST_BUFSIZ * 2, &dfu));
+	ret = 0;
+	for (i = 0; i * DFU_TEST_CHUNK < DFU_TEST_SIZE && !ret; i++)
+		ret = dfu_write(dfu, (void *)src + i * DFU_TEST_CHUNK,
+				DFU_TEST_CHUNK, i);
+	if (!ret)
+		ret = dfu_flush(dfu, NULL, 0, i);
+	ut_asserteq(-EINVAL, ret);
+	ut_assert(i * DFU_TEST_CHUNK >= DFU_TEST_BUFSIZ * 4);
+	ut_asserteq_mem(src, dst, DFU_TEST_BUFSIZ * 3);
+
+	return 0;
+}
+
+/* Test that full DFU buffers are written from a ring by a uthread */
+static int dm_test_dfu_async_write(struct unit_test_state *uts)
+{
+	u8 *src, *dst;
+	int i, ret;
+
+	if (!IS_ENABLED(CONFIG_DFU_RAM))
+		return -EAGAIN;
+
+	src = map_sysmem(DFU_TEST_SRC, DFU_TEST_SIZE);
+	dst = map_sysmem(DFU_TEST_DST, DFU_TEST_SIZE);
+	for (i = 0; i < DFU_TEST_SIZE; i++)
+		src[i] = i * 7 + i / DFU_TEST_CHUNK + 1;
+	memset(dst, '\0', DFU_TEST_SIZE);
+	ut_assertok(env_set("dfu_bufsiz", __stringify(DFU_TEST_BUFSIZ)));
+
+	ret = dfu_test_async_write(uts, src, dst);
+
+	dfu_free_entities();
+	env_set("dfu_bufsiz", NULL);
+	unmap_sysmem(dst);
+	unmap_sysmem(src);
+
+	return ret;
+}
+DM_TEST(dm_test_dfu_async_write, 0);
@@ -707,3 +707,103 @@ static int dm_test_process_ra(struct unit_test_state *uts)
 DM_TEST(dm_test_process_ra, 0);
 
 #endif
+
+#if CONFIG_IS_ENABLED(LWIP_RX_ZERO_COPY)
+/* One more packet than the sandbox driver lets the network stack hold */
+#define LWIP_HOLD_PKTS		(PKTBUFSRX / 2 + 1)
+
+static struct pbuf *lwip_hold_pbufs[LWIP_HOLD_PKTS + 1];
+static int lwip_hold_count;
+
+/* Keep each packet which lwIP passes up, as a protocol queueing it would */
+static err_t lwip_hold_input(struct pbuf *p, struct netif *netif)
+{
+	if (lwip_hold_count == ARRAY_SIZE(lwip_hold_pbufs))
+		return ERR_MEM;
+	lwip_hold_pbufs[lwip_hold_count++] = p;
+
+	return ERR_OK;
+}
+
+/* Queue a packet filled with @val, which must not be in a held buffer */
+static int lwip_hold_queue(struct unit_test_state *uts, struct udevice *dev,
+			   u8 val)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	uchar *buf = priv->recv_packet_buffer[priv->recv_packets];
+	int i;
+
+	for (i = 0; i < lwip_hold_count; i++)
+		ut_assert(lwip_hold_pbufs[i]->payload != buf);
+	memset(buf, val, ETHER_HDR_SIZE + 64);
+	priv->recv_packet_length[priv->recv_packets++] = ETHER_HDR_SIZE + 64;
+
+	return 0;
+}
+
+/* Test that received packets are lent to lwIP and handed back */
+static int dm_test_eth_lwip_hold(struct unit_test_state *uts)
+{
+	struct eth_sandbox_priv *priv;
+	struct netif *netif;
+	struct udevice *dev;
+	u8 *data;
+	int i, j;
+
+	env_set("ethact", "eth@10002000");
+	ut_assertok(net_lwip_eth_start());
+	dev = eth_get_dev();
+	ut_assertnonnull(dev);
+	priv = dev_get_priv(dev);
+	netif = net_lwip_new_netif_noip(dev);
+	ut_assertnonnull(netif);
+	netif->input = lwip_hold_input;
+	lwip_hold_count = 0;
+
+	/* Only as many packets as the driver allows are passed without a copy */
+	for (i = 0; i < LWIP_HOLD_PKTS; i++)
+		ut_assertok(lwip_hold_queue(uts, dev, i + 1));
+	ut_assertok(net_lwip_rx(dev, netif));
+	ut_asserteq(LWIP_HOLD_PKTS, lwip_hold_count);
+	ut_asserteq(PKTBUFSRX / 2, priv->recv_held);
+	ut_asserteq(PKTBUFSRX / 2, priv->recv_packets);
+	for (i = 0; i < LWIP_HOLD_PKTS; i++) {
+		data = lwip_hold_pbufs[i]->payload;
+		ut_asserteq(i + 1, data[0]);
+		ut_asserteq(i < PKTBUFSRX / 2,
+			    data == priv->recv_packet_buffer[i]);
+	}
+
+	/* The held packets survive the device being stopped and started */
+	eth_halt();
+	ut_assertok(eth_start_udev(dev));
+	ut_asserteq(PKTBUFSRX / 2, priv->recv_held);
+	ut_assertok(lwip_hold_queue(uts, dev, 0xff));
+	ut_assertok(net_lwip_rx(dev, netif));
+	ut_asserteq(LWIP_HOLD_PKTS + 1, lwip_hold_count);
+	for (i = 0; i < LWIP_HOLD_PKTS + 1; i++) {
+		data = lwip_hold_pbufs[i]->payload;
+		ut_asserteq(i < LWIP_HOLD_PKTS ? i + 1 : 0xff, data[0]);
+	}
+
+	/* Freeing the packets, in any order, hands every buffer back */
+	for (i = lwip_hold_count - 1; i >= 0; i -= 2)
+		pbuf_free(lwip_hold_pbufs[i]);
+	for (i = lwip_hold_count - 2; i >= 0; i -= 2)
+		pbuf_free(lwip_hold_pbufs[i]);
+	ut_asserteq(0, priv->recv_held);
+	ut_asserteq(0, priv->recv_packets);
+	for (i = 0; i < PKTBUFSRX; i++) {
+		for (j = 0; j < PKTBUFSRX; j++)
+			if (priv->recv_packet_buffer[j] == net_rx_packets[i])
+				break;
+		ut_assert(j < PKTBUFSRX);
+	}
+
+	net_lwip_remove_netif(netif);
+	eth_halt();
+
+	return 0;
+}
+DM_TEST(dm_test_eth_lwip_hold, UTF_SCAN_FDT);
+#endif
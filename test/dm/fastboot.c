@@ -7,9 +7,12 @@
 #include <env.h>
 #include <fastboot.h>
 #include <fb_mmc.h>
+#include <image-sparse.h>
+#include <malloc.h>
 #include <mmc.h>
 #include <part.h>
 #include <part_efi.h>
+#include <asm/unaligned.h>
 #include <dm/test.h>
 #include <test/ut.h>
 #include <linux/stringify.h>
@@ -93,3 +96,215 @@ static int dm_test_fastboot_mmc_part(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_fastboot_mmc_part, UTF_SCAN_PDATA | UTF_SCAN_FDT);
+
+/* Blocks in the sparse image streamed by dm_test_fastboot_mmc_stream() */
+#define FB_TEST_SPARSE_RAW1	40
+#define FB_TEST_SPARSE_FILL	16
+#define FB_TEST_SPARSE_SKIP	8
+#define FB_TEST_SPARSE_RAW2	20
+#define FB_TEST_SPARSE_FILL_VAL	0xa5a55a5a
+
+/* Add a chunk of @blocks 512-byte blocks to a sparse image at @p */
+static u8 *fb_test_sparse_chunk(u8 *p, u16 type, u32 blocks, const void *data,
+				u32 len)
+{
+	chunk_header_t *chunk = (void *)p;
+
+	chunk->chunk_type = cpu_to_le16(type);
+	chunk->reserved1 = 0;
+	chunk->chunk_sz = cpu_to_le32(blocks);
+	chunk->total_sz = cpu_to_le32(sizeof(*chunk) + len);
+	memcpy(p + sizeof(*chunk), data, len);
+
+	return p + sizeof(*chunk) + len;
+}
+
+/*
+ * Build a sparse image of two raw chunks from @data, with a fill and a
+ * "don't care" chunk between them, returning its size
+ */
+static int fb_test_sparse_image(u8 *img, const u8 *data)
+{
+	sparse_header_t *hdr = (void *)img;
+	u32 fill = cpu_to_le32(FB_TEST_SPARSE_FILL_VAL);
+	u8 *p = img + sizeof(*hdr);
+
+	hdr->magic = cpu_to_le32(SPARSE_HEADER_MAGIC);
+	hdr->major_version = cpu_to_le16(1);
+	hdr->minor_version = 0;
+	hdr->file_hdr_sz = cpu_to_le16(sizeof(sparse_header_t));
+	hdr->chunk_hdr_sz = cpu_to_le16(sizeof(chunk_header_t));
+	hdr->blk_sz = cpu_to_le32(512);
+	hdr->total_blks = cpu_to_le32(FB_TEST_SPARSE_RAW1 + FB_TEST_SPARSE_FILL +
+				      FB_TEST_SPARSE_SKIP + FB_TEST_SPARSE_RAW2);
+	hdr->total_chunks = cpu_to_le32(4);
+	hdr->image_checksum = 0;
+
+	p = fb_test_sparse_chunk(p, CHUNK_TYPE_RAW, FB_TEST_SPARSE_RAW1, data,
+				 FB_TEST_SPARSE_RAW1 * 512);
+	p = fb_test_sparse_chunk(p, CHUNK_TYPE_FILL, FB_TEST_SPARSE_FILL, &fill,
+				 sizeof(fill));
+	p = fb_test_sparse_chunk(p, CHUNK_TYPE_DONT_CARE, FB_TEST_SPARSE_SKIP,
+				 NULL, 0);
+	p = fb_test_sparse_chunk(p, CHUNK_TYPE_RAW, FB_TEST_SPARSE_RAW2,
+				 data + FB_TEST_SPARSE_RAW1 * 512,
+				 FB_TEST_SPARSE_RAW2 * 512);
+
+	return p - img;
+}
+
+static int dm_test_fastboot_mmc_stream(struct unit_test_state *uts)
+{
+	char response[FASTBOOT_RESPONSE_LEN] = {0};
+	char str_disk_guid[UUID_STR_LEN + 1];
+	struct blk_desc *mmc_dev_desc;
+	struct disk_partition parts[2] = {
+		{
+			.start = 48,
+			.size = 128,
+			.name = "test1",
+		},
+		{
+			.start = 176,
+			.size = 1,
+			.name = "test2",
+		},
+	};
+	const int size = 40000;
+	char cmd[FASTBOOT_COMMAND_LEN];
+	u8 *buf, *data, *readback, *img;
+	int i, len, ofs;
+
+	ut_assertok(blk_get_device_by_str("mmc", "0", &mmc_dev_desc));
+	if (CONFIG_IS_ENABLED(RANDOM_UUID)) {
+		gen_rand_uuid_str(parts[0].uuid, UUID_STR_FORMAT_STD);
+		gen_rand_uuid_str(parts[1].uuid, UUID_STR_FORMAT_STD);
+		gen_rand_uuid_str(str_disk_guid, UUID_STR_FORMAT_STD);
+	}
+	ut_assertok(gpt_restore(mmc_dev_desc, str_disk_guid, parts,
+				ARRAY_SIZE(parts)));
+
+	/* A small buffer, so that it is written out during the download */
+	buf = malloc(0x4000);
+	data = malloc(size);
+	readback = malloc(ALIGN(size, 512));
+	img = malloc(ALIGN(size, 512));
+	ut_assertnonnull(buf);
+	ut_assertnonnull(data);
+	ut_assertnonnull(readback);
+	ut_assertnonnull(img);
+	for (i = 0; i < size; i++)
+		data[i] = i * 7;
+	fastboot_init(buf, 0x4000);
+
+	strcpy(cmd, "oem stream:test1");
+	ut_asserteq(FASTBOOT_COMMAND_OEM_STREAM,
+		    fastboot_handle_command(cmd, response));
+	ut_asserteq_str("OKAY", response);
+	strcpy(cmd, "getvar:max-download-size");
+	fastboot_handle_command(cmd, response);
+	ut_asserteq_str("OKAY0xfffff000", response);
+
+	strcpy(cmd, "download:00009c40");
+	fastboot_handle_command(cmd, response);
+	ut_asserteq_str("DATA00009c40", response);
+	for (i = 0; i < size; i += 1000) {
+		fastboot_data_download(data + i, 1000, response);
+		ut_asserteq_str("", response);
+	}
+	fastboot_data_complete(response);
+	ut_asserteq_str("OKAY", response);
+	strcpy(cmd, "flash:test1");
+	fastboot_handle_command(cmd, response);
+	ut_asserteq_strn("OKAYrx ", response);
+
+	memset(readback, 0xff, ALIGN(size, 512));
+	ut_asserteq(ALIGN(size, 512) / 512,
+		    blk_dread(mmc_dev_desc, 48, ALIGN(size, 512) / 512,
+			      readback));
+	ut_asserteq_mem(data, readback, size);
+	for (i = size; i < ALIGN(size, 512); i++)
+		ut_asserteq(0, readback[i]);
+
+	/* A sparse image is detected and written chunk by chunk */
+	for (i = 0; i < size; i++)
+		data[i] = i * 11 + 3;
+	len = fb_test_sparse_image(img, data);
+	ut_assert(len > 0x4000);
+	snprintf(cmd, sizeof(cmd), "download:%08x", len);
+	fastboot_handle_command(cmd, response);
+	ut_assert(!strncmp("DATA", response, 4));
+	for (ofs = 0; ofs < len; ofs += 1000) {
+		fastboot_data_download(img + ofs, min(len - ofs, 1000),
+				       response);
+		ut_asserteq_str("", response);
+	}
+	fastboot_data_complete(response);
+	ut_asserteq_str("OKAY", response);
+	strcpy(cmd, "flash:test1");
+	fastboot_handle_command(cmd, response);
+	ut_asserteq_strn("OKAYrx ", response);
+
+	memcpy(img, readback, ALIGN(size, 512));
+	ut_asserteq(ALIGN(size, 512) / 512,
+		    blk_dread(mmc_dev_desc, 48, ALIGN(size, 512) / 512,
+			      readback));
+	ofs = 0;
+	ut_asserteq_mem(data, readback, FB_TEST_SPARSE_RAW1 * 512);
+	ofs += FB_TEST_SPARSE_RAW1 * 512;
+	for (i = 0; i < FB_TEST_SPARSE_FILL * 512; i += 4)
+		ut_asserteq(FB_TEST_SPARSE_FILL_VAL,
+			    get_unaligned_le32(readback + ofs + i));
+	ofs += FB_TEST_SPARSE_FILL * 512;
+	/* "don't care" blocks keep what the raw image wrote there */
+	ut_asserteq_mem(img + ofs, readback + ofs, FB_TEST_SPARSE_SKIP * 512);
+	ofs += FB_TEST_SPARSE_SKIP * 512;
+	ut_asserteq_mem(data + FB_TEST_SPARSE_RAW1 * 512, readback + ofs,
+			FB_TEST_SPARSE_RAW2 * 512);
+
+	/*
+	 * The flash command must name the same partition, but by the time it
+	 * is checked the full buffers have been written
+	 */
+	strcpy(cmd, "download:00004e20");
+	fastboot_handle_command(cmd, response);
+	for (i = 0; i < 20000; i += 1000)
+		fastboot_data_download(data + 1000 + i, 1000, response);
+	fastboot_data_complete(response);
+	strcpy(cmd, "flash:test2");
+	fastboot_handle_command(cmd, response);
+	ut_asserteq_str("FAILimage was flashed to another partition",
+			response);
+	ut_asserteq(0x4000 / 512,
+		    blk_dread(mmc_dev_desc, 48, 0x4000 / 512, readback));
+	ut_asserteq_mem(data + 1000, readback, 0x4000);
+
+	/* The image must fit */
+	strcpy(cmd, "oem stream:test2");
+	fastboot_handle_command(cmd, response);
+	ut_asserteq_str("OKAY", response);
+	strcpy(cmd, "download:000003e8");
+	fastboot_handle_command(cmd, response);
+	fastboot_data_download(data, 1000, response);
+	fastboot_data_complete(response);
+	strcpy(cmd, "flash:test2");
+	fastboot_handle_command(cmd, response);
+	ut_asserteq_str("FAILtoo large for partition", response);
+
+	/* Downloads are kept in memory again */
+	strcpy(cmd, "oem stream");
+	fastboot_handle_command(cmd, response);
+	ut_asserteq_str("OKAY", response);
+	strcpy(cmd, "getvar:max-download-size");
+	fastboot_handle_command(cmd, response);
+	ut_asserteq_str("OKAY0x00004000", response);
+
+	fastboot_init(NULL, 0);
+	free(img);
+	free(readback);
+	free(data);
+	free(buf);
+
+	return 0;
+}
+DM_TEST(dm_test_fastboot_mmc_stream, UTF_SCAN_PDATA | UTF_SCAN_FDT);
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Test for the virtio block driver, using the block device emulated by the
+ * sandbox virtio transport
+ */
+
+#include <blk.h>
+#include <dm.h>
+#include <malloc.h>
+#include <time.h>
+#include <virtio.h>
+#include <dm/device-internal.h>
+#include <dm/test.h>
+#include <test/test.h>
+#include <test/ut.h>
+
+#define VIRTIO_BLK_TEST_SIZE	(4 << 20)
+
+/* Get the block device on the sandbox virtio transport */
+static int get_virtio_blk(struct unit_test_state *uts, struct udevice **blkp)
+{
+	struct udevice *bus;
+
+	uclass_foreach_dev_probe(UCLASS_VIRTIO, bus)
+		;
+	ut_assertok(blk_get_device(UCLASS_VIRTIO, 0, blkp));
+	ut_assertok(device_probe(*blkp));
+
+	return 0;
+}
+
+/*
+ * Test reads and writes larger than a request. The device takes at most
+ * 8 segments of 64KiB per request, so these are split over many requests
+ * spread across both queues. Use 'ut -v' on sandbox to see the throughput.
+ */
+static int dm_test_virtio_blk_rw(struct unit_test_state *uts)
+{
+	lbaint_t blkcnt = VIRTIO_BLK_TEST_SIZE / 512;
+	struct blk_desc *desc;
+	struct udevice *blk;
+	ulong start, wr_us, rd_us;
+	u8 *src, *buf;
+	int i;
+
+	ut_assertok(get_virtio_blk(uts, &blk));
+	desc = dev_get_uclass_plat(blk);
+	ut_asserteq(512, desc->blksz);
+	ut_asserteq(0x8000, desc->lba);
+
+	src = malloc(VIRTIO_BLK_TEST_SIZE);
+	buf = malloc(VIRTIO_BLK_TEST_SIZE);
+	ut_assertnonnull(src);
+	ut_assertnonnull(buf);
+	for (i = 0; i < VIRTIO_BLK_TEST_SIZE; i++)
+		src[i] = i * 7 + i / 512;
+
+	start = timer_get_us();
+	ut_asserteq(blkcnt, blk_write(blk, 1, blkcnt, src));
+	wr_us = max(timer_get_us() - start, 1UL);
+
+	memset(buf, '\0', VIRTIO_BLK_TEST_SIZE);
+	start = timer_get_us();
+	ut_asserteq(blkcnt, blk_read(blk, 1, blkcnt, buf));
+	rd_us = max(timer_get_us() - start, 1UL);
+	ut_asserteq_mem(src, buf, VIRTIO_BLK_TEST_SIZE);
+	printf("virtio-blk: write %lu MB/s, read %lu MB/s\n",
+	       VIRTIO_BLK_TEST_SIZE / wr_us, VIRTIO_BLK_TEST_SIZE / rd_us);
+
+	/* A small read, which goes through a single request */
+	memset(buf, '\0', 3 * 512);
+	ut_asserteq(3, blk_read(blk, 0x100, 3, buf));
+	ut_asserteq_mem(src + 0xff * 512, buf, 3 * 512);
+
+	free(buf);
+	free(src);
+
+	return 0;
+}
+DM_TEST(dm_test_virtio_blk_rw, UTF_SCAN_PDATA | UTF_SCAN_FDT);
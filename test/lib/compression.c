@@ -5,12 +5,16 @@
 
 #include <abuf.h>
 #include <bootm.h>
+#include <blk.h>
 #include <command.h>
+#include <decompwrite.h>
 #include <gzip.h>
 #include <image.h>
 #include <log.h>
 #include <malloc.h>
 #include <mapmem.h>
+#include <memalign.h>
+#include <part.h>
 #include <asm/io.h>
 
 #include <u-boot/lz4.h>
@@ -606,3 +610,93 @@ static int compression_test_bootm_none(struct unit_test_state *uts)
 	return run_bootm_test(uts, IH_COMP_NONE, compress_using_none);
 }
 LIB_TEST(compression_test_bootm_none, 0);
+
+/* Write an image to mmc0 with decompwrite() and check what arrives there */
+static int run_decompwrite_test(struct unit_test_state *uts,
+				struct blk_desc *desc, const void *in,
+				ulong in_size, u8 *buf)
+{
+	ulong size = strlen(plain);
+	lbaint_t blkcnt = DIV_ROUND_UP(size, desc->blksz);
+	struct decompwrite *dw;
+	ulong n;
+	u64 out_size;
+	int i;
+
+	/* The whole image at once, one block after the start */
+	ut_assertok(decompwrite(in, in_size, desc, desc->blksz, desc->blksz,
+				size));
+	ut_asserteq(blkcnt, blk_dread(desc, 1, blkcnt, buf));
+	ut_asserteq_mem(plain, buf, size);
+
+	/* The header, then a few bytes at a time */
+	memset(buf, '\0', blkcnt * desc->blksz);
+	ut_asserteq(blkcnt, blk_dwrite(desc, 0, blkcnt, buf));
+	dw = decompwrite_init(desc, desc->blksz, 0, blkcnt);
+	ut_assertnonnull(dw);
+	for (i = 0; i < in_size; i += n) {
+		n = min(in_size - i, i ? 5UL : 32UL);
+		ut_assertok(decompwrite_write(dw, in + i, n));
+	}
+	ut_assertok(decompwrite_finish(dw, &out_size));
+	ut_asserteq(size, out_size);
+	ut_asserteq(blkcnt, blk_dread(desc, 0, blkcnt, buf));
+	ut_asserteq_mem(plain, buf, size);
+
+	/* A truncated image or the wrong expected size are refused */
+	ut_assert(decompwrite(in, in_size - 8, desc, desc->blksz, 0, 0));
+	ut_assert(decompwrite(in, in_size, desc, desc->blksz, 0, size + 1));
+
+	return 0;
+}
+
+static int compression_test_decompwrite(struct unit_test_state *uts)
+{
+	ulong gzip_size = TEST_BUFFER_SIZE;
+	ulong half, second_size;
+	struct blk_desc *desc;
+	lbaint_t blkcnt;
+	void *gzipped;
+	u8 *buf;
+
+	if (!IS_ENABLED(CONFIG_DECOMPWRITE))
+		return -EAGAIN;
+
+	ut_asserteq(0, blk_get_device_by_str("mmc", "0", &desc));
+	blkcnt = DIV_ROUND_UP(strlen(plain), desc->blksz) + 1;
+	buf = malloc_cache_aligned(blkcnt * desc->blksz);
+	ut_assertnonnull(buf);
+	gzipped = malloc(gzip_size);
+	ut_assertnonnull(gzipped);
+	ut_assertok(gzip(gzipped, &gzip_size, (uchar *)plain, strlen(plain)));
+
+	ut_assertok(run_decompwrite_test(uts, desc, gzipped, gzip_size, buf));
+
+	/* Two gzip files put together give the two halves one after another */
+	half = strlen(plain) / 2;
+	gzip_size = TEST_BUFFER_SIZE;
+	ut_assertok(gzip(gzipped, &gzip_size, (uchar *)plain, half));
+	second_size = TEST_BUFFER_SIZE - gzip_size;
+	ut_assertok(gzip(gzipped + gzip_size, &second_size,
+			 (uchar *)plain + half, strlen(plain) - half));
+	ut_assertok(run_decompwrite_test(uts, desc, gzipped,
+					 gzip_size + second_size, buf));
+
+	ut_assertok(run_decompwrite_test(uts, desc, zstd_compressed,
+					 zstd_compressed_size, buf));
+	ut_assertok(run_decompwrite_test(uts, desc, lz4_compressed,
+					 lz4_compressed_size, buf));
+
+	/* Something which is not compressed is refused */
+	ut_asserteq(-EPROTONOSUPPORT,
+		    decompwrite(plain, strlen(plain), desc, desc->blksz, 0, 0));
+
+	/* Leave the device blank for other tests */
+	memset(buf, '\0', blkcnt * desc->blksz);
+	ut_asserteq(blkcnt, blk_dwrite(desc, 0, blkcnt, buf));
+	free(gzipped);
+	free(buf);
+
+	return 0;
+}
+LIB_TEST(compression_test_decompwrite, 0);
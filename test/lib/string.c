@@ -11,7 +11,9 @@
 
 #include <command.h>
 #include <log.h>
+#include <malloc.h>
 #include <string.h>
+#include <time.h>
 #include <test/lib.h>
 #include <test/test.h>
 #include <test/ut.h>
@@ -193,6 +195,120 @@ static int lib_memmove(struct unit_test_state *uts)
 }
 LIB_TEST(lib_memmove, 0);
 
+/* Lengths which reach the unrolled and single-word loops, in bytes */
+static const int long_lens[] = {
+	15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 127, 128, 129, 200,
+};
+
+#define LONG_BUFLEN	(2 * SWEEP + 200)
+
+/**
+ * lib_memcpy_long() - unit test for memcpy() and memmove() on longer regions
+ *
+ * Check all combinations of source and destination alignment, including
+ * overlapping moves in both directions.
+ *
+ * @uts:	unit test state
+ * Return:	0 = success, 1 = failure
+ */
+static int lib_memcpy_long(struct unit_test_state *uts)
+{
+	u8 src[LONG_BUFLEN], buf[LONG_BUFLEN], expect[LONG_BUFLEN];
+	int offset1, offset2, i, j, len;
+
+	for (i = 0; i < LONG_BUFLEN; i++)
+		src[i] = (i * 7) ^ MASK;
+
+	for (i = 0; i < ARRAY_SIZE(long_lens); i++) {
+		len = long_lens[i];
+		for (offset1 = 0; offset1 < SWEEP; offset1++) {
+			for (offset2 = 0; offset2 < SWEEP; offset2++) {
+				memset(buf, 0, LONG_BUFLEN);
+				memset(expect, 0, LONG_BUFLEN);
+				memcpy(buf + offset2, src + offset1, len);
+				for (j = 0; j < len; j++)
+					expect[offset2 + j] = src[offset1 + j];
+				ut_asserteq_mem(expect, buf, LONG_BUFLEN);
+
+				/* overlapping, in either direction */
+				memcpy(buf, src, LONG_BUFLEN);
+				memcpy(expect, src, LONG_BUFLEN);
+				memmove(buf + offset2, buf + offset1, len);
+				for (j = 0; j < len; j++)
+					expect[offset2 + j] = src[offset1 + j];
+				ut_asserteq_mem(expect, buf, LONG_BUFLEN);
+
+				memset(buf, 0, LONG_BUFLEN);
+				memset(buf + offset1, MASK, len);
+				for (j = 0; j < LONG_BUFLEN; j++)
+					ut_asserteq(j >= offset1 &&
+						    j < offset1 + len ? MASK : 0,
+						    buf[j]);
+			}
+		}
+	}
+
+	return 0;
+}
+LIB_TEST(lib_memcpy_long, 0);
+
+#define BENCH_MAX	(16 << 20)
+#define BENCH_ITERS	(1 << 20)
+
+/* Return the speed in MB/s of running @op on @size bytes */
+#define BENCH(op, size) ({ \
+	ulong _iters = clamp_t(ulong, BENCH_MAX / (size), 1, BENCH_ITERS); \
+	ulong _start = timer_get_us(), _n; \
+	\
+	for (_n = 0; _n < _iters; _n++) \
+		op; \
+	(ulong)((u64)_iters * (size) / max_t(ulong, timer_get_us() - _start, 1)); \
+})
+
+/**
+ * lib_mem_bench_norun() - show the speed of memcpy(), memmove() and memset()
+ *
+ * Sizes go from 1 byte to 16MiB, each repeated to cover up to 16MiB. The
+ * misaligned copy starts one byte into the source and the overlapping move
+ * shifts a region up by one word plus one byte, so it copies backwards. This
+ * takes a while, so it only runs when asked for, with
+ * 'ut -v lib lib_mem_bench_norun' on sandbox.
+ *
+ * @uts:	unit test state
+ * Return:	0 = success, 1 = failure
+ */
+static int lib_mem_bench_norun(struct unit_test_state *uts)
+{
+	ulong size;
+	u8 *src, *dst;
+
+	src = malloc(BENCH_MAX + 16);
+	dst = malloc(BENCH_MAX + 16);
+	ut_assertnonnull(src);
+	ut_assertnonnull(dst);
+	memset(src, MASK, BENCH_MAX + 16);
+
+	printf("%10s %10s %10s %10s %10s  (MB/s)\n", "size", "memcpy",
+	       "unaligned", "memmove", "memset");
+	for (size = 1; size <= BENCH_MAX; size *= 4) {
+		ulong cpy, unaligned, move, set;
+
+		cpy = BENCH(memcpy(dst, src, size), size);
+		unaligned = BENCH(memcpy(dst, src + 1, size), size);
+		move = BENCH(memmove(dst + 9, dst, size), size);
+		set = BENCH(memset(dst, _n, size), size);
+		printf("%10lu %10lu %10lu %10lu %10lu\n", size, cpy, unaligned,
+		       move, set);
+	}
+	memcpy(dst, src + 1, BENCH_MAX);
+	ut_asserteq_mem(src + 1, dst, BENCH_MAX);
+	free(dst);
+	free(src);
+
+	return 0;
+}
+LIB_TEST(lib_mem_bench_norun, UTF_MANUAL);
+
 /** lib_memdup() - unit test for memdup() */
 static int lib_memdup(struct unit_test_state *uts)
 {
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Unit tests and benchmark for the CRC32 methods in lib/crc32.c
+ */
+
+#include <malloc.h>
+#include <time.h>
+#include <linux/errno.h>
+#include <test/lib.h>
+#include <test/ut.h>
+#include <u-boot/crc.h>
+
+#define BENCH_SIZE	(8 << 20)
+
+static const char *const crc32_impl_name[CRC32_IMPL_COUNT] = {
+	[CRC32_IMPL_TABLE]	= "table",
+	[CRC32_IMPL_SLICE8]	= "slice-by-8",
+	[CRC32_IMPL_HW]		= "hardware",
+};
+
+/* Bit-at-a-time reference, with no tables to get wrong */
+static u32 crc32_ref(u32 crc, const u8 *buf, uint len)
+{
+	int k;
+
+	crc = ~crc;
+	while (len--) {
+		crc ^= *buf++;
+		for (k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+	}
+
+	return ~crc;
+}
+
+static void crc32_fill(u8 *buf, uint size)
+{
+	u32 seed = 0x87654321;
+	uint i;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+/* Every available method must give the same result at every alignment */
+static int lib_test_crc32(struct unit_test_state *uts)
+{
+	static const uint lens[] = {
+		0, 1, 3, 7, 8, 15, 16, 17, 63, 64, 65, 127, 128, 200, 4099,
+	};
+	enum crc32_impl impl;
+	uint i, ofs;
+	u8 *buf;
+
+	buf = malloc(4200);
+	ut_assertnonnull(buf);
+	crc32_fill(buf, 4200);
+
+	for (impl = CRC32_IMPL_TABLE; impl < CRC32_IMPL_COUNT; impl++) {
+		if (crc32_select(impl))
+			continue;
+		ut_asserteq(0xcbf43926, crc32(0, (u8 *)"123456789", 9));
+		for (i = 0; i < ARRAY_SIZE(lens); i++) {
+			for (ofs = 0; ofs < 8; ofs++) {
+				u32 expect = crc32_ref(0x1234, buf + ofs,
+						       lens[i]);
+
+				ut_asserteq(expect, crc32(0x1234, buf + ofs,
+							  lens[i]));
+			}
+		}
+		/* crc32_no_comp() and crc32_le() skip the inversion */
+		ut_asserteq(~crc32_ref(0, buf, 1000),
+			    crc32_no_comp(~0, buf, 1000));
+	}
+	ut_assertok(crc32_select(CRC32_IMPL_AUTO));
+	ut_assertok(crc32_select(CRC32_IMPL_TABLE));
+	ut_asserteq(-ENOSYS, crc32_select(CRC32_IMPL_COUNT));
+	ut_assertok(crc32_select(CRC32_IMPL_AUTO));
+	free(buf);
+
+	return 0;
+}
+LIB_TEST(lib_test_crc32, 0);
+
+/*
+ * Show the throughput of each available method on a large buffer. This is
+ * manual, so that it does not slow down every run: 'ut lib -f
+ * lib_test_crc32_bench_norun'
+ */
+static int lib_test_crc32_bench_norun(struct unit_test_state *uts)
+{
+	enum crc32_impl impl;
+	u32 expect = 0, crc;
+	ulong start, us;
+	u8 *buf;
+
+	buf = malloc(BENCH_SIZE);
+	ut_assertnonnull(buf);
+	crc32_fill(buf, BENCH_SIZE);
+
+	for (impl = CRC32_IMPL_TABLE; impl < CRC32_IMPL_COUNT; impl++) {
+		if (crc32_select(impl))
+			continue;
+		start = timer_get_us();
+		crc = crc32(0, buf, BENCH_SIZE);
+		us = max(timer_get_us() - start, 1UL);
+		if (impl == CRC32_IMPL_TABLE)
+			expect = crc;
+		ut_asserteq(expect, crc);
+		printf("%-12s %8lu us %6lu MB/s\n", crc32_impl_name[impl], us,
+		       (ulong)BENCH_SIZE / us);
+	}
+	ut_assertok(crc32_select(CRC32_IMPL_AUTO));
+	free(buf);
+
+	return 0;
+}
+LIB_TEST(lib_test_crc32_bench_norun, UTF_MANUAL);
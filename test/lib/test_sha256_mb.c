@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Unit tests for multi-buffer SHA-256 and hash_block_multi()
+ */
+
+#include <malloc.h>
+#include <hash.h>
+#include <test/lib.h>
+#include <test/test.h>
+#include <test/ut.h>
+#include <u-boot/sha256.h>
+
+/* Lengths around the padding boundaries, then some longer ones */
+static const unsigned int test_sha256_mb_len[] = {
+	0, 1, 55, 56, 63, 64, 65, 119, 120, 127, 128, 1000, 4096, 70001,
+};
+
+#define TEST_COUNT	ARRAY_SIZE(test_sha256_mb_len)
+#define TEST_SIZE	70001
+
+static void test_sha256_mb_fill(u8 *buf, unsigned int size)
+{
+	u32 seed = 0x12345678;
+	unsigned int i;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+}
+
+/* sha256_csum_multi() must match sha256_csum_wd() for every buffer */
+static int lib_test_sha256_mb(struct unit_test_state *uts)
+{
+	u8 expect[TEST_COUNT][SHA256_SUM_LEN];
+	u8 digest[TEST_COUNT][SHA256_SUM_LEN];
+	const unsigned char *input[TEST_COUNT];
+	unsigned char *output[TEST_COUNT];
+	unsigned int ilen[TEST_COUNT];
+	unsigned int i;
+	u8 *buf;
+
+	buf = malloc(TEST_SIZE);
+	ut_assertnonnull(buf);
+	test_sha256_mb_fill(buf, TEST_SIZE);
+
+	for (i = 0; i < TEST_COUNT; i++) {
+		/* Use a different start for each so the lanes differ */
+		input[i] = buf + (i & 7);
+		ilen[i] = min(test_sha256_mb_len[i], TEST_SIZE - (i & 7));
+		output[i] = digest[i];
+		sha256_csum_wd(input[i], ilen[i], expect[i], CHUNKSZ_SHA256);
+	}
+
+	/* A small chunk size makes the lanes stop and start often */
+	memset(digest, '\0', sizeof(digest));
+	sha256_csum_multi(input, ilen, output, TEST_COUNT, 256);
+	for (i = 0; i < TEST_COUNT; i++)
+		ut_asserteq_mem(expect[i], digest[i], SHA256_SUM_LEN);
+
+	/* Fewer buffers than lanes */
+	memset(digest, '\0', sizeof(digest));
+	sha256_csum_multi(input + 10, ilen + 10, output, 2, CHUNKSZ_SHA256);
+	ut_asserteq_mem(expect[10], digest[0], SHA256_SUM_LEN);
+	ut_asserteq_mem(expect[11], digest[1], SHA256_SUM_LEN);
+	free(buf);
+
+	return 0;
+}
+LIB_TEST(lib_test_sha256_mb, 0);
+
+/* hash_block_multi() must match hash_block() with mixed algorithms */
+static int lib_test_hash_block_multi(struct unit_test_state *uts)
+{
+	static const char *const algos[] = {
+		"sha256", "crc32", "sha256", "sha1", "sha256", "sha256",
+		"sha256", "md5", "sha256", "sha256", "sha256", "sha256",
+	};
+	u8 expect[ARRAY_SIZE(algos)][HASH_MAX_DIGEST_SIZE];
+	u8 digest[ARRAY_SIZE(algos)][HASH_MAX_DIGEST_SIZE];
+	struct hash_req reqs[ARRAY_SIZE(algos)];
+	unsigned int i;
+	u8 *buf;
+
+	buf = malloc(TEST_SIZE);
+	ut_assertnonnull(buf);
+	test_sha256_mb_fill(buf, TEST_SIZE);
+
+	memset(expect, '\0', sizeof(expect));
+	memset(digest, '\0', sizeof(digest));
+	for (i = 0; i < ARRAY_SIZE(algos); i++) {
+		reqs[i].algo_name = algos[i];
+		reqs[i].data = buf + i;
+		reqs[i].len = TEST_SIZE - i * 1000;
+		reqs[i].output = digest[i];
+		ut_assertok(hash_block(algos[i], reqs[i].data, reqs[i].len,
+				       expect[i], NULL));
+	}
+	ut_assertok(hash_block_multi(reqs, ARRAY_SIZE(algos)));
+	for (i = 0; i < ARRAY_SIZE(algos); i++)
+		ut_asserteq_mem(expect[i], digest[i], HASH_MAX_DIGEST_SIZE);
+
+	reqs[1].algo_name = "nothing";
+	ut_asserteq(-EPROTONOSUPPORT, hash_block_multi(reqs, 2));
+	free(buf);
+
+	return 0;
+}
+LIB_TEST(lib_test_hash_block_multi, 0);
@@ -407,3 +407,160 @@ def test_fit(ubman):
         # Go back to the original U-Boot with the correct dtb.
         ubman.config.dtb = old_dtb
         ubman.restart_uboot()
+
+# A configuration whose images all have plain hashes, so that bootm can check
+# them together
+batch_its = '''
+/dts-v1/;
+
+/ {
+        description = "Images checked together";
+        #address-cells = <1>;
+
+        images {
+                kernel-1 {
+                        data = /incbin/("%(kernel)s");
+                        type = "kernel";
+                        arch = "sandbox";
+                        os = "linux";
+                        compression = "none";
+                        load = <0x40000>;
+                        entry = <0x8>;
+                        hash-1 {
+                                algo = "sha256";
+                        };
+                };
+                kernel-2 {
+                        data = /incbin/("%(loadable)s");
+                        type = "kernel";
+                        arch = "sandbox";
+                        os = "linux";
+                        compression = "none";
+                        load = <0x100000>;
+                        entry = <0x0>;
+                        hash-1 {
+                                algo = "sha256";
+                        };
+                };
+                fdt-1 {
+                        data = /incbin/("%(fdt)s");
+                        type = "flat_dt";
+                        arch = "sandbox";
+                        compression = "none";
+                        load = <0x80000>;
+                        hash-1 {
+                                algo = "sha256";
+                        };
+                };
+                ramdisk-1 {
+                        data = /incbin/("%(ramdisk)s");
+                        type = "ramdisk";
+                        arch = "sandbox";
+                        os = "linux";
+                        compression = "none";
+                        load = <0xc0000>;
+                        hash-1 {
+                                algo = "sha256";
+                        };
+                };
+        };
+        configurations {
+                default = "conf-1";
+                conf-1 {
+                        kernel = "kernel-1";
+                        fdt = "fdt-1";
+                        ramdisk = "ramdisk-1";
+                        loadables = "kernel-2";
+                };
+        };
+};
+'''
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('fit_verify_batch')
+@pytest.mark.requiredtool('dtc')
+def test_fit_verify_batch(ubman):
+    """Check that bootm hashes each image of a configuration only once
+
+    The images are checked together when the configuration is selected, so
+    loading them (including copying them to their load addresses) must not
+    hash any of them again.
+    """
+    old_dtb = ubman.config.dtb
+    try:
+        mkimage = ubman.config.build_dir + '/tools/mkimage'
+        control_dtb = fit_util.make_dtb(ubman, base_fdt, 'u-boot')
+        params = {
+            'kernel': fit_util.make_kernel(ubman, 'test-kernel.bin', 'kernel'),
+            'loadable': fit_util.make_kernel(ubman, 'test-loadable.bin',
+                                             'lenrek'),
+            'fdt': control_dtb,
+            'ramdisk': fit_util.make_kernel(ubman, 'test-ramdisk.bin',
+                                            'ksidmar'),
+        }
+        fit = fit_util.make_fit(ubman, mkimage, batch_its, params)
+
+        ubman.config.dtb = control_dtb
+        ubman.restart_uboot()
+        output = '\n'.join(ubman.run_command_list([
+            'host load hostfs 0 1000 %s' % fit,
+            'bootm start 1000',
+            'bootm loados']))
+
+        # kernel, FDT, ramdisk and loadable are each checked with the config
+        assert output.count('OK (checked with configuration)') == 4
+        # ...and fit_image_verify() never hashes one of them again
+        assert 'sha256+' not in output
+        assert 'Bad Data Hash' not in output
+    finally:
+        ubman.config.dtb = old_dtb
+        ubman.restart_uboot()
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('fit_verify_batch')
+@pytest.mark.requiredtool('dtc')
+def test_fit_verify_batch_bad(ubman):
+    """Check that an image with a bad hash is not booted
+
+    When one image of the configuration is corrupted, checking the hashes
+    together must leave that image out, so that it is checked again on its
+    own when loaded, which fails and stops bootm.
+    """
+    old_dtb = ubman.config.dtb
+    try:
+        mkimage = ubman.config.build_dir + '/tools/mkimage'
+        control_dtb = fit_util.make_dtb(ubman, base_fdt, 'u-boot')
+        params = {
+            'kernel': fit_util.make_kernel(ubman, 'test-kernel.bin', 'kernel'),
+            'loadable': fit_util.make_kernel(ubman, 'test-loadable.bin',
+                                             'lenrek'),
+            'fdt': control_dtb,
+            'ramdisk': fit_util.make_kernel(ubman, 'test-ramdisk.bin',
+                                            'ksidmar'),
+        }
+        fit = fit_util.make_fit(ubman, mkimage, batch_its, params)
+
+        # Change one character of the ramdisk, leaving its hash as it was
+        with open(fit, 'rb') as inf:
+            data = bytearray(inf.read())
+        pos = data.find(b'this ksidmar 50 is')
+        assert pos >= 0
+        data[pos + 5] = ord('K')
+        with open(fit, 'wb') as outf:
+            outf.write(data)
+
+        ubman.config.dtb = control_dtb
+        ubman.restart_uboot()
+        output = '\n'.join(ubman.run_command_list([
+            'host load hostfs 0 1000 %s' % fit,
+            'bootm 1000']))
+
+        # The kernel still passes the check made with the configuration...
+        assert 'OK (checked with configuration)' in output
+        # ...but the ramdisk is checked on its own and rejected
+        assert 'Bad Data Hash' in output
+        assert 'Ramdisk image is corrupt or invalid' in output
+        assert 'Transferring control to Linux' not in output
+    finally:
+        ubman.config.dtb = old_dtb
+        ubman.restart_uboot()
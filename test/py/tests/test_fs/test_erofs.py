@@ -218,3 +218,62 @@ def test_erofs(ubman):
 
     # clean test environment
     clean_erofs_image(build_dir)
+
+EROFS_PIPE_SRC_DIR = 'erofs_pipe_src_dir'
+EROFS_PIPE_IMAGE_NAME = 'erofs_pipe.img'
+EROFS_PIPE_SIZE = 600000
+
+def erofs_pipe_load(ubman, address, pipeline):
+    """
+    Loads the large file with the pipeline on ('y') or off ('n').
+    """
+    ubman.run_command('setenv erofs_pipeline {}'.format(pipeline))
+    out = ubman.run_command('erofsload host 0 {} big'.format(address))
+    assert str(EROFS_PIPE_SIZE) in out
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_fs_generic')
+@pytest.mark.buildconfigspec('cmd_erofs')
+@pytest.mark.buildconfigspec('fs_erofs_zip_pipeline')
+@pytest.mark.requiredtool('mkfs.erofs')
+@pytest.mark.requiredtool('md5sum')
+def test_erofs_pipeline(ubman):
+    """
+    Checks that reading compressed clusters ahead gives the same data as
+    reading them in line, with a file of many clusters.
+    """
+    build_dir = ubman.config.build_dir
+    src_dir = os.path.join(build_dir, EROFS_PIPE_SRC_DIR)
+    image_path = os.path.join(build_dir, EROFS_PIPE_IMAGE_NAME)
+    file_path = os.path.join(src_dir, 'big')
+
+    ubman.restart_uboot()
+    os.makedirs(src_dir)
+    try:
+        content = ''
+        i = 0
+        while len(content) < EROFS_PIPE_SIZE:
+            content += '{:08x} pipeline {}\n'.format(i, i * 7919 % 10007)
+            i += 1
+        with open(file_path, 'w') as outf:
+            outf.write(content[:EROFS_PIPE_SIZE])
+        subprocess.run(['mkfs.erofs -zlz4 {} {}'.format(image_path, src_dir)],
+                       shell=True, check=True, stdout=subprocess.DEVNULL)
+
+        ubman.run_command('host bind 0 {}'.format(image_path))
+        erofs_pipe_load(ubman, '1000000', 'n')
+        erofs_pipe_load(ubman, '2000000', 'y')
+        out = ubman.run_command('cmp.b 1000000 2000000 {:x}'.format(
+                                EROFS_PIPE_SIZE))
+        assert 'Total of {} byte(s) were the same'.format(EROFS_PIPE_SIZE) in out
+
+        out = ubman.run_command('md5sum 2000000 {:x}'.format(EROFS_PIPE_SIZE))
+        u_boot_checksum = out.split()[-1]
+        out = subprocess.run(['md5sum ' + file_path], shell=True, check=True,
+                             capture_output=True, text=True)
+        assert u_boot_checksum == out.stdout.split()[0]
+    finally:
+        ubman.run_command('setenv erofs_pipeline')
+        shutil.rmtree(src_dir)
+        if os.path.exists(image_path):
+            os.remove(image_path)
@@ -0,0 +1,96 @@
+# SPDX-License-Identifier:      GPL-2.0+
+#
+# U-Boot File System: ext4 sparse file test
+
+"""
+This test reads an ext4 file with holes through its extent tree.
+"""
+
+import hashlib
+import os
+import re
+import shutil
+from subprocess import check_call, check_output
+import pytest
+
+# Filesystem block size, and the blocks in each data chunk and gap after it
+EXT4_SPARSE_BLKSZ = 1024
+EXT4_SPARSE_CHUNK = 4
+EXT4_SPARSE_GAP = 8
+# Chunks before and after the middle hole, enough to need two leaf blocks
+EXT4_SPARSE_CHUNKS = 50
+EXT4_SPARSE_MID_HOLE = 1 << 20
+EXT4_SPARSE_END_HOLE = 2 << 20
+# Bytes read from within the trailing hole
+EXT4_SPARSE_TAIL = 64 << 10
+
+def ext4_sparse_write(path):
+    """Writes the sparse file, returning its contents.
+
+    Args:
+        path: path of the file to write.
+
+    Returns:
+        bytes: contents of the file, with zeroes for the holes.
+    """
+    chunk = EXT4_SPARSE_CHUNK * EXT4_SPARSE_BLKSZ
+    gap = EXT4_SPARSE_GAP * EXT4_SPARSE_BLKSZ
+    content = bytearray()
+    with open(path, 'wb') as outf:
+        for half in range(2):
+            for _ in range(EXT4_SPARSE_CHUNKS):
+                data = os.urandom(chunk)
+                outf.write(data)
+                outf.seek(gap, os.SEEK_CUR)
+                content += data + bytes(gap)
+            if not half:
+                outf.seek(EXT4_SPARSE_MID_HOLE, os.SEEK_CUR)
+                content += bytes(EXT4_SPARSE_MID_HOLE)
+        content += bytes(EXT4_SPARSE_END_HOLE)
+        outf.truncate(len(content))
+    return bytes(content)
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_ext4')
+@pytest.mark.buildconfigspec('cmd_md5sum')
+@pytest.mark.requiredtool('mkfs.ext4')
+@pytest.mark.requiredtool('debugfs')
+def test_ext4_sparse(ubman):
+    """Test reading a file with a middle hole, a trailing hole and an
+    extent tree of depth 1 whose leaves are split by a gap.
+    """
+    build_dir = ubman.config.persistent_data_dir
+    src_dir = os.path.join(build_dir, 'ext4_sparse_src')
+    fs_img = os.path.join(build_dir, 'ext4_sparse.img')
+
+    os.makedirs(src_dir, exist_ok=True)
+    try:
+        content = ext4_sparse_write(os.path.join(src_dir, 'sparse'))
+        size = len(content)
+        check_call('rm -f {0}; truncate -s 8M {0}'.format(fs_img), shell=True)
+        check_call('mkfs.ext4 -q -b {} -O ^metadata_csum -d {} {}'.format(
+                   EXT4_SPARSE_BLKSZ, src_dir, fs_img), shell=True)
+        out = check_output('debugfs -R "ex /sparse" {}'.format(fs_img),
+                           shell=True).decode()
+        assert re.search(r'^\s*1/\s*1\s', out, re.M)
+
+        ubman.run_command('host bind 0 {}'.format(fs_img))
+        out = ubman.run_command('ext4load host 0:0 1000000 /sparse')
+        assert '{} bytes read'.format(size) in out
+        out = ubman.run_command('md5sum 1000000 {:x}'.format(size))
+        assert out.split()[-1] == hashlib.md5(content).hexdigest()
+
+        # Start part way through a block of the trailing hole
+        pos = size - EXT4_SPARSE_TAIL - 100
+        ubman.run_command('mw.b 1000000 ff {:x}'.format(EXT4_SPARSE_TAIL))
+        out = ubman.run_command('ext4load host 0:0 1000000 /sparse {:x} {:x}'
+                                .format(EXT4_SPARSE_TAIL, pos))
+        assert '{} bytes read'.format(EXT4_SPARSE_TAIL) in out
+        out = ubman.run_command('md5sum 1000000 {:x}'.format(EXT4_SPARSE_TAIL))
+        assert out.split()[-1] == hashlib.md5(
+            content[pos:pos + EXT4_SPARSE_TAIL]).hexdigest()
+    finally:
+        ubman.run_command('host unbind 0')
+        shutil.rmtree(src_dir)
+        if os.path.exists(fs_img):
+            os.remove(fs_img)
@@ -8,8 +8,12 @@
 This test verifies fat specific file system behaviour.
 """
 
+import hashlib
+import os
 import pytest
 import re
+import shutil
+from subprocess import check_call
 
 @pytest.mark.boardspec('sandbox')
 @pytest.mark.slow
@@ -23,3 +27,78 @@ class TestFsFat(object):
                 'host bind 0 %s' % fs_img,
                 'fatinfo host 0:0'])
             assert(re.search('Filesystem: %s' % fs_type.upper(), ''.join(output)))
+
+# Size of the FAT test image, and of each of the files filling it
+FAT_WIN_IMG_SIZE = 40 << 20
+FAT_WIN_FILLERS = 36
+FAT_WIN_FILLER_SIZE = 1 << 20
+# Size of the file which fills the gaps left by deleting half of the fillers
+FAT_WIN_FRAG_SIZE = 16 << 20
+
+def fat_win_check(ubman, path, name, size):
+    """Loads a file and checks that it matches the original.
+
+    Args:
+        ubman: provides the means to interact with U-Boot's console.
+        path: path of the original file on the host.
+        name: name of the file in the FAT image.
+        size: size of the file.
+    """
+    out = ubman.run_command('fatload host 0:0 1000000 {}'.format(name))
+    assert '{} bytes read'.format(size) in out
+    out = ubman.run_command('md5sum 1000000 {:x}'.format(size))
+    u_boot_checksum = out.split()[-1]
+    with open(path, 'rb') as inf:
+        assert u_boot_checksum == hashlib.md5(inf.read()).hexdigest()
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_fat')
+@pytest.mark.buildconfigspec('cmd_md5sum')
+@pytest.mark.requiredtool('mkfs.vfat')
+@pytest.mark.requiredtool('mcopy')
+@pytest.mark.requiredtool('mdel')
+@pytest.mark.parametrize('fat_type,mkfs_opt', [('fat16', '-F 16 -s 2'),
+                                               ('fat32', '-F 32 -s 1')])
+def test_fs_fat_windows(ubman, fat_type, mkfs_opt):
+    """Test reading files whose cluster chains cross many FAT windows.
+
+    With small clusters, the FAT takes many more sectors than the windows
+    kept by FS_FAT_CACHE_WINDOWS can hold. Deleting every other filler file
+    leaves gaps all over the disk, which a large file then fills, so its
+    chain hops between distant parts of the FAT.
+    """
+    build_dir = ubman.config.persistent_data_dir
+    src_dir = os.path.join(build_dir, 'fat_win_src')
+    fs_img = os.path.join(build_dir, 'fat_win.{}.img'.format(fat_type))
+
+    os.makedirs(src_dir, exist_ok=True)
+    try:
+        check_call('rm -f {0}; truncate -s {1} {0}; mkfs.vfat {2} {0}'.format(
+                   fs_img, FAT_WIN_IMG_SIZE, mkfs_opt), shell=True)
+        for i in range(FAT_WIN_FILLERS):
+            path = os.path.join(src_dir, 'fill{}'.format(i))
+            with open(path, 'wb') as outf:
+                outf.write(os.urandom(FAT_WIN_FILLER_SIZE))
+            check_call('mcopy -i {} {} ::/'.format(fs_img, path), shell=True)
+        for i in range(1, FAT_WIN_FILLERS, 2):
+            check_call('mdel -i {} ::/fill{}'.format(fs_img, i), shell=True)
+        frag_path = os.path.join(src_dir, 'frag')
+        with open(frag_path, 'wb') as outf:
+            outf.write(os.urandom(FAT_WIN_FRAG_SIZE))
+        check_call('mcopy -i {} {} ::/'.format(fs_img, frag_path), shell=True)
+
+        ubman.run_command('host bind 0 {}'.format(fs_img))
+        out = ubman.run_command('fatinfo host 0:0')
+        assert 'Filesystem: {}'.format(fat_type.upper()) in out
+        fat_win_check(ubman, frag_path, 'frag', FAT_WIN_FRAG_SIZE)
+        fat_win_check(ubman, os.path.join(src_dir, 'fill0'), 'fill0',
+                      FAT_WIN_FILLER_SIZE)
+        fat_win_check(ubman, os.path.join(src_dir, 'fill34'), 'fill34',
+                      FAT_WIN_FILLER_SIZE)
+        # Again, now that the windows hold the end of the FAT
+        fat_win_check(ubman, frag_path, 'frag', FAT_WIN_FRAG_SIZE)
+    finally:
+        ubman.run_command('host unbind 0')
+        shutil.rmtree(src_dir)
+        if os.path.exists(fs_img):
+            os.remove(fs_img)
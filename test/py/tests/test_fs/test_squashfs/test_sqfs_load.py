@@ -3,6 +3,7 @@
 # Author: Joao Marcos Costa <joaomarcos.costa@bootlin.com>
 
 import os
+import shutil
 import subprocess
 import pytest
 
@@ -106,6 +107,29 @@ def sqfs_load_non_existent_file(ubman):
     out = ubman.run_command('sqfsload host 0 {} {}'.format(address, file))
     assert 'Failed to load' in out
 
+def sqfs_cache_stats(ubman):
+    """ Checks that sqfscache shows the cache statistics and resets them.
+
+    The caches are kept from one command to the next on the same image, so
+    loading a file again must not decompress the tables again.
+
+    Args:
+        ubman: provides the means to interact with U-Boot's console.
+    """
+    out = ubman.run_command('sqfscache')
+    assert 'table misses:' in out
+    assert 'table misses: 0' not in out
+    assert 'table hits: 0' not in out
+    out = ubman.run_command('sqfscache')
+    assert 'table hits: 0' in out
+    assert 'table misses: 0' in out
+
+    out = ubman.run_command('sqfsload host 0 $kernel_addr_r f1000')
+    assert '1000' in out
+    out = ubman.run_command('sqfscache')
+    assert 'table hits: 0' not in out
+    assert 'table misses: 0' in out
+
 def sqfs_run_all_load_tests(ubman):
     """ Runs all the previously defined test cases.
 
@@ -115,6 +139,7 @@ def sqfs_run_all_load_tests(ubman):
     sqfs_load_files_at_root(ubman)
     sqfs_load_files_at_subdir(ubman)
     sqfs_load_non_existent_file(ubman)
+    sqfs_cache_stats(ubman)
 
 @pytest.mark.boardspec('sandbox')
 @pytest.mark.buildconfigspec('cmd_fs_generic')
@@ -152,3 +177,66 @@ def test_sqfs_load(ubman):
     # clean test environment
     clean_all_images(build_dir)
     clean_sqfs_src_dir(build_dir)
+
+# source directory and image for the pipeline test
+SQFS_PIPE_SRC_DIR = 'sqfs_pipe_src_dir'
+SQFS_PIPE_IMAGE = 'sqfs_pipe.img'
+SQFS_PIPE_SIZE = 600000
+
+def sqfs_pipe_load(ubman, address, pipeline):
+    """ Loads the large file with the pipeline on or off.
+
+    Args:
+        ubman: provides the means to interact with U-Boot's console.
+        address: the address where the file should be loaded.
+        pipeline: 'y' to read blocks from a uthread, 'n' to read them in line.
+    """
+    ubman.run_command('setenv sqfs_pipeline {}'.format(pipeline))
+    out = ubman.run_command('sqfsload host 0 {} big'.format(address))
+    assert str(SQFS_PIPE_SIZE) in out
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_fs_generic')
+@pytest.mark.buildconfigspec('cmd_squashfs')
+@pytest.mark.buildconfigspec('fs_squashfs_pipeline')
+@pytest.mark.requiredtool('mksquashfs')
+def test_sqfs_pipeline(ubman):
+    """ Checks that reading ahead gives the same data as reading in line.
+
+    The file spans many small blocks, so that the pipeline is used.
+
+    Args:
+        ubman: provides the means to interact with U-Boot's console.
+    """
+    build_dir = ubman.config.build_dir
+    src_dir = os.path.join(build_dir, SQFS_PIPE_SRC_DIR)
+    image_path = os.path.join(build_dir, SQFS_PIPE_IMAGE)
+
+    check_mksquashfs_version()
+    os.makedirs(src_dir)
+    try:
+        content = ''
+        i = 0
+        while len(content) < SQFS_PIPE_SIZE:
+            content += '{:08x} pipeline {}\n'.format(i, i * 7919 % 10007)
+            i += 1
+        with open(os.path.join(src_dir, 'big'), 'w') as outf:
+            outf.write(content[:SQFS_PIPE_SIZE])
+        subprocess.run(['mksquashfs {} {} -noappend -comp gzip -b 4096'.format(
+                        src_dir, image_path)], shell=True, check=True,
+                       stdout=subprocess.DEVNULL)
+
+        ubman.run_command('host bind 0 {}'.format(image_path))
+        sqfs_pipe_load(ubman, '1000000', 'n')
+        sqfs_pipe_load(ubman, '2000000', 'y')
+        out = ubman.run_command('cmp.b 1000000 2000000 {:x}'.format(
+                                SQFS_PIPE_SIZE))
+        assert 'Total of {} byte(s) were the same'.format(SQFS_PIPE_SIZE) in out
+
+        u_boot_checksum = uboot_md5sum(ubman, '2000000', hex(SQFS_PIPE_SIZE))
+        assert u_boot_checksum == original_md5sum(os.path.join(src_dir, 'big'))
+    finally:
+        ubman.run_command('setenv sqfs_pipeline')
+        shutil.rmtree(src_dir)
+        if os.path.exists(image_path):
+            os.remove(image_path)